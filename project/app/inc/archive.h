@@ -0,0 +1,55 @@
+/** @file archive.h
+*
+* @brief Retrieval of stored frames.  A client sends one request for a
+*        capture time or sequence number range of a camera and the archive
+*        service sends the matching frames straight from their files, found
+*        through the camera's frame index, then closes the connection.
+*
+*/
+
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include <stdint.h>
+
+#include "server.h"
+
+// Port requests are taken on, next to the live stream's.  Set with make
+// ARCHIVE_PORT=n.
+#ifndef ARCHIVE_PORT
+#define ARCHIVE_PORT (SERVER_PORT + 1)
+#endif /* ARCHIVE_PORT */
+
+// Time between checks of the abort flag while waiting for requests
+#define ARCHIVE_PERIOD_US (100000)
+
+// Range a request picks frames by
+typedef enum {
+  ARCHIVE_BY_TIME,
+  ARCHIVE_BY_SEQ,
+  ARCHIVE_MODES
+} archive_mode_t;
+
+// Request sent in network byte order.  By time picks the frames captured
+// from begin up to end, by sequence number from first through last.  Every
+// step'th frame of the range is sent, 0 sends them all like 1.
+typedef struct archive_req {
+  uint32_t cam;
+  uint32_t mode;
+  uint32_t step;
+  uint32_t first;
+  uint32_t last;
+  uint32_t begin_sec;
+  uint32_t begin_nsec;
+  uint32_t end_sec;
+  uint32_t end_nsec;
+} archive_req_t;
+
+/*!
+* @brief Starts the archive service thread which answers requests on
+*        ARCHIVE_PORT with frames in the live stream format
+* @return SUCCESS/FAILURE
+*/
+uint32_t archive_init();
+
+#endif /* __ARCHIVE_H__ */
@@ -0,0 +1,71 @@
+/** @file bench.h
+*
+* @brief Microbenchmark harness for the per-frame hot functions
+*
+*/
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+
+// Time spent warming up each case and targeted for each timed repetition
+#define BENCH_WARMUP_NS (50000000ull)
+#define BENCH_REP_NS (20000000ull)
+
+// Number of timed repetitions and max number of cases
+#define BENCH_REPS (15)
+#define BENCH_MAX_CASES (32)
+
+// Default results file, runs are appended so they can be compared
+#define BENCH_RESULTS_FILE "bench_results.csv"
+
+// Directory files written by the benchmarks are stored in
+#define BENCH_DIR_NAME "bench_tmp"
+
+// 1080p frames the parallel conversion is measured on, a YUYV frame and
+// its RGB conversion are taken from frame memory on top of the services'
+#define BENCH_HD_HRES (1920)
+#define BENCH_HD_VRES (1080)
+#define BENCH_HD_BYTES (BENCH_HD_HRES * BENCH_HD_VRES * (2 + 3))
+
+// A single operation being measured
+typedef void (*bench_func_t)(void * ctx);
+
+/*!
+* @brief Adds a case to be run
+* @param[in] p_name name of the case
+* @param[in] func function running one operation
+* @param[in] ctx context passed to func
+* @param[in] bytes bytes processed by one operation, 0 if not meaningful
+* @return SUCCESS/FAILURE
+*/
+uint32_t bench_add(const char * p_name, bench_func_t func, void * ctx, uint32_t bytes);
+
+/*!
+* @brief Runs every case and appends the results to a CSV file
+* @param[in] p_file_name results file
+* @param[in] p_label label for this run such as a commit id
+* @return SUCCESS/FAILURE
+*/
+uint32_t bench_run(const char * p_file_name, const char * p_label);
+
+/*!
+* @brief Adds the timestamp, logging, and queue handoff cases
+* @return SUCCESS/FAILURE
+*/
+uint32_t bench_add_common();
+
+/*!
+* @brief Adds the PPM conversion and write cases
+* @return SUCCESS/FAILURE
+*/
+uint32_t bench_add_ppm();
+
+/*!
+* @brief Adds the JPEG write case
+* @return SUCCESS/FAILURE
+*/
+uint32_t bench_add_jpeg();
+
+#endif /* __BENCH_H__ */
@@ -8,17 +8,36 @@
 #define __CAPTURE_H__
 
 #include <mqueue.h>
+#include <stddef.h>
 
 #include <opencv2/core/core.hpp>
+#ifndef HEADLESS
 #include <opencv2/highgui/highgui.hpp>
+#endif /* HEADLESS */
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include "frame.h"
+
 // Max number for frames before unlinking old frames
 #define MAX_FRAMES (2000)
 
+// Number of cameras, each with its own capture and store services, frame
+// queue, and storage directory.  Set with make CAMERAS=n.
+#ifndef CAMERAS
+#define CAMERAS (1)
+#endif /* CAMERAS */
+#define CAMERAS_MAX (4)
+
+#if CAMERAS < 1 || CAMERAS > CAMERAS_MAX
+#error "CAMERAS must be from 1 to CAMERAS_MAX"
+#endif /* CAMERAS */
+
 typedef struct cap_info {
-  IplImage * frame;
+  frame_t frame;
   struct timespec time;
+  uint32_t seq;
+  uint32_t cam;
+  int32_t buf_index;
 } cap_info_t;
 
 // Hold resolution information
@@ -33,11 +52,58 @@ typedef struct {
   struct mq_attr attr;
 } image_q_inf_t;
 
+// Frame queue of the first camera, see capture_name() for the others
 #define QUEUE_NAME "/frame_queue"
+#define QUEUE_NAME_MAX (32)
+
+// Longest capture directory name of a camera, keeps file names in the
+// directories within FILE_NAME_MAX
+#define DIR_NAME_MAX (32)
+
+// Frame period in milliseconds and microseconds
+#define PERIOD (100)
+#define PERIOD_US (PERIOD * 1000)
+
+/*!
+* @brief Gets the name of a per camera queue, directory, or service.  The
+*        first camera uses the base name so single camera builds are
+*        unchanged, camera n appends _n.
+* @param[in] cam camera id
+* @param[in] p_base name for the first camera
+* @param[out] p_name name of the camera's instance
+* @param[in] size size of p_name
+*/
+void capture_name(uint32_t cam, const char * p_base, char * p_name, size_t size);
+
+/*!
+* @brief Sets the device a camera captures from, V4L2 builds only
+* @param[in] cam camera id
+* @param[in] p_device device path
+* @return SUCCESS/FAILURE
+*/
+uint32_t capture_config(uint32_t cam, const char * p_device);
+
+/*!
+* @brief Releases the capture buffer a frame was passed in once the frame has
+*        been encoded or dropped.  Does nothing unless the frame is in a
+*        driver buffer.
+* @param[in] p_info capture information of the frame
+*/
+void capture_release(cap_info_t * p_info);
+
+/*!
+* @brief Gets how many of a camera's frames can be held past capture at
+*        once before capture writes over one of them or the driver runs out
+*        of buffers
+* @param[in] cam camera, after its capture is open
+* @return frames
+*/
+uint32_t capture_frames_held(uint32_t cam);
 
 /*!
-* @brief Starts capture, jpeg/ppm, and server service.  Then becomes the
-* scheduler service
+* @brief Starts capture and jpeg/ppm services for every camera and the
+* server service.  Then becomes the scheduler service releasing every camera
+* each period
 * @return SUCCESS/FAILURE
 */
 int sched_service();
@@ -8,11 +8,20 @@
 #ifndef _CLIENT_H
 #define _CLIENT_H
 
+#include <stdint.h>
+
+// Most servers one client collects from
+#define CLIENT_MAX_SERVERS (64)
+
 /*!
-* @brief Initialize client socket to talk to server
-* @param sockfd pointer to a int32_t to hold socket fd after creation
+* @brief Connects to every server and stores the frames they send until
+*        SIGINT or SIGTERM, then reports the totals.  Lost connections are
+*        retried with backoff.
+* @param count number of servers, 0 for the default server
+* @param pp_servers servers as host[:port], each stored in a host_port
+*        directory when there is more than one
 * @return SUCCESS/FAILURE
 */
-uint32_t client_init();
+uint32_t client_init(uint32_t count, char ** pp_servers);
 
 #endif /* _CLIENT_H */
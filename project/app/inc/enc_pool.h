@@ -0,0 +1,84 @@
+/** @file enc_pool.h
+*
+* @brief Size classed slab allocator for encoded frames.  Buffers are
+*        reference counted so the storage service and the server share a
+*        frame, and go back on the lock-free free list of their class when
+*        the last reference is dropped.
+*
+*/
+
+#ifndef __ENC_POOL_H__
+#define __ENC_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Smallest and largest size class as powers of two, 8KB to 4MB
+#define ENC_POOL_MIN_SHIFT (13)
+#define ENC_POOL_MAX_SHIFT (22)
+#define ENC_POOL_CLASSES (ENC_POOL_MAX_SHIFT - ENC_POOL_MIN_SHIFT + 1)
+
+// Bytes carved from the pool at once for classes smaller than this, bigger
+// classes are carved a buffer at a time
+#define ENC_POOL_SLAB_BYTES (256 * 1024)
+
+// Usage of one size class
+typedef struct enc_pool_class_stats {
+  // Bytes of each buffer including its header
+  uint32_t size;
+  uint32_t carved;
+  uint32_t in_use;
+  uint32_t peak;
+} enc_pool_class_stats_t;
+
+// Usage of the pool, peaks are high water marks since startup
+typedef struct enc_pool_stats {
+  uint64_t size;
+  uint64_t carved;
+  uint64_t in_use;
+  uint64_t peak;
+  uint32_t failed;
+  enc_pool_class_stats_t classes[ENC_POOL_CLASSES];
+} enc_pool_stats_t;
+
+/*!
+* @brief Gets the pool from frame memory, it is carved into slabs of each
+*        size class as they are first needed
+* @param[in] size size of the pool in bytes
+* @return SUCCESS/FAILURE
+*/
+uint32_t enc_pool_init(size_t size);
+
+/*!
+* @brief Gets a buffer from the smallest class that fits, or a bigger class
+*        when that one is used up.  The caller holds the only reference.
+*        Safe from any thread.
+* @param[in] size number of bytes needed
+* @return buffer or NULL when the pool is used up
+*/
+uint8_t * enc_pool_get(uint32_t size);
+
+/*!
+* @brief Adds a reference to a buffer for another service
+* @param[in] p_buf buffer from enc_pool_get()
+*/
+void enc_pool_ref(uint8_t * p_buf);
+
+/*!
+* @brief Drops a reference to a buffer, the last one frees it
+* @param[in] p_buf buffer from enc_pool_get()
+*/
+void enc_pool_put(uint8_t * p_buf);
+
+/*!
+* @brief Gets the usage of the pool and each size class
+* @param[out] p_stats usage
+*/
+void enc_pool_stats(enc_pool_stats_t * p_stats);
+
+/*!
+* @brief Logs the usage of the pool and every size class used
+*/
+void enc_pool_report();
+
+#endif /* __ENC_POOL_H__ */
@@ -0,0 +1,109 @@
+/** @file frame.h
+*
+* @brief Captured frame with its pixel format.  Frames stay in the format the
+*        camera delivered and are only converted to RGB where RGB is needed.
+*
+*/
+
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+// Most planes of any format
+#define FRAME_PLANES (3)
+
+// Pixel formats a frame can be in
+typedef enum pix_fmt {
+  PIX_FMT_BGR24,  // Packed B, G, R, what OpenCV captures in
+  PIX_FMT_YUYV,   // Packed 4:2:2 Y0 Cb Y1 Cr, what most cameras deliver
+  PIX_FMT_YUV420, // Planar 4:2:0 Y, Cb, Cr
+  PIX_FMTS
+} pix_fmt_t;
+
+// Frame in the buffer it was captured in.  YUV samples are BT.601 limited
+// range.
+typedef struct frame {
+  pix_fmt_t format;
+  uint32_t width;
+  uint32_t height;
+  uint8_t * planes[FRAME_PLANES];
+  uint32_t strides[FRAME_PLANES];
+
+  // Image header over the data of BGR24 frames, NULL for the other formats
+  IplImage * image;
+} frame_t;
+
+/*!
+* @brief Gets the name of a pixel format
+* @param[in] format pixel format
+* @return name
+*/
+const char * frame_format_name(pix_fmt_t format);
+
+/*!
+* @brief Gets the rows of a plane
+* @param[in] format pixel format
+* @param[in] height frame height
+* @param[in] plane plane number
+* @return rows, 0 for planes the format doesn't have
+*/
+uint32_t frame_plane_rows(pix_fmt_t format, uint32_t height, uint32_t plane);
+
+/*!
+* @brief Describes a BGR24 OpenCV image as a frame
+* @param[out] p_frame frame to fill out
+* @param[in] p_image image holding the data
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_from_image(frame_t * p_frame, IplImage * p_image);
+
+/*!
+* @brief Converts a row of YUYV pixels to packed RGB or BGR.  Uses SSE2 or
+*        NEON when built for them.
+* @param[in] p_src YUYV row
+* @param[out] p_dst row of 3 byte pixels
+* @param[in] width pixels in the row, a multiple of 2
+* @param[in] bgr 1 for B, G, R order, 0 for R, G, B
+*/
+void yuyv_to_rgb_row(const uint8_t * p_src, uint8_t * p_dst, uint32_t width, uint8_t bgr);
+
+/*!
+* @brief Converts some rows of a frame to packed R, G, B or B, G, R, so a
+*        frame can be worked on a strip at a time
+* @param[in] p_frame frame in any format
+* @param[in] first first row converted
+* @param[in] rows number of rows, cut short at the bottom of the frame
+* @param[out] p_dst where the first row goes
+* @param[in] dst_stride bytes between destination rows
+* @param[in] bgr 1 for B, G, R order, 0 for R, G, B
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_convert_rows(const frame_t * p_frame,
+                            uint32_t first,
+                            uint32_t rows,
+                            uint8_t * p_dst,
+                            uint32_t dst_stride,
+                            uint8_t bgr);
+
+/*!
+* @brief Converts a frame to packed R, G, B
+* @param[in] p_frame frame in any format
+* @param[out] p_dst width x height 3 byte pixels
+* @param[in] dst_stride bytes between destination rows
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_to_rgb(const frame_t * p_frame, uint8_t * p_dst, uint32_t dst_stride);
+
+/*!
+* @brief Converts a frame to packed B, G, R
+* @param[in] p_frame frame in any format
+* @param[out] p_dst width x height 3 byte pixels
+* @param[in] dst_stride bytes between destination rows
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_to_bgr(const frame_t * p_frame, uint8_t * p_dst, uint32_t dst_stride);
+
+#endif /* __FRAME_H__ */
@@ -0,0 +1,178 @@
+/** @file frame_bus.h
+*
+* @brief Shared memory frame bus.  The storage service of each camera
+*        publishes its frames into a ring of fixed slots in a POSIX shared
+*        memory object, local reader processes map it read-only and use the
+*        frames in place.  Every slot is guarded by a seqlock so readers
+*        never block the publisher, they find out afterwards when a frame
+*        was overwritten while they used it.
+*
+*/
+
+#ifndef __FRAME_BUS_H__
+#define __FRAME_BUS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "frame.h"
+
+// Shared memory object of the first camera, see capture_name() for the
+// others
+#define FRAME_BUS_NAME "/frame_bus"
+#define FRAME_BUS_NAME_MAX (32)
+
+// Slots in the ring, readers have this many frame periods to use a frame
+// before it is overwritten.  Set with make FRAME_BUS_SLOTS=n.
+#ifndef FRAME_BUS_SLOTS
+#define FRAME_BUS_SLOTS (8)
+#endif /* FRAME_BUS_SLOTS */
+
+// Shared memory identification, "FBUS" when read as bytes
+#define FRAME_BUS_MAGIC (0x53554246)
+#define FRAME_BUS_VERSION (1)
+
+// Alignment of the slot headers and frame data
+#define FRAME_BUS_ALIGN (64)
+
+// Header of one slot.  lock is odd while the publisher writes the slot and
+// goes up by 2 for every frame written to it.  frame is the number of the
+// frame in the slot, counting every frame published.
+typedef struct frame_bus_slot {
+  uint32_t lock;
+  uint32_t frame;
+  uint32_t seq;
+  uint32_t cam;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+
+  // Bytes of frame data and where each plane starts in the slot's data
+  uint32_t size;
+  uint32_t offsets[FRAME_PLANES];
+  uint32_t strides[FRAME_PLANES];
+
+  // Capture time, CLOCK_REALTIME
+  int64_t cap_sec;
+  int64_t cap_nsec;
+} __attribute__((aligned(FRAME_BUS_ALIGN))) frame_bus_slot_t;
+
+// Start of the shared memory, the slots' frame data follows at data_offset
+typedef struct frame_bus_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t slot_hdr_size;
+  uint32_t slots;
+  uint32_t slot_bytes;
+  uint32_t data_offset;
+  uint32_t period_us;
+
+  // Frames published so far, frame n is in slot n % slots.  Readers wait on
+  // it with FUTEX_WAIT.
+  uint32_t published __attribute__((aligned(FRAME_BUS_ALIGN)));
+
+  frame_bus_slot_t slot[FRAME_BUS_SLOTS];
+} frame_bus_hdr_t;
+
+// Publisher or reader mapping of a bus
+typedef struct frame_bus {
+  frame_bus_hdr_t * p_hdr;
+  uint8_t * p_data;
+  size_t len;
+  char name[FRAME_BUS_NAME_MAX];
+  uint8_t publisher;
+} frame_bus_t;
+
+// Frame a reader is using in place.  The planes point into the shared memory
+// and are only good while frame_bus_check() says so.
+typedef struct frame_bus_view {
+  const frame_bus_slot_t * p_slot;
+  uint32_t lock;
+  uint32_t frame;
+  uint32_t seq;
+  uint32_t cam;
+  pix_fmt_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t size;
+  const uint8_t * planes[FRAME_PLANES];
+  uint32_t strides[FRAME_PLANES];
+  struct timespec cap;
+} frame_bus_view_t;
+
+/*!
+* @brief Creates a bus, replacing one left by an earlier run, and prefaults
+*        it
+* @param[out] p_bus bus to set up
+* @param[in] p_name shared memory object name
+* @param[in] slot_bytes largest frame published
+* @param[in] period_us period frames are published at, recorded in the header
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_bus_create(frame_bus_t * p_bus, const char * p_name, uint32_t slot_bytes, uint32_t period_us);
+
+/*!
+* @brief Copies a frame into the next slot and wakes waiting readers.  Only
+*        one thread may publish to a bus.
+* @param[in] p_bus bus from frame_bus_create()
+* @param[in] p_frame frame to publish
+* @param[in] seq frame sequence number
+* @param[in] cam camera the frame is from
+* @param[in] p_time capture time
+* @return SUCCESS/FAILURE, a frame too big for a slot isn't published
+*/
+uint32_t frame_bus_publish(frame_bus_t * p_bus, const frame_t * p_frame, uint32_t seq, uint32_t cam, const struct timespec * p_time);
+
+/*!
+* @brief Maps an existing bus read-only
+* @param[out] p_bus bus to set up
+* @param[in] p_name shared memory object name
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_bus_open(frame_bus_t * p_bus, const char * p_name);
+
+/*!
+* @brief Gets the latest frame published
+* @param[in] p_bus bus from frame_bus_open()
+* @param[out] p_view frame in place
+* @return SUCCESS/FAILURE when nothing is published yet
+*/
+uint32_t frame_bus_latest(frame_bus_t * p_bus, frame_bus_view_t * p_view);
+
+/*!
+* @brief Gets the next frame, waiting for it to be published.  A reader that
+*        fell more than a ring behind skips ahead to the oldest frame left.
+* @param[in] p_bus bus from frame_bus_open()
+* @param[in,out] p_next number of the frame wanted, 0 for the first, moved
+*                past the frame returned
+* @param[out] p_view frame in place
+* @param[in] timeout_ms longest wait for the frame
+* @return SUCCESS/FAILURE when nothing is published in time
+*/
+uint32_t frame_bus_next(frame_bus_t * p_bus, uint32_t * p_next, frame_bus_view_t * p_view, uint32_t timeout_ms);
+
+/*!
+* @brief Checks a frame wasn't overwritten, call after using it
+* @param[in] p_view frame from frame_bus_latest() or frame_bus_next()
+* @return 1 when everything read from the frame is good, 0 otherwise
+*/
+uint8_t frame_bus_check(const frame_bus_view_t * p_view);
+
+/*!
+* @brief Unmaps a bus, the publisher also removes the shared memory object
+* @param[in] p_bus bus to close
+*/
+void frame_bus_close(frame_bus_t * p_bus);
+
+// Publishing is compiled out unless FRAME_BUS is defined, build with make
+// FRAME_BUS=1
+#ifdef FRAME_BUS
+#define FRAME_BUS_PUBLISH(p_bus, p_frame, seq, cam, p_time) frame_bus_publish(p_bus, p_frame, seq, cam, p_time)
+#define FRAME_BUS_CLOSE(p_bus)                              frame_bus_close(p_bus)
+#else
+#define FRAME_BUS_PUBLISH(p_bus, p_frame, seq, cam, p_time)
+#define FRAME_BUS_CLOSE(p_bus)
+#endif /* FRAME_BUS */
+
+#endif /* __FRAME_BUS_H__ */
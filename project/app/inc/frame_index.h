@@ -0,0 +1,158 @@
+/** @file frame_index.h
+*
+* @brief Binary per-frame index written next to the stored frames.  Each
+*        storage service appends one fixed size record per frame so
+*        recordings can be queried without opening the frames themselves.
+*
+*/
+
+#ifndef __FRAME_INDEX_H__
+#define __FRAME_INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Index file in each storage directory
+#define FRAME_INDEX_FILE "index.bin"
+
+// File header identification, "FIDX" when read as bytes
+#define FRAME_INDEX_MAGIC (0x58444946)
+#define FRAME_INDEX_VERSION (1)
+
+// Longest file name kept in a record, including the terminator
+#define FRAME_INDEX_NAME_MAX (64)
+
+// Timestamp with a fixed layout, a timespec differs between 32 and 64 bit
+// targets
+typedef struct index_time {
+  int64_t sec;
+  int64_t nsec;
+} index_time_t;
+
+// Start of the index file
+typedef struct frame_index_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t rec_size;
+
+  // Period the frames were stored at
+  uint32_t period_us;
+
+  // Sequence numbers between stored frames, 0 is read as 1
+  uint32_t seq_step;
+} frame_index_hdr_t;
+
+// One record per stored frame, 128 bytes
+typedef struct frame_index_rec {
+  uint32_t seq;
+
+  // Bytes written to the file
+  uint32_t size;
+
+  // JPEG quality, 0 for uncompressed frames
+  uint8_t quality;
+
+  // Pixel format the frame was captured in
+  uint8_t format;
+  uint8_t reserved[6];
+
+  // Captured, encoded (or converted), and written to storage
+  index_time_t cap;
+  index_time_t enc;
+  index_time_t write;
+
+  // File the frame was stored in
+  char file_name[FRAME_INDEX_NAME_MAX];
+} frame_index_rec_t;
+
+// Index being written by a storage service
+typedef struct frame_index {
+  int32_t fd;
+  uint32_t count;
+} frame_index_t;
+
+// Index mapped for reading
+typedef struct frame_index_map {
+  void * p_base;
+  size_t len;
+  const frame_index_hdr_t * p_hdr;
+  const frame_index_rec_t * p_recs;
+  uint32_t count;
+} frame_index_map_t;
+
+/*!
+* @brief Creates the index in a storage directory, replacing the index of a
+*        previous run.  Frames kept from earlier runs aren't indexed.
+* @param[out] p_index index to set up
+* @param[in] p_dir storage directory
+* @param[in] period_us storage period recorded in the header
+* @param[in] seq_step sequence numbers between stored frames, from
+*            seq_frame_step()
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_index_open(frame_index_t * p_index, const char * p_dir, uint32_t period_us, uint32_t seq_step);
+
+/*!
+* @brief Appends a record in a single write, stamping its write time
+* @param[in] p_index index to append to
+* @param[in] p_rec record with every other field filled out
+* @param[in] p_file_name file the frame was stored in, cut to fit
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_index_append(frame_index_t * p_index, frame_index_rec_t * p_rec, const char * p_file_name);
+
+/*!
+* @brief Closes the index
+* @param[in] p_index index to close
+*/
+void frame_index_close(frame_index_t * p_index);
+
+/*!
+* @brief Stores a timespec in a record timestamp
+* @param[out] p_dst record timestamp
+* @param[in] p_src time to store
+*/
+void frame_index_time(index_time_t * p_dst, const struct timespec * p_src);
+
+/*!
+* @brief Converts a record timestamp to nanoseconds
+* @param[in] p_time record timestamp
+* @return nanoseconds since the epoch
+*/
+int64_t frame_index_ns(const index_time_t * p_time);
+
+/*!
+* @brief Maps an index file and checks its header.  A record cut short by a
+*        crash at the end of the file is left out.
+* @param[in] p_file index file
+* @param[out] p_map mapped index
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_index_map(const char * p_file, frame_index_map_t * p_map);
+
+/*!
+* @brief Unmaps an index file
+* @param[in] p_map mapped index
+*/
+void frame_index_unmap(frame_index_map_t * p_map);
+
+/*!
+* @brief Binary searches for the first record captured at or after a time,
+*        records are appended in capture order
+* @param[in] p_map mapped index
+* @param[in] ns capture time in nanoseconds since the epoch
+* @return record index, count when every record is earlier
+*/
+uint32_t frame_index_find(const frame_index_map_t * p_map, int64_t ns);
+
+/*!
+* @brief Binary searches for the first record with a sequence number at or
+*        after one, sequence numbers only go up within a run
+* @param[in] p_map mapped index
+* @param[in] seq sequence number
+* @return record index, count when every record is earlier
+*/
+uint32_t frame_index_find_seq(const frame_index_map_t * p_map, uint32_t seq);
+
+#endif /* __FRAME_INDEX_H__ */
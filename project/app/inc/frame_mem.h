@@ -0,0 +1,51 @@
+/** @file frame_mem.h
+*
+* @brief Locked and prefaulted memory arena for frame buffers
+*
+*/
+
+#ifndef __FRAME_MEM_H__
+#define __FRAME_MEM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Size of the frame memory arena, a multiple of the 2MB huge page size.  The
+// server reserves this much for every camera.
+#define FRAME_MEM_SIZE (8 * 1024 * 1024)
+
+// Number of bytes of each service stack touched before the service runs
+#define FRAME_MEM_STACK_PREFAULT (128 * 1024)
+
+/*!
+* @brief Allocates the frame memory arena from huge pages when available,
+*        prefaults it, and locks all current and future memory
+* @param[in] size size of the arena in bytes
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_mem_init(size_t size);
+
+/*!
+* @brief Allocates a buffer from the arena.  Buffers live until exit.
+* @param[in] size number of bytes
+* @return pointer to the buffer or NULL when the arena is out of memory
+*/
+void * frame_mem_alloc(size_t size);
+
+/*!
+* @brief Touches the top of the calling thread's stack so it is faulted in
+*        before the thread does any real-time work
+*/
+void frame_mem_prefault_stack();
+
+/*!
+* @brief Gets the page fault counts for a thread of this process
+* @param[in] tid thread id
+* @param[out] minflt minor fault count
+* @param[out] majflt major fault count
+* @return SUCCESS/FAILURE
+*/
+uint32_t frame_mem_faults(pid_t tid, uint64_t * minflt, uint64_t * majflt);
+
+#endif /* __FRAME_MEM_H__ */
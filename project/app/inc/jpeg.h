@@ -7,9 +7,28 @@
 #ifndef _JPEG_H
 #define _JPEG_H
 
+#include <stdint.h>
+
+#include "capture.h"
+#include "project_defs.h"
+#include "qoi.h"
+#include "service.h"
+
+// Lossless frames go through the same services as JPEG frames
+#if defined(LOSSLESS) && !defined(JPEG_COMPRESSION)
+#error "LOSSLESS can't be built with NO_COMP"
+#endif /* LOSSLESS */
+
+// Max uname string length
+#define UNAME_MAX (255)
+
 // Max timestamp length
 #define TIMESTAMP_MAX (32)
+#ifdef LOSSLESS
+#define DIR_NAME "capture_qoi"
+#else
 #define DIR_NAME "capture_jpeg"
+#endif /* LOSSLESS */
 
 // Image Resolution information
 #define HRES (640)
@@ -17,9 +36,80 @@
 #define BYTES_PER_PIXEL (3)
 #define IMAGE_NUM_BYTES (HRES * VRES * BYTES_PER_PIXEL)
 
+// Largest encoded frame, a QOI frame can be bigger than the raw one
+#ifdef LOSSLESS
+#define ENC_MAX_BYTES (QOI_MAX_BYTES(HRES, VRES))
+#else
+#define ENC_MAX_BYTES (IMAGE_NUM_BYTES)
+#endif /* LOSSLESS */
+
+// Encoded frame pool for each camera, enough for the server queue to fill
+// with typical frames.  Set with make ENC_POOL_KB=n.
+#ifndef ENC_POOL_KB
+#ifdef LOSSLESS
+#define ENC_POOL_KB (4096)
+#else
+#define ENC_POOL_KB (1536)
+#endif /* LOSSLESS */
+#endif /* ENC_POOL_KB */
+
+#ifdef TASK_GRAPH
+// Frame memory for the encoders of the graph workers, which take the place
+// of the encoder of each camera
+#define JPEG_GRAPH_MEM_SIZE ((SERVICE_WORKERS_MAX + 1) * (ENC_MAX_BYTES + IMAGE_NUM_BYTES))
+#endif /* TASK_GRAPH */
+
+// Struct of information for the thread
+typedef struct {
+  // File contents of the current frame, a reference counted buffer from the
+  // encoded frame pool
+  uint8_t * cur_buf;
+
+  // Hold the uname str
+  char uname_str[UNAME_MAX];
+  uint16_t uname_len;
+  uint16_t comment_len;
+
+  // Filename
+  char file_name[FILE_NAME_MAX];
+
+  // Encoded JPEG starting with SOI
+  uint8_t * enc_buf;
+  uint32_t enc_len;
+
+  // Capture info object
+  cap_info_t cap;
+} jpeg_cap_t;
+
 /*!
-* @brief Start the jpeg_service thread
+* @brief Builds the JPEG file buffer and writes to file
+* @param cap current capture information
+* @return number of bytes written or FAILURE
+*/
+uint32_t write_jpeg(jpeg_cap_t * cap);
+
+/*!
+* @brief Start a jpeg_service thread for every camera, camera n stores in
+*        DIR_NAME_n
 * @return SUCCESS/FAILURE
 */
 uint32_t jpeg_init();
+
+#ifdef TASK_GRAPH
+/*!
+* @brief Submits a captured frame to its camera's graph, which encodes it,
+*        stores it, and releases the capture buffer
+* @param p_info capture info of the frame, copied
+* @param tick sequencer tick the frame was captured on
+* @return SUCCESS, FAILURE when the camera has too many frames in flight
+*/
+uint32_t jpeg_submit(const cap_info_t * p_info, uint32_t tick);
+#endif /* TASK_GRAPH */
+
+/*!
+* @brief Waits for every camera's jpeg_service to exit, or in task graph
+*        builds stores the frames already submitted, stops the graph workers,
+*        and reports the occupancy of each camera's graph
+*/
+void jpeg_stop();
 #endif /* _JPEG_H */
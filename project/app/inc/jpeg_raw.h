@@ -0,0 +1,72 @@
+/** @file jpeg_raw.h
+*
+* @brief JPEG encoding straight from YUV frames with libjpeg raw data input,
+*        skipping the conversion to BGR and back to YCbCr.  BGR24 frames are
+*        encoded too.
+*
+*/
+
+#ifndef __JPEG_RAW_H__
+#define __JPEG_RAW_H__
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "frame.h"
+
+// Luma rows in a 4:2:0 MCU row, chroma has half
+#define MCU_ROWS (2 * DCTSIZE)
+
+// Entries in the limited to full range tables, one for each sample value
+#define JPEG_RAW_LUT_SIZE (256)
+
+// Encoder, one for each encoding thread
+typedef struct jpeg_raw {
+  // First so the error handler can find the encoder from the compressor
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  jmp_buf fail;
+  uint32_t width;
+  uint32_t height;
+
+  // Encoded output from frame memory
+  uint8_t * p_out;
+  unsigned long out_size;
+
+  // MCU row of each component and the row pointers handed to libjpeg
+  uint8_t * strips[FRAME_PLANES];
+  JSAMPROW rows[FRAME_PLANES][MCU_ROWS];
+  JSAMPARRAY planes[FRAME_PLANES];
+
+  // Limited to full range tables
+  uint8_t y_lut[JPEG_RAW_LUT_SIZE];
+  uint8_t c_lut[JPEG_RAW_LUT_SIZE];
+} jpeg_raw_t;
+
+/*!
+* @brief Sets up an encoder and gets its buffers from frame memory.  Only
+*        one thread may encode with it.
+* @param[out] p_raw encoder to set up
+* @param[in] width frame width, a multiple of 16
+* @param[in] height frame height, a multiple of 16
+* @param[in] quality JPEG quality 1 to 100
+* @return SUCCESS/FAILURE
+*/
+uint32_t jpeg_raw_init(jpeg_raw_t * p_raw, uint32_t width, uint32_t height, int32_t quality);
+
+/*!
+* @brief Encodes a YUYV, YUV420, or BGR24 frame as 4:2:0, YUYV chroma is
+*        averaged over each pair of rows
+* @param[in] p_raw encoder
+* @param[in] p_frame frame to encode
+* @param[out] pp_data encoded JPEG starting with SOI, valid until the next
+*             encode
+* @param[out] p_len length of the encoded JPEG
+* @return SUCCESS/FAILURE
+*/
+uint32_t jpeg_raw_encode(jpeg_raw_t * p_raw, const frame_t * p_frame, uint8_t ** pp_data, uint32_t * p_len);
+
+#endif /* __JPEG_RAW_H__ */
@@ -0,0 +1,70 @@
+/** @file latency.h
+*
+* @brief Fixed bucket latency histograms used to report latency distributions
+*
+*/
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+#include <time.h>
+
+// Histogram resolution and range, latencies past the range land in the last
+// bucket
+#define LATENCY_BUCKET_NS (100000)
+#define LATENCY_BUCKETS (10000)
+
+// Latency histogram, all values are in nanoseconds
+typedef struct latency_hist {
+  uint32_t count;
+  int64_t sum;
+  int64_t min;
+  int64_t max;
+  uint32_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
+/*!
+* @brief Clears out a histogram
+* @param[in] hist histogram to clear
+*/
+void latency_reset(latency_hist_t * hist);
+
+/*!
+* @brief Adds a latency sample to a histogram
+* @param[in] hist histogram to add sample to
+* @param[in] ns latency in nanoseconds
+*/
+void latency_add(latency_hist_t * hist, int64_t ns);
+
+/*!
+* @brief Adds every sample of one histogram to another
+* @param[in] dst histogram to add to
+* @param[in] src histogram to add
+*/
+void latency_merge(latency_hist_t * dst, const latency_hist_t * src);
+
+/*!
+* @brief Gets the latency at a percentile
+* @param[in] hist histogram to search
+* @param[in] pct percentile between 0 and 100
+* @return upper edge of the bucket holding the percentile in nanoseconds
+*/
+int64_t latency_percentile(latency_hist_t * hist, double pct);
+
+/*!
+* @brief Logs count, min, mean, percentiles, and max of a histogram
+* @param[in] p_name name of the histogram
+* @param[in] hist histogram to report
+*/
+void latency_report(const char * p_name, latency_hist_t * hist);
+
+/*!
+* @brief Difference between two timestamps
+* @param[in] start earlier timestamp
+* @param[in] end later timestamp
+* @return end - start in nanoseconds
+*/
+int64_t latency_diff_ns(const struct timespec * start, const struct timespec * end);
+
+#endif /* __LATENCY_H__ */
@@ -0,0 +1,103 @@
+/** @file load_test.h
+*
+* @brief Load generator driving the whole pipeline from a synthetic frame
+*        source at stepped frame rates to find the maximum sustainable rate
+*
+*/
+
+#ifndef __LOAD_TEST_H__
+#define __LOAD_TEST_H__
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <opencv2/core/core.hpp>
+
+// Frame rates stepped through, in frames per second
+#define LOAD_RATES {10, 15, 20, 30, 45, 60, 90, 120, 180, 240}
+
+// Time spent at each rate
+#define LOAD_STEP_SECONDS (5)
+
+// Stop stepping after this many rates in a row are not sustainable
+#define LOAD_FAIL_STEPS (2)
+
+// A frame must be stored and served within this many periods of capture
+#define LOAD_DEADLINE_PERIODS (2)
+
+// Fraction of the requested rate that must be achieved
+#define LOAD_RATE_MARGIN (0.95)
+
+// Longest wait for the pipeline to empty at the end of a step
+#define LOAD_DRAIN_MS (2000)
+
+// Synthetic frames, more than the capture queue holds so a queued frame is
+// never overwritten
+#define LOAD_FRAME_BUFS (16)
+
+// Per step results
+#define LOAD_REPORT_FILE_NAME "load_report.csv"
+
+// Pipeline stages after capture
+typedef enum load_stage {
+  LOAD_STAGE_CAPTURE,
+  LOAD_STAGE_STORE,
+  LOAD_STAGE_SERVE,
+  LOAD_STAGES
+} load_stage_t;
+
+/*!
+* @brief Creates the synthetic frames and opens the stage queues for
+*        sampling their depth
+* @param[in] hres horizontal resolution
+* @param[in] vres vertical resolution
+* @return SUCCESS/FAILURE
+*/
+uint32_t load_init(uint32_t hres, uint32_t vres);
+
+/*!
+* @brief Gets the next synthetic frame in place of a camera
+* @param[in] cam camera id, each camera has its own frames
+* @param[in] seq frame sequence number
+* @return frame
+*/
+IplImage * load_frame(uint32_t cam, uint32_t seq);
+
+/*!
+* @brief Records a frame finishing a stage.  Only one thread may record
+*        each camera's frames at a stage.
+* @param[in] stage stage finished
+* @param[in] cam camera the frame is from
+* @param[in] cap_time CLOCK_REALTIME capture time of the frame
+*/
+void load_done(load_stage_t stage, uint32_t cam, const struct timespec * cap_time);
+
+/*!
+* @brief Records a frame dropped because the queue into a stage was full
+* @param[in] stage stage the frame was dropped in front of
+*/
+void load_drop(load_stage_t stage);
+
+/*!
+* @brief Steps through every rate releasing every camera's capture service,
+*        reports each step, and logs the maximum sustainable rate.  A step
+*        is only sustainable when all the cameras together keep up.
+* @param[in] p_start semaphore releasing each camera's capture service
+* @param[in] p_stop semaphore each camera's capture service posts after each
+*            frame
+* @param[in] num_cams number of cameras
+* @return maximum sustainable rate of each camera in frames per second, 0 if
+*         none
+*/
+uint32_t load_run(sem_t * p_start, sem_t * p_stop, uint32_t num_cams);
+
+#ifdef LOAD_TEST
+#define LOAD_DONE(stage, cam, cap_time) load_done(stage, cam, cap_time)
+#define LOAD_DROP(stage)                load_drop(stage)
+#else
+#define LOAD_DONE(stage, cam, cap_time)
+#define LOAD_DROP(stage)
+#endif /* LOAD_TEST */
+
+#endif /* __LOAD_TEST_H__ */
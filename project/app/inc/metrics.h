@@ -0,0 +1,105 @@
+/** @file metrics.h
+*
+* @brief Pipeline counters, gauges, and latency histograms served in
+*        Prometheus text format on a localhost HTTP port
+*
+*/
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <time.h>
+
+// Port the metrics are served on, only bound to localhost.  Set with make
+// METRICS_PORT=n.
+#ifndef METRICS_PORT
+#define METRICS_PORT (9464)
+#endif /* METRICS_PORT */
+
+// Time between checks of the abort flag while waiting for a scrape
+#define METRICS_PERIOD_US (100000)
+
+// Max number of threads with their own counters, threads past it share one
+#define METRICS_MAX_THREADS (32)
+
+// Counters, each thread adds to its own copy and they are only summed when
+// scraped
+typedef enum {
+  METRICS_FRAMES_CAPTURED,
+  METRICS_FRAMES_ENCODED,
+  METRICS_FRAMES_WRITTEN,
+  METRICS_FRAMES_SENT,
+  METRICS_FRAMES_DROPPED,
+  METRICS_BYTES_WRITTEN,
+  METRICS_BYTES_SENT,
+  METRICS_INDEX_ERRORS,
+  METRICS_COUNTERS
+} metrics_counter_t;
+
+// Gauges, set by the one service that owns each
+typedef enum {
+  METRICS_ENCODE_QUALITY,
+  METRICS_CLIENTS,
+  METRICS_GAUGES
+} metrics_gauge_t;
+
+// Latency histograms of each stage, from capture to the frame being encoded,
+// stored, or sent
+typedef enum {
+  METRICS_LAT_ENCODE,
+  METRICS_LAT_STORE,
+  METRICS_LAT_SEND,
+  METRICS_HISTS
+} metrics_hist_t;
+
+/*!
+* @brief Claims counters for the calling thread
+* @param[in] p_name name of the thread, logged when no counters are left
+*/
+void metrics_thread_init(const char * p_name);
+
+/*!
+* @brief Adds to a counter of the calling thread
+* @param[in] counter counter to add to
+* @param[in] value amount to add
+*/
+void metrics_add(metrics_counter_t counter, uint64_t value);
+
+/*!
+* @brief Sets a gauge
+* @param[in] gauge gauge to set
+* @param[in] value new value
+*/
+void metrics_set(metrics_gauge_t gauge, int64_t value);
+
+/*!
+* @brief Adds the latency from a capture time until now to a histogram of the
+*        calling thread
+* @param[in] hist histogram to add to
+* @param[in] p_start capture time, CLOCK_REALTIME
+*/
+void metrics_latency(metrics_hist_t hist, const struct timespec * p_start);
+
+/*!
+* @brief Starts the metrics service thread which serves the metrics on
+*        METRICS_PORT
+* @return SUCCESS/FAILURE
+*/
+uint32_t metrics_init();
+
+// Metrics are compiled out unless METRICS is defined, build with make
+// METRICS=1
+#ifdef METRICS
+#define METRICS_INIT(name)           metrics_thread_init(name)
+#define METRICS_ADD(counter, value)  metrics_add(counter, value)
+#define METRICS_SET(gauge, value)    metrics_set(gauge, value)
+#define METRICS_LATENCY(hist, start) metrics_latency(hist, start)
+#else
+#define METRICS_INIT(name)
+#define METRICS_ADD(counter, value)
+#define METRICS_SET(gauge, value)
+#define METRICS_LATENCY(hist, start)
+#endif /* METRICS */
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,118 @@
+/** @file overload.h
+*
+* @brief Per queue overload policy and drop accounting for the queues
+*        between pipeline stages
+*
+*/
+
+#ifndef __OVERLOAD_H__
+#define __OVERLOAD_H__
+
+#include <mqueue.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Degrade skips the consumer's work while its queue is at least this full,
+// as a percentage of the queue size
+#define OVERLOAD_DEGRADE_PCT (50)
+
+// Consumers waiting on an empty queue look at the abort flag this often
+#define OVERLOAD_RECEIVE_MS (100)
+
+// What happens to a frame when the queue into the next stage is full
+typedef enum overload_policy {
+  OVERLOAD_BLOCK,       // Sender waits for room
+  OVERLOAD_DROP_NEWEST, // Frame being sent is dropped
+  OVERLOAD_DROP_OLDEST, // Oldest queued frame is dropped to make room
+  OVERLOAD_DEGRADE,     // Consumer skips encode/store to catch up, frames
+                        // are dropped only when the queue is full
+  OVERLOAD_POLICIES
+} overload_policy_t;
+
+// Queues between pipeline stages
+typedef enum overload_queue {
+  OVERLOAD_Q_FRAME,  // Capture to the JPEG/PPM service, one per camera
+  OVERLOAD_Q_SERVER, // JPEG service to the server
+  OVERLOAD_QUEUES
+} overload_queue_t;
+
+/*!
+* @brief Sets the policy of a queue
+* @param[in] p_queue queue name, frame_queue or server_queue
+* @param[in] p_policy block, drop-newest, drop-oldest, or degrade
+* @return SUCCESS/FAILURE
+*/
+uint32_t overload_config(const char * p_queue, const char * p_policy);
+
+/*!
+* @brief Sets the function releasing whatever a message holds when the
+*        message is dropped or degraded, such as a capture buffer
+* @param[in] queue queue the messages are passed through
+* @param[in] release release function, NULL when there is nothing to release
+*/
+void overload_set_release(overload_queue_t queue, void (*release)(void * msg));
+
+/*!
+* @brief Sets how many messages a queue is created to hold, for queues whose
+*        messages hold buffers there are only so many of.  Takes effect for
+*        queues opened after it.
+* @param[in] queue queue to size
+* @param[in] depth most messages, 0 for the system default
+* @param[in] msg_size size of a message
+*/
+void overload_set_depth(overload_queue_t queue, long depth, long msg_size);
+
+/*!
+* @brief Opens the sending end of a queue as its policy needs it
+* @param[in] queue queue to open
+* @param[in] cam camera sending, picks the frame queue and the buffer drop
+*            oldest receives into
+* @return queue descriptor or -1 on failure
+*/
+mqd_t overload_open(overload_queue_t queue, uint32_t cam);
+
+/*!
+* @brief Sends a message applying the queue policy when the queue is full
+* @param[in] queue queue being sent to
+* @param[in] cam camera the queue was opened for
+* @param[in] mq descriptor from overload_open()
+* @param[in] msg message to send
+* @param[in] size size of the message
+* @return SUCCESS when sent or dropped by policy, FAILURE on error
+*/
+uint32_t overload_send(overload_queue_t queue, uint32_t cam, mqd_t mq, const void * msg, size_t size);
+
+/*!
+* @brief Receives the next message, giving up once the test is aborted so the
+*        consumer can exit and be joined
+* @param[in] mq consumer's descriptor of the queue
+* @param[out] msg message received
+* @param[in] size size of the message buffer
+* @return size of the message, 0 when aborted, -1 on error
+*/
+ssize_t overload_receive(mqd_t mq, void * msg, size_t size);
+
+/*!
+* @brief Checks if the consumer of a degrade queue should skip the work for
+*        the frame it just received, counting and releasing it when it does
+* @param[in] queue queue the frame was received from
+* @param[in] mq consumer's descriptor of the queue
+* @param[in] msg message received
+* @return 1 to skip the frame, 0 to process it
+*/
+uint8_t overload_degrade(overload_queue_t queue, mqd_t mq, void * msg);
+
+/*!
+* @brief Counts and releases a frame the consumer of a queue could not pass on
+* @param[in] queue queue the frame was received from
+* @param[in] msg message received
+*/
+void overload_drop(overload_queue_t queue, void * msg);
+
+/*!
+* @brief Logs the policy and sent, dropped, and degraded counts of every queue
+*/
+void overload_report();
+
+#endif /* __OVERLOAD_H__ */
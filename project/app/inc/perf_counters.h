@@ -0,0 +1,86 @@
+/** @file perf_counters.h
+*
+* @brief Per-stage hardware counters.  Every service thread opens a
+*        perf_event_open counter group for itself and the counts between the
+*        begin and end of a stage are added to that stage, so the report
+*        tells why a stage is slow and not only how long it took.
+*
+*/
+
+#ifndef __PERF_COUNTERS_H__
+#define __PERF_COUNTERS_H__
+
+#include <stdint.h>
+
+// Max number of threads with their own counter group
+#define PERF_MAX_THREADS (16)
+
+// Name of the file the per-stage counts are written to on exit
+#define PERF_REPORT_FILE_NAME "perf_report.csv"
+
+// Stages counted for each frame, capture, convert, and encode are counted
+// per pixel and the others per byte
+typedef enum {
+  PERF_STAGE_CAPTURE,
+  PERF_STAGE_CONVERT,
+  PERF_STAGE_ENCODE,
+  PERF_STAGE_FILE_WRITE,
+  PERF_STAGE_SOCKET_SEND,
+  PERF_STAGES
+} perf_stage_t;
+
+// Events counted.  The hardware events are left out when there is no PMU or
+// perf_event_paranoid forbids them, the software events then come from
+// getrusage() and the thread CPU clock.
+typedef enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_TASK_CLOCK,
+  PERF_CONTEXT_SWITCHES,
+  PERF_PAGE_FAULTS,
+  PERF_EVENTS
+} perf_event_t;
+
+/*!
+* @brief Opens the counter group of the calling thread
+* @param[in] p_name name of the thread used in the report
+*/
+void perf_thread_init(const char * p_name);
+
+/*!
+* @brief Reads the counters at the beginning of a stage
+* @param[in] stage stage being started
+*/
+void perf_begin(perf_stage_t stage);
+
+/*!
+* @brief Adds the counts since perf_begin() to a stage as one frame
+* @param[in] stage stage being ended
+* @param[in] units pixels or bytes the stage worked on
+*/
+void perf_end(perf_stage_t stage, uint64_t units);
+
+/*!
+* @brief Logs and writes the counts of every stage per frame with the IPC
+*        and misses per thousand pixels or bytes
+* @param[in] p_file_name name of the report file
+* @return SUCCESS/FAILURE
+*/
+uint32_t perf_report(const char * p_file_name);
+
+// Counters are compiled out unless PERF_COUNTERS is defined
+#ifdef PERF_COUNTERS
+#define PERF_INIT(name)         perf_thread_init(name)
+#define PERF_BEGIN(stage)       perf_begin(stage)
+#define PERF_END(stage, units)  perf_end(stage, units)
+#define PERF_REPORT()           perf_report(PERF_REPORT_FILE_NAME)
+#else
+#define PERF_INIT(name)
+#define PERF_BEGIN(stage)
+#define PERF_END(stage, units)
+#define PERF_REPORT()
+#endif /* PERF_COUNTERS */
+
+#endif /* __PERF_COUNTERS_H__ */
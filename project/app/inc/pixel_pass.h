@@ -0,0 +1,134 @@
+/** @file pixel_pass.h
+*
+* @brief Fused pixel pass.  A frame is converted to packed 3 byte pixels a
+*        strip of rows at a time and every op of the pass runs over the
+*        strip while it is still in cache, so a chain of ops reads the
+*        frame from memory once instead of once per op.
+*
+*/
+
+#ifndef __PIXEL_PASS_H__
+#define __PIXEL_PASS_H__
+
+#include <stdint.h>
+
+#include "frame.h"
+
+// Bytes of converted pixels in a strip, small enough for the strip to stay
+// in L1 or L2 while the ops run.  Set with make PIXEL_STRIP_KB=n.
+#ifndef PIXEL_STRIP_KB
+#define PIXEL_STRIP_KB (32)
+#endif /* PIXEL_STRIP_KB */
+
+// Most ops in a pass and widest frame a pass takes
+#define PIXEL_PASS_OPS_MAX (8)
+#define PIXEL_WIDTH_MAX (1920)
+
+// Bins of the luma histogram
+#define PIXEL_HIST_BINS (256)
+
+// Rows of converted pixels an op works on in place
+typedef struct pixel_strip {
+  uint8_t * p_rows;
+  uint32_t stride;
+  uint32_t width;
+
+  // Row of the frame the strip starts at, 0 for the first strip of a frame
+  uint32_t first;
+  uint32_t rows;
+
+  // 1 for B, G, R order, 0 for R, G, B
+  uint8_t bgr;
+} pixel_strip_t;
+
+// Op run on every strip with the context it was added with
+typedef void (*pixel_kernel_t)(const pixel_strip_t * p_strip, void * p_ctx);
+
+typedef struct pixel_op {
+  const char * p_name;
+  pixel_kernel_t kernel;
+  void * p_ctx;
+} pixel_op_t;
+
+// Ops run in the order they were added.  Strips are an even number of rows
+// so 2x2 ops never straddle two strips.  A parallel pass spreads the strips
+// over the worker pool, so its ops must be safe to run on different strips
+// at once.
+typedef struct pixel_pass {
+  pixel_op_t ops[PIXEL_PASS_OPS_MAX];
+  uint32_t count;
+  uint8_t bgr;
+  uint8_t parallel;
+} pixel_pass_t;
+
+// Exposure statistics gathered by pixel_stats(), cleared by the caller
+typedef struct pixel_stats {
+  uint32_t hist[PIXEL_HIST_BINS];
+  uint64_t sums[3];
+  uint32_t pixels;
+} pixel_stats_t;
+
+// Half size thumbnail written by pixel_downscale()
+typedef struct pixel_thumb {
+  uint8_t * p_buf;
+  uint32_t stride;
+} pixel_thumb_t;
+
+/*!
+* @brief Sets up an empty pass
+* @param[out] p_pass pass
+* @param[in] bgr 1 to convert to B, G, R order, 0 for R, G, B
+* @param[in] parallel 1 to run the strips on the worker pool, which has to
+*            be started with worker_pool_init(), 0 to run them in order on
+*            the caller
+*/
+void pixel_pass_init(pixel_pass_t * p_pass, uint8_t bgr, uint8_t parallel);
+
+/*!
+* @brief Adds an op to the end of a pass
+* @param[in,out] p_pass pass
+* @param[in] p_name name of the op for logs
+* @param[in] kernel op run on every strip
+* @param[in] p_ctx context passed to the kernel
+* @return SUCCESS/FAILURE
+*/
+uint32_t pixel_pass_add(pixel_pass_t * p_pass, const char * p_name, pixel_kernel_t kernel, void * p_ctx);
+
+/*!
+* @brief Converts a frame strip by strip, running every op on each strip
+*        right after converting it.  Safe to run the same pass from many
+*        threads when the ops' contexts are only read.
+* @param[in] p_pass pass
+* @param[in] p_frame frame in any format
+* @param[out] p_dst width x height 3 byte pixels
+* @param[in] dst_stride bytes between destination rows
+* @return SUCCESS/FAILURE
+*/
+uint32_t pixel_pass_run(const pixel_pass_t * p_pass, const frame_t * p_frame, uint8_t * p_dst, uint32_t dst_stride);
+
+/*!
+* @brief Maps every intensity through a table in place, e.g. the gamma
+*        transfer function
+* @param[in] p_strip strip
+* @param[in] p_ctx 256 byte table
+*/
+void pixel_tone_map(const pixel_strip_t * p_strip, void * p_ctx);
+
+/*!
+* @brief Adds the strip to a luma histogram and per channel sums, in R, G, B
+*        order.  Strips are counted on their own and added atomically, so
+*        parallel passes can use it.
+* @param[in] p_strip strip
+* @param[in,out] p_ctx pixel_stats_t
+*/
+void pixel_stats(const pixel_strip_t * p_strip, void * p_ctx);
+
+/*!
+* @brief Averages each 2x2 block of the strip into a pixel of a half size
+*        thumbnail.  Uses SSE2 or NEON for the rows.
+* @param[in] p_strip strip
+* @param[in] p_ctx pixel_thumb_t
+*/
+void pixel_downscale(const pixel_strip_t * p_strip, void * p_ctx);
+
+#endif /* __PIXEL_PASS_H__ */
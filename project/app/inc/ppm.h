@@ -7,6 +7,14 @@
 #ifndef _PPM_H
 #define _PPM_H
 
+#include <stdint.h>
+
+#include "capture.h"
+#include "project_defs.h"
+
+// Max uname string length
+#define UNAME_MAX (255)
+
 // Max timestamp length
 #define TIMESTAMP_MAX (40)
 
@@ -23,9 +31,86 @@ typedef struct colors {
   uint8_t red;
 } __attribute__((packed)) colors_t;
 
+// PPM capture info
+typedef struct {
+  // Hold the uname str
+  char uname_str[UNAME_MAX];
+
+  // Length of uname string
+  uint8_t uname_len;
+
+  // Resolution info
+  resolution_t resolution;
+
+  // Timestamp to place in image
+  char timestamp[TIMESTAMP_MAX];
+
+  // Captupre info object
+  cap_info_t cap;
+
+  // Filename
+  char file_name[FILE_NAME_MAX];
+
+  // Converted PPM data of the camera, allocated from frame memory
+  char * image_buf;
+} ppm_cap_t;
+
 /*!
-* @brief Start the ppm thread
+* @brief Applies gamma transfer function to color intensity
+* @param color color intensity
+* @return transformed result
+*/
+uint8_t gamma_tf(uint8_t color);
+
+/*!
+* @brief Applies gamma transfer function to color intensity using the table
+*        built by ppm_buf_init()
+* @param color color intensity
+* @return transformed result
+*/
+uint8_t gamma_tf_lut(uint8_t color);
+
+/*!
+* @brief Writes ppm to file and socket
+* @param fd file descriptor to write ppm to
+* @param ppm struct holding ppm data to write to fd
+* @return SUCCESS/FAILURE
+*/
+uint32_t write_ppm(uint32_t fd, ppm_cap_t * ppm);
+
+/*!
+* @brief Puts image buffer rgb in correct format
+* @param ppm ppm structure to set data pointer
+* @param data imageData casted as a colors_t data structure
+* @return SUCCESS/FAILURE
+*/
+uint32_t create_image_buf(ppm_cap_t * ppm, colors_t * data);
+
+/*!
+* @brief Puts image buffer rgb in correct format from a frame, converting
+*        and applying the gamma function in one pass of cache sized strips
+* @param ppm ppm structure to set data pointer
+* @param frame frame in any format
+* @return SUCCESS/FAILURE
+*/
+uint32_t create_image_buf_yuv(ppm_cap_t * ppm, const frame_t * frame);
+
+/*!
+* @brief Allocates a PPM image buffer and builds the gamma table
+* @param[out] pp_buf gets the image buffer
+* @return SUCCESS/FAILURE
+*/
+uint32_t ppm_buf_init(char ** pp_buf);
+
+/*!
+* @brief Start a ppm thread for every camera, camera n stores in
+*        capture_ppm_n
 * @return SUCCESS/FAILURE
 */
 uint32_t ppm_init();
+
+/*!
+* @brief Waits for every camera's ppm_service to exit
+*/
+void ppm_stop();
 #endif /* _PPM_H */
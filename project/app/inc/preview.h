@@ -0,0 +1,57 @@
+/** @file preview.h
+*
+* @brief Preview window fed from a latest-frame mailbox by a low priority
+*        thread, so display never runs in the real-time capture path
+*
+*/
+
+#ifndef __PREVIEW_H__
+#define __PREVIEW_H__
+
+#include <stdint.h>
+
+#include "capture.h"
+#include "frame.h"
+
+// Time between preview updates, set with make PREVIEW_MS=ms.  Frames posted
+// in between are never shown.
+#ifndef PREVIEW_MS
+#define PREVIEW_MS (5 * PERIOD)
+#endif /* PREVIEW_MS */
+#define PREVIEW_PERIOD_US (PREVIEW_MS * 1000)
+
+// There is no window in headless builds or while load testing
+#if !defined(HEADLESS) && !defined(LOAD_TEST)
+#define PREVIEW
+#endif /* HEADLESS */
+
+/*!
+* @brief Starts the preview service thread, which opens the window
+* @param[in] hres horizontal resolution of the frames
+* @param[in] vres vertical resolution of the frames
+* @return SUCCESS/FAILURE
+*/
+uint32_t preview_init(uint32_t hres, uint32_t vres);
+
+/*!
+* @brief Offers a frame to the preview, which copies it when it is waiting
+*        for one.  Never blocks, frames the preview isn't waiting for are only
+*        counted.
+* @param[in] p_frame frame, which can be released once this returns
+* @param[in] seq frame sequence number
+*/
+void preview_post(const frame_t * p_frame, uint32_t seq);
+
+/*!
+* @brief Waits for the preview service to see the abort flag, closes the
+*        window, and logs how many frames were shown
+*/
+void preview_stop();
+
+#ifdef PREVIEW
+#define PREVIEW_POST(p_frame, seq) preview_post(p_frame, seq)
+#else
+#define PREVIEW_POST(p_frame, seq)
+#endif /* PREVIEW */
+
+#endif /* __PREVIEW_H__ */
@@ -11,6 +11,17 @@
 #include <stddef.h>
 #include <time.h>
 
+// Execution and period statistics kept for each timer in nanoseconds.  A
+// sample is recorded every time a started timer is stopped.
+typedef struct profiler_stats {
+  uint32_t count;
+  uint64_t wcet;
+  uint64_t total;
+  uint32_t period_count;
+  uint64_t period_min;
+  uint64_t period_total;
+} profiler_stats_t;
+
 /*!
 * @brief Initializes the profiler
 */
@@ -40,5 +51,12 @@ void reset_timer(uint8_t timer);
 */
 void get_time(uint8_t timer, struct timespec * diff);
 
+/*!
+* @brief Gets the execution and period statistics for a timer
+* @param[in] timer timer to get statistics for
+* @param[out] p_stats structure to fill out with the statistics
+*/
+void get_stats(uint8_t timer, profiler_stats_t * p_stats);
+
 
 #endif // __PROFILER_H__
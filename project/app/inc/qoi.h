@@ -0,0 +1,73 @@
+/** @file qoi.h
+*
+* @brief Lossless QOI ("Quite OK Image") encoding of frames.  One pass of
+*        runs, a 64 entry index of recent colors, and small differences from
+*        the previous pixel, with no tables or entropy coding.
+*
+*/
+
+#ifndef __QOI_H__
+#define __QOI_H__
+
+#include <stdint.h>
+
+#include "frame.h"
+
+// File header and end marker
+#define QOI_HEADER_BYTES (14)
+#define QOI_END_BYTES (8)
+
+// Largest encoding of a width x height RGB image, 4 bytes a pixel when no
+// pixel matches
+#define QOI_MAX_BYTES(width, height) ((width) * (height) * 4 + QOI_HEADER_BYTES + QOI_END_BYTES)
+
+// Encoder, one for each encoding thread
+typedef struct qoi {
+  // Frames not in BGR are converted into this, from frame memory
+  uint8_t * p_rgb;
+
+  // Frame size the buffers are set up for
+  uint32_t width;
+  uint32_t height;
+} qoi_t;
+
+/*!
+* @brief Gets the buffer frames not in BGR are converted into from frame
+*        memory.  Only one thread may encode frames with an encoder.
+* @param[out] p_qoi encoder to set up
+* @param[in] width frame width
+* @param[in] height frame height
+* @return SUCCESS/FAILURE
+*/
+uint32_t qoi_init(qoi_t * p_qoi, uint32_t width, uint32_t height);
+
+/*!
+* @brief Encodes a packed 3 byte a pixel image
+* @param[in] p_src first row of the image
+* @param[in] width image width
+* @param[in] height image height
+* @param[in] stride bytes between rows
+* @param[in] bgr 1 for B, G, R order, 0 for R, G, B
+* @param[out] p_dst at least QOI_MAX_BYTES(width, height)
+* @return number of bytes encoded
+*/
+uint32_t qoi_encode(const uint8_t * p_src,
+                    uint32_t width,
+                    uint32_t height,
+                    uint32_t stride,
+                    uint8_t bgr,
+                    uint8_t * p_dst);
+
+/*!
+* @brief Encodes a frame, YUV frames are converted to RGB first so the file
+*        holds the same pixels a PPM would
+* @param[in] p_qoi encoder
+* @param[in] p_frame frame in any format, of the size the encoder was set up
+*            for
+* @param[out] p_dst at least QOI_MAX_BYTES(width, height)
+* @param[out] p_len number of bytes encoded
+* @return SUCCESS/FAILURE, FAILURE for a frame of another size
+*/
+uint32_t qoi_encode_frame(qoi_t * p_qoi, const frame_t * p_frame, uint8_t * p_dst, uint32_t * p_len);
+
+#endif /* __QOI_H__ */
@@ -0,0 +1,76 @@
+/** @file retention.h
+*
+* @brief Retention of stored frames.  Storage services only report the files
+*        they write, a low priority service deletes the oldest once a
+*        directory is over its frame count, byte, or age quota.
+*
+*/
+
+#ifndef __RETENTION_H__
+#define __RETENTION_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "capture.h"
+
+// Quotas for each storage directory, 0 turns a quota off.  Set with make
+// RETAIN_FRAMES=n RETAIN_MB=n RETAIN_AGE_S=s.
+#ifndef RETAIN_FRAMES
+#define RETAIN_FRAMES (MAX_FRAMES)
+#endif /* RETAIN_FRAMES */
+#ifndef RETAIN_MB
+#define RETAIN_MB (0)
+#endif /* RETAIN_MB */
+#ifndef RETAIN_AGE_S
+#define RETAIN_AGE_S (0)
+#endif /* RETAIN_AGE_S */
+
+// Time between retention passes
+#define RETENTION_PERIOD_US (10 * PERIOD_US)
+
+// Files tracked for each directory, a power of 2.  Past this retention is too
+// far behind to track more, so each newly stored file is deleted at once.
+#define RETENTION_FILES_MAX (16384)
+
+// Most files deleted by one pass
+#define RETENTION_BATCH (256)
+
+// Most storage directories, every camera stores in its own
+#define RETENTION_DIRS (2 * CAMERAS)
+
+#if RETAIN_FRAMES >= RETENTION_FILES_MAX
+#error "RETAIN_FRAMES must be below RETENTION_FILES_MAX"
+#endif /* RETAIN_FRAMES */
+
+/*!
+* @brief Adds a storage directory holding files named <prefix><number><suffix>.
+*        Files left by an earlier run are tracked as if just stored, so
+*        quotas carry over a restart.
+* @param[in] p_dir storage directory, kept
+* @param[in] p_prefix file name before the number, kept
+* @param[in] p_suffix file name after the number, kept
+* @param[out] p_id directory id to report stored files with
+* @param[out] p_next number to give the next file, one past the newest
+* @return SUCCESS/FAILURE
+*/
+uint32_t retention_add(const char * p_dir, const char * p_prefix, const char * p_suffix, uint32_t * p_id, uint32_t * p_next);
+
+/*!
+* @brief Reports a stored file.  Never blocks, and only deletes the file
+*        when there is no room left to track it.  Only one thread may report
+*        for a directory.
+* @param[in] id directory id from retention_add()
+* @param[in] num file number
+* @param[in] size bytes in the file
+* @param[in] p_time time the frame was captured
+*/
+void retention_stored(uint32_t id, uint32_t num, uint32_t size, const struct timespec * p_time);
+
+/*!
+* @brief Starts the retention service thread once the directories are added
+* @return SUCCESS/FAILURE
+*/
+uint32_t retention_init();
+
+#endif /* __RETENTION_H__ */
@@ -0,0 +1,51 @@
+/** @file sched_analysis.h
+*
+* @brief Rate monotonic schedulability analysis of the service set
+*
+*/
+
+#ifndef __SCHED_ANALYSIS_H__
+#define __SCHED_ANALYSIS_H__
+
+#include <stdint.h>
+
+// Max number of services that can be analyzed
+#define SA_MAX_SERVICES (16)
+#define SA_NAME_MAX (32)
+
+// Report written on exit which is also used as the budget for the next start
+#define SA_REPORT_FILE_NAME "sched_report.csv"
+
+/*!
+* @brief Registers a service to be analyzed using its profiler timer
+* @param[in] p_name name of the service
+* @param[in] timer profiler timer wrapping one release of the service
+* @param[in] period_us period the service is expected to run at
+* @return SUCCESS/FAILURE
+*/
+uint32_t sa_register(const char * p_name, uint8_t timer, uint32_t period_us);
+
+/*!
+* @brief Checks the service budgets from a previous report against the
+*        configured periods before any service is started, each service
+*        at the sequencer tick times its divisor
+* @param[in] p_file_name report file holding the service budgets
+* @return SUCCESS if schedulable or there are no budgets, FAILURE otherwise
+*/
+uint32_t sa_admit(const char * p_file_name);
+
+/*!
+* @brief Updates every registered service from its profiler statistics and
+*        checks the service set is still schedulable
+* @return SUCCESS if schedulable, FAILURE otherwise
+*/
+uint32_t sa_check();
+
+/*!
+* @brief Writes the per service CPU budget report
+* @param[in] p_file_name name of the report file
+* @return SUCCESS/FAILURE
+*/
+uint32_t sa_report(const char * p_file_name);
+
+#endif /* __SCHED_ANALYSIS_H__ */
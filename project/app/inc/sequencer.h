@@ -0,0 +1,113 @@
+/** @file sequencer.h
+*
+* @brief Multi-rate cyclic executive.  One timer ticks at the period of
+*        sched_service and every service added to the sequencer is released
+*        through its own semaphore on the ticks that are a multiple of its
+*        period.  A service still busy with its last release when it is due
+*        again isn't released and the overrun is counted.
+*
+*/
+
+#ifndef __SEQUENCER_H__
+#define __SEQUENCER_H__
+
+#include <semaphore.h>
+#include <stdint.h>
+
+// Max number of services released, one for each camera of a camera service
+#define SEQ_MAX_SLOTS (16)
+
+// Slot returned when a service isn't in the sequencer
+#define SEQ_NO_SLOT (UINT32_MAX)
+
+/*!
+* @brief Adds a service to be released every period from the service table,
+*        rounded to whole ticks
+* @param[in] p_name name of the service in the table
+* @param[in] cam camera the service runs for
+* @param[in] p_release semaphore the service waits on, NULL for the
+*            sequencer's own which seq_wait() uses
+* @param[in] p_done semaphore the service posts after each release, NULL
+*            with p_release
+* @param[out] p_slot slot of the service
+* @return SUCCESS/FAILURE
+*/
+uint32_t seq_add(const char * p_name, uint32_t cam, sem_t * p_release, sem_t * p_done, uint32_t * p_slot);
+
+/*!
+* @brief Finds the slot of a service
+* @param[in] p_name name of the service in the table
+* @param[in] cam camera the service runs for
+* @return slot or SEQ_NO_SLOT
+*/
+uint32_t seq_find(const char * p_name, uint32_t cam);
+
+/*!
+* @brief Finishes the last release of a service and waits for the next.
+*        Load tests don't run the sequencer so it sleeps one period of the
+*        service instead.
+* @param[in] slot slot from seq_add() with the sequencer's own semaphores
+* @return 1 when released, 0 when exiting
+*/
+uint8_t seq_wait(uint32_t slot);
+
+/*!
+* @brief Gets the tick a service was last released on, services released on
+*        the same tick are working on the same frame
+* @param[in] slot slot from seq_add()
+* @return tick, 0 until the sequencer runs
+*/
+uint32_t seq_tick(uint32_t slot);
+
+/*!
+* @brief Gets the length of a tick, the period of sched_service in the
+*        service table or PERIOD_US
+* @return tick length in microseconds
+*/
+uint32_t seq_tick_us();
+
+/*!
+* @brief Gets the ticks between releases of a service without adding it, for
+*        services fed frames at a lower rate instead of being released
+* @param[in] p_name name of the service in the table
+* @return ticks, 1 for services at the tick rate or not in the table
+*/
+uint32_t seq_divisor(const char * p_name);
+
+/*!
+* @brief Gets the period a service is released at, its ticks times the tick
+*        length
+* @param[in] p_name name of the service in the table
+* @return period in microseconds
+*/
+uint32_t seq_period_us(const char * p_name);
+
+/*!
+* @brief Gets the sequence numbers between the frames a service is handed.
+*        Captured frames are passed on only on ticks both capture and the
+*        service are due on, so the service sees every step-th frame.
+* @param[in] p_name name of the service in the table
+* @param[in] p_also service the frames also pass through first, or NULL
+* @return sequence numbers between frames, 1 in load tests which pass on
+*         every frame
+*/
+uint32_t seq_frame_step(const char * p_name, const char * p_also);
+
+/*!
+* @brief Releases the services due on each tick, carrying on from the tick
+*        the last call ended on
+* @param[in] ticks number of ticks to run
+*/
+void seq_run(uint32_t ticks);
+
+/*!
+* @brief Wakes every service waiting in seq_wait() so it sees the abort flag
+*/
+void seq_stop();
+
+/*!
+* @brief Logs releases and overruns of every service
+*/
+void seq_report();
+
+#endif /* __SEQUENCER_H__ */
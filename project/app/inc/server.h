@@ -7,23 +7,62 @@
 #ifndef __SERVER_H__
 #define __SERVER_H__
 
+#include <stdint.h>
+#include <time.h>
+
 #include "project_defs.h"
 
 // Queue name for images to passed to be sent of TCP socket
 # define SERVER_QUEUE_NAME "/server_queue"
 
+// Port the server listens on and clients connect to by default.  Set with make
+// SERVER_PORT=n.
+#ifndef SERVER_PORT
+#define SERVER_PORT (12345)
+#endif /* SERVER_PORT */
+
+// CLOCK_REALTIME timestamps following a frame through each stage
+typedef struct frame_times {
+  struct timespec cap;
+  struct timespec enc;
+  struct timespec send;
+} frame_times_t;
+
 // Structure holding information to be passed over TCP socket
 typedef struct server_info {
   char file_name[FILE_NAME_MAX];
   uint32_t file_name_len;
   uint8_t * image_buf;
   uint32_t image_buf_len;
+  uint32_t seq;
+  uint32_t cam;
+  frame_times_t times;
 } server_info_t;
 
+// Header sent in network byte order ahead of every frame on the socket
+typedef struct frame_hdr {
+  uint32_t seq;
+  uint32_t cam;
+  uint32_t cap_sec;
+  uint32_t cap_nsec;
+  uint32_t enc_sec;
+  uint32_t enc_nsec;
+  uint32_t send_sec;
+  uint32_t send_nsec;
+
+  // Sequence numbers between frames of the stream, larger gaps were dropped
+  uint32_t seq_step;
+} frame_hdr_t;
+
 /*!
 * @brief Starts a TCP server
 * @return status SUCCESS/FAIL
 */
 status_t server_init();
 
+/*!
+* @brief Waits for the server service to see the abort flag and exit
+*/
+void server_stop();
+
 #endif /* __SERVER_H__ */
@@ -0,0 +1,140 @@
+/** @file service.h
+*
+* @brief Service configuration table and common thread launcher
+*
+*/
+
+#ifndef __SERVICE_H__
+#define __SERVICE_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+// Max number of services in the table and length of a service name
+#define SERVICE_MAX (16)
+#define SERVICE_NAME_MAX (32)
+
+// Priority value requesting a rate monotonic priority from the period
+#define SERVICE_PRI_RM (-1)
+
+// Priority value requesting a SCHED_OTHER (non real-time) thread
+#define SERVICE_PRI_OTHER (0)
+
+// Most workers in a pool launched with service_launch_worker()
+#define SERVICE_WORKERS_MAX (8)
+
+// Stack size of every service thread
+#define SERVICE_STACK_SIZE (512 * 1024)
+
+// Configuration for a single service thread
+typedef struct service_cfg {
+  char name[SERVICE_NAME_MAX];
+  uint32_t period_us;
+  int32_t priority;
+  uint32_t cpu_mask;
+} service_cfg_t;
+
+/*!
+* @brief Parses the command line for service configuration.
+*        -c <file> loads a configuration file, -s "<line>" sets one service
+*        using the same line format as the file:
+*          <name> <priority|rm|other> [cpus]
+*          housekeeping <cpus>
+*          queue <frame_queue|server_queue> <policy>
+*          camera <id> <cpus> [device]
+*          period <name> <ms>
+*        cpus is a list such as 0-1,3 or all.  policy is block, drop-newest,
+*        drop-oldest, or degrade.
+* @param[in] argc number of arguments
+* @param[in] argv arguments
+* @return SUCCESS/FAILURE
+*/
+uint32_t service_args(int32_t argc, char ** argv);
+
+/*!
+* @brief Loads a service configuration file
+* @param[in] p_file_name name of the file
+* @return SUCCESS/FAILURE
+*/
+uint32_t service_config(const char * p_file_name);
+
+/*!
+* @brief Gets the period of a service from the service table
+* @param[in] p_name name of the service in the table
+* @return period in microseconds, 0 when not found
+*/
+uint32_t service_period_us(const char * p_name);
+
+/*!
+* @brief Creates a service thread with the priority and affinity from the
+*        service table
+* @param[in] p_name name of the service in the table
+* @param[in] func thread function
+* @param[in] arg argument passed to the thread function
+* @param[out] thread created thread
+* @return SUCCESS/FAILURE
+*/
+uint32_t service_launch(const char * p_name,
+                        void * (*func)(void *),
+                        void * arg,
+                        pthread_t * thread);
+
+/*!
+* @brief Creates the thread of a service run for each camera.  It gets the
+*        priority from the service table and the cpus of the camera's
+*        configuration line, or the table's cpus moved along by the camera id
+*        so the cameras' pipelines run on different cores.
+* @param[in] p_name name of the service in the table
+* @param[in] cam camera id
+* @param[in] func thread function
+* @param[in] arg argument passed to the thread function
+* @param[out] thread created thread
+* @return SUCCESS/FAILURE
+*/
+uint32_t service_launch_camera(const char * p_name,
+                               uint32_t cam,
+                               void * (*func)(void *),
+                               void * arg,
+                               pthread_t * thread);
+
+/*!
+* @brief Creates one worker of a pool.  It gets the priority from the
+*        service table and is pinned to a single cpu, the worker'th of the
+*        service's cpus or of every online cpu when it has none, so the
+*        workers of a pool each get their own core.
+* @param[in] p_name name of the service in the table
+* @param[in] worker index of the worker, below SERVICE_WORKERS_MAX
+* @param[in] func thread function
+* @param[in] arg argument passed to the thread function
+* @param[out] thread created thread
+* @return SUCCESS/FAILURE
+*/
+uint32_t service_launch_worker(const char * p_name,
+                               uint32_t worker,
+                               void * (*func)(void *),
+                               void * arg,
+                               pthread_t * thread);
+
+/*!
+* @brief Gets the number of cpus configured for a service, one worker is
+*        started for each
+* @param[in] p_name name of the service in the table
+* @return cpus configured, 0 when the service isn't pinned
+*/
+uint32_t service_workers(const char * p_name);
+
+/*!
+* @brief Applies the priority and affinity from the service table to the
+*        calling thread
+* @param[in] p_name name of the service in the table
+* @return SUCCESS/FAILURE
+*/
+uint32_t service_apply_self(const char * p_name);
+
+/*!
+* @brief Logs the minor and major page faults taken by each launched service
+*        in total and since the last report
+*/
+void service_report_faults();
+
+#endif /* __SERVICE_H__ */
@@ -0,0 +1,161 @@
+/** @file task_graph.h
+*
+* @brief Task graph executor.  The stages of a pipeline are the nodes of a
+*        graph and every item submitted, e.g. a frame, runs each node once
+*        after the nodes it depends on.  Ready tasks run on a pool of
+*        workers pinned one per core, each with its own work stealing deque,
+*        so items overlap across stages and idle workers take work from busy
+*        ones.  Serial nodes run one item at a time in the order the items
+*        were submitted.
+*
+*/
+
+#ifndef __TASK_GRAPH_H__
+#define __TASK_GRAPH_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+// Service in the table the workers are launched as
+#define TASK_GRAPH_SERVICE "graph_worker"
+
+// Number of workers, -1 for one for each cpu of the graph_worker service, or
+// each cpu but one when it has none.  Set with make GRAPH_WORKERS=n.
+#ifndef GRAPH_WORKERS
+#define GRAPH_WORKERS (-1)
+#endif /* GRAPH_WORKERS */
+
+// Most nodes in a graph and nodes following one node
+#define TASK_GRAPH_NODES_MAX (8)
+#define TASK_GRAPH_NEXT_MAX (4)
+
+// Most items of a graph in flight, a power of 2
+#define TASK_GRAPH_INFLIGHT (8)
+
+// Function run by a node for one item
+typedef void (*task_func_t)(void * p_data);
+
+struct task_graph;
+struct task_item;
+
+// A node ready to run for an item, what the deques hold
+typedef struct task {
+  struct task_item * p_item;
+  uint32_t node;
+} task_t;
+
+// Item moving through a graph, embedded in the caller's own item
+typedef struct task_item {
+  struct task_graph * p_graph;
+  void * p_data;
+  uint32_t ticket;
+
+  // Nodes each node still waits for, and nodes left before the item is done
+  uint32_t waiting[TASK_GRAPH_NODES_MAX];
+  uint32_t left;
+  task_t tasks[TASK_GRAPH_NODES_MAX];
+} task_item_t;
+
+// Stage of a graph
+typedef struct task_node {
+  const char * p_name;
+  task_func_t func;
+  uint32_t next[TASK_GRAPH_NEXT_MAX];
+  uint32_t num_next;
+  uint32_t num_prev;
+
+  // Serial nodes keep ready items by ticket and run the next one in order
+  uint8_t serial;
+  pthread_mutex_t lock;
+  task_t * p_ready[TASK_GRAPH_INFLIGHT];
+  uint32_t next_ticket;
+  uint8_t draining;
+
+  // Items run and time spent running them
+  uint64_t runs;
+  uint64_t busy_ns;
+} task_node_t;
+
+typedef struct task_graph {
+  const char * p_name;
+  task_node_t nodes[TASK_GRAPH_NODES_MAX];
+  uint32_t num_nodes;
+
+  // Called once an item has run every node, the item may then be reused
+  task_func_t done;
+
+  uint32_t tickets;
+  uint32_t inflight;
+} task_graph_t;
+
+/*!
+* @brief Starts the workers, pinned one per cpu of the graph_worker service
+* @return SUCCESS/FAILURE
+*/
+uint32_t task_graph_init();
+
+/*!
+* @brief Sets up an empty graph
+* @param[out] p_graph graph
+* @param[in] p_name name of the graph for the report
+* @param[in] done function called with the item's data once it has run
+*            every node
+*/
+void task_graph_create(task_graph_t * p_graph, const char * p_name, task_func_t done);
+
+/*!
+* @brief Adds a node to a graph
+* @param[in,out] p_graph graph
+* @param[in] p_name name of the node for the report
+* @param[in] func function run for each item
+* @param[in] serial 1 to run items one at a time in the order they were
+*            submitted, 0 to run them on any number of workers at once
+* @param[out] p_node node id
+* @return SUCCESS/FAILURE
+*/
+uint32_t task_graph_node(task_graph_t * p_graph, const char * p_name, task_func_t func, uint8_t serial, uint32_t * p_node);
+
+/*!
+* @brief Makes a node run after another for every item
+* @param[in,out] p_graph graph
+* @param[in] before node running first
+* @param[in] after node running once before is done
+* @return SUCCESS/FAILURE
+*/
+uint32_t task_graph_edge(task_graph_t * p_graph, uint32_t before, uint32_t after);
+
+/*!
+* @brief Submits an item, the nodes with nothing before them are ready at
+*        once.  Safe to call from any thread.
+* @param[in] p_graph graph
+* @param[out] p_item item, not touched again until done is called
+* @param[in] p_data data passed to every node
+* @return SUCCESS, FAILURE when TASK_GRAPH_INFLIGHT items are in flight
+*/
+uint32_t task_graph_submit(task_graph_t * p_graph, task_item_t * p_item, void * p_data);
+
+/*!
+* @brief Gets the worker the calling thread is
+* @return worker index, or the number of workers for other threads
+*/
+uint32_t task_graph_worker();
+
+/*!
+* @brief Gets the number of workers
+* @return workers
+*/
+uint32_t task_graph_workers();
+
+/*!
+* @brief Logs the occupancy of each node and worker of a graph since the
+*        workers were started
+* @param[in] p_graph graph
+*/
+void task_graph_report(const task_graph_t * p_graph);
+
+/*!
+* @brief Stops the workers once the items already submitted are done
+*/
+void task_graph_stop();
+
+#endif /* __TASK_GRAPH_H__ */
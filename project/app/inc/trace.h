@@ -0,0 +1,87 @@
+/** @file trace.h
+*
+* @brief Per-frame span tracing dumped in Chrome Trace Event JSON format
+*
+*/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+// Max number of threads able to record spans and events per thread buffer
+#define TRACE_MAX_THREADS (16)
+#define TRACE_MAX_EVENTS (8192)
+
+// Name of the file the trace is dumped to on exit
+#define TRACE_FILE_NAME "trace.json"
+
+// Spans recorded for each frame as it moves through the pipeline
+typedef enum {
+  TRACE_SPAN_RELEASE,
+  TRACE_SPAN_CAPTURE,
+  TRACE_SPAN_QUEUE_WAIT,
+  TRACE_SPAN_ENCODE,
+  TRACE_SPAN_CONVERT,
+  TRACE_SPAN_FILE_WRITE,
+  TRACE_SPAN_SOCKET_SEND,
+  TRACE_SPAN_MAX
+} trace_span_t;
+
+/*!
+* @brief Claims a preallocated event buffer for the calling thread
+* @param[in] p_name name of the thread shown in the trace viewer
+* @return buffer id used when recording spans
+*/
+uint8_t trace_thread_init(const char * p_name);
+
+/*!
+* @brief Gets the buffer the calling thread claimed, for tasks run on worker
+*        threads that claim their own
+* @return buffer id from trace_thread_init(), past the max when none
+*/
+uint8_t trace_thread_buf();
+
+/*!
+* @brief Records the beginning of a span
+* @param[in] buf buffer id from trace_thread_init()
+* @param[in] span span being started
+* @param[in] seq frame sequence number the span belongs to
+*/
+void trace_begin(uint8_t buf, trace_span_t span, uint32_t seq);
+
+/*!
+* @brief Records the end of a span
+* @param[in] buf buffer id from trace_thread_init()
+* @param[in] span span being ended
+* @param[in] seq frame sequence number the span belongs to
+*/
+void trace_end(uint8_t buf, trace_span_t span, uint32_t seq);
+
+/*!
+* @brief Writes every recorded span to a trace JSON file
+* @param[in] p_file_name name of the file to write
+* @return SUCCESS/FAILURE
+*/
+uint32_t trace_dump(const char * p_file_name);
+
+// Tracing is compiled out unless TRACE is defined.  TRACE_INIT declares the
+// trace_buf local used by the other macros, like profiler_init() does for
+// timer, TRACE_ATTACH declares it for the buffer of the thread it runs on.
+// Queue waits start before the frame is known so a consumer tags both ends
+// with its own count, not the frame's sequence number.
+#ifdef TRACE
+#define TRACE_INIT(name)       uint8_t trace_buf = trace_thread_init(name)
+#define TRACE_ATTACH()         uint8_t trace_buf = trace_thread_buf()
+#define TRACE_BEGIN(span, seq) trace_begin(trace_buf, span, seq)
+#define TRACE_END(span, seq)   trace_end(trace_buf, span, seq)
+#define TRACE_DUMP()           trace_dump(TRACE_FILE_NAME)
+#else
+#define TRACE_INIT(name)
+#define TRACE_ATTACH()
+#define TRACE_BEGIN(span, seq)
+#define TRACE_END(span, seq)
+#define TRACE_DUMP()
+#endif /* TRACE */
+
+#endif /* __TRACE_H__ */
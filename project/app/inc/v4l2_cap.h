@@ -0,0 +1,95 @@
+/** @file v4l2_cap.h
+*
+* @brief V4L2 mmap streaming capture.  Frames are handed on in the buffers the
+*        driver filled and go back to the driver once released.
+*
+*/
+
+#ifndef __V4L2_CAP_H__
+#define __V4L2_CAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "capture.h"
+#include "frame.h"
+
+// Device to open, set with make V4L2_DEVICE=/dev/videoN
+#ifndef V4L2_DEVICE
+#define V4L2_DEVICE "/dev/video0"
+#endif /* V4L2_DEVICE */
+
+// Device of camera n past the first unless set in the service configuration
+#define V4L2_DEVICE_FMT "/dev/video%u"
+
+// Number of driver buffers requested, set with make V4L2_BUFS=n.  Buffers
+// held by later stages aren't available to the driver so this bounds how far
+// behind the encoder can get, the frame queue holds two fewer so one is always
+// left with the driver.  At least 3 are needed for that.
+#ifndef V4L2_BUFS
+#define V4L2_BUFS (4)
+#endif /* V4L2_BUFS */
+
+// Most buffers accepted from the driver
+#define V4L2_MAX_BUFS (32)
+
+// Longest wait for a filled buffer
+#define V4L2_POLL_MS (2 * PERIOD)
+
+// Buffer mapped from the driver and the frame describing its data
+typedef struct v4l2_cap_buf {
+  void * start;
+  size_t length;
+  frame_t frame;
+} v4l2_cap_buf_t;
+
+// Open streaming device
+typedef struct v4l2_cap {
+  int32_t fd;
+  uint32_t num_bufs;
+  uint32_t queued;
+  v4l2_cap_buf_t bufs[V4L2_MAX_BUFS];
+} v4l2_cap_t;
+
+/*!
+* @brief Opens a device, sets the first of YUYV, YUV420, and BGR24 it
+*        supports, maps the buffers, queues them, and starts streaming
+* @param[out] p_cap device to fill out
+* @param[in] p_dev device path
+* @param[in] hres horizontal resolution
+* @param[in] vres vertical resolution
+* @param[in] num_bufs number of buffers to request
+* @return SUCCESS/FAILURE, on failure nothing is left mapped or open
+*/
+uint32_t v4l2_open(v4l2_cap_t * p_cap,
+                   const char * p_dev,
+                   uint32_t hres,
+                   uint32_t vres,
+                   uint32_t num_bufs);
+
+/*!
+* @brief Waits for a filled buffer and dequeues it.  The frame points at the
+*        driver buffer, the time is the driver timestamp on CLOCK_REALTIME,
+*        and the buffer index is set so the buffer can be released.
+* @param[in] p_cap device
+* @param[out] p_info capture information to fill out
+* @return SUCCESS/FAILURE
+*/
+uint32_t v4l2_grab(v4l2_cap_t * p_cap, cap_info_t * p_info);
+
+/*!
+* @brief Gives a dequeued buffer back to the driver.  Safe to call from any
+*        thread.
+* @param[in] p_cap device
+* @param[in] index buffer index from v4l2_grab()
+* @return SUCCESS/FAILURE
+*/
+uint32_t v4l2_release(v4l2_cap_t * p_cap, int32_t index);
+
+/*!
+* @brief Stops streaming, unmaps the buffers, and closes the device
+* @param[in] p_cap device
+*/
+void v4l2_close(v4l2_cap_t * p_cap);
+
+#endif /* __V4L2_CAP_H__ */
@@ -0,0 +1,60 @@
+/** @file worker_pool.h
+*
+* @brief Pool of persistent worker threads for splitting per-frame work
+*        across cores.  Workers are started once, each pinned to its own
+*        core, and sleep between jobs.  A parallel for hands out items to
+*        the workers and the calling thread and returns once every item is
+*        done.
+*
+*/
+
+#ifndef __WORKER_POOL_H__
+#define __WORKER_POOL_H__
+
+#include <stdint.h>
+
+#include "service.h"
+
+// Name of the workers in the service table, their priority and cpus are set
+// like any other service
+#define WORKER_POOL_SERVICE "pool_worker"
+
+// Workers started, by default one for each cpu of pool_worker's
+// configuration line or one less than the online cpus, as the caller works
+// too.  Set with make POOL_WORKERS=n, 0 runs every job on the caller.
+#ifndef POOL_WORKERS
+#define POOL_WORKERS (-1)
+#endif /* POOL_WORKERS */
+
+// Item of a parallel for, run once for each index from 0 up to the count
+typedef void (*worker_pool_func_t)(void * p_ctx, uint32_t item);
+
+/*!
+* @brief Starts the workers, safe to call again once they are running
+* @return SUCCESS/FAILURE
+*/
+uint32_t worker_pool_init();
+
+/*!
+* @brief Runs func for every item across the workers and the caller and
+*        waits until all are done.  Items are taken one at a time, so they
+*        can take different times.  Jobs from different threads run one
+*        after the other.
+* @param[in] items number of items
+* @param[in] func item function, must be safe to run on many threads at once
+* @param[in] p_ctx context passed to func
+*/
+void worker_pool_for(uint32_t items, worker_pool_func_t func, void * p_ctx);
+
+/*!
+* @brief Gets the number of workers running
+* @return workers, not counting the caller
+*/
+uint32_t worker_pool_workers();
+
+/*!
+* @brief Stops the workers and waits for them to exit
+*/
+void worker_pool_stop();
+
+#endif /* __WORKER_POOL_H__ */
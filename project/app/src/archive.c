@@ -0,0 +1,329 @@
+/** @file archive.c
+*
+* @brief Archive service.  Requests are answered one at a time by a non
+*        real-time thread at the lowest best effort I/O priority, so reading
+*        old frames waits behind the storage services.  Each request maps
+*        the camera's frame index, binary searches it for the range, and
+*        sends every file with sendfile so frames never pass through user
+*        space.
+*
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "capture.h"
+#include "frame_index.h"
+#include "log.h"
+#include "project_defs.h"
+#include "server.h"
+#include "service.h"
+
+// Frames are read from the JPEG or PPM directories
+#ifdef JPEG_COMPRESSION
+#include "jpeg.h"
+#else
+#define DIR_NAME "capture_ppm"
+#endif /* JPEG_COMPRESSION */
+
+// Time a client gets to send its request, and the longest a frame may stall
+#define ARCHIVE_IO_TIMEOUT_MS (1000)
+
+// Lowest best effort I/O priority, from linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT (13)
+#define IOPRIO_CLASS_BE (2)
+#define IOPRIO_WHO_PROCESS (1)
+#define ARCHIVE_IOPRIO ((IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7)
+
+// Frame header, name length, name, and buffer length sent ahead of a file
+#define ARCHIVE_PREFIX_MAX (sizeof(frame_hdr_t) + sizeof(uint32_t) * 2 + FRAME_INDEX_NAME_MAX)
+
+// Time conversion
+#define NSEC_PER_SEC (1000000000ll)
+#define NSEC_PER_MSEC (1000000.0)
+#define BYTES_PER_KB (1024)
+
+// Flag for stopping application
+extern uint32_t abort_test;
+
+static struct archive {
+  int32_t sockfd;
+  pthread_t thread;
+} archive;
+
+/*!
+* @brief Reads a request and puts it in host byte order
+* @param fd connected socket
+* @param p_req request read
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t archive_recv(int32_t fd, archive_req_t * p_req)
+{
+  struct pollfd readable = {fd, POLLIN, 0};
+  uint32_t * p_field = (uint32_t *)p_req;
+
+  if (poll(&readable, 1, ARCHIVE_IO_TIMEOUT_MS) != 1 ||
+      recv(fd, p_req, sizeof(*p_req), MSG_WAITALL) != sizeof(*p_req))
+  {
+    LOG_ERROR("No request from the client");
+    return FAILURE;
+  }
+  for (uint32_t field = 0; field < sizeof(*p_req) / sizeof(uint32_t); field++)
+  {
+    p_field[field] = ntohl(p_field[field]);
+  }
+  if (p_req->cam >= CAMERAS || p_req->mode >= ARCHIVE_MODES)
+  {
+    LOG_ERROR("Bad request for camera %u mode %u", p_req->cam, p_req->mode);
+    return FAILURE;
+  }
+  return SUCCESS;
+} // archive_recv()
+
+/*!
+* @brief Finds the records a request covers
+* @param p_map mapped index of the camera
+* @param p_req request
+* @param p_first first record of the range
+* @param p_last one past the last record of the range
+*/
+static
+void archive_range(const frame_index_map_t * p_map, const archive_req_t * p_req, uint32_t * p_first, uint32_t * p_last)
+{
+  if (p_req->mode == ARCHIVE_BY_TIME)
+  {
+    *p_first = frame_index_find(p_map, p_req->begin_sec * NSEC_PER_SEC + p_req->begin_nsec);
+    *p_last = frame_index_find(p_map, p_req->end_sec * NSEC_PER_SEC + p_req->end_nsec);
+  }
+  else
+  {
+    *p_first = frame_index_find_seq(p_map, p_req->first);
+    *p_last = (p_req->last == UINT32_MAX) ? p_map->count : frame_index_find_seq(p_map, p_req->last + 1);
+  }
+  *p_last = (*p_last > *p_first) ? *p_last : *p_first;
+} // archive_range()
+
+/*!
+* @brief Sends one stored frame in the live stream format, the file goes
+*        from the page cache to the socket with sendfile
+* @param fd connected socket
+* @param cam camera the frame is from
+* @param p_rec index record of the frame
+* @param seq_step sequence numbers between the frames sent
+* @param p_bytes bytes of the file sent, 0 when it was already deleted
+* @return SUCCESS/FAILURE, FAILURE when the stream can't go on
+*/
+static
+uint32_t archive_send(int32_t fd, uint32_t cam, const frame_index_rec_t * p_rec, uint32_t seq_step, uint64_t * p_bytes)
+{
+  uint8_t prefix[ARCHIVE_PREFIX_MAX];
+  frame_hdr_t hdr;
+  struct timespec now;
+  struct stat info;
+  off_t offset = 0;
+  ssize_t sent = 0;
+  uint32_t name_len = strnlen(p_rec->file_name, FRAME_INDEX_NAME_MAX);
+  uint32_t len = 0;
+  uint32_t value = 0;
+  int32_t file = -1;
+
+  // Retention may have deleted the file, that isn't an error
+  *p_bytes = 0;
+  file = open(p_rec->file_name, O_RDONLY);
+  if (file == -1 || fstat(file, &info) != 0)
+  {
+    if (file != -1)
+    {
+      close(file);
+    }
+    return SUCCESS;
+  }
+
+  // Same header as a live frame, stamped with the stored times
+  clock_gettime(CLOCK_REALTIME, &now);
+  hdr.seq = htonl(p_rec->seq);
+  hdr.cam = htonl(cam);
+  hdr.cap_sec = htonl(p_rec->cap.sec);
+  hdr.cap_nsec = htonl(p_rec->cap.nsec);
+  hdr.enc_sec = htonl(p_rec->enc.sec);
+  hdr.enc_nsec = htonl(p_rec->enc.nsec);
+  hdr.send_sec = htonl(now.tv_sec);
+  hdr.send_nsec = htonl(now.tv_nsec);
+  hdr.seq_step = htonl(seq_step);
+  memcpy(prefix, &hdr, sizeof(hdr));
+  len = sizeof(hdr);
+  value = htonl(name_len);
+  memcpy(prefix + len, &value, sizeof(value));
+  len += sizeof(value);
+  memcpy(prefix + len, p_rec->file_name, name_len);
+  len += name_len;
+  value = htonl(info.st_size);
+  memcpy(prefix + len, &value, sizeof(value));
+  len += sizeof(value);
+
+  // The prefix is held back to go out with the start of the file
+  if (send(fd, prefix, len, MSG_NOSIGNAL | MSG_MORE) != (ssize_t)len)
+  {
+    close(file);
+    return FAILURE;
+  }
+  while (offset < info.st_size)
+  {
+    sent = sendfile(fd, file, &offset, info.st_size - offset);
+    if (sent <= 0)
+    {
+      LOG_ERROR("sendfile of %s failed with error: %s", p_rec->file_name, strerror(errno));
+      close(file);
+      return FAILURE;
+    }
+  }
+  close(file);
+  *p_bytes = info.st_size;
+  return SUCCESS;
+} // archive_send()
+
+/*!
+* @brief Answers one request and closes the connection
+* @param fd connected socket
+*/
+static
+void archive_answer(int32_t fd)
+{
+  FUNC_ENTRY;
+  frame_index_map_t map;
+  archive_req_t req;
+  struct timespec start;
+  struct timespec end;
+  char dir[DIR_NAME_MAX];
+  char file_name[FILE_NAME_MAX];
+  uint64_t total = 0;
+  uint64_t bytes = 0;
+  uint32_t first = 0;
+  uint32_t last = 0;
+  uint32_t sent = 0;
+  uint32_t gone = 0;
+  uint32_t seq_step = 0;
+
+  if (archive_recv(fd, &req) != SUCCESS)
+  {
+    return;
+  }
+  capture_name(req.cam, DIR_NAME, dir, sizeof(dir));
+  snprintf(file_name, FILE_NAME_MAX, "%s/%s", dir, FRAME_INDEX_FILE);
+  if (frame_index_map(file_name, &map) != SUCCESS)
+  {
+    return;
+  }
+
+  // Records appended after the index was mapped wait for the next request
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  archive_range(&map, &req, &first, &last);
+  req.step = req.step ? req.step : 1;
+  seq_step = (map.p_hdr->seq_step ? map.p_hdr->seq_step : 1) * req.step;
+  for (uint64_t rec = first; rec < last && !abort_test; rec += req.step)
+  {
+    if (archive_send(fd, req.cam, &map.p_recs[rec], seq_step, &bytes) != SUCCESS)
+    {
+      LOG_ERROR("Client went away after %u frames", sent);
+      break;
+    }
+    sent += (bytes > 0);
+    gone += (bytes == 0);
+    total += bytes;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  frame_index_unmap(&map);
+
+  LOG_MED("Sent %u frames of %s, %lluKB, %u already deleted, in %.1fms",
+          sent,
+          dir,
+          (unsigned long long)total / BYTES_PER_KB,
+          gone,
+          ((end.tv_sec - start.tv_sec) * NSEC_PER_SEC + (end.tv_nsec - start.tv_nsec)) / NSEC_PER_MSEC);
+} // archive_answer()
+
+/*!
+* @brief Answers requests until the abort flag is set
+* @param param unused
+* @return NULL
+*/
+static
+void * archive_service(void * param)
+{
+  FUNC_ENTRY;
+  struct pollfd incoming = {archive.sockfd, POLLIN, 0};
+  struct timeval timeout;
+  int32_t fd = -1;
+
+  timeout.tv_sec = ARCHIVE_IO_TIMEOUT_MS / 1000;
+  timeout.tv_usec = (ARCHIVE_IO_TIMEOUT_MS % 1000) * 1000;
+
+  // Reads of old frames queue behind the storage services' writes
+  if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ARCHIVE_IOPRIO) != 0)
+  {
+    LOG_MED("Can't lower the archive I/O priority: %s", strerror(errno));
+  }
+
+  // Wake up every period to check the abort flag
+  while (!abort_test)
+  {
+    if (poll(&incoming, 1, ARCHIVE_PERIOD_US / 1000) != 1)
+    {
+      continue;
+    }
+    fd = accept(archive.sockfd, NULL, NULL);
+    if (fd == -1)
+    {
+      continue;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    archive_answer(fd);
+    close(fd);
+  }
+  close(archive.sockfd);
+  LOG_HIGH("archive_service thread exiting");
+  return NULL;
+} // archive_service()
+
+uint32_t archive_init()
+{
+  FUNC_ENTRY;
+  struct sockaddr_in addr;
+  int32_t reuse = 1;
+  int32_t res = 0;
+
+  EQ_RET_E(archive.sockfd, socket(AF_INET, SOCK_STREAM, 0), -1, FAILURE);
+  EQ_RET_E(res,
+           setsockopt(archive.sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)),
+           -1,
+           FAILURE);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons(ARCHIVE_PORT);
+  EQ_RET_E(res, bind(archive.sockfd, (struct sockaddr *)&addr, sizeof(addr)), -1, FAILURE);
+  EQ_RET_E(res, listen(archive.sockfd, SOMAXCONN), -1, FAILURE);
+  LOG_MED("Serving stored frames on port %d", ARCHIVE_PORT);
+
+  // Start the service thread with its configured priority and affinity
+  EQ_RET_E(res,
+           service_launch("archive_service", archive_service, NULL, &archive.thread),
+           FAILURE,
+           FAILURE);
+  return SUCCESS;
+} // archive_init()
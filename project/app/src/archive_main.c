@@ -0,0 +1,257 @@
+/** @file main.c
+*
+* @brief Main file for the archive reader.  Asks a server built with
+*        ARCHIVE=1 for the stored frames of a camera in a capture time or
+*        sequence number range and writes them to a directory.
+*
+*/
+
+#include <arpa/inet.h>
+#include <libgen.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <archive.h>
+#include <project_defs.h>
+#include <server.h>
+#include <utilities.h>
+
+// Bytes copied from the socket to a file at once
+#define COPY_BYTES (64 * 1024)
+
+// Longest name kept from the server
+#define NAME_MAX_LEN (256)
+
+// Time conversion
+#define NSEC_PER_SEC (1000000000.0)
+#define NSEC_PER_MSEC (1000000.0)
+#define BYTES_PER_KB (1024)
+
+/*!
+* @brief Splits seconds given with a fraction
+* @param p_arg seconds since the epoch
+* @param p_sec whole seconds
+* @param p_nsec nanoseconds
+*/
+static
+void parse_time(const char * p_arg, uint32_t * p_sec, uint32_t * p_nsec)
+{
+  double time = atof(p_arg);
+
+  *p_sec = (uint32_t)time;
+  *p_nsec = (uint32_t)((time - *p_sec) * NSEC_PER_SEC);
+} // parse_time()
+
+/*!
+* @brief Reads exactly len bytes
+* @param fd connected socket
+* @param p_buf buffer read into
+* @param len bytes to read
+* @return SUCCESS/FAILURE, FAILURE at the end of the stream
+*/
+static
+uint32_t read_all(int32_t fd, void * p_buf, uint32_t len)
+{
+  return (recv(fd, p_buf, len, MSG_WAITALL) == (ssize_t)len) ? SUCCESS : FAILURE;
+} // read_all()
+
+/*!
+* @brief Connects to the archive service
+* @param p_server host[:port]
+* @return connected socket or -1
+*/
+static
+int32_t archive_connect(char * p_server)
+{
+  struct addrinfo hints;
+  struct addrinfo * p_info = NULL;
+  struct sockaddr_in addr;
+  char * p_port = strchr(p_server, ':');
+  int32_t fd = -1;
+
+  if (p_port != NULL)
+  {
+    *p_port++ = '\0';
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(p_server, NULL, &hints, &p_info) != 0)
+  {
+    fprintf(stderr, "Can't find server %s\n", p_server);
+    return -1;
+  }
+  memcpy(&addr, p_info->ai_addr, sizeof(addr));
+  addr.sin_port = htons(p_port ? atoi(p_port) : ARCHIVE_PORT);
+  freeaddrinfo(p_info);
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+  {
+    perror("connect");
+    if (fd != -1)
+    {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+} // archive_connect()
+
+/*!
+* @brief Copies one frame's buffer from the socket to a file
+* @param fd connected socket
+* @param p_path file written
+* @param len bytes of the buffer
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t copy_frame(int32_t fd, const char * p_path, uint32_t len)
+{
+  static uint8_t chunk[COPY_BYTES];
+  FILE * p_file = fopen(p_path, "wb");
+  uint32_t part = 0;
+
+  if (p_file == NULL)
+  {
+    perror(p_path);
+    return FAILURE;
+  }
+  while (len > 0)
+  {
+    part = (len < COPY_BYTES) ? len : COPY_BYTES;
+    if (read_all(fd, chunk, part) != SUCCESS || fwrite(chunk, 1, part, p_file) != part)
+    {
+      fclose(p_file);
+      return FAILURE;
+    }
+    len -= part;
+  }
+  fclose(p_file);
+  return SUCCESS;
+} // copy_frame()
+
+int main(int argc, char ** argv)
+{
+  archive_req_t req;
+  frame_hdr_t hdr;
+  struct timespec start;
+  struct timespec end;
+  char name[NAME_MAX_LEN];
+  char path[NAME_MAX_LEN * 2];
+  char * p_dir = "archive";
+  uint64_t total = 0;
+  uint32_t frames = 0;
+  uint32_t name_len = 0;
+  uint32_t buf_len = 0;
+  uint32_t * p_field = (uint32_t *)&req;
+  int32_t fd = -1;
+  int32_t opt = 0;
+
+  // Every stored frame of camera 0 unless asked for a range
+  memset(&req, 0, sizeof(req));
+  req.mode = ARCHIVE_BY_SEQ;
+  req.last = UINT32_MAX;
+  req.end_sec = UINT32_MAX;
+  while ((opt = getopt(argc, argv, "c:b:e:f:l:n:o:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'c':
+        req.cam = atoi(optarg);
+        break;
+      case 'b':
+        req.mode = ARCHIVE_BY_TIME;
+        parse_time(optarg, &req.begin_sec, &req.begin_nsec);
+        break;
+      case 'e':
+        req.mode = ARCHIVE_BY_TIME;
+        parse_time(optarg, &req.end_sec, &req.end_nsec);
+        break;
+      case 'f':
+        req.first = atoi(optarg);
+        break;
+      case 'l':
+        req.last = atoi(optarg);
+        break;
+      case 'n':
+        req.step = atoi(optarg);
+        break;
+      case 'o':
+        p_dir = optarg;
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    fprintf(stderr,
+            "Usage: %s [-c camera] [-b begin] [-e end] [-f first] [-l last] [-n step] [-o dir] host[:port]\n"
+            "  -b and -e pick frames by capture time in epoch seconds, -f and -l by\n"
+            "  sequence number, every frame by default.  Port %d by default.\n",
+            argv[0],
+            ARCHIVE_PORT);
+    return FAILURE;
+  }
+  if (create_dir(p_dir) != SUCCESS)
+  {
+    return FAILURE;
+  }
+  fd = archive_connect(argv[optind]);
+  if (fd == -1)
+  {
+    return FAILURE;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t field = 0; field < sizeof(req) / sizeof(uint32_t); field++)
+  {
+    p_field[field] = htonl(p_field[field]);
+  }
+  if (send(fd, &req, sizeof(req), 0) != sizeof(req))
+  {
+    perror("send");
+    close(fd);
+    return FAILURE;
+  }
+
+  // Frames come in the live stream format until the server closes
+  while (read_all(fd, &hdr, sizeof(hdr)) == SUCCESS &&
+         read_all(fd, &name_len, sizeof(name_len)) == SUCCESS)
+  {
+    name_len = ntohl(name_len);
+    if (name_len >= NAME_MAX_LEN ||
+        read_all(fd, name, name_len) != SUCCESS ||
+        read_all(fd, &buf_len, sizeof(buf_len)) != SUCCESS)
+    {
+      fprintf(stderr, "Bad frame after %u frames\n", frames);
+      break;
+    }
+    name[name_len] = '\0';
+    buf_len = ntohl(buf_len);
+    snprintf(path, sizeof(path), "%s/%s", p_dir, basename(name));
+    if (copy_frame(fd, path, buf_len) != SUCCESS)
+    {
+      fprintf(stderr, "Stream ended in frame %u\n", ntohl(hdr.seq));
+      break;
+    }
+    total += buf_len;
+    frames++;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  close(fd);
+
+  printf("frames: %u, %lluKB in %.1fms to %s\n",
+         frames,
+         (unsigned long long)total / BYTES_PER_KB,
+         ((end.tv_sec - start.tv_sec) * NSEC_PER_SEC + (end.tv_nsec - start.tv_nsec)) / NSEC_PER_MSEC,
+         p_dir);
+  return SUCCESS;
+}
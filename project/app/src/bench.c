@@ -0,0 +1,285 @@
+/** @file bench.c
+*
+* @brief Microbenchmark harness.  Each case is warmed up, calibrated so one
+*        repetition takes about BENCH_REP_NS, then timed over BENCH_REPS
+*        repetitions.  Results are appended to a CSV file tagged with a label,
+*        the machine, and the build so runs can be compared across commits
+*        and between x86 and ARM.
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <mqueue.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <time.h>
+
+#include "bench.h"
+#include "capture.h"
+#include "log.h"
+#include "project_defs.h"
+#include "server.h"
+#include "utilities.h"
+
+#define NSEC_PER_SEC (1000000000ull)
+#define BENCH_NAME_MAX (32)
+#define BENCH_QUEUE_NAME "/bench_queue"
+#define BENCH_QUEUE_MSGS (4)
+#define BENCH_TIMESTAMP_MAX (40)
+
+// Build description stored with the results
+#ifdef __OPTIMIZE__
+#define BENCH_OPT "opt"
+#else
+#define BENCH_OPT "debug"
+#endif /* __OPTIMIZE__ */
+#define STR(x) #x
+#define XSTR(x) STR(x)
+#define BENCH_BUILD BENCH_OPT "-log" XSTR(LOG_LEVEL)
+
+// Registered case
+typedef struct {
+  char name[BENCH_NAME_MAX];
+  bench_func_t func;
+  void * ctx;
+  uint32_t bytes;
+} bench_case_t;
+
+// Context for the queue handoff cases
+typedef struct {
+  mqd_t queue;
+  void * msg;
+  uint32_t size;
+} bench_queue_t;
+
+// Context for the timestamp case
+typedef struct {
+  struct timespec time;
+  char timestamp[BENCH_TIMESTAMP_MAX];
+} bench_timestamp_t;
+
+static bench_case_t cases[BENCH_MAX_CASES];
+static uint32_t num_cases = 0;
+
+static bench_queue_t cap_queue;
+static bench_queue_t server_queue;
+static cap_info_t cap_msg;
+static server_info_t server_msg;
+static bench_timestamp_t timestamp;
+
+/*!
+* @brief Gets the monotonic time in nanoseconds
+* @return time in nanoseconds
+*/
+static inline
+uint64_t bench_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+} // bench_now()
+
+/*!
+* @brief Runs an operation a number of times
+* @param bench case to run
+* @param iterations number of times to run it
+* @return nanoseconds taken
+*/
+static inline
+uint64_t bench_loop(bench_case_t * bench, uint64_t iterations)
+{
+  uint64_t start = bench_now();
+  for (uint64_t i = 0; i < iterations; i++)
+  {
+    bench->func(bench->ctx);
+  }
+  return bench_now() - start;
+} // bench_loop()
+
+/*!
+* @brief Timestamp case
+* @param ctx bench_timestamp_t
+*/
+static
+void bench_get_timestamp(void * ctx)
+{
+  bench_timestamp_t * p_ts = (bench_timestamp_t *)ctx;
+  get_timestamp(&p_ts->time, p_ts->timestamp, BENCH_TIMESTAMP_MAX);
+} // bench_get_timestamp()
+
+/*!
+* @brief Log case, goes through log_level() directly so it is measured at any
+*        LOG_LEVEL
+* @param ctx unused
+*/
+static
+void bench_log_level(void * ctx)
+{
+  LOG(LOG_LEVEL_LOW, "Using %s file name", "capture_jpeg/capture_0000.jpeg");
+} // bench_log_level()
+
+/*!
+* @brief Queue handoff case, sends and receives one message
+* @param ctx bench_queue_t
+*/
+static
+void bench_queue_handoff(void * ctx)
+{
+  bench_queue_t * p_queue = (bench_queue_t *)ctx;
+  mq_send(p_queue->queue, p_queue->msg, p_queue->size, 0);
+  mq_receive(p_queue->queue, p_queue->msg, p_queue->size, NULL);
+} // bench_queue_handoff()
+
+/*!
+* @brief Opens a queue for a handoff case
+* @param p_queue queue context to fill out
+* @param msg message to pass
+* @param size size of the message
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t bench_queue_open(bench_queue_t * p_queue, void * msg, uint32_t size)
+{
+  struct mq_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.mq_maxmsg = BENCH_QUEUE_MSGS;
+  attr.mq_msgsize = size;
+  mq_unlink(BENCH_QUEUE_NAME);
+  EQ_RET_E(p_queue->queue,
+           mq_open(BENCH_QUEUE_NAME, O_RDWR | O_CREAT, S_IRWXU, &attr),
+           -1,
+           FAILURE);
+  mq_unlink(BENCH_QUEUE_NAME);
+  p_queue->msg = msg;
+  p_queue->size = size;
+  return SUCCESS;
+} // bench_queue_open()
+
+uint32_t bench_add(const char * p_name, bench_func_t func, void * ctx, uint32_t bytes)
+{
+  CHECK_NULL(p_name);
+  if (num_cases >= BENCH_MAX_CASES)
+  {
+    LOG_ERROR("No room for bench case %s", p_name);
+    return FAILURE;
+  }
+  strncpy(cases[num_cases].name, p_name, BENCH_NAME_MAX - 1);
+  cases[num_cases].func = func;
+  cases[num_cases].ctx = ctx;
+  cases[num_cases].bytes = bytes;
+  num_cases++;
+  return SUCCESS;
+} // bench_add()
+
+uint32_t bench_add_common()
+{
+  FUNC_ENTRY;
+  uint32_t res = 0;
+
+  clock_gettime(CLOCK_REALTIME, &timestamp.time);
+  EQ_RET_E(res, bench_add("get_timestamp", bench_get_timestamp, &timestamp, 0), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("log_level", bench_log_level, NULL, 0), FAILURE, FAILURE);
+
+  // One queue per message type handed off between services
+  EQ_RET_E(res, bench_queue_open(&cap_queue, &cap_msg, sizeof(cap_msg)), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_queue_open(&server_queue, &server_msg, sizeof(server_msg)), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("mq_handoff_cap_info", bench_queue_handoff, &cap_queue, sizeof(cap_msg)), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("mq_handoff_server_info", bench_queue_handoff, &server_queue, sizeof(server_msg)), FAILURE, FAILURE);
+  return SUCCESS;
+} // bench_add_common()
+
+uint32_t bench_run(const char * p_file_name, const char * p_label)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_file_name);
+  CHECK_NULL(p_label);
+  struct utsname info;
+  struct stat file_stat;
+  double rep_ns[BENCH_REPS];
+  int32_t res = 0;
+  FILE * fp;
+
+  EQ_RET_E(res, uname(&info), -1, FAILURE);
+
+  // Append to the results, writing the header for a new file
+  res = stat(p_file_name, &file_stat);
+  EQ_RET_E(fp, fopen(p_file_name, "a"), NULL, FAILURE);
+  if (res != 0 || file_stat.st_size == 0)
+  {
+    fprintf(fp,
+            "label,arch,build,name,iterations,reps,ns_per_op,ns_per_op_min,"
+            "ns_per_op_stddev,mb_per_s\n");
+  }
+
+  fprintf(stderr, "%-24s %12s %12s %10s %10s\n",
+          "name", "ns/op", "min ns/op", "stddev %", "MB/s");
+
+  for (uint32_t i = 0; i < num_cases; i++)
+  {
+    bench_case_t * bench = &cases[i];
+    uint64_t iterations = 0;
+    uint64_t warm_ns = 0;
+    double mean = 0;
+    double min = 0;
+    double var = 0;
+    double mbs = 0;
+
+    // Warm up and count how many operations fit in the warm up time
+    while (warm_ns < BENCH_WARMUP_NS)
+    {
+      warm_ns += bench_loop(bench, 1);
+      iterations++;
+    }
+    iterations = iterations * BENCH_REP_NS / warm_ns;
+    if (iterations == 0)
+    {
+      iterations = 1;
+    }
+
+    // Timed repetitions
+    for (uint32_t rep = 0; rep < BENCH_REPS; rep++)
+    {
+      rep_ns[rep] = (double)bench_loop(bench, iterations) / iterations;
+      mean += rep_ns[rep];
+      if (rep == 0 || rep_ns[rep] < min)
+      {
+        min = rep_ns[rep];
+      }
+    }
+    mean /= BENCH_REPS;
+    for (uint32_t rep = 0; rep < BENCH_REPS; rep++)
+    {
+      var += (rep_ns[rep] - mean) * (rep_ns[rep] - mean);
+    }
+    var /= (BENCH_REPS - 1);
+    mbs = bench->bytes ? (double)bench->bytes * 1000.0 / mean : 0;
+
+    fprintf(stderr, "%-24s %12.1f %12.1f %10.2f %10.1f\n",
+            bench->name,
+            mean,
+            min,
+            100.0 * sqrt(var) / mean,
+            mbs);
+    fprintf(fp, "%s,%s,%s,%s,%llu,%d,%.1f,%.1f,%.1f,%.1f\n",
+            p_label,
+            info.machine,
+            BENCH_BUILD,
+            bench->name,
+            (unsigned long long)iterations,
+            BENCH_REPS,
+            mean,
+            min,
+            sqrt(var),
+            mbs);
+  }
+
+  EQ_RET_E(res, fclose(fp), EOF, FAILURE);
+  fprintf(stderr, "Results appended to %s\n", p_file_name);
+  return SUCCESS;
+} // bench_run()
@@ -0,0 +1,163 @@
+/** @file bench_jpeg.c
+*
+* @brief Benchmark cases for the JPEG write path
+*
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "frame_mem.h"
+#include "jpeg.h"
+#include "jpeg_raw.h"
+#include "log.h"
+#include "project_defs.h"
+#include "qoi.h"
+#include "utilities.h"
+
+#define BENCH_JPEG_FILE BENCH_DIR_NAME "/bench.jpeg"
+
+// Size of the synthetic encoded image, typical for a 640x480 frame
+#define BENCH_JPEG_BYTES (50 * 1024)
+
+// Quality jpeg_service encodes at
+#define BENCH_JPEG_QUALITY (50)
+
+// Context for the JPEG cases
+typedef struct {
+  jpeg_cap_t cap;
+  frame_t yuyv;
+  frame_t yuv420;
+  frame_t bgr;
+  uint8_t * p_qoi;
+  jpeg_raw_t raw;
+  qoi_t qoi;
+} bench_jpeg_t;
+
+static bench_jpeg_t jpeg;
+
+/*!
+* @brief Builds the JPEG file buffer and writes it
+* @param ctx bench_jpeg_t
+*/
+static
+void bench_write_jpeg(void * ctx)
+{
+  bench_jpeg_t * p_jpeg = (bench_jpeg_t *)ctx;
+  write_jpeg(&p_jpeg->cap);
+} // bench_write_jpeg()
+
+/*!
+* @brief Raw encodes a synthetic YUYV frame
+* @param ctx frame_t
+*/
+static
+void bench_jpeg_raw_encode(void * ctx)
+{
+  uint8_t * p_data;
+  uint32_t len;
+  jpeg_raw_encode(&jpeg.raw, (frame_t *)ctx, &p_data, &len);
+} // bench_jpeg_raw_encode()
+
+/*!
+* @brief QOI encodes a synthetic frame
+* @param ctx frame_t
+*/
+static
+void bench_qoi_encode(void * ctx)
+{
+  uint32_t len;
+  qoi_encode_frame(&jpeg.qoi, (frame_t *)ctx, jpeg.p_qoi, &len);
+} // bench_qoi_encode()
+
+/*!
+* @brief Fills out a synthetic YUV frame over a gradient
+* @param p_frame frame to fill out
+* @param format YUYV or YUV420
+* @param p_data gradient of at least two bytes a pixel
+*/
+static
+void bench_yuv_frame(frame_t * p_frame, pix_fmt_t format, uint8_t * p_data)
+{
+  memset(p_frame, 0, sizeof(*p_frame));
+  p_frame->format = format;
+  p_frame->width = HRES;
+  p_frame->height = VRES;
+  p_frame->planes[0] = p_data;
+  if (format == PIX_FMT_YUYV)
+  {
+    p_frame->strides[0] = HRES * 2;
+    return;
+  }
+  p_frame->strides[0] = HRES;
+  p_frame->planes[1] = p_data + HRES * VRES;
+  p_frame->strides[1] = HRES / 2;
+  p_frame->planes[2] = p_frame->planes[1] + (HRES / 2) * (VRES / 2);
+  p_frame->strides[2] = HRES / 2;
+} // bench_yuv_frame()
+
+uint32_t bench_add_jpeg()
+{
+  FUNC_ENTRY;
+  uint8_t * p_encoded;
+  uint8_t * p_yuv;
+  uint32_t res = 0;
+
+  // Synthetic encoded image standing in for the encoder output
+  EQ_RET_E(p_encoded, frame_mem_alloc(BENCH_JPEG_BYTES), NULL, FAILURE);
+  for (uint32_t i = 0; i < BENCH_JPEG_BYTES; i++)
+  {
+    p_encoded[i] = (uint8_t)(i * 13);
+  }
+  memset(&jpeg, 0, sizeof(jpeg));
+  jpeg.cap.enc_buf = p_encoded;
+  jpeg.cap.enc_len = BENCH_JPEG_BYTES;
+
+  // Fill out the capture info the same way jpeg_service does
+  EQ_RET_E(jpeg.cap.cur_buf, frame_mem_alloc(IMAGE_NUM_BYTES), NULL, FAILURE);
+  EQ_RET_E(res, get_uname(jpeg.cap.uname_str, UNAME_MAX), FAILURE, FAILURE);
+  jpeg.cap.uname_len = strlen(jpeg.cap.uname_str);
+  jpeg.cap.comment_len = TIMESTAMP_MAX + jpeg.cap.uname_len + 2;
+  jpeg.cap.comment_len = (jpeg.cap.comment_len << 8 | jpeg.cap.comment_len >> 8);
+  clock_gettime(CLOCK_REALTIME, &jpeg.cap.cap.time);
+  snprintf(jpeg.cap.file_name, FILE_NAME_MAX, "%s", BENCH_JPEG_FILE);
+
+  // Smooth gradient YUV frames for the raw encoder
+  EQ_RET_E(res, jpeg_raw_init(&jpeg.raw, HRES, VRES, BENCH_JPEG_QUALITY), FAILURE, FAILURE);
+  EQ_RET_E(p_yuv, frame_mem_alloc(HRES * VRES * 2), NULL, FAILURE);
+  for (uint32_t i = 0; i < HRES * VRES * 2; i++)
+  {
+    p_yuv[i] = (uint8_t)(16 + (i % (HRES * 2)) * 219 / (HRES * 2));
+  }
+  bench_yuv_frame(&jpeg.yuyv, PIX_FMT_YUYV, p_yuv);
+  bench_yuv_frame(&jpeg.yuv420, PIX_FMT_YUV420, p_yuv);
+
+  // BGR frame of the gradient with sensor like noise in the low bits, so
+  // QOI can't code it all as runs
+  EQ_RET_E(res, qoi_init(&jpeg.qoi, HRES, VRES), FAILURE, FAILURE);
+  EQ_RET_E(jpeg.p_qoi, frame_mem_alloc(QOI_MAX_BYTES(HRES, VRES)), NULL, FAILURE);
+  EQ_RET_E(jpeg.bgr.planes[0], frame_mem_alloc(IMAGE_NUM_BYTES), NULL, FAILURE);
+  jpeg.bgr.format = PIX_FMT_BGR24;
+  jpeg.bgr.width = HRES;
+  jpeg.bgr.height = VRES;
+  jpeg.bgr.strides[0] = HRES * BYTES_PER_PIXEL;
+  EQ_RET_E(res, frame_to_bgr(&jpeg.yuyv, jpeg.bgr.planes[0], jpeg.bgr.strides[0]), FAILURE, FAILURE);
+  for (uint32_t i = 0; i < IMAGE_NUM_BYTES; i++)
+  {
+    jpeg.bgr.planes[0][i] ^= (i * 2654435761u) >> 30;
+  }
+
+  EQ_RET_E(res, bench_add("write_jpeg", bench_write_jpeg, &jpeg, BENCH_JPEG_BYTES), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("jpeg_raw_encode_yuyv", bench_jpeg_raw_encode, &jpeg.yuyv, HRES * VRES * 2), FAILURE, FAILURE);
+  EQ_RET_E(res,
+           bench_add("jpeg_raw_encode_yuv420", bench_jpeg_raw_encode, &jpeg.yuv420, HRES * VRES * 3 / 2),
+           FAILURE,
+           FAILURE);
+  EQ_RET_E(res, bench_add("qoi_encode_bgr", bench_qoi_encode, &jpeg.bgr, IMAGE_NUM_BYTES), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("qoi_encode_yuyv", bench_qoi_encode, &jpeg.yuyv, HRES * VRES * 2), FAILURE, FAILURE);
+  return SUCCESS;
+} // bench_add_jpeg()
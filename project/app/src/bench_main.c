@@ -0,0 +1,39 @@
+/** @file main.c
+*
+* @brief Main file for the microbenchmarks
+*
+*/
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <bench.h>
+#include <frame_mem.h>
+#include <project_defs.h>
+#include <utilities.h>
+
+int main(int argc, char ** argv)
+{
+  const char * p_file_name = (argc > 1) ? argv[1] : BENCH_RESULTS_FILE;
+  const char * p_label = (argc > 2) ? argv[2] : "local";
+  int32_t null_fd = open("/dev/null", O_WRONLY);
+
+  // Logs go to stdout, send them away so the log case doesn't flood the
+  // terminal.  Results are printed on stderr.
+  if (null_fd != -1)
+  {
+    dup2(null_fd, STDOUT_FILENO);
+  }
+
+  // Same memory setup as the services plus the 1080p frames, then add every
+  // case and run
+  if (frame_mem_init(FRAME_MEM_SIZE + BENCH_HD_BYTES) != SUCCESS ||
+      create_dir(BENCH_DIR_NAME) != SUCCESS ||
+      bench_add_common() != SUCCESS ||
+      bench_add_ppm() != SUCCESS ||
+      bench_add_jpeg() != SUCCESS)
+  {
+    return FAILURE;
+  }
+  return bench_run(p_file_name, p_label);
+}
@@ -0,0 +1,247 @@
+/** @file bench_ppm.c
+*
+* @brief Benchmark cases for the PPM conversion and write path
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "frame_mem.h"
+#include "log.h"
+#include "pixel_pass.h"
+#include "ppm.h"
+#include "project_defs.h"
+#include "utilities.h"
+#include "worker_pool.h"
+
+#define BENCH_PPM_FILE BENCH_DIR_NAME "/bench.ppm"
+#define NUM_INTENSITIES (256)
+
+// Context shared by the PPM cases
+typedef struct {
+  ppm_cap_t cap;
+  colors_t * frame;
+  frame_t yuyv;
+  int32_t fd;
+
+  // Gamma, exposure statistics, and a thumbnail, run as separate passes
+  // over the frame or as one fused pass
+  uint8_t lut[NUM_INTENSITIES];
+  pixel_stats_t stats;
+  pixel_thumb_t thumb;
+  pixel_pass_t fused;
+
+  // 1080p frame converted with the gamma function on the caller alone or
+  // spread over the worker pool
+  frame_t hd;
+  uint8_t * p_hd_rgb;
+  pixel_pass_t hd_serial;
+  pixel_pass_t hd_pool;
+} bench_ppm_t;
+
+static bench_ppm_t ppm;
+
+/*!
+* @brief Gamma transfer function over every intensity
+* @param ctx unused
+*/
+static
+void bench_gamma_tf(void * ctx)
+{
+  volatile uint8_t out;
+  for (uint32_t color = 0; color < NUM_INTENSITIES; color++)
+  {
+    out = gamma_tf(color);
+  }
+  (void)out;
+} // bench_gamma_tf()
+
+/*!
+* @brief Gamma lookup table over every intensity
+* @param ctx unused
+*/
+static
+void bench_gamma_tf_lut(void * ctx)
+{
+  volatile uint8_t out;
+  for (uint32_t color = 0; color < NUM_INTENSITIES; color++)
+  {
+    out = gamma_tf_lut(color);
+  }
+  (void)out;
+} // bench_gamma_tf_lut()
+
+/*!
+* @brief Converts one synthetic frame
+* @param ctx bench_ppm_t
+*/
+static
+void bench_create_image_buf(void * ctx)
+{
+  bench_ppm_t * p_ppm = (bench_ppm_t *)ctx;
+  create_image_buf(&p_ppm->cap, p_ppm->frame);
+} // bench_create_image_buf()
+
+/*!
+* @brief Converts one synthetic YUYV frame
+* @param ctx bench_ppm_t
+*/
+static
+void bench_create_image_buf_yuv(void * ctx)
+{
+  bench_ppm_t * p_ppm = (bench_ppm_t *)ctx;
+  create_image_buf_yuv(&p_ppm->cap, &p_ppm->yuyv);
+} // bench_create_image_buf_yuv()
+
+/*!
+* @brief Converts one YUYV frame then runs each op over the whole frame
+* @param ctx bench_ppm_t
+*/
+static
+void bench_pixel_separate(void * ctx)
+{
+  bench_ppm_t * p_ppm = (bench_ppm_t *)ctx;
+  pixel_strip_t frame = {(uint8_t *)p_ppm->cap.image_buf, HRES * BYTES_PER_PIXEL, HRES, 0, VRES, 0};
+
+  memset(&p_ppm->stats, 0, sizeof(p_ppm->stats));
+  frame_to_rgb(&p_ppm->yuyv, frame.p_rows, frame.stride);
+  pixel_tone_map(&frame, p_ppm->lut);
+  pixel_stats(&frame, &p_ppm->stats);
+  pixel_downscale(&frame, &p_ppm->thumb);
+} // bench_pixel_separate()
+
+/*!
+* @brief Converts one YUYV frame running the same ops on each strip
+* @param ctx bench_ppm_t
+*/
+static
+void bench_pixel_fused(void * ctx)
+{
+  bench_ppm_t * p_ppm = (bench_ppm_t *)ctx;
+  memset(&p_ppm->stats, 0, sizeof(p_ppm->stats));
+  pixel_pass_run(&p_ppm->fused, &p_ppm->yuyv, (uint8_t *)p_ppm->cap.image_buf, HRES * BYTES_PER_PIXEL);
+} // bench_pixel_fused()
+
+/*!
+* @brief Converts one 1080p YUYV frame on the caller
+* @param ctx bench_ppm_t
+*/
+static
+void bench_pixel_hd_serial(void * ctx)
+{
+  bench_ppm_t * p_ppm = (bench_ppm_t *)ctx;
+  pixel_pass_run(&p_ppm->hd_serial, &p_ppm->hd, p_ppm->p_hd_rgb, BENCH_HD_HRES * BYTES_PER_PIXEL);
+} // bench_pixel_hd_serial()
+
+/*!
+* @brief Converts one 1080p YUYV frame across the worker pool
+* @param ctx bench_ppm_t
+*/
+static
+void bench_pixel_hd_pool(void * ctx)
+{
+  bench_ppm_t * p_ppm = (bench_ppm_t *)ctx;
+  pixel_pass_run(&p_ppm->hd_pool, &p_ppm->hd, p_ppm->p_hd_rgb, BENCH_HD_HRES * BYTES_PER_PIXEL);
+} // bench_pixel_hd_pool()
+
+/*!
+* @brief Writes one converted frame over the same file
+* @param ctx bench_ppm_t
+*/
+static
+void bench_write_ppm(void * ctx)
+{
+  bench_ppm_t * p_ppm = (bench_ppm_t *)ctx;
+  lseek(p_ppm->fd, 0, SEEK_SET);
+  write_ppm(p_ppm->fd, &p_ppm->cap);
+} // bench_write_ppm()
+
+uint32_t bench_add_ppm()
+{
+  FUNC_ENTRY;
+  uint8_t * p_frame;
+  uint32_t res = 0;
+
+  // Synthetic gradient frame
+  EQ_RET_E(p_frame, frame_mem_alloc(IMAGE_NUM_BYTES), NULL, FAILURE);
+  for (uint32_t i = 0; i < IMAGE_NUM_BYTES; i++)
+  {
+    p_frame[i] = (uint8_t)(i * 7 + (i / (HRES * BYTES_PER_PIXEL)));
+  }
+  ppm.frame = (colors_t *)p_frame;
+
+  // The same gradient read as a YUYV frame
+  ppm.yuyv.format = PIX_FMT_YUYV;
+  ppm.yuyv.width = HRES;
+  ppm.yuyv.height = VRES;
+  ppm.yuyv.planes[0] = p_frame;
+  ppm.yuyv.strides[0] = HRES * 2;
+
+  // Ops of the separate and fused pixel cases
+  for (uint32_t color = 0; color < NUM_INTENSITIES; color++)
+  {
+    ppm.lut[color] = gamma_tf(color);
+  }
+  ppm.thumb.stride = (HRES / 2) * BYTES_PER_PIXEL;
+  EQ_RET_E(ppm.thumb.p_buf, frame_mem_alloc(ppm.thumb.stride * (VRES / 2)), NULL, FAILURE);
+  pixel_pass_init(&ppm.fused, 0, 0);
+  EQ_RET_E(res, pixel_pass_add(&ppm.fused, "gamma", pixel_tone_map, ppm.lut), FAILURE, FAILURE);
+  EQ_RET_E(res, pixel_pass_add(&ppm.fused, "stats", pixel_stats, &ppm.stats), FAILURE, FAILURE);
+  EQ_RET_E(res, pixel_pass_add(&ppm.fused, "thumb", pixel_downscale, &ppm.thumb), FAILURE, FAILURE);
+
+  // A 1080p gradient for the serial and parallel conversions
+  ppm.hd.format = PIX_FMT_YUYV;
+  ppm.hd.width = BENCH_HD_HRES;
+  ppm.hd.height = BENCH_HD_VRES;
+  ppm.hd.strides[0] = BENCH_HD_HRES * 2;
+  EQ_RET_E(ppm.hd.planes[0], frame_mem_alloc(BENCH_HD_HRES * BENCH_HD_VRES * 2), NULL, FAILURE);
+  EQ_RET_E(ppm.p_hd_rgb, frame_mem_alloc(BENCH_HD_HRES * BENCH_HD_VRES * BYTES_PER_PIXEL), NULL, FAILURE);
+  for (uint32_t i = 0; i < BENCH_HD_HRES * BENCH_HD_VRES * 2; i++)
+  {
+    ppm.hd.planes[0][i] = (uint8_t)(i * 7 + (i / (BENCH_HD_HRES * 2)));
+  }
+  EQ_RET_E(res, worker_pool_init(), FAILURE, FAILURE);
+  pixel_pass_init(&ppm.hd_serial, 0, 0);
+  pixel_pass_init(&ppm.hd_pool, 0, 1);
+  EQ_RET_E(res, pixel_pass_add(&ppm.hd_serial, "gamma", pixel_tone_map, ppm.lut), FAILURE, FAILURE);
+  EQ_RET_E(res, pixel_pass_add(&ppm.hd_pool, "gamma", pixel_tone_map, ppm.lut), FAILURE, FAILURE);
+
+  // Fill out the capture info the same way ppm_service does
+  memset(&ppm.cap, 0, sizeof(ppm.cap));
+  EQ_RET_E(res, ppm_buf_init(&ppm.cap.image_buf), FAILURE, FAILURE);
+  ppm.cap.resolution.hres = HRES;
+  ppm.cap.resolution.vres = VRES;
+  clock_gettime(CLOCK_REALTIME, &ppm.cap.cap.time);
+  EQ_RET_E(res, get_uname(ppm.cap.uname_str, UNAME_MAX), FAILURE, FAILURE);
+  ppm.cap.uname_len = strlen(ppm.cap.uname_str);
+  EQ_RET_E(res,
+           get_timestamp(&ppm.cap.cap.time, ppm.cap.timestamp, TIMESTAMP_MAX),
+           FAILURE,
+           FAILURE);
+  EQ_RET_E(ppm.fd, open(BENCH_PPM_FILE, O_CREAT | O_WRONLY, FILE_PERM), -1, FAILURE);
+
+  EQ_RET_E(res, bench_add("gamma_tf_x256", bench_gamma_tf, NULL, NUM_INTENSITIES), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("gamma_tf_lut_x256", bench_gamma_tf_lut, NULL, NUM_INTENSITIES), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("create_image_buf", bench_create_image_buf, &ppm, IMAGE_NUM_BYTES), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("create_image_buf_yuyv", bench_create_image_buf_yuv, &ppm, IMAGE_NUM_BYTES), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("pixel_ops_separate", bench_pixel_separate, &ppm, IMAGE_NUM_BYTES), FAILURE, FAILURE);
+  EQ_RET_E(res, bench_add("pixel_ops_fused", bench_pixel_fused, &ppm, IMAGE_NUM_BYTES), FAILURE, FAILURE);
+  EQ_RET_E(res,
+           bench_add("pixel_pass_1080p", bench_pixel_hd_serial, &ppm, BENCH_HD_HRES * BENCH_HD_VRES * 2),
+           FAILURE,
+           FAILURE);
+  EQ_RET_E(res,
+           bench_add("pixel_pass_1080p_pool", bench_pixel_hd_pool, &ppm, BENCH_HD_HRES * BENCH_HD_VRES * 2),
+           FAILURE,
+           FAILURE);
+  EQ_RET_E(res, bench_add("write_ppm", bench_write_ppm, &ppm, IMAGE_NUM_BYTES), FAILURE, FAILURE);
+  return SUCCESS;
+} // bench_add_ppm()
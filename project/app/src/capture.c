@@ -11,6 +11,7 @@
 #include <sched.h>
 #include <semaphore.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -19,20 +20,42 @@
 #include <unistd.h>
 #include <time.h>
 
+#include "archive.h"
 #include "capture.h"
+#include "frame_mem.h"
+#include "load_test.h"
 #include "log.h"
+#include "metrics.h"
+#include "overload.h"
+#include "perf_counters.h"
+#include "preview.h"
 #include "profiler.h"
 #include "project_defs.h"
+#include "retention.h"
+#include "sched_analysis.h"
+#include "sequencer.h"
+#include "service.h"
+#include "trace.h"
 #include "utilities.h"
+#include "v4l2_cap.h"
+#include "worker_pool.h"
 
 // Use either JPEG or PPM to save files
 #ifdef JPEG_COMPRESSION
+#include "enc_pool.h"
 #include "jpeg.h"
 #include "server.h"
+#define STORE_SERVICE "jpeg_service"
 #else
 #include "ppm.h"
+#define STORE_SERVICE "ppm_service"
 #endif
 
+// The task graph runs the JPEG/QOI storage stages
+#if defined(TASK_GRAPH) && !defined(JPEG_COMPRESSION)
+#error "TASK_GRAPH can't be built with NO_COMP"
+#endif /* TASK_GRAPH */
+
 // Warm up camera by capturing frames
 #define WARM_UP
 #define WARM_UP_FRAMES (10)
@@ -40,49 +63,82 @@
 // Capture ping pong buffer size
 #define CAP_BUF_SIZE (4)
 
-// Open CV info
-#define WINDOWNAME "capture"
+// Open CV device of the first camera, camera n opens the next n
 #define DEVICE_NUMBER (0)
 
+// Headless builds have no highgui to capture with
+#if defined(HEADLESS) && !defined(V4L2_CAPTURE) && !defined(LOAD_TEST)
+#error "HEADLESS needs V4L2_CAPTURE"
+#endif /* HEADLESS */
+
 // Timing info
 #define MICROSECONDS_PER_SECOND (1000000)
-#define MICROSECONDS_PER_MILLISECOND (1000)
 
 // Frame capture info
 #define NUM_FRAMES (20)
-#define PERIOD (100)
-#define TIMING_BUFFER (125)
+
+// Number of frames between online schedulability checks
+#define SA_CHECK_FRAMES (10)
 
 // Flag for stopping application.  All services extern this variable.
 uint32_t abort_test = 0;
 
-// Ping Pong buffer for cap info
-static cap_info_t cap_info[CAP_BUF_SIZE];
-
-// Capture structure
-static struct cap {
+// Camera, its ping pong buffer for cap info, and its frame queue
+typedef struct camera {
+  uint32_t id;
+  cap_info_t cap_info[CAP_BUF_SIZE];
+#ifndef HEADLESS
   CvCapture * capture;
-  sem_t start;
-  sem_t stop;
+#endif /* HEADLESS */
+  v4l2_cap_t v4l2;
+  char device[FILE_NAME_MAX];
   mqd_t image_queue;
+
+  // Sequencer slots of the camera's capture and storage services
+  uint32_t slot;
+  uint32_t store_slot;
+  pthread_t thread;
+} camera_t;
+
+// Capture structure, the sequencer releases every camera with its own
+// semaphores
+static struct cap {
+  camera_t cams[CAMERAS];
+  sem_t start[CAMERAS];
+  sem_t stop[CAMERAS];
 } cap;
 
 /*!
 * @brief Captures frames and passes them through a message queue for the
-*        jpeg/ppm service to convert and save to disk
-* @param param void pointer to params
+*        jpeg/ppm service of the camera to convert and save to disk
+* @param param camera_t to capture from
 * @return NULL
 */
 void * cap_service(void * param)
 {
   FUNC_ENTRY;
 
+  camera_t * p_cam = (camera_t *)param;
   struct timespec time;
   struct timespec diff;
   cap_info_t * cur_cap_info;
+  char name[SERVICE_NAME_MAX];
   uint32_t count = 0;
+#if !defined(LOAD_TEST) || !defined(TASK_GRAPH)
   uint32_t res = 0;
+#endif /* !LOAD_TEST || !TASK_GRAPH */
   uint8_t timer = profiler_init();
+#ifdef TASK_GRAPH
+  uint32_t store_ticks = seq_divisor(STORE_SERVICE);
+#endif /* TASK_GRAPH */
+
+  capture_name(p_cam->id, "cap_service", name, sizeof(name));
+  TRACE_INIT(name);
+  METRICS_INIT(name);
+  PERF_INIT(name);
+
+  // Register for schedulability analysis
+  sa_register(name, timer, seq_period_us("cap_service"));
 
   // Loop capturing frames and displaying
   while(!abort_test)
@@ -90,122 +146,329 @@ void * cap_service(void * param)
     GET_TIME;
     DISPLAY_TIMESTAMP;
     // Wait for start signal
-    sem_wait(&cap.start);
+    sem_wait(&cap.start[p_cam->id]);
     START_TIME;
+    TRACE_BEGIN(TRACE_SPAN_CAPTURE, count);
+    PERF_BEGIN(PERF_STAGE_CAPTURE);
 
     // Get the time
     clock_gettime(CLOCK_REALTIME, &time);
 
     // Get the current cap info
-    cur_cap_info = &cap_info[count % CAP_BUF_SIZE];
-
-    EQ_RET_E(cur_cap_info->frame, cvQueryFrame(cap.capture), NULL, NULL);
-
+    cur_cap_info = &p_cam->cap_info[count % CAP_BUF_SIZE];
     cur_cap_info->time = time;
+    cur_cap_info->seq = count;
+    cur_cap_info->cam = p_cam->id;
+    cur_cap_info->buf_index = -1;
+
+#if defined(LOAD_TEST)
+    // Synthetic frame in place of the camera
+    frame_from_image(&cur_cap_info->frame, load_frame(p_cam->id, count));
+#elif defined(V4L2_CAPTURE)
+    // Take the next driver buffer with its driver timestamp, the buffer goes
+    // to the encoder without a copy
+    NOT_EQ_RET_EA(res, v4l2_grab(&p_cam->v4l2, cur_cap_info), SUCCESS, NULL, abort_test);
+#else
+    NOT_EQ_RET_E(res, frame_from_image(&cur_cap_info->frame, cvQueryFrame(p_cam->capture)), SUCCESS, NULL);
+#endif /* LOAD_TEST */
 
-    // Try to send the cap info via messaqe queue
-    NOT_EQ_RET_EA(res,
-                 mq_send(cap.image_queue, (char *)cur_cap_info, sizeof(*cur_cap_info), 0),
-                 SUCCESS,
-                 NULL,
-                 abort_test);
+    // Hand the first camera's frame to the preview, which copies it if it is
+    // waiting for one, before the buffer is released or sent on
+    if (p_cam->id == 0)
+    {
+      PREVIEW_POST(&cur_cap_info->frame, count);
+    }
 
-    cvShowImage(WINDOWNAME, cur_cap_info->frame);
-    cvWaitKey(1);
+#ifdef TASK_GRAPH
+    // Frames of the ticks storage is due on go to the camera's graph, the
+    // others straight back to the driver.  A camera with too many frames in
+    // flight drops the new one.
+    if (seq_tick(p_cam->slot) % store_ticks != 0)
+    {
+      capture_release(cur_cap_info);
+    }
+    else if (jpeg_submit(cur_cap_info, seq_tick(p_cam->slot)) != SUCCESS)
+    {
+      overload_drop(OVERLOAD_Q_FRAME, cur_cap_info);
+    }
+#else
+    // Frames are only queued on the ticks the storage service is released
+    // on, the others go straight back to the driver.  Send the cap info via
+    // message queue, a full queue is handled by the frame queue overload
+    // policy.
+    if (p_cam->store_slot == SEQ_NO_SLOT)
+    {
+      p_cam->store_slot = seq_find(STORE_SERVICE, p_cam->id);
+    }
+    if (p_cam->store_slot != SEQ_NO_SLOT && seq_tick(p_cam->store_slot) != seq_tick(p_cam->slot))
+    {
+      capture_release(cur_cap_info);
+    }
+    else
+    {
+      NOT_EQ_RET_EA(res,
+                    overload_send(OVERLOAD_Q_FRAME, p_cam->id, p_cam->image_queue, cur_cap_info, sizeof(*cur_cap_info)),
+                    SUCCESS,
+                    NULL,
+                    abort_test);
+    }
+#endif /* TASK_GRAPH */
+    TRACE_END(TRACE_SPAN_CAPTURE, count);
+    PERF_END(PERF_STAGE_CAPTURE, cur_cap_info->frame.width * cur_cap_info->frame.height);
+    METRICS_ADD(METRICS_FRAMES_CAPTURED, 1);
+    LOAD_DONE(LOAD_STAGE_CAPTURE, p_cam->id, &time);
 
     // Post done
-    sem_post(&cap.stop);
+    sem_post(&cap.stop[p_cam->id]);
     count++;
   }
-  LOG_HIGH("cap_service thread exiting");
+  LOG_HIGH("%s thread exiting", name);
   return NULL;
 } // cap_service()
 
-int sched_service()
+/*!
+* @brief Releases the capture buffer of a dropped frame message
+* @param msg cap_info_t of the dropped frame
+*/
+static
+void cap_release_msg(void * msg)
 {
-  struct sched_param sched;
-  struct sched_param cap_sched;
-  struct timespec diff;
-  pthread_t cap_thread;
-  pthread_attr_t sched_attr;
-  int32_t cap_policy = 0;
+  capture_release((cap_info_t *)msg);
+} // cap_release_msg()
+
+void capture_release(cap_info_t * p_info)
+{
+#ifdef V4L2_CAPTURE
+  if (p_info->buf_index >= 0)
+  {
+    v4l2_release(&cap.cams[p_info->cam].v4l2, p_info->buf_index);
+  }
+#endif /* V4L2_CAPTURE */
+} // capture_release()
+
+uint32_t capture_frames_held(uint32_t cam)
+{
+  uint32_t held = 1;
+
+#if defined(LOAD_TEST)
+  // Synthetic frames are written over LOAD_FRAME_BUFS frames later
+  held = LOAD_FRAME_BUFS - 1;
+#elif defined(V4L2_CAPTURE)
+  // Every buffer but the one capture takes next, a frame capture can't hand
+  // on goes straight back to the driver
+  held = (cap.cams[cam].v4l2.num_bufs > 1) ? cap.cams[cam].v4l2.num_bufs - 1 : 1;
+#endif /* LOAD_TEST */
+  // OpenCV frames are all the one image cvQueryFrame() fills
+  return held;
+} // capture_frames_held()
+
+void capture_name(uint32_t cam, const char * p_base, char * p_name, size_t size)
+{
+  if (cam == 0)
+  {
+    snprintf(p_name, size, "%s", p_base);
+  }
+  else
+  {
+    snprintf(p_name, size, "%s_%u", p_base, cam);
+  }
+} // capture_name()
+
+uint32_t capture_config(uint32_t cam, const char * p_device)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_device);
+
+  if (cam >= CAMERAS || strlen(p_device) >= FILE_NAME_MAX)
+  {
+    LOG_ERROR("Bad device for camera %u: %s", cam, p_device);
+    return FAILURE;
+  }
+  strcpy(cap.cams[cam].device, p_device);
+  return SUCCESS;
+} // capture_config()
+
+/*!
+* @brief Opens a camera and its frame queue and starts its capture service
+* @param p_cam camera to start
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t capture_open(camera_t * p_cam)
+{
+  FUNC_ENTRY;
   int32_t res = 0;
-  int32_t rt_max_pri = 0;
-  uint8_t timer = profiler_init();
 
-#ifdef WARM_UP
-  // Frame used for capture during warm up phase
-  IplImage * frame;
+  // Semaphores for timing, released by the sequencer every capture period
+  PT_NOT_EQ_RET(res, sem_init(&cap.start[p_cam->id], 0, 0), SUCCESS, FAILURE);
+  PT_NOT_EQ_RET(res, sem_init(&cap.stop[p_cam->id], 0, 0), SUCCESS, FAILURE);
+  NOT_EQ_RET_E(res,
+               seq_add("cap_service", p_cam->id, &cap.start[p_cam->id], &cap.stop[p_cam->id], &p_cam->slot),
+               SUCCESS,
+               FAILURE);
+  p_cam->store_slot = SEQ_NO_SLOT;
+
+#if defined(V4L2_CAPTURE) && !defined(LOAD_TEST)
+  // Open the camera and start streaming into the driver buffers
+  if (p_cam->device[0] == '\0' && p_cam->id == 0)
+  {
+    snprintf(p_cam->device, FILE_NAME_MAX, "%s", V4L2_DEVICE);
+  }
+  else if (p_cam->device[0] == '\0')
+  {
+    snprintf(p_cam->device, FILE_NAME_MAX, V4L2_DEVICE_FMT, p_cam->id);
+  }
+  LOG_HIGH("Setting %s resolution to %dx%d", p_cam->device, HRES, VRES);
+  NOT_EQ_RET_E(res, v4l2_open(&p_cam->v4l2, p_cam->device, HRES, VRES, V4L2_BUFS), SUCCESS, FAILURE);
+#elif !defined(LOAD_TEST)
+  // Create a capture object and set values, camera n is device n
+  EQ_RET_E(p_cam->capture, (CvCapture *)cvCreateCameraCapture(DEVICE_NUMBER + p_cam->id), NULL, FAILURE);
+  LOG_HIGH("Setting camera %u resolution to %dx%d", p_cam->id, HRES, VRES);
+  cvSetCaptureProperty(p_cam->capture, CV_CAP_PROP_FRAME_WIDTH, HRES);
+  cvSetCaptureProperty(p_cam->capture, CV_CAP_PROP_FRAME_HEIGHT, VRES);
+#endif /* V4L2_CAPTURE */
+
+#if defined(V4L2_CAPTURE) && !defined(LOAD_TEST)
+  // The store service holds a buffer while working on a frame and capture
+  // needs one left with the driver, so the queue only holds the rest.  A
+  // full queue then drops frames by its policy instead of the driver running
+  // out of buffers and the grab timing out.
+  overload_set_depth(OVERLOAD_Q_FRAME,
+                     (p_cam->v4l2.num_bufs > 2) ? p_cam->v4l2.num_bufs - 2 : 1,
+                     sizeof(cap_info_t));
+#endif /* V4L2_CAPTURE */
+
+  // Try to create the queue as its overload policy needs it
+  EQ_RET_E(p_cam->image_queue, overload_open(OVERLOAD_Q_FRAME, p_cam->id), -1, FAILURE);
+
+  // Create pthread, spread over the cores by camera
+  NOT_EQ_RET_E(res,
+               service_launch_camera("cap_service", p_cam->id, cap_service, p_cam, &p_cam->thread),
+               SUCCESS,
+               FAILURE);
+  return SUCCESS;
+} // capture_open()
+
+/*!
+* @brief Closes a camera once its capture service has exited
+* @param p_cam camera to close
+*/
+static
+void capture_close(camera_t * p_cam)
+{
+  FUNC_ENTRY;
+  char queue_name[QUEUE_NAME_MAX];
+
+#ifndef LOAD_TEST
+  // Destroy capture
+#ifdef V4L2_CAPTURE
+  v4l2_close(&p_cam->v4l2);
+#else
+  cvReleaseCapture(&p_cam->capture);
+#endif /* V4L2_CAPTURE */
+#endif /* LOAD_TEST */
+
+  // Close the message queue fd and unlink it so it is destroyed
+  mq_close(p_cam->image_queue);
+  capture_name(p_cam->id, QUEUE_NAME, queue_name, sizeof(queue_name));
+  mq_unlink(queue_name);
+} // capture_close()
+
+#if defined(WARM_UP) && !defined(LOAD_TEST)
+/*!
+* @brief Captures frames to allow the cameras to warm up, showing the first
+*        camera's in the preview
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t capture_warm_up()
+{
+  FUNC_ENTRY;
+  cap_info_t warm_up;
+  uint32_t res = 0;
+
+  LOG_MED("Running %d frames for warm up", WARM_UP_FRAMES);
+  for (uint8_t frames = 0; frames < WARM_UP_FRAMES; frames++)
+  {
+    for (uint32_t cam = 0; cam < CAMERAS; cam++)
+    {
+#ifdef V4L2_CAPTURE
+      NOT_EQ_RET_E(res, v4l2_grab(&cap.cams[cam].v4l2, &warm_up), SUCCESS, FAILURE);
+#else
+      NOT_EQ_RET_E(res, frame_from_image(&warm_up.frame, cvQueryFrame(cap.cams[cam].capture)), SUCCESS, FAILURE);
+#endif /* V4L2_CAPTURE */
+
+      // The preview copies the frame before the buffer goes back
+      if (cam == 0)
+      {
+        PREVIEW_POST(&warm_up.frame, frames);
+      }
+#ifdef V4L2_CAPTURE
+      v4l2_release(&cap.cams[cam].v4l2, warm_up.buf_index);
+#endif /* V4L2_CAPTURE */
+    }
+    usleep(MICROSECONDS_PER_SECOND);
+  }
+  return SUCCESS;
+} // capture_warm_up()
 #endif // WARM_UP
 
+int sched_service()
+{
+  char queue_name[QUEUE_NAME_MAX];
+  int32_t res = 0;
+
   // Initialize log (does nothing if not using syslog)
   log_init();
 
   // Print function entry
   FUNC_ENTRY;
 
-  // Unlink the queue name in case it is still hanging around, it is okay
-  // if this fails it is just precaution for stale queues
-  mq_unlink(QUEUE_NAME);
-
-  // Create a window
-  cvNamedWindow(WINDOWNAME, CV_WINDOW_AUTOSIZE);
-
-  // Try to create the queue
-  EQ_EXIT_E(cap.image_queue,
-            mq_open(QUEUE_NAME, O_WRONLY | O_CREAT, S_IRWXU, NULL),
-            -1);
-
-  // Semaphore for timing
-  PT_NOT_EQ_EXIT(res, sem_init(&cap.start, 0, 0), SUCCESS);
-  PT_NOT_EQ_EXIT(res, sem_init(&cap.stop, 0, 0), SUCCESS);
-
-  // Create a capture object and set values
-  EQ_EXIT_E(cap.capture, (CvCapture *)cvCreateCameraCapture(DEVICE_NUMBER), NULL);
-
-  // Initialize the schedule attributes
-  PT_NOT_EQ_EXIT(res, pthread_attr_init(&sched_attr), SUCCESS);
-
-  // Set the attributes structure to PTHREAD_EXPLICIT_SCHED and SCHED_FIFO
-  PT_NOT_EQ_EXIT(res,
-                 pthread_attr_setinheritsched(&sched_attr, PTHREAD_EXPLICIT_SCHED),
-                 SUCCESS);
-  PT_NOT_EQ_EXIT(res,
-                 pthread_attr_setschedpolicy(&sched_attr, SCHED_FIFO),
-                 SUCCESS);
-
-  // Get the max priority
-  EQ_EXIT_E(rt_max_pri, sched_get_priority_max(SCHED_FIFO), -1);
-
-  // Set scheduler to SCHED_FIFO for the main thread
-  sched.sched_priority = rt_max_pri;
-  NOT_EQ_EXIT_E(res,
-                sched_setscheduler(getpid(), SCHED_FIFO, &sched),
-                SUCCESS);
-
-  // Set the priority to max - 1 for the test thread
-  sched.sched_priority = rt_max_pri - 1;
-  PT_NOT_EQ_EXIT(res,
-                 pthread_attr_setschedparam(&sched_attr, &sched),
-                 SUCCESS);
-
-  // Set resolution
-  LOG_HIGH("Setting resolution to %dx%d", HRES, VRES);
-  cvSetCaptureProperty(cap.capture, CV_CAP_PROP_FRAME_WIDTH, HRES);
-  cvSetCaptureProperty(cap.capture, CV_CAP_PROP_FRAME_HEIGHT, VRES);
-
-  // Create pthread
-  PT_NOT_EQ_EXIT(res,
-                 pthread_create(&cap_thread, &sched_attr, cap_service, NULL),
-                 SUCCESS);
-
-  // Get the scheduler parameters to display
-  PT_NOT_EQ_EXIT(res,
-                 pthread_getschedparam(cap_thread, &cap_policy, &cap_sched),
-                 SUCCESS);
-  LOG_HIGH("cap_thread policy: %d, priority: %d",
-           cap_policy,
-           cap_sched.sched_priority);
+  // Check the budgets from the last run still fit the configured rate
+  if (sa_admit(SA_REPORT_FILE_NAME) != SUCCESS)
+  {
+#ifdef SCHED_STRICT
+    LOG_ERROR("Services at tick %uus are not schedulable, refusing to start", seq_tick_us());
+    exit(1);
+#else
+    LOG_ERROR("Services at tick %uus may not be schedulable", seq_tick_us());
+#endif /* SCHED_STRICT */
+  }
+
+  // Allocate, prefault, and lock frame memory before any service starts,
+  // every camera gets its own buffers
+#ifdef TASK_GRAPH
+  NOT_EQ_EXIT_E(res, frame_mem_init(CAMERAS * FRAME_MEM_SIZE + JPEG_GRAPH_MEM_SIZE), SUCCESS);
+#else
+  NOT_EQ_EXIT_E(res, frame_mem_init(CAMERAS * FRAME_MEM_SIZE), SUCCESS);
+#endif /* TASK_GRAPH */
+
+  // Unlink the queue names in case they are still hanging around, it is
+  // okay if this fails it is just precaution for stale queues
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    capture_name(cam, QUEUE_NAME, queue_name, sizeof(queue_name));
+    mq_unlink(queue_name);
+  }
+
+#ifdef LOAD_TEST
+  // Synthetic frames replace the camera and there is no window
+  NOT_EQ_EXIT_E(res, load_init(HRES, VRES), SUCCESS);
+#endif /* LOAD_TEST */
+
+  // Dropped frames give their capture buffer back
+  overload_set_release(OVERLOAD_Q_FRAME, cap_release_msg);
+
+  // Set the priority and affinity for the main thread which is the sequencer
+  NOT_EQ_EXIT_E(res, service_apply_self("sched_service"), SUCCESS);
+
+  // Open every camera and start its capture service
+  LOG_HIGH("Starting %d cameras", CAMERAS);
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    cap.cams[cam].id = cam;
+    NOT_EQ_EXIT_E(res, capture_open(&cap.cams[cam]), SUCCESS);
+  }
 
 #ifdef JPEG_COMPRESSION
   // Try setting up the JPEG service
@@ -217,75 +480,116 @@ int sched_service()
   NOT_EQ_EXIT_E(res, ppm_init(), SUCCESS);
 #endif
 
-#ifdef WARM_UP
-  // Loop captures frames to allow camera to warm up
-  LOG_MED("Running %d frames for warm up", WARM_UP_FRAMES);
-  for (uint8_t frames = 0; frames < WARM_UP_FRAMES; frames++)
+  // Old frames are deleted by their own low priority service
+  NOT_EQ_EXIT_E(res, retention_init(), SUCCESS);
+
+#ifdef METRICS
+  // Counters are served to scrapers by their own low priority service
+  NOT_EQ_EXIT_E(res, metrics_init(), SUCCESS);
+#endif /* METRICS */
+
+#ifdef ARCHIVE
+  // Stored frames are sent on request by their own low priority service
+  NOT_EQ_EXIT_E(res, archive_init(), SUCCESS);
+#endif /* ARCHIVE */
+
+#ifdef PREVIEW
+  // The window is shown by its own low priority service
+  NOT_EQ_EXIT_E(res, preview_init(HRES, VRES), SUCCESS);
+#endif /* PREVIEW */
+
+#if defined(WARM_UP) && !defined(LOAD_TEST)
+  // A camera that fails to warm up stops the test through the same shutdown
+  // as the end of the run
+  if (capture_warm_up() != SUCCESS)
   {
-    EQ_RET_E(frame, cvQueryFrame(cap.capture), NULL, FAILURE);
-    cvShowImage(WINDOWNAME, frame);
-    cvWaitKey(1);
-    usleep(MICROSECONDS_PER_SECOND);
+    abort_test = 1;
   }
 #endif // WARM_UP
 
-  // Loop captures frames to get stats
-  for (uint32_t frames = 0; frames < NUM_FRAMES; frames++)
-  {
-    // Start the timer
-    START_TIME;
+  // Faults taken during startup, the steady state should add none
+  service_report_faults();
 
-    // Post semaphore for capture
-    sem_post(&cap.start);
+#ifdef LOAD_TEST
+  // Step through the load test rates in place of the fixed frame loop
+  load_run(cap.start, cap.stop, CAMERAS);
 
-    // Get the time
-    GET_TIME;
+  // Faults taken under load
+  service_report_faults();
+  overload_report();
+#else
+  // Release every service at its own rate, checking the observed execution
+  // times still fit every so often
+  for (uint32_t frames = 0; frames < NUM_FRAMES && !abort_test; frames += SA_CHECK_FRAMES)
+  {
+    seq_run(SA_CHECK_FRAMES);
+    sa_check();
+  }
 
-    // Display the time
-    DISPLAY_TIMESTAMP;
+  // Faults taken since startup
+  service_report_faults();
 
-    // Sleep for the period of a frame
-    usleep(MICROSECONDS_PER_MILLISECOND * PERIOD - TIMING_BUFFER);
+  // Services that overran their periods and frames dropped or degraded by
+  // overload
+  seq_report();
+  overload_report();
 
-    // Start the timer
-    START_TIME;
+  // Write the per service budget report used by the next admission check
+  sa_check();
+  sa_report(SA_REPORT_FILE_NAME);
+#endif /* LOAD_TEST */
 
-    if (!abort_test)
-    {
-      // Wait for frame to be captured
-      sem_wait(&cap.stop);
-    }
-    else
-    {
-      break;
-    }
-    // Get the time
-    GET_TIME;
+#ifdef JPEG_COMPRESSION
+  // High water marks of the encoded frame pool
+  enc_pool_report();
+#endif /* JPEG_COMPRESSION */
 
-    // Display the time
-    DISPLAY_TIMESTAMP;
+  // Set the abort flag then allow the threads to exit
+  abort_test = 1;
+  seq_stop();
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    sem_post(&cap.start[cam]);
+    sem_post(&cap.stop[cam]);
   }
 
-  // Set the abort flag then allow the thread to exit
-  sem_post(&cap.start);
-  abort_test = 1;
-  sem_post(&cap.stop);
+  // Wait for test threads to join
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    PT_NOT_EQ_EXIT(res,
+                   pthread_join(cap.cams[cam].thread, NULL),
+                   SUCCESS);
+  }
+  LOG_MED("cap_service threads joined");
+
+#ifdef JPEG_COMPRESSION
+  // Nothing is submitted once capture is done, the frames in flight are
+  // stored before the storage services, then the server, stop
+  jpeg_stop();
+  server_stop();
+#else
+  // A conversion still running finishes before the services stop
+  ppm_stop();
+#endif /* JPEG_COMPRESSION */
 
-  // Wait for test thread to join
-  PT_NOT_EQ_EXIT(res,
-                 pthread_join(cap_thread, NULL),
-                 SUCCESS);
-  LOG_MED("cap_service thread joined");
+  // Every user of the workers has stopped
+  worker_pool_stop();
 
-  // Destroy capture and window
-  cvReleaseCapture(&cap.capture);
-  cvDestroyWindow(WINDOWNAME);
+#ifdef PREVIEW
+  // The preview reads capture buffers so it stops before they go away
+  preview_stop();
+#endif /* PREVIEW */
 
-  // Close the message queue fd
-  mq_close(cap.image_queue);
+  // Write out the spans recorded by every service and their counters, every
+  // thread recording them has been joined
+  TRACE_DUMP();
+  PERF_REPORT();
 
-  // Unlink it so it is destroyed
-  mq_unlink(QUEUE_NAME);
+  // Close the cameras and their queues
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    capture_close(&cap.cams[cam]);
+  }
 
   // Destroy log
   log_destroy();
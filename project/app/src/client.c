@@ -1,78 +1,538 @@
 /** @file client.c
 *
-* @brief Holds functionality for socket client
+* @brief Holds functionality for socket client.  One thread collects from
+*        every server with non-blocking sockets in an epoll loop, each
+*        connection steps through the frame it is receiving as data arrives
+*        and is retried with backoff when it drops.
 *
 */
 
+#include <arpa/inet.h>
 #include <errno.h>
-#include <mqueue.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <signal.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "capture.h"
 #include "client.h"
+#include "frame_mem.h"
 #include "jpeg.h"
+#include "latency.h"
 #include "log.h"
 #include "project_defs.h"
 #include "server.h"
+#include "service.h"
 #include "utilities.h"
 
-#define SERVER_PORT (12345)
+// Server used when none are given
 #define ADDRESS "10.0.0.29"
 
-// Inform the main that service is done
-static sem_t done;
+// Longest host name and the host_port directory named after it
+#define CLIENT_HOST_MAX (40)
+#define CLIENT_ROOT_MAX (48)
+
+// Reconnect backoff, doubled after every failed attempt
+#define CLIENT_BACKOFF_MIN_MS (100)
+#define CLIENT_BACKOFF_MAX_MS (5000)
+
+// Time between stream and latency reports
+#define CLIENT_REPORT_MS (10000)
+
+// Time conversion
+#define NSEC_PER_SEC (1000000000l)
+#define NSEC_PER_MSEC (1000000l)
+
+// Part of a frame a stream is waiting for, the frame header, file name
+// length, file name, image length, and image follow each other on the socket
+typedef enum {
+  STREAM_IDLE,
+  STREAM_CONNECTING,
+  STREAM_HDR,
+  STREAM_NAME_LEN,
+  STREAM_NAME,
+  STREAM_BUF_LEN,
+  STREAM_BUF
+} stream_state_t;
+
+// Connection to one server and what has been received from it
+typedef struct client_stream {
+  char host[CLIENT_HOST_MAX];
+  uint16_t port;
+  struct sockaddr_in addr;
+
+  // Directory frames are stored under, empty when there is one server
+  char root[CLIENT_ROOT_MAX];
+  uint32_t cam_dirs;
+
+  int32_t sockfd;
+  stream_state_t state;
+
+  // Where the part being received goes and how much of it is in
+  uint8_t * p_dst;
+  uint32_t want;
+  uint32_t got;
+
+  // Frame being received, the image buffer is allocated from frame memory
+  frame_hdr_t hdr;
+  uint32_t name_len;
+  uint32_t buf_len;
+  char file_name[FILE_NAME_MAX];
+  uint8_t * image_buf;
+
+  // Next reconnect, CLOCK_MONOTONIC
+  uint32_t backoff_ms;
+  int64_t retry_ns;
+
+  // Totals and the totals at the last report
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t report_frames;
+  uint64_t report_bytes;
+  uint32_t connects;
+  uint32_t skipped;
+  uint32_t last_seq[CAMERAS_MAX];
+
+  // Capture to disk latency since the last report
+  latency_hist_t lag;
+#ifdef CLOCK_OFFSET
+  // Minimum send to receive delta seen used as the clock offset estimate,
+  // every server has its own clock
+  int64_t offset;
+  uint32_t offset_set;
+#endif /* CLOCK_OFFSET */
+} client_stream_t;
+
+// Latency histograms for each hop a frame takes from capture to disk
+typedef struct {
+  latency_hist_t cap_enc;
+  latency_hist_t enc_send;
+  latency_hist_t send_recv;
+  latency_hist_t recv_disk;
+  latency_hist_t total;
+#ifdef CLOCK_OFFSET
+  latency_hist_t total_corrected;
+#endif /* CLOCK_OFFSET */
+} client_latency_t;
+
+static client_latency_t latency;
+
+// Servers collected from
+static client_stream_t streams[CLIENT_MAX_SERVERS];
+static uint32_t num_streams;
+
+// Set by SIGINT or SIGTERM.  Both are blocked except while client_service
+// waits for events, so they always cut the wait short.
+static volatile sig_atomic_t client_stop = 0;
+static sigset_t wait_mask;
+
+/*!
+* @brief Gets CLOCK_MONOTONIC in nanoseconds
+* @return time
+*/
+static inline
+int64_t client_now_ns()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+} // client_now_ns()
 
 /*!
-* @brief Ensure to receive all bytes on a read
-* @param sockfd socket file descriptor
-* @param data location to store data
-* @param count number of bytes to read
-* @return number of bytes read
+* @brief Converts a network order seconds/nanoseconds pair to a timespec
+* @param sec network order seconds
+* @param nsec network order nanoseconds
+* @param time timespec to fill out
 */
 static inline
-uint32_t client_recv(int32_t sockfd, void * data, uint32_t count)
+void client_ntoh_time(uint32_t sec, uint32_t nsec, struct timespec * time)
+{
+  time->tv_sec = ntohl(sec);
+  time->tv_nsec = ntohl(nsec);
+} // client_ntoh_time()
+
+/*!
+* @brief Adds the latency of each hop for a received frame
+* @param p_stream stream the frame came from
+* @param recv time the frame was fully received
+* @param disk time the frame was written to disk
+*/
+static inline
+void client_add_latency(client_stream_t * p_stream,
+                        struct timespec * recv,
+                        struct timespec * disk)
+{
+  frame_hdr_t * hdr = &p_stream->hdr;
+  struct timespec cap;
+  struct timespec enc;
+  struct timespec send;
+  int64_t send_recv;
+
+  client_ntoh_time(hdr->cap_sec, hdr->cap_nsec, &cap);
+  client_ntoh_time(hdr->enc_sec, hdr->enc_nsec, &enc);
+  client_ntoh_time(hdr->send_sec, hdr->send_nsec, &send);
+  send_recv = latency_diff_ns(&send, recv);
+
+  latency_add(&latency.cap_enc, latency_diff_ns(&cap, &enc));
+  latency_add(&latency.enc_send, latency_diff_ns(&enc, &send));
+  latency_add(&latency.send_recv, send_recv);
+  latency_add(&latency.recv_disk, latency_diff_ns(recv, disk));
+  latency_add(&latency.total, latency_diff_ns(&cap, disk));
+  latency_add(&p_stream->lag, latency_diff_ns(&cap, disk));
+
+#ifdef CLOCK_OFFSET
+  // Assume the fastest transfer seen took no time, anything above it is
+  // network delay and the rest is the difference between the two clocks
+  if (!p_stream->offset_set || send_recv < p_stream->offset)
+  {
+    p_stream->offset = send_recv;
+    p_stream->offset_set = 1;
+  }
+  latency_add(&latency.total_corrected,
+              latency_diff_ns(&cap, disk) - p_stream->offset);
+#endif /* CLOCK_OFFSET */
+} // client_add_latency()
+
+/*!
+* @brief Logs the latency distribution for every hop
+*/
+static
+void client_report_latency()
+{
+  LOG_HIGH("Latency per hop over %d frames", latency.total.count);
+  latency_report("capture-encode", &latency.cap_enc);
+  latency_report("encode-send", &latency.enc_send);
+  latency_report("send-receive", &latency.send_recv);
+  latency_report("receive-disk", &latency.recv_disk);
+  latency_report("capture-disk", &latency.total);
+#ifdef CLOCK_OFFSET
+  latency_report("corrected", &latency.total_corrected);
+#endif /* CLOCK_OFFSET */
+} // client_report_latency()
+
+/*!
+* @brief Logs the throughput and lag of every stream since the last report
+* @param secs seconds since the last report
+*/
+static
+void client_report_streams(double secs)
+{
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+
+  for (uint32_t i = 0; i < num_streams; i++)
+  {
+    client_stream_t * p_stream = &streams[i];
+    uint64_t stream_frames = p_stream->frames - p_stream->report_frames;
+    uint64_t stream_bytes = p_stream->bytes - p_stream->report_bytes;
+
+    LOG_HIGH("%s:%d %s %.1ffps %.2fMB/s frames: %llu skipped: %u connects: %u "
+             "lag p50=%.1fms p99=%.1fms max=%.2fms",
+             p_stream->host,
+             p_stream->port,
+             (p_stream->state > STREAM_CONNECTING) ? "up" : "down",
+             stream_frames / secs,
+             stream_bytes / secs / (1024.0 * 1024.0),
+             (unsigned long long)p_stream->frames,
+             p_stream->skipped,
+             p_stream->connects,
+             (float)latency_percentile(&p_stream->lag, 50) / NSEC_PER_MSEC,
+             (float)latency_percentile(&p_stream->lag, 99) / NSEC_PER_MSEC,
+             (float)p_stream->lag.max / NSEC_PER_MSEC);
+    frames += stream_frames;
+    bytes += stream_bytes;
+    p_stream->report_frames = p_stream->frames;
+    p_stream->report_bytes = p_stream->bytes;
+    latency_reset(&p_stream->lag);
+  }
+  LOG_HIGH("All %d streams %.1ffps %.2fMB/s",
+           num_streams,
+           frames / secs,
+           bytes / secs / (1024.0 * 1024.0));
+} // client_report_streams()
+
+/*!
+* @brief Sets up the part of the frame a stream receives next
+* @param p_stream stream
+* @param state part being received
+* @param p_dst where it goes
+* @param count number of bytes
+*/
+static inline
+void client_expect(client_stream_t * p_stream, stream_state_t state, void * p_dst, uint32_t count)
+{
+  p_stream->state = state;
+  p_stream->p_dst = p_dst;
+  p_stream->want = count;
+  p_stream->got = 0;
+} // client_expect()
+
+/*!
+* @brief Drops a stream's connection and schedules the next attempt
+* @param p_stream stream
+*/
+static
+void client_retry(client_stream_t * p_stream)
 {
   FUNC_ENTRY;
 
-  int32_t bytes = 0;
+  // Closing the socket also takes it out of the epoll set
+  if (p_stream->sockfd != -1)
+  {
+    shutdown(p_stream->sockfd, SHUT_RDWR);
+    close(p_stream->sockfd);
+    p_stream->sockfd = -1;
+  }
+  LOG_MED("Retrying %s:%d in %dms", p_stream->host, p_stream->port, p_stream->backoff_ms);
+  p_stream->state = STREAM_IDLE;
+  p_stream->retry_ns = client_now_ns() + (int64_t)p_stream->backoff_ms * NSEC_PER_MSEC;
+  p_stream->backoff_ms *= 2;
+  if (p_stream->backoff_ms > CLIENT_BACKOFF_MAX_MS)
+  {
+    p_stream->backoff_ms = CLIENT_BACKOFF_MAX_MS;
+  }
+} // client_retry()
+
+/*!
+* @brief Starts connecting a stream without waiting for the connection
+* @param epfd epoll instance
+* @param p_stream stream
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t client_connect(int32_t epfd, client_stream_t * p_stream)
+{
+  FUNC_ENTRY;
+  struct epoll_event event;
   int32_t res = 0;
 
-  while (bytes < count)
+  EQ_RET_E(p_stream->sockfd, socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), -1, FAILURE);
+  LOG_MED("Trying connection to %s on port %d", p_stream->host, p_stream->port);
+  res = connect(p_stream->sockfd, (struct sockaddr *)&p_stream->addr, sizeof(p_stream->addr));
+  if (res == -1 && errno != EINPROGRESS)
   {
-    EQ_RET_E(res, read(sockfd, data + bytes, count - bytes), -1, -1);
-    bytes += res;
+    LOG_MED("Connection to %s:%d failed: %s", p_stream->host, p_stream->port, strerror(errno));
+    return FAILURE;
   }
-  return bytes;
-} // client_recv()
+
+  // Writable once the connection is made or has failed
+  p_stream->state = STREAM_CONNECTING;
+  event.events = EPOLLOUT;
+  event.data.ptr = p_stream;
+  EQ_RET_E(res, epoll_ctl(epfd, EPOLL_CTL_ADD, p_stream->sockfd, &event), -1, FAILURE);
+  return SUCCESS;
+} // client_connect()
 
 /*!
-* @brief Shutdown socked
-* @param sockfd socket file descriptor
+* @brief Finishes a connection that was in progress
+* @param epfd epoll instance
+* @param p_stream stream
 * @return SUCCESS/FAILURE
 */
-uint32_t client_dest(int32_t sockfd)
+static
+uint32_t client_connected(int32_t epfd, client_stream_t * p_stream)
 {
   FUNC_ENTRY;
+  struct epoll_event event;
+  socklen_t len = sizeof(int32_t);
+  int32_t error = 0;
+  int32_t res = 0;
+
+  EQ_RET_E(res, getsockopt(p_stream->sockfd, SOL_SOCKET, SO_ERROR, &error, &len), -1, FAILURE);
+  if (error != 0)
+  {
+    LOG_MED("Connection to %s:%d failed: %s", p_stream->host, p_stream->port, strerror(error));
+    return FAILURE;
+  }
+
+  // Only wait for data from now on
+  event.events = EPOLLIN;
+  event.data.ptr = p_stream;
+  EQ_RET_E(res, epoll_ctl(epfd, EPOLL_CTL_MOD, p_stream->sockfd, &event), -1, FAILURE);
+  client_expect(p_stream, STREAM_HDR, &p_stream->hdr, sizeof(p_stream->hdr));
+  p_stream->connects++;
+  LOG_HIGH("Connected to %s:%d", p_stream->host, p_stream->port);
+  return SUCCESS;
+} // client_connected()
 
+/*!
+* @brief Writes a received frame to disk and tracks it
+* @param p_stream stream the frame came from
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t client_store(client_stream_t * p_stream)
+{
+  FUNC_ENTRY;
+  struct timespec recv_time;
+  struct timespec disk_time;
+  char path[CLIENT_ROOT_MAX + FILE_NAME_MAX];
+  char dir[DIR_NAME_MAX];
   int32_t res = 0;
+  int32_t fd = 0;
+  uint32_t cam = ntohl(p_stream->hdr.cam);
+  uint32_t seq = ntohl(p_stream->hdr.seq);
+  uint32_t step = ntohl(p_stream->hdr.seq_step);
+  uint8_t seen = (p_stream->cam_dirs >> cam) & 1;
+
+  clock_gettime(CLOCK_REALTIME, &recv_time);
+  LOG_LOW("Received %s from %s camera %u", p_stream->file_name, p_stream->host, cam);
+
+  // The server names files after the camera's directory, which is made the
+  // first time the camera is seen
+  if (!seen)
+  {
+    capture_name(cam, DIR_NAME, dir, sizeof(dir));
+    snprintf(path, sizeof(path), "%s%s%s", p_stream->root, p_stream->root[0] ? "/" : "", dir);
+    EQ_RET_E(res, create_dir(path), FAILURE, FAILURE);
+    p_stream->cam_dirs |= 1u << cam;
+  }
 
-  // Shutdown the socket
-  LOG_MED("Shutting down socket fd: %d", sockfd);
-  EQ_RET_E(res, shutdown(sockfd, SHUT_RDWR), -1, FAILURE);
+  // Open file to store contents
+  snprintf(path, sizeof(path), "%s%s%s", p_stream->root, p_stream->root[0] ? "/" : "", p_stream->file_name);
+  EQ_RET_E(fd, open(path, O_CREAT | O_RDWR | O_TRUNC, FILE_PERM), -1, FAILURE);
+  res = write(fd, p_stream->image_buf, p_stream->buf_len);
+  close(fd);
+  if (res != p_stream->buf_len)
+  {
+    LOG_ERROR("Writing %s failed with error: %s", path, strerror(errno));
+    return FAILURE;
+  }
+  clock_gettime(CLOCK_REALTIME, &disk_time);
+
+  // The server sends every step-th frame, larger gaps in a camera's sequence
+  // numbers are frames it dropped.  The first frame of each camera has
+  // nothing to follow.
+  step = step ? step : 1;
+  if (seen && seq > p_stream->last_seq[cam] + step)
+  {
+    p_stream->skipped += (seq - p_stream->last_seq[cam]) / step - 1;
+  }
+  p_stream->last_seq[cam] = seq;
+  p_stream->frames++;
+  p_stream->bytes += p_stream->buf_len;
 
+  // Back off from scratch again once a connection delivers frames
+  p_stream->backoff_ms = CLIENT_BACKOFF_MIN_MS;
+  client_add_latency(p_stream, &recv_time, &disk_time);
   return SUCCESS;
-} // client_dest()
+} // client_store()
+
+/*!
+* @brief Moves a stream on to the next part of the frame once a part is in
+* @param p_stream stream
+* @return SUCCESS/FAILURE when the server sent something invalid
+*/
+static
+uint32_t client_step(client_stream_t * p_stream)
+{
+  switch (p_stream->state)
+  {
+    case STREAM_HDR:
+      if (ntohl(p_stream->hdr.cam) >= CAMERAS_MAX)
+      {
+        LOG_ERROR("Camera %u from %s is out of range", ntohl(p_stream->hdr.cam), p_stream->host);
+        return FAILURE;
+      }
+      client_expect(p_stream, STREAM_NAME_LEN, &p_stream->name_len, sizeof(p_stream->name_len));
+      break;
+    case STREAM_NAME_LEN:
+      p_stream->name_len = ntohl(p_stream->name_len);
+      if (p_stream->name_len >= FILE_NAME_MAX)
+      {
+        LOG_ERROR("File name length %d from %s is too long", p_stream->name_len, p_stream->host);
+        return FAILURE;
+      }
+      client_expect(p_stream, STREAM_NAME, p_stream->file_name, p_stream->name_len);
+      break;
+    case STREAM_NAME:
+      p_stream->file_name[p_stream->name_len] = '\0';
+      client_expect(p_stream, STREAM_BUF_LEN, &p_stream->buf_len, sizeof(p_stream->buf_len));
+      break;
+    case STREAM_BUF_LEN:
+      p_stream->buf_len = ntohl(p_stream->buf_len);
+      if (p_stream->buf_len > ENC_MAX_BYTES)
+      {
+        LOG_ERROR("Buffer length %d from %s is too long", p_stream->buf_len, p_stream->host);
+        return FAILURE;
+      }
+      client_expect(p_stream, STREAM_BUF, p_stream->image_buf, p_stream->buf_len);
+      break;
+    case STREAM_BUF:
+      if (client_store(p_stream) != SUCCESS)
+      {
+        return FAILURE;
+      }
+      client_expect(p_stream, STREAM_HDR, &p_stream->hdr, sizeof(p_stream->hdr));
+      break;
+    default:
+      return FAILURE;
+  }
+  return SUCCESS;
+} // client_step()
+
+/*!
+* @brief Receives what a stream's socket has, up to the end of one frame so
+*        a busy server can't starve the others
+* @param p_stream stream
+* @return SUCCESS/FAILURE when the connection is lost or the frame is bad
+*/
+static
+uint32_t client_readable(client_stream_t * p_stream)
+{
+  ssize_t res = 0;
+
+  while (1)
+  {
+    if (p_stream->got < p_stream->want)
+    {
+      res = read(p_stream->sockfd, p_stream->p_dst + p_stream->got, p_stream->want - p_stream->got);
+      if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      {
+        return SUCCESS;
+      }
+      if (res <= 0)
+      {
+        LOG_MED("Lost %s:%d: %s", p_stream->host, p_stream->port, res ? strerror(errno) : "closed");
+        return FAILURE;
+      }
+      p_stream->got += res;
+      continue;
+    }
+    if (client_step(p_stream) != SUCCESS)
+    {
+      return FAILURE;
+    }
+    if (p_stream->state == STREAM_HDR)
+    {
+      return SUCCESS;
+    }
+  }
+} // client_readable()
 
 /*!
-* @brief Handles incoming messages on queue
+* @brief Asks client_service to stop
+* @param sig signal taken
+*/
+static
+void client_signal(int sig)
+{
+  client_stop = 1;
+} // client_signal()
+
+/*!
+* @brief Handles incoming frames from every server until stopped by SIGINT
+*        or SIGTERM, then reports the totals
 * @param param no data
 * @return NULL
 */
@@ -80,127 +540,202 @@ void * client_service(void * param)
 {
   FUNC_ENTRY;
 
-  struct hostent * server;
-  struct sockaddr_in serv_addr;
-  int32_t res = 0;
-  int32_t sockfd;
-  int32_t name_len = 0;
-  int32_t buf_len = 0;
-  int32_t fd = 0;
-  char file_name[FILE_NAME_MAX];
-  uint8_t image_buf[IMAGE_NUM_BYTES];
+  struct epoll_event events[CLIENT_MAX_SERVERS];
+  client_stream_t * p_stream;
+  int64_t now = client_now_ns();
+  int64_t report = now;
+  int64_t wake = 0;
+  int32_t epfd = -1;
+  int32_t timeout = 0;
+  int32_t count = 0;
 
-  // Memset the serv_addr struct to 0
-  memset((void *)&serv_addr, 0, sizeof(serv_addr));
+  EQ_RET_E(epfd, epoll_create1(EPOLL_CLOEXEC), -1, NULL);
 
-  // Instantiate socket and get the host name for connection
-  EQ_RET_E(sockfd, socket(AF_INET, SOCK_STREAM, 0), -1, NULL);
-  EQ_RET_E(server, gethostbyname(ADDRESS), NULL, NULL);
+  // Every stream starts out due for a connection attempt
+  for (uint32_t i = 0; i < num_streams; i++)
+  {
+    streams[i].retry_ns = now;
+  }
 
-  // Set up the serv_addr structure for connection
-  serv_addr.sin_family = AF_INET;
-  memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-  serv_addr.sin_port = htons(SERVER_PORT);
+  while (!client_stop)
+  {
+    // Connect streams that are due and find the next thing to wake for
+    now = client_now_ns();
+    wake = report + (int64_t)CLIENT_REPORT_MS * NSEC_PER_MSEC;
+    for (uint32_t i = 0; i < num_streams; i++)
+    {
+      p_stream = &streams[i];
+      if (p_stream->state != STREAM_IDLE)
+      {
+        continue;
+      }
+      if (p_stream->retry_ns <= now && client_connect(epfd, p_stream) != SUCCESS)
+      {
+        client_retry(p_stream);
+      }
+      if (p_stream->state == STREAM_IDLE && p_stream->retry_ns < wake)
+      {
+        wake = p_stream->retry_ns;
+      }
+    }
+    timeout = (wake > now) ? (wake - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC : 0;
 
-  // Connect
-  LOG_HIGH("Trying connection to %s on port %d", ADDRESS, SERVER_PORT);
-  EQ_RET_E(res,
-           connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)),
-           -1,
-           NULL);
-  LOG_HIGH("Connection successful");
-
-  // Loop catching the file name size, file name, image buffer size, image buffer
-  while(1)
-  {
-      // Receive the file name
-      EQ_RET_E(res, client_recv(sockfd, &name_len, sizeof(name_len)), -1, NULL);
-      name_len = htons(name_len);
-      if (name_len > FILE_NAME_MAX)
+    count = epoll_pwait(epfd, events, CLIENT_MAX_SERVERS, timeout, &wait_mask);
+    if (count == -1 && errno != EINTR)
+    {
+      LOG_ERROR("epoll_wait failed with error: %s", strerror(errno));
+      break;
+    }
+    for (int32_t i = 0; i < count; i++)
+    {
+      p_stream = (client_stream_t *)events[i].data.ptr;
+      if (p_stream->state == STREAM_CONNECTING)
       {
-        LOG_ERROR("File name length %d is too long exiting", name_len);
-        break;
+        if (client_connected(epfd, p_stream) != SUCCESS)
+        {
+          client_retry(p_stream);
+        }
       }
-      EQ_RET_E(res, client_recv(sockfd, file_name, name_len), -1, NULL);
-      LOG_LOW("Receiving file name %s", file_name);
-
-      // Receive the buffer
-      EQ_RET_E(res, client_recv(sockfd, &buf_len, sizeof(buf_len)), -1, NULL);
-      buf_len = htons(buf_len);
-      LOG_LOW("Trying to read %d bytes", buf_len);
-      EQ_RET_E(res, client_recv(sockfd, image_buf, buf_len), -1, NULL);
-      if (buf_len > IMAGE_NUM_BYTES)
+      else if (client_readable(p_stream) != SUCCESS)
       {
-        LOG_ERROR("Buffer length %d is too long exiting, buf_len");
-        break;
+        client_retry(p_stream);
       }
-      LOG_HIGH("Received %s", file_name);
-      LOG_LOW("Received %d bytes", res);
+    }
 
-      // Open file to store contents
-      EQ_RET_E(fd, open(file_name, O_CREAT | O_RDWR, FILE_PERM), -1, NULL);
-      EQ_RET_E(res, write(fd, image_buf, buf_len), -1, NULL);
-      EQ_RET_E(res, close(fd), -1, NULL);
+    // Report every stream and the hop latency of all of them together
+    now = client_now_ns();
+    if (now - report >= (int64_t)CLIENT_REPORT_MS * NSEC_PER_MSEC)
+    {
+      client_report_streams((double)(now - report) / NSEC_PER_SEC);
+      client_report_latency();
+      report = now;
+    }
   }
+
+  // Report what came in since the last report before closing
+  now = client_now_ns();
+  client_report_streams((double)(now - report) / NSEC_PER_SEC);
+  client_report_latency();
   LOG_HIGH("client_service exiting");
-  client_dest(sockfd);
+  for (uint32_t i = 0; i < num_streams; i++)
+  {
+    if (streams[i].sockfd != -1)
+    {
+      close(streams[i].sockfd);
+    }
+  }
+  close(epfd);
   return NULL;
 } // client_service()
 
-uint32_t client_init()
+/*!
+* @brief Sets up a stream from a host[:port] argument
+* @param p_stream stream to fill out
+* @param p_server server as host[:port]
+* @param own_dir 1 to store the stream in its own host_port directory
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t client_stream_init(client_stream_t * p_stream, const char * p_server, uint8_t own_dir)
 {
   FUNC_ENTRY;
-  struct sched_param sched;
-  struct sched_param  client_sched;
-  pthread_attr_t sched_attr;
+  struct addrinfo hints;
+  struct addrinfo * p_info;
+  const char * p_port = strrchr(p_server, ':');
+  size_t host_len = p_port ? (size_t)(p_port - p_server) : strlen(p_server);
+  int32_t res = 0;
+
+  memset(p_stream, 0, sizeof(*p_stream));
+  if (host_len == 0 || host_len >= CLIENT_HOST_MAX)
+  {
+    LOG_ERROR("Server %s isn't host[:port] with a host under %d characters", p_server, CLIENT_HOST_MAX);
+    return FAILURE;
+  }
+  memcpy(p_stream->host, p_server, host_len);
+  p_stream->port = p_port ? atoi(p_port + 1) : SERVER_PORT;
+  if (p_stream->port == 0)
+  {
+    LOG_ERROR("Server %s has no valid port", p_server);
+    return FAILURE;
+  }
+
+  // Names are only looked up once, reconnects go to the same address
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  res = getaddrinfo(p_stream->host, NULL, &hints, &p_info);
+  if (res != 0)
+  {
+    LOG_ERROR("Can't find server %s: %s", p_stream->host, gai_strerror(res));
+    return FAILURE;
+  }
+  memcpy(&p_stream->addr, p_info->ai_addr, sizeof(p_stream->addr));
+  p_stream->addr.sin_port = htons(p_stream->port);
+  freeaddrinfo(p_info);
+
+  // With more than one server each is kept apart in its own directory
+  if (own_dir)
+  {
+    snprintf(p_stream->root, CLIENT_ROOT_MAX, "%.*s_%d", (int32_t)host_len, p_server, p_stream->port);
+    EQ_RET_E(res, create_dir(p_stream->root), FAILURE, FAILURE);
+  }
+
+  // The receive buffer comes from locked frame memory
+  EQ_RET_E(p_stream->image_buf, frame_mem_alloc(ENC_MAX_BYTES), NULL, FAILURE);
+  p_stream->sockfd = -1;
+  p_stream->state = STREAM_IDLE;
+  p_stream->backoff_ms = CLIENT_BACKOFF_MIN_MS;
+  latency_reset(&p_stream->lag);
+  return SUCCESS;
+} // client_stream_init()
+
+uint32_t client_init(uint32_t count, char ** pp_servers)
+{
+  FUNC_ENTRY;
+  char * p_default = ADDRESS;
   pthread_t client_thread;
+  struct sigaction action;
+  sigset_t stop_mask;
   int32_t res = 0;
-  int32_t rt_max_pri = 0;
-  int32_t client_policy = 0;
-
-  // Semaphore for signaling done
-  PT_NOT_EQ_EXIT(res, sem_init(&done, 0, 0), SUCCESS);
-
-  // Try to create directory for storing images
-  EQ_RET_E(res, create_dir(DIR_NAME), FAILURE, FAILURE);
-
-  // Initialize the schedule attributes
-  PT_NOT_EQ_RET(res, pthread_attr_init(&sched_attr), SUCCESS, FAILURE);
-
-  // Set the attributes structure to PTHREAD_EXPLICIT_SCHED and SCHED_FIFO
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setinheritsched(&sched_attr, PTHREAD_EXPLICIT_SCHED),
-                SUCCESS,
-                FAILURE);
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setschedpolicy(&sched_attr, SCHED_FIFO),
-                SUCCESS,
-                FAILURE);
-
-  // Get the max priority
-  EQ_RET_E(rt_max_pri, sched_get_priority_max(SCHED_FIFO), -1, FAILURE);
-
-  // Set the priority to max - 1 for the test thread
-  sched.sched_priority = rt_max_pri - 4;
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setschedparam(&sched_attr, &sched),
-                SUCCESS,
-                FAILURE);
-
-  // Create pthread
-  PT_NOT_EQ_RET(res,
-                pthread_create(&client_thread, &sched_attr, client_service, NULL),
-                SUCCESS,
-                FAILURE);
-
-  // Get the scheduler parameters to display
-  PT_NOT_EQ_RET(res,
-                pthread_getschedparam(client_thread, &client_policy, &client_sched),
-                SUCCESS,
-                FAILURE);
-  LOG_HIGH("client_service policy: %d, priority: %d",
-           client_policy,
-           client_sched.sched_priority);
+
+  if (count == 0)
+  {
+    count = 1;
+    pp_servers = &p_default;
+  }
+  if (count > CLIENT_MAX_SERVERS)
+  {
+    LOG_ERROR("%d servers given, at most %d are supported", count, CLIENT_MAX_SERVERS);
+    return FAILURE;
+  }
+
+  // Lock and prefault memory for a receive buffer per server
+  EQ_RET_E(res, frame_mem_init((size_t)count * ENC_MAX_BYTES), FAILURE, FAILURE);
+  for (num_streams = 0; num_streams < count; num_streams++)
+  {
+    EQ_RET_E(res,
+             client_stream_init(&streams[num_streams], pp_servers[num_streams], count > 1),
+             FAILURE,
+             FAILURE);
+  }
+
+  // Stop on SIGINT and SIGTERM.  The service thread inherits the blocked
+  // mask and only unblocks them while waiting, so this thread never takes
+  // them.
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = client_signal;
+  sigemptyset(&stop_mask);
+  sigaddset(&stop_mask, SIGINT);
+  sigaddset(&stop_mask, SIGTERM);
+  PT_NOT_EQ_RET(res, pthread_sigmask(SIG_BLOCK, &stop_mask, &wait_mask), SUCCESS, FAILURE);
+  EQ_RET_E(res, sigaction(SIGINT, &action, NULL), -1, FAILURE);
+  EQ_RET_E(res, sigaction(SIGTERM, &action, NULL), -1, FAILURE);
+
+  // Start the service thread with its configured priority and affinity
+  EQ_RET_E(res,
+           service_launch("client_service", client_service, NULL, &client_thread),
+           FAILURE,
+           FAILURE);
 
   // Wait for thread to join
   pthread_join(client_thread, NULL);
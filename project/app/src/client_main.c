@@ -5,9 +5,19 @@
 */
 
 #include <stdint.h>
+#include <unistd.h>
 #include <client.h>
+#include <project_defs.h>
+#include <service.h>
 
-int main()
+int main(int argc, char ** argv)
 {
-  return client_init();
+  // Load the service configuration from the command line
+  if (service_args(argc, argv) != SUCCESS)
+  {
+    return FAILURE;
+  }
+
+  // Everything after the options is a server to collect from
+  return client_init(argc - optind, argv + optind);
 }
@@ -0,0 +1,318 @@
+/** @file enc_pool.c
+*
+* @brief Size classed slab allocator for encoded frames.  Each class keeps
+*        its free buffers on a Treiber stack whose head carries a tag that
+*        changes on every push and pop, so a buffer freed and reused between
+*        a reader's load and its compare and swap can't corrupt the list.
+*        Buffers are never given back to frame memory, so reading a next
+*        link that went stale is always safe.
+*
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "enc_pool.h"
+#include "frame_mem.h"
+#include "log.h"
+#include "project_defs.h"
+
+// Alignment of every buffer, and the unit links count in
+#define ENC_POOL_ALIGN (64)
+
+// Free list link, a buffer's offset in units of ENC_POOL_ALIGN plus one so
+// zero ends the list
+#define ENC_POOL_NONE (0)
+#define ENC_POOL_LINK(p_hdr) ((uint32_t)(((uint8_t *)(p_hdr) - pool.p_base) / ENC_POOL_ALIGN) + 1)
+#define ENC_POOL_HDR(link) ((enc_pool_hdr_t *)(pool.p_base + (size_t)((link) - 1) * ENC_POOL_ALIGN))
+
+// Free list head, the link in the low half and the tag in the high half
+#define ENC_POOL_HEAD(tag, link) (((uint64_t)(tag) << 32) | (link))
+#define ENC_POOL_HEAD_TAG(head) ((uint32_t)((head) >> 32))
+#define ENC_POOL_HEAD_LINK(head) ((uint32_t)(head))
+
+#define BYTES_PER_KB (1024)
+
+// Header in front of every buffer, a whole line so the data stays aligned
+typedef struct enc_pool_hdr {
+  uint32_t next;
+  uint32_t cls;
+  uint32_t refs;
+} __attribute__((aligned(ENC_POOL_ALIGN))) enc_pool_hdr_t;
+
+// Free list and usage of a size class
+typedef struct enc_pool_class {
+  uint64_t head;
+  uint32_t carved;
+  uint32_t in_use;
+  uint32_t peak;
+} __attribute__((aligned(ENC_POOL_ALIGN))) enc_pool_class_t;
+
+static struct {
+  uint8_t * p_base;
+  uint64_t size;
+  uint64_t carved;
+  uint64_t in_use;
+  uint64_t peak;
+  uint32_t failed;
+  enc_pool_class_t classes[ENC_POOL_CLASSES];
+} pool;
+
+/*!
+* @brief Gets the bytes of each buffer of a class, including its header
+* @param cls size class
+* @return bytes
+*/
+static inline
+uint32_t enc_pool_class_size(uint32_t cls)
+{
+  return (uint32_t)1 << (cls + ENC_POOL_MIN_SHIFT);
+} // enc_pool_class_size()
+
+/*!
+* @brief Raises a 32 bit high water mark
+* @param p_peak high water mark
+* @param value value reached
+*/
+static inline
+void enc_pool_peak32(uint32_t * p_peak, uint32_t value)
+{
+  uint32_t peak = __atomic_load_n(p_peak, __ATOMIC_RELAXED);
+
+  while (value > peak &&
+         !__atomic_compare_exchange_n(p_peak, &peak, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+  }
+} // enc_pool_peak32()
+
+/*!
+* @brief Raises a 64 bit high water mark
+* @param p_peak high water mark
+* @param value value reached
+*/
+static inline
+void enc_pool_peak64(uint64_t * p_peak, uint64_t value)
+{
+  uint64_t peak = __atomic_load_n(p_peak, __ATOMIC_RELAXED);
+
+  while (value > peak &&
+         !__atomic_compare_exchange_n(p_peak, &peak, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+  }
+} // enc_pool_peak64()
+
+/*!
+* @brief Pushes a buffer on the free list of its class
+* @param p_class class of the buffer
+* @param p_hdr header of the buffer
+*/
+static
+void enc_pool_push(enc_pool_class_t * p_class, enc_pool_hdr_t * p_hdr)
+{
+  uint64_t head = __atomic_load_n(&p_class->head, __ATOMIC_RELAXED);
+  uint64_t next;
+
+  do
+  {
+    __atomic_store_n(&p_hdr->next, ENC_POOL_HEAD_LINK(head), __ATOMIC_RELAXED);
+    next = ENC_POOL_HEAD(ENC_POOL_HEAD_TAG(head) + 1, ENC_POOL_LINK(p_hdr));
+  } while (!__atomic_compare_exchange_n(&p_class->head, &head, next, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+} // enc_pool_push()
+
+/*!
+* @brief Pops a buffer off the free list of a class
+* @param p_class class to pop from
+* @return header of the buffer or NULL when the list is empty
+*/
+static
+enc_pool_hdr_t * enc_pool_pop(enc_pool_class_t * p_class)
+{
+  uint64_t head = __atomic_load_n(&p_class->head, __ATOMIC_ACQUIRE);
+  enc_pool_hdr_t * p_hdr;
+  uint64_t next;
+
+  do
+  {
+    if (ENC_POOL_HEAD_LINK(head) == ENC_POOL_NONE)
+    {
+      return NULL;
+    }
+
+    // The buffer may be popped by another thread before this reads its
+    // link, the tag then fails the swap
+    p_hdr = ENC_POOL_HDR(ENC_POOL_HEAD_LINK(head));
+    next = ENC_POOL_HEAD(ENC_POOL_HEAD_TAG(head) + 1, __atomic_load_n(&p_hdr->next, __ATOMIC_RELAXED));
+  } while (!__atomic_compare_exchange_n(&p_class->head, &head, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+  return p_hdr;
+} // enc_pool_pop()
+
+/*!
+* @brief Carves a slab for a class out of the pool, keeping one buffer and
+*        putting the rest on the free list.  Only one buffer is carved when
+*        a whole slab no longer fits.
+* @param cls size class
+* @return header of the buffer kept or NULL when the pool is used up
+*/
+static
+enc_pool_hdr_t * enc_pool_carve(uint32_t cls)
+{
+  enc_pool_class_t * p_class = &pool.classes[cls];
+  uint32_t size = enc_pool_class_size(cls);
+  uint32_t count = (size < ENC_POOL_SLAB_BYTES) ? ENC_POOL_SLAB_BYTES / size : 1;
+  uint64_t offset = __atomic_load_n(&pool.carved, __ATOMIC_RELAXED);
+  enc_pool_hdr_t * p_hdr;
+
+  do
+  {
+    if (offset + (uint64_t)count * size > pool.size)
+    {
+      count = 1;
+    }
+    if (offset + size > pool.size)
+    {
+      return NULL;
+    }
+  } while (!__atomic_compare_exchange_n(&pool.carved,
+                                        &offset,
+                                        offset + (uint64_t)count * size,
+                                        1,
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+
+  __atomic_fetch_add(&p_class->carved, count, __ATOMIC_RELAXED);
+  for (uint32_t buf = 1; buf < count; buf++)
+  {
+    p_hdr = (enc_pool_hdr_t *)(pool.p_base + offset + (uint64_t)buf * size);
+    p_hdr->cls = cls;
+    enc_pool_push(p_class, p_hdr);
+  }
+  p_hdr = (enc_pool_hdr_t *)(pool.p_base + offset);
+  p_hdr->cls = cls;
+  return p_hdr;
+} // enc_pool_carve()
+
+uint32_t enc_pool_init(size_t size)
+{
+  FUNC_ENTRY;
+
+  EQ_RET_E(pool.p_base, frame_mem_alloc(size), NULL, FAILURE);
+  pool.size = size;
+  return SUCCESS;
+} // enc_pool_init()
+
+uint8_t * enc_pool_get(uint32_t size)
+{
+  enc_pool_hdr_t * p_hdr = NULL;
+  uint32_t first = 0;
+  uint32_t cls;
+  uint32_t in_use;
+
+  // Smallest class the buffer and its header fit
+  while (first < ENC_POOL_CLASSES && enc_pool_class_size(first) - sizeof(enc_pool_hdr_t) < size)
+  {
+    first++;
+  }
+  if (first == ENC_POOL_CLASSES)
+  {
+    LOG_ERROR("No size class fits %u bytes", size);
+    return NULL;
+  }
+
+  // A free buffer of the class, a new slab of the class, or a free buffer
+  // of a bigger class
+  cls = first;
+  if ((p_hdr = enc_pool_pop(&pool.classes[cls])) == NULL &&
+      (p_hdr = enc_pool_carve(cls)) == NULL)
+  {
+    for (cls = first + 1; cls < ENC_POOL_CLASSES; cls++)
+    {
+      if ((p_hdr = enc_pool_pop(&pool.classes[cls])) != NULL)
+      {
+        break;
+      }
+    }
+  }
+  if (p_hdr == NULL)
+  {
+    __atomic_fetch_add(&pool.failed, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  in_use = __atomic_add_fetch(&pool.classes[cls].in_use, 1, __ATOMIC_RELAXED);
+  enc_pool_peak32(&pool.classes[cls].peak, in_use);
+  enc_pool_peak64(&pool.peak,
+                  __atomic_add_fetch(&pool.in_use, enc_pool_class_size(cls), __ATOMIC_RELAXED));
+  __atomic_store_n(&p_hdr->refs, 1, __ATOMIC_RELAXED);
+  return (uint8_t *)(p_hdr + 1);
+} // enc_pool_get()
+
+void enc_pool_ref(uint8_t * p_buf)
+{
+  enc_pool_hdr_t * p_hdr = (enc_pool_hdr_t *)p_buf - 1;
+
+  __atomic_fetch_add(&p_hdr->refs, 1, __ATOMIC_RELAXED);
+} // enc_pool_ref()
+
+void enc_pool_put(uint8_t * p_buf)
+{
+  enc_pool_hdr_t * p_hdr = (enc_pool_hdr_t *)p_buf - 1;
+  uint32_t refs = __atomic_load_n(&p_hdr->refs, __ATOMIC_RELAXED);
+
+  // Never take the count below 0, a buffer put once too often stays free
+  do
+  {
+    if (refs == 0)
+    {
+      LOG_ERROR("Buffer %p was already free", (void *)p_buf);
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&p_hdr->refs, &refs, refs - 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  if (refs == 1)
+  {
+    __atomic_fetch_sub(&pool.classes[p_hdr->cls].in_use, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&pool.in_use, enc_pool_class_size(p_hdr->cls), __ATOMIC_RELAXED);
+    enc_pool_push(&pool.classes[p_hdr->cls], p_hdr);
+  }
+} // enc_pool_put()
+
+void enc_pool_stats(enc_pool_stats_t * p_stats)
+{
+  p_stats->size = pool.size;
+  p_stats->carved = __atomic_load_n(&pool.carved, __ATOMIC_RELAXED);
+  p_stats->in_use = __atomic_load_n(&pool.in_use, __ATOMIC_RELAXED);
+  p_stats->peak = __atomic_load_n(&pool.peak, __ATOMIC_RELAXED);
+  p_stats->failed = __atomic_load_n(&pool.failed, __ATOMIC_RELAXED);
+  for (uint32_t cls = 0; cls < ENC_POOL_CLASSES; cls++)
+  {
+    p_stats->classes[cls].size = enc_pool_class_size(cls);
+    p_stats->classes[cls].carved = __atomic_load_n(&pool.classes[cls].carved, __ATOMIC_RELAXED);
+    p_stats->classes[cls].in_use = __atomic_load_n(&pool.classes[cls].in_use, __ATOMIC_RELAXED);
+    p_stats->classes[cls].peak = __atomic_load_n(&pool.classes[cls].peak, __ATOMIC_RELAXED);
+  }
+} // enc_pool_stats()
+
+void enc_pool_report()
+{
+  FUNC_ENTRY;
+  enc_pool_stats_t stats;
+
+  enc_pool_stats(&stats);
+  LOG_HIGH("Encoded frame pool: %lluKB of %lluKB carved, peak %lluKB in use, %u frames found it used up",
+           (unsigned long long)stats.carved / BYTES_PER_KB,
+           (unsigned long long)stats.size / BYTES_PER_KB,
+           (unsigned long long)stats.peak / BYTES_PER_KB,
+           stats.failed);
+  for (uint32_t cls = 0; cls < ENC_POOL_CLASSES; cls++)
+  {
+    if (stats.classes[cls].carved == 0)
+    {
+      continue;
+    }
+    LOG_HIGH("%5uKB buffers: %u carved, peak %u in use",
+             stats.classes[cls].size / BYTES_PER_KB,
+             stats.classes[cls].carved,
+             stats.classes[cls].peak);
+  }
+} // enc_pool_report()
@@ -0,0 +1,364 @@
+/** @file frame.c
+*
+* @brief Pixel formats of captured frames and the conversions to RGB used
+*        by the PPM writer and the preview.  The YUYV kernel is vectorized
+*        with SSE2 or NEON, the B, G, R swap with SSSE3 or NEON, and the
+*        scalar code gives the same results.
+*
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif /* __SSE2__ */
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif /* __SSSE3__ */
+
+#include "frame.h"
+#include "log.h"
+#include "project_defs.h"
+
+// BT.601 limited range to RGB in 6 bit fixed point, small enough to work in
+// 16 bit lanes
+#define YUV_SHIFT (6)
+#define YUV_ROUND (1 << (YUV_SHIFT - 1))
+#define YUV_Y (74)
+#define YUV_RV (102)
+#define YUV_GU (25)
+#define YUV_GV (52)
+#define YUV_BU (129)
+#define YUV_Y_OFFSET (16)
+#define YUV_C_OFFSET (128)
+
+#define RGB_BYTES_PER_PIXEL (3)
+
+static const char * format_names[PIX_FMTS] = {
+  "BGR24",
+  "YUYV",
+  "YUV420"
+};
+
+const char * frame_format_name(pix_fmt_t format)
+{
+  return format < PIX_FMTS ? format_names[format] : "unknown";
+} // frame_format_name()
+
+uint32_t frame_plane_rows(pix_fmt_t format, uint32_t height, uint32_t plane)
+{
+  if (plane == 0)
+  {
+    return height;
+  }
+  return (format == PIX_FMT_YUV420) ? (height + 1) / 2 : 0;
+} // frame_plane_rows()
+
+uint32_t frame_from_image(frame_t * p_frame, IplImage * p_image)
+{
+  CHECK_NULL(p_image);
+  memset(p_frame, 0, sizeof(*p_frame));
+  p_frame->format = PIX_FMT_BGR24;
+  p_frame->width = p_image->width;
+  p_frame->height = p_image->height;
+  p_frame->planes[0] = (uint8_t *)p_image->imageData;
+  p_frame->strides[0] = p_image->widthStep;
+  p_frame->image = p_image;
+  return SUCCESS;
+} // frame_from_image()
+
+/*!
+* @brief Clamps a fixed point result to a color intensity
+* @param value result before the shift
+* @return intensity
+*/
+static inline
+uint8_t yuv_clamp(int32_t value)
+{
+  value = (value + YUV_ROUND) >> YUV_SHIFT;
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+} // yuv_clamp()
+
+/*!
+* @brief Converts one pixel
+* @param y luma
+* @param u Cb
+* @param v Cr
+* @param p_dst 3 byte pixel
+* @param bgr 1 for B, G, R order
+*/
+static inline
+void yuv_pixel(int32_t y, int32_t u, int32_t v, uint8_t * p_dst, uint8_t bgr)
+{
+  int32_t luma = (y - YUV_Y_OFFSET) * YUV_Y;
+  uint8_t red;
+  uint8_t blue;
+
+  u -= YUV_C_OFFSET;
+  v -= YUV_C_OFFSET;
+  red = yuv_clamp(luma + YUV_RV * v);
+  blue = yuv_clamp(luma + YUV_BU * u);
+  p_dst[0] = bgr ? blue : red;
+  p_dst[1] = yuv_clamp(luma - YUV_GU * u - YUV_GV * v);
+  p_dst[2] = bgr ? red : blue;
+} // yuv_pixel()
+
+#if defined(__SSE2__)
+// Pixels converted per SSE2 step
+#define YUYV_STEP (8)
+
+/*!
+* @brief Converts 8 YUYV pixels with SSE2
+* @param p_src 16 bytes of YUYV
+* @param p_dst 24 bytes of 3 byte pixels
+* @param bgr 1 for B, G, R order
+*/
+static inline
+void yuyv_step(const uint8_t * p_src, uint8_t * p_dst, uint8_t bgr)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i src = _mm_loadu_si128((const __m128i *)p_src);
+  __m128i luma;
+  __m128i chroma;
+  __m128i u;
+  __m128i v;
+  __m128i red;
+  __m128i green;
+  __m128i blue;
+  __m128i pixels[2];
+  uint32_t out[YUYV_STEP];
+
+  // Split into 16 bit luma and chroma, then give each pixel its pair's Cb
+  // and Cr
+  luma = _mm_and_si128(src, _mm_set1_epi16(0xff));
+  chroma = _mm_srli_epi16(src, 8);
+  u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(chroma, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+  v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(chroma, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+  luma = _mm_mullo_epi16(_mm_sub_epi16(luma, _mm_set1_epi16(YUV_Y_OFFSET)), _mm_set1_epi16(YUV_Y));
+  luma = _mm_add_epi16(luma, _mm_set1_epi16(YUV_ROUND));
+  u = _mm_sub_epi16(u, _mm_set1_epi16(YUV_C_OFFSET));
+  v = _mm_sub_epi16(v, _mm_set1_epi16(YUV_C_OFFSET));
+
+  // Saturating adds only clip results that clamp to 255 anyway
+  red = _mm_adds_epi16(luma, _mm_mullo_epi16(v, _mm_set1_epi16(YUV_RV)));
+  green = _mm_subs_epi16(luma, _mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(YUV_GU)),
+                                             _mm_mullo_epi16(v, _mm_set1_epi16(YUV_GV))));
+  blue = _mm_adds_epi16(luma, _mm_mullo_epi16(u, _mm_set1_epi16(YUV_BU)));
+  red = _mm_packus_epi16(_mm_srai_epi16(red, YUV_SHIFT), zero);
+  green = _mm_packus_epi16(_mm_srai_epi16(green, YUV_SHIFT), zero);
+  blue = _mm_packus_epi16(_mm_srai_epi16(blue, YUV_SHIFT), zero);
+  if (bgr)
+  {
+    __m128i swap = red;
+    red = blue;
+    blue = swap;
+  }
+
+  // Interleave into 4 byte pixels and store 3 bytes of each
+  red = _mm_unpacklo_epi8(red, green);
+  blue = _mm_unpacklo_epi8(blue, zero);
+  pixels[0] = _mm_unpacklo_epi16(red, blue);
+  pixels[1] = _mm_unpackhi_epi16(red, blue);
+  _mm_storeu_si128((__m128i *)&out[0], pixels[0]);
+  _mm_storeu_si128((__m128i *)&out[4], pixels[1]);
+  for (uint32_t pixel = 0; pixel < YUYV_STEP - 1; pixel++)
+  {
+    memcpy(&p_dst[pixel * RGB_BYTES_PER_PIXEL], &out[pixel], sizeof(uint32_t));
+  }
+  memcpy(&p_dst[(YUYV_STEP - 1) * RGB_BYTES_PER_PIXEL], &out[YUYV_STEP - 1], RGB_BYTES_PER_PIXEL);
+} // yuyv_step()
+#elif defined(__ARM_NEON)
+// Pixels converted per NEON step
+#define YUYV_STEP (16)
+
+/*!
+* @brief Converts 16 YUYV pixels with NEON
+* @param p_src 32 bytes of YUYV
+* @param p_dst 48 bytes of 3 byte pixels
+* @param bgr 1 for B, G, R order
+*/
+static inline
+void yuyv_step(const uint8_t * p_src, uint8_t * p_dst, uint8_t bgr)
+{
+  // Even luma, Cb, odd luma, Cr
+  uint8x8x4_t src = vld4_u8(p_src);
+  int16x8_t even = vreinterpretq_s16_u16(vmovl_u8(src.val[0]));
+  int16x8_t odd = vreinterpretq_s16_u16(vmovl_u8(src.val[2]));
+  int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(src.val[1])), vdupq_n_s16(YUV_C_OFFSET));
+  int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(src.val[3])), vdupq_n_s16(YUV_C_OFFSET));
+  int16x8_t red = vmulq_n_s16(v, YUV_RV);
+  int16x8_t green = vaddq_s16(vmulq_n_s16(u, YUV_GU), vmulq_n_s16(v, YUV_GV));
+  int16x8_t blue = vmulq_n_s16(u, YUV_BU);
+  uint8x8x2_t reds;
+  uint8x8x2_t greens;
+  uint8x8x2_t blues;
+  uint8x8x3_t out;
+
+  even = vmulq_n_s16(vsubq_s16(even, vdupq_n_s16(YUV_Y_OFFSET)), YUV_Y);
+  odd = vmulq_n_s16(vsubq_s16(odd, vdupq_n_s16(YUV_Y_OFFSET)), YUV_Y);
+
+  // Rounding narrow shifts clamp to intensities, saturating adds only clip
+  // results that clamp to 255 anyway
+  reds = vzip_u8(vqrshrun_n_s16(vqaddq_s16(even, red), YUV_SHIFT),
+                 vqrshrun_n_s16(vqaddq_s16(odd, red), YUV_SHIFT));
+  greens = vzip_u8(vqrshrun_n_s16(vqsubq_s16(even, green), YUV_SHIFT),
+                   vqrshrun_n_s16(vqsubq_s16(odd, green), YUV_SHIFT));
+  blues = vzip_u8(vqrshrun_n_s16(vqaddq_s16(even, blue), YUV_SHIFT),
+                  vqrshrun_n_s16(vqaddq_s16(odd, blue), YUV_SHIFT));
+
+  for (uint32_t half = 0; half < 2; half++)
+  {
+    out.val[0] = bgr ? blues.val[half] : reds.val[half];
+    out.val[1] = greens.val[half];
+    out.val[2] = bgr ? reds.val[half] : blues.val[half];
+    vst3_u8(&p_dst[half * (YUYV_STEP / 2) * RGB_BYTES_PER_PIXEL], out);
+  }
+} // yuyv_step()
+#endif /* __SSE2__ */
+
+void yuyv_to_rgb_row(const uint8_t * p_src, uint8_t * p_dst, uint32_t width, uint8_t bgr)
+{
+  uint32_t pixel = 0;
+
+#ifdef YUYV_STEP
+  for (; pixel + YUYV_STEP <= width; pixel += YUYV_STEP)
+  {
+    yuyv_step(&p_src[pixel * 2], &p_dst[pixel * RGB_BYTES_PER_PIXEL], bgr);
+  }
+#endif /* YUYV_STEP */
+
+  // Pixels left over from the vector steps
+  for (; pixel + 1 < width; pixel += 2)
+  {
+    const uint8_t * p_pair = &p_src[pixel * 2];
+    yuv_pixel(p_pair[0], p_pair[1], p_pair[3], &p_dst[pixel * RGB_BYTES_PER_PIXEL], bgr);
+    yuv_pixel(p_pair[2], p_pair[1], p_pair[3], &p_dst[(pixel + 1) * RGB_BYTES_PER_PIXEL], bgr);
+  }
+} // yuyv_to_rgb_row()
+
+/*!
+* @brief Swaps the first and third byte of every 3 byte pixel, B, G, R to
+*        R, G, B and back.  Uses SSSE3 or NEON when built for them.
+* @param p_src row of 3 byte pixels
+* @param p_dst row of 3 byte pixels
+* @param width pixels in the row
+*/
+static
+void swap_rb_row(const uint8_t * p_src, uint8_t * p_dst, uint32_t width)
+{
+  uint32_t pixel = 0;
+
+#if defined(__SSSE3__)
+  // 5 pixels of each 16 byte load, the 16th byte is written again by the
+  // next step so a step needs a pixel to spare
+  const __m128i swap = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+  for (; pixel + 6 <= width; pixel += 5)
+  {
+    __m128i src = _mm_loadu_si128((const __m128i *)&p_src[pixel * RGB_BYTES_PER_PIXEL]);
+    _mm_storeu_si128((__m128i *)&p_dst[pixel * RGB_BYTES_PER_PIXEL], _mm_shuffle_epi8(src, swap));
+  }
+#elif defined(__ARM_NEON)
+  for (; pixel + 16 <= width; pixel += 16)
+  {
+    uint8x16x3_t src = vld3q_u8(&p_src[pixel * RGB_BYTES_PER_PIXEL]);
+    uint8x16_t red = src.val[0];
+
+    src.val[0] = src.val[2];
+    src.val[2] = red;
+    vst3q_u8(&p_dst[pixel * RGB_BYTES_PER_PIXEL], src);
+  }
+#endif /* __SSSE3__ */
+
+  // Pixels left over from the vector steps
+  for (; pixel < width; pixel++)
+  {
+    const uint8_t * p_pixel = &p_src[pixel * RGB_BYTES_PER_PIXEL];
+    uint8_t * p_out = &p_dst[pixel * RGB_BYTES_PER_PIXEL];
+
+    p_out[0] = p_pixel[2];
+    p_out[1] = p_pixel[1];
+    p_out[2] = p_pixel[0];
+  }
+} // swap_rb_row()
+
+/*!
+* @brief Converts a row of 4:2:0 planar pixels
+* @param p_y luma row
+* @param p_u Cb row shared with the neighbouring luma row
+* @param p_v Cr row shared with the neighbouring luma row
+* @param p_dst row of 3 byte pixels
+* @param width pixels in the row
+* @param bgr 1 for B, G, R order
+*/
+static
+void yuv420_to_rgb_row(const uint8_t * p_y,
+                       const uint8_t * p_u,
+                       const uint8_t * p_v,
+                       uint8_t * p_dst,
+                       uint32_t width,
+                       uint8_t bgr)
+{
+  for (uint32_t pixel = 0; pixel < width; pixel++)
+  {
+    yuv_pixel(p_y[pixel], p_u[pixel / 2], p_v[pixel / 2], &p_dst[pixel * RGB_BYTES_PER_PIXEL], bgr);
+  }
+} // yuv420_to_rgb_row()
+
+uint32_t frame_convert_rows(const frame_t * p_frame,
+                            uint32_t first,
+                            uint32_t rows,
+                            uint8_t * p_dst,
+                            uint32_t dst_stride,
+                            uint8_t bgr)
+{
+  CHECK_NULL(p_frame);
+  CHECK_NULL(p_dst);
+
+  for (uint32_t row = first; row < first + rows && row < p_frame->height; row++)
+  {
+    const uint8_t * p_src = p_frame->planes[0] + row * p_frame->strides[0];
+    uint8_t * p_row = p_dst + (row - first) * dst_stride;
+
+    switch (p_frame->format)
+    {
+      case PIX_FMT_BGR24:
+        if (bgr)
+        {
+          memcpy(p_row, p_src, p_frame->width * RGB_BYTES_PER_PIXEL);
+          break;
+        }
+        swap_rb_row(p_src, p_row, p_frame->width);
+        break;
+      case PIX_FMT_YUYV:
+        yuyv_to_rgb_row(p_src, p_row, p_frame->width, bgr);
+        break;
+      case PIX_FMT_YUV420:
+        yuv420_to_rgb_row(p_src,
+                          p_frame->planes[1] + (row / 2) * p_frame->strides[1],
+                          p_frame->planes[2] + (row / 2) * p_frame->strides[2],
+                          p_row,
+                          p_frame->width,
+                          bgr);
+        break;
+      default:
+        LOG_ERROR("Can't convert %s frames", frame_format_name(p_frame->format));
+        return FAILURE;
+    }
+  }
+  return SUCCESS;
+} // frame_convert_rows()
+
+uint32_t frame_to_rgb(const frame_t * p_frame, uint8_t * p_dst, uint32_t dst_stride)
+{
+  CHECK_NULL(p_frame);
+  return frame_convert_rows(p_frame, 0, p_frame->height, p_dst, dst_stride, 0);
+} // frame_to_rgb()
+
+uint32_t frame_to_bgr(const frame_t * p_frame, uint8_t * p_dst, uint32_t dst_stride)
+{
+  CHECK_NULL(p_frame);
+  return frame_convert_rows(p_frame, 0, p_frame->height, p_dst, dst_stride, 1);
+} // frame_to_bgr()
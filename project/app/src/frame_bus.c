@@ -0,0 +1,321 @@
+/** @file frame_bus.c
+*
+* @brief Publishes frames into a shared memory ring and reads them in place.
+*        Slots use a seqlock, the publisher makes a slot's lock odd, copies
+*        the frame in, and makes it even again, a reader knows a frame is
+*        good when the lock is the same even value before and after using
+*        it.  Readers sleep on the published count with a shared futex, so
+*        the only syscall in the steady state is the publisher's wake.
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "frame_bus.h"
+#include "log.h"
+#include "project_defs.h"
+
+#define FRAME_BUS_PAGE (4096)
+#define FRAME_BUS_PERM (0644)
+#define NSEC_PER_SEC (1000000000l)
+#define NSEC_PER_MSEC (1000000l)
+
+// Rounds a size up to a multiple of a power of 2
+#define FRAME_BUS_ROUND(size, align) (((size) + (align) - 1) & ~((size_t)(align) - 1))
+
+uint32_t frame_bus_create(frame_bus_t * p_bus, const char * p_name, uint32_t slot_bytes, uint32_t period_us)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_bus);
+  CHECK_NULL(p_name);
+
+  frame_bus_hdr_t * p_hdr;
+  int32_t fd = -1;
+  size_t data_offset = FRAME_BUS_ROUND(sizeof(frame_bus_hdr_t), FRAME_BUS_PAGE);
+
+  memset(p_bus, 0, sizeof(*p_bus));
+  strncpy(p_bus->name, p_name, FRAME_BUS_NAME_MAX - 1);
+  // Each plane starts aligned, leave room for the padding of every plane
+  slot_bytes = FRAME_BUS_ROUND(slot_bytes, FRAME_BUS_ALIGN) + FRAME_PLANES * FRAME_BUS_ALIGN;
+  p_bus->len = data_offset + (size_t)slot_bytes * FRAME_BUS_SLOTS;
+
+  // Readers still mapping the bus of an earlier run keep the old object
+  shm_unlink(p_name);
+  EQ_RET_E(fd, shm_open(p_name, O_RDWR | O_CREAT | O_EXCL, FRAME_BUS_PERM), -1, FAILURE);
+  if (ftruncate(fd, p_bus->len) == -1)
+  {
+    LOG_ERROR("ftruncate of %s failed with error: %s", p_name, strerror(errno));
+    close(fd);
+    shm_unlink(p_name);
+    return FAILURE;
+  }
+  p_hdr = mmap(NULL, p_bus->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p_hdr == MAP_FAILED)
+  {
+    LOG_ERROR("mmap of %s failed with error: %s", p_name, strerror(errno));
+    shm_unlink(p_name);
+    return FAILURE;
+  }
+
+  // Touch every page now so publishing never faults
+  memset(p_hdr, 0, p_bus->len);
+  p_hdr->version = FRAME_BUS_VERSION;
+  p_hdr->slot_hdr_size = sizeof(frame_bus_slot_t);
+  p_hdr->slots = FRAME_BUS_SLOTS;
+  p_hdr->slot_bytes = slot_bytes;
+  p_hdr->data_offset = data_offset;
+  p_hdr->period_us = period_us;
+
+  // Readers only trust the header once the magic is there
+  __atomic_store_n(&p_hdr->magic, FRAME_BUS_MAGIC, __ATOMIC_RELEASE);
+
+  p_bus->p_hdr = p_hdr;
+  p_bus->p_data = (uint8_t *)p_hdr + data_offset;
+  p_bus->publisher = 1;
+  LOG_MED("Publishing frames to %s, %d slots of %d bytes", p_name, FRAME_BUS_SLOTS, slot_bytes);
+  return SUCCESS;
+} // frame_bus_create()
+
+uint32_t frame_bus_publish(frame_bus_t * p_bus, const frame_t * p_frame, uint32_t seq, uint32_t cam, const struct timespec * p_time)
+{
+  CHECK_NULL(p_bus);
+  CHECK_NULL(p_frame);
+  CHECK_NULL(p_time);
+
+  frame_bus_hdr_t * p_hdr = p_bus->p_hdr;
+  uint32_t frame = p_hdr->published;
+  frame_bus_slot_t * p_slot = &p_hdr->slot[frame % FRAME_BUS_SLOTS];
+  uint8_t * p_dst = p_bus->p_data + (size_t)(frame % FRAME_BUS_SLOTS) * p_hdr->slot_bytes;
+  uint32_t lock = p_slot->lock;
+  uint32_t plane_bytes[FRAME_PLANES];
+  uint32_t size = 0;
+
+  for (uint32_t plane = 0; plane < FRAME_PLANES; plane++)
+  {
+    plane_bytes[plane] = frame_plane_rows(p_frame->format, p_frame->height, plane) * p_frame->strides[plane];
+    size += FRAME_BUS_ROUND(plane_bytes[plane], FRAME_BUS_ALIGN);
+  }
+  if (size > p_hdr->slot_bytes)
+  {
+    LOG_ERROR("Frame of %d bytes doesn't fit a %d byte slot", size, p_hdr->slot_bytes);
+    return FAILURE;
+  }
+
+  // Odd lock first so readers see the slot is being overwritten before any
+  // of the frame changes
+  __atomic_store_n(&p_slot->lock, lock + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  size = 0;
+  for (uint32_t plane = 0; plane < FRAME_PLANES; plane++)
+  {
+    p_slot->offsets[plane] = size;
+    p_slot->strides[plane] = plane_bytes[plane] ? p_frame->strides[plane] : 0;
+    if (plane_bytes[plane] > 0)
+    {
+      memcpy(p_dst + size, p_frame->planes[plane], plane_bytes[plane]);
+    }
+    size += FRAME_BUS_ROUND(plane_bytes[plane], FRAME_BUS_ALIGN);
+  }
+  p_slot->frame = frame;
+  p_slot->seq = seq;
+  p_slot->cam = cam;
+  p_slot->format = p_frame->format;
+  p_slot->width = p_frame->width;
+  p_slot->height = p_frame->height;
+  p_slot->size = size;
+  p_slot->cap_sec = p_time->tv_sec;
+  p_slot->cap_nsec = p_time->tv_nsec;
+
+  // Even lock once the frame is all there, then hand it to readers
+  __atomic_store_n(&p_slot->lock, lock + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&p_hdr->published, frame + 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &p_hdr->published, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  return SUCCESS;
+} // frame_bus_publish()
+
+uint32_t frame_bus_open(frame_bus_t * p_bus, const char * p_name)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_bus);
+  CHECK_NULL(p_name);
+
+  struct stat info;
+  frame_bus_hdr_t * p_hdr;
+  int32_t fd = -1;
+
+  memset(p_bus, 0, sizeof(*p_bus));
+  strncpy(p_bus->name, p_name, FRAME_BUS_NAME_MAX - 1);
+  EQ_RET_E(fd, shm_open(p_name, O_RDONLY, 0), -1, FAILURE);
+  if (fstat(fd, &info) == -1 || info.st_size < (off_t)sizeof(frame_bus_hdr_t))
+  {
+    LOG_ERROR("%s is too short for a frame bus", p_name);
+    close(fd);
+    return FAILURE;
+  }
+  p_bus->len = info.st_size;
+  p_hdr = mmap(NULL, p_bus->len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p_hdr == MAP_FAILED)
+  {
+    LOG_ERROR("mmap of %s failed with error: %s", p_name, strerror(errno));
+    return FAILURE;
+  }
+  if (__atomic_load_n(&p_hdr->magic, __ATOMIC_ACQUIRE) != FRAME_BUS_MAGIC ||
+      p_hdr->version != FRAME_BUS_VERSION ||
+      p_hdr->slot_hdr_size != sizeof(frame_bus_slot_t) ||
+      p_hdr->slots != FRAME_BUS_SLOTS ||
+      p_hdr->data_offset + (size_t)p_hdr->slots * p_hdr->slot_bytes > p_bus->len)
+  {
+    LOG_ERROR("%s is not a version %d frame bus with %d slots", p_name, FRAME_BUS_VERSION, FRAME_BUS_SLOTS);
+    munmap(p_hdr, p_bus->len);
+    return FAILURE;
+  }
+  p_bus->p_hdr = p_hdr;
+  p_bus->p_data = (uint8_t *)p_hdr + p_hdr->data_offset;
+  return SUCCESS;
+} // frame_bus_open()
+
+/*!
+* @brief Fills out a view of a frame still in its slot
+* @param p_bus bus the frame is on
+* @param frame number of the frame
+* @param p_view view to fill out
+* @return SUCCESS/FAILURE when the slot is being written or holds another
+*         frame
+*/
+static
+uint32_t frame_bus_view(frame_bus_t * p_bus, uint32_t frame, frame_bus_view_t * p_view)
+{
+  const frame_bus_slot_t * p_slot = &p_bus->p_hdr->slot[frame % FRAME_BUS_SLOTS];
+  const uint8_t * p_data = p_bus->p_data + (size_t)(frame % FRAME_BUS_SLOTS) * p_bus->p_hdr->slot_bytes;
+
+  p_view->p_slot = p_slot;
+  p_view->lock = __atomic_load_n(&p_slot->lock, __ATOMIC_ACQUIRE);
+  if (p_view->lock & 1)
+  {
+    return FAILURE;
+  }
+  p_view->frame = p_slot->frame;
+  p_view->seq = p_slot->seq;
+  p_view->cam = p_slot->cam;
+  p_view->format = p_slot->format;
+  p_view->width = p_slot->width;
+  p_view->height = p_slot->height;
+  p_view->size = p_slot->size;
+  p_view->cap.tv_sec = p_slot->cap_sec;
+  p_view->cap.tv_nsec = p_slot->cap_nsec;
+  for (uint32_t plane = 0; plane < FRAME_PLANES; plane++)
+  {
+    p_view->strides[plane] = p_slot->strides[plane];
+    p_view->planes[plane] = p_view->strides[plane] ? p_data + p_slot->offsets[plane] : NULL;
+  }
+
+  // The header has to be from one frame, and the frame asked for
+  return (frame_bus_check(p_view) && p_view->frame == frame) ? SUCCESS : FAILURE;
+} // frame_bus_view()
+
+uint32_t frame_bus_latest(frame_bus_t * p_bus, frame_bus_view_t * p_view)
+{
+  CHECK_NULL(p_bus);
+  CHECK_NULL(p_view);
+
+  uint32_t published = 0;
+
+  // The latest slot can only be overwritten after a ring of frames, so
+  // trying again with the new latest frame always ends
+  do
+  {
+    published = __atomic_load_n(&p_bus->p_hdr->published, __ATOMIC_ACQUIRE);
+    if (published == 0)
+    {
+      return FAILURE;
+    }
+  } while (frame_bus_view(p_bus, published - 1, p_view) != SUCCESS);
+  return SUCCESS;
+} // frame_bus_latest()
+
+uint32_t frame_bus_next(frame_bus_t * p_bus, uint32_t * p_next, frame_bus_view_t * p_view, uint32_t timeout_ms)
+{
+  CHECK_NULL(p_bus);
+  CHECK_NULL(p_next);
+  CHECK_NULL(p_view);
+
+  struct timespec now;
+  struct timespec wait;
+  int64_t left = (int64_t)timeout_ms * NSEC_PER_MSEC;
+  int64_t start = 0;
+  uint32_t published = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  start = now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+  while (1)
+  {
+    published = __atomic_load_n(&p_bus->p_hdr->published, __ATOMIC_ACQUIRE);
+
+    // Sleep until the publisher moves the count on or the time is up
+    if ((int32_t)(published - *p_next) <= 0)
+    {
+      if (left <= 0)
+      {
+        return FAILURE;
+      }
+      wait.tv_sec = left / NSEC_PER_SEC;
+      wait.tv_nsec = left % NSEC_PER_SEC;
+      syscall(SYS_futex, &p_bus->p_hdr->published, FUTEX_WAIT, published, &wait, NULL, 0);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      left = (int64_t)timeout_ms * NSEC_PER_MSEC - (now.tv_sec * NSEC_PER_SEC + now.tv_nsec - start);
+      continue;
+    }
+
+    // The oldest slot may be getting the next frame, skip to the one after
+    if (published - *p_next >= FRAME_BUS_SLOTS)
+    {
+      *p_next = published - FRAME_BUS_SLOTS + 1;
+    }
+    if (frame_bus_view(p_bus, *p_next, p_view) == SUCCESS)
+    {
+      (*p_next)++;
+      return SUCCESS;
+    }
+
+    // Overwritten while looking at it, the reader is too far behind
+    (*p_next)++;
+  }
+} // frame_bus_next()
+
+uint8_t frame_bus_check(const frame_bus_view_t * p_view)
+{
+  // Everything read before this has to be done before the lock is read again
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&p_view->p_slot->lock, __ATOMIC_RELAXED) == p_view->lock;
+} // frame_bus_check()
+
+void frame_bus_close(frame_bus_t * p_bus)
+{
+  FUNC_ENTRY;
+
+  if (p_bus->p_hdr == NULL)
+  {
+    return;
+  }
+  munmap(p_bus->p_hdr, p_bus->len);
+  p_bus->p_hdr = NULL;
+  if (p_bus->publisher)
+  {
+    shm_unlink(p_bus->name);
+  }
+} // frame_bus_close()
@@ -0,0 +1,141 @@
+/** @file main.c
+*
+* @brief Main file for the frame bus reader.  Reads frames in place from the
+*        shared memory bus of a camera and reports frames skipped, frames
+*        overwritten while being read, and the latency from capture.
+*
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <capture.h>
+#include <frame_bus.h>
+#include <latency.h>
+#include <project_defs.h>
+
+// Longest wait for a frame before giving up on the publisher
+#define READ_TIMEOUT_MS (2000)
+
+// Time conversion
+#define NSEC_PER_MSEC (1000000.0)
+
+// Latency histogram, too big for the stack
+static latency_hist_t latencies;
+
+/*!
+* @brief Sums the first plane of a frame, standing in for a reader that uses
+*        the pixels
+* @param p_view frame in place
+* @return sum of the bytes
+*/
+static
+uint64_t sum_plane(const frame_bus_view_t * p_view)
+{
+  const uint8_t * p_row = p_view->planes[0];
+  uint32_t row_bytes = p_view->width * ((p_view->format == PIX_FMT_BGR24) ? 3 : 2);
+  uint64_t sum = 0;
+
+  if (p_view->format == PIX_FMT_YUV420)
+  {
+    row_bytes = p_view->width;
+  }
+  for (uint32_t row = 0; row < p_view->height; row++, p_row += p_view->strides[0])
+  {
+    for (uint32_t col = 0; col < row_bytes; col++)
+    {
+      sum += p_row[col];
+    }
+  }
+  return sum;
+} // sum_plane()
+
+int main(int argc, char ** argv)
+{
+  frame_bus_t bus;
+  frame_bus_view_t view;
+  struct timespec now;
+  char name[FRAME_BUS_NAME_MAX];
+  uint64_t sum = 0;
+  uint32_t cam = 0;
+  uint32_t frames = 100;
+  uint32_t next = 0;
+  uint32_t read = 0;
+  uint32_t skipped = 0;
+  uint32_t torn = 0;
+  int32_t opt = 0;
+
+  while ((opt = getopt(argc, argv, "c:n:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'c':
+        cam = atoi(optarg);
+        break;
+      case 'n':
+        frames = atoi(optarg);
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+  if (optind != argc || cam >= CAMERAS_MAX)
+  {
+    fprintf(stderr,
+            "Usage: %s [-c camera] [-n frames]\n"
+            "  reads frames from a server built with FRAME_BUS=1\n",
+            argv[0]);
+    return FAILURE;
+  }
+  capture_name(cam, FRAME_BUS_NAME, name, sizeof(name));
+  if (frame_bus_open(&bus, name) != SUCCESS)
+  {
+    return FAILURE;
+  }
+
+  // Start from the frame being published next
+  next = __atomic_load_n(&bus.p_hdr->published, __ATOMIC_ACQUIRE);
+  latency_reset(&latencies);
+  while (read < frames)
+  {
+    uint32_t wanted = next;
+
+    if (frame_bus_next(&bus, &next, &view, READ_TIMEOUT_MS) != SUCCESS)
+    {
+      fprintf(stderr, "No frame from %s in %dms\n", name, READ_TIMEOUT_MS);
+      break;
+    }
+    skipped += view.frame - wanted;
+    sum += sum_plane(&view);
+
+    // The publisher lapped the reader while it summed the frame
+    if (!frame_bus_check(&view))
+    {
+      torn++;
+      continue;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    latency_add(&latencies, latency_diff_ns(&view.cap, &now));
+    read++;
+  }
+
+  printf("frames: %u read, %u skipped, %u overwritten while read, checksum %llx\n",
+         read,
+         skipped,
+         torn,
+         (unsigned long long)sum);
+  if (latencies.count > 0)
+  {
+    printf("capture to read: min=%.3fms mean=%.3fms p50=%.1fms p99=%.1fms max=%.3fms\n",
+           latencies.min / NSEC_PER_MSEC,
+           (double)latencies.sum / latencies.count / NSEC_PER_MSEC,
+           latency_percentile(&latencies, 50) / NSEC_PER_MSEC,
+           latency_percentile(&latencies, 99) / NSEC_PER_MSEC,
+           latencies.max / NSEC_PER_MSEC);
+  }
+  frame_bus_close(&bus);
+  return (read == frames) ? SUCCESS : FAILURE;
+}
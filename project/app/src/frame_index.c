@@ -0,0 +1,231 @@
+/** @file frame_index.c
+*
+* @brief Binary per-frame index.  Records are appended with O_APPEND in a
+*        single write so a reader never sees one half written, except the
+*        last after a crash, which the reader drops.
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame_index.h"
+#include "log.h"
+#include "project_defs.h"
+#include "utilities.h"
+
+// Time conversion
+#define NSEC_PER_SEC (1000000000ll)
+
+/*!
+* @brief Writes a header or record in a single write
+* @param fd index file
+* @param p_buf data to write
+* @param len number of bytes
+* @return SUCCESS, FAILURE on an error or a short write
+*/
+static
+uint32_t frame_index_write(int32_t fd, const void * p_buf, size_t len)
+{
+  ssize_t res = write(fd, p_buf, len);
+
+  if (res == -1)
+  {
+    LOG_ERROR("Index write failed with error: %s", strerror(errno));
+    return FAILURE;
+  }
+  if ((size_t)res != len)
+  {
+    LOG_ERROR("Index write stopped after %d of %u bytes", (int32_t)res, (uint32_t)len);
+    return FAILURE;
+  }
+  return SUCCESS;
+} // frame_index_write()
+
+uint32_t frame_index_open(frame_index_t * p_index, const char * p_dir, uint32_t period_us, uint32_t seq_step)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_index);
+  CHECK_NULL(p_dir);
+
+  char file_name[FILE_NAME_MAX];
+  frame_index_hdr_t hdr = {
+    .magic = FRAME_INDEX_MAGIC,
+    .version = FRAME_INDEX_VERSION,
+    .rec_size = sizeof(frame_index_rec_t),
+    .period_us = period_us,
+    .seq_step = seq_step,
+  };
+
+  // Sequence numbers start over every run while file numbers carry on, so
+  // the index only covers this run's frames.  Files kept from earlier runs
+  // are still on disk for retention but can't be looked up.
+  snprintf(file_name, FILE_NAME_MAX, "%s/%s", p_dir, FRAME_INDEX_FILE);
+  EQ_RET_E(p_index->fd,
+           open(file_name, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, FILE_PERM),
+           -1,
+           FAILURE);
+  if (frame_index_write(p_index->fd, &hdr, sizeof(hdr)) != SUCCESS)
+  {
+    close(p_index->fd);
+    p_index->fd = -1;
+    return FAILURE;
+  }
+  p_index->count = 0;
+  LOG_MED("Indexing frames in %s", file_name);
+  return SUCCESS;
+} // frame_index_open()
+
+uint32_t frame_index_append(frame_index_t * p_index, frame_index_rec_t * p_rec, const char * p_file_name)
+{
+  CHECK_NULL(p_index);
+  CHECK_NULL(p_rec);
+  CHECK_NULL(p_file_name);
+
+  struct timespec now;
+  size_t len = strlen(p_file_name);
+  int32_t res = 0;
+
+  // Keep the end of names too long to fit, that's where the frame number is
+  if (len >= FRAME_INDEX_NAME_MAX)
+  {
+    p_file_name += len - (FRAME_INDEX_NAME_MAX - 1);
+    len = FRAME_INDEX_NAME_MAX - 1;
+  }
+  memcpy(p_rec->file_name, p_file_name, len + 1);
+  clock_gettime(CLOCK_REALTIME, &now);
+  frame_index_time(&p_rec->write, &now);
+
+  // Cut off a part written record so the records after it stay aligned
+  if (frame_index_write(p_index->fd, p_rec, sizeof(*p_rec)) != SUCCESS)
+  {
+    EQ_RET_E(res,
+             ftruncate(p_index->fd, sizeof(frame_index_hdr_t) + (off_t)p_index->count * sizeof(*p_rec)),
+             -1,
+             FAILURE);
+    return FAILURE;
+  }
+  p_index->count++;
+  return SUCCESS;
+} // frame_index_append()
+
+void frame_index_close(frame_index_t * p_index)
+{
+  FUNC_ENTRY;
+
+  close(p_index->fd);
+  LOG_HIGH("Indexed %u frames", p_index->count);
+} // frame_index_close()
+
+void frame_index_time(index_time_t * p_dst, const struct timespec * p_src)
+{
+  p_dst->sec = p_src->tv_sec;
+  p_dst->nsec = p_src->tv_nsec;
+} // frame_index_time()
+
+int64_t frame_index_ns(const index_time_t * p_time)
+{
+  return p_time->sec * NSEC_PER_SEC + p_time->nsec;
+} // frame_index_ns()
+
+uint32_t frame_index_map(const char * p_file, frame_index_map_t * p_map)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_file);
+  CHECK_NULL(p_map);
+
+  struct stat info;
+  int32_t fd = 0;
+  int32_t res = 0;
+
+  EQ_RET_E(fd, open(p_file, O_RDONLY), -1, FAILURE);
+  EQ_RET_E(res, fstat(fd, &info), -1, FAILURE);
+  if (info.st_size < (off_t)sizeof(frame_index_hdr_t))
+  {
+    LOG_ERROR("%s is too short for an index", p_file);
+    close(fd);
+    return FAILURE;
+  }
+
+  // The mapping stays valid once the file is closed
+  p_map->len = info.st_size;
+  p_map->p_base = mmap(NULL, p_map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p_map->p_base == MAP_FAILED)
+  {
+    LOG_ERROR("mmap of %s failed with error: %s", p_file, strerror(errno));
+    return FAILURE;
+  }
+
+  p_map->p_hdr = (const frame_index_hdr_t *)p_map->p_base;
+  if (p_map->p_hdr->magic != FRAME_INDEX_MAGIC ||
+      p_map->p_hdr->version != FRAME_INDEX_VERSION ||
+      p_map->p_hdr->rec_size != sizeof(frame_index_rec_t))
+  {
+    LOG_ERROR("%s is not a version %d frame index", p_file, FRAME_INDEX_VERSION);
+    munmap(p_map->p_base, p_map->len);
+    return FAILURE;
+  }
+  p_map->p_recs = (const frame_index_rec_t *)(p_map->p_hdr + 1);
+  p_map->count = (p_map->len - sizeof(frame_index_hdr_t)) / sizeof(frame_index_rec_t);
+
+  // Ranges are read front to back once found
+  madvise(p_map->p_base, p_map->len, MADV_SEQUENTIAL);
+  return SUCCESS;
+} // frame_index_map()
+
+void frame_index_unmap(frame_index_map_t * p_map)
+{
+  FUNC_ENTRY;
+
+  munmap(p_map->p_base, p_map->len);
+} // frame_index_unmap()
+
+uint32_t frame_index_find(const frame_index_map_t * p_map, int64_t ns)
+{
+  uint32_t low = 0;
+  uint32_t high = p_map->count;
+
+  while (low < high)
+  {
+    uint32_t mid = low + (high - low) / 2;
+
+    if (frame_index_ns(&p_map->p_recs[mid].cap) < ns)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return low;
+} // frame_index_find()
+
+uint32_t frame_index_find_seq(const frame_index_map_t * p_map, uint32_t seq)
+{
+  uint32_t low = 0;
+  uint32_t high = p_map->count;
+
+  while (low < high)
+  {
+    uint32_t mid = low + (high - low) / 2;
+
+    if (p_map->p_recs[mid].seq < seq)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return low;
+} // frame_index_find_seq()
@@ -0,0 +1,213 @@
+/** @file main.c
+*
+* @brief Main file for the frame index query tool.  Reports frame interval
+*        jitter and storage latency for a time range of a recording and
+*        exports the range as CSV.
+*
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <frame_index.h>
+#include <latency.h>
+#include <project_defs.h>
+
+// Time conversion
+#define NSEC_PER_SEC (1000000000.0)
+#define NSEC_PER_MSEC (1000000.0)
+
+// Interval histogram, too big for the stack
+static latency_hist_t intervals;
+
+/*!
+* @brief Writes the records in a range as CSV, times in milliseconds.
+*        capture_ms is from the first frame of the index, the others are
+*        from the frame's capture.
+* @param p_file CSV file, - for stdout
+* @param p_map mapped index
+* @param first first record of the range
+* @param last one past the last record of the range
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t export_csv(const char * p_file, const frame_index_map_t * p_map, uint32_t first, uint32_t last)
+{
+  int64_t start = frame_index_ns(&p_map->p_recs[0].cap);
+  FILE * fp = stdout;
+
+  if (strcmp(p_file, "-") != 0 && (fp = fopen(p_file, "w")) == NULL)
+  {
+    fprintf(stderr, "Can't open %s\n", p_file);
+    return FAILURE;
+  }
+
+  fprintf(fp, "seq,file,size,quality,capture_ms,interval_ms,encode_ms,write_ms\n");
+  for (uint32_t i = first; i < last; i++)
+  {
+    const frame_index_rec_t * p_rec = &p_map->p_recs[i];
+    int64_t cap = frame_index_ns(&p_rec->cap);
+    int64_t interval = (i > first) ? cap - frame_index_ns(&p_map->p_recs[i - 1].cap) : 0;
+
+    fprintf(fp, "%u,%.*s,%u,%u,%.3f,%.3f,%.3f,%.3f\n",
+            p_rec->seq,
+            FRAME_INDEX_NAME_MAX,
+            p_rec->file_name,
+            p_rec->size,
+            p_rec->quality,
+            (cap - start) / NSEC_PER_MSEC,
+            interval / NSEC_PER_MSEC,
+            (frame_index_ns(&p_rec->enc) - cap) / NSEC_PER_MSEC,
+            (frame_index_ns(&p_rec->write) - cap) / NSEC_PER_MSEC);
+  }
+  if (fp != stdout)
+  {
+    fclose(fp);
+  }
+  return SUCCESS;
+} // export_csv()
+
+/*!
+* @brief Prints interval jitter, skipped sequence numbers, and storage
+*        latency for a range
+* @param p_map mapped index
+* @param first first record of the range
+* @param last one past the last record of the range
+*/
+static
+void report(const frame_index_map_t * p_map, uint32_t first, uint32_t last)
+{
+  const frame_index_rec_t * p_recs = p_map->p_recs;
+  double period = p_map->p_hdr->period_us * 1000.0;
+  uint32_t step = p_map->p_hdr->seq_step ? p_map->p_hdr->seq_step : 1;
+  double sum = 0;
+  double sum_sq = 0;
+  double jitter_max = 0;
+  int64_t write_max = 0;
+  int64_t write_sum = 0;
+  uint32_t skipped = 0;
+  uint32_t count = last - first;
+
+  latency_reset(&intervals);
+  for (uint32_t i = first; i < last; i++)
+  {
+    int64_t cap = frame_index_ns(&p_recs[i].cap);
+    int64_t write = frame_index_ns(&p_recs[i].write) - cap;
+
+    write_sum += write;
+    write_max = (write > write_max) ? write : write_max;
+    if (i == first)
+    {
+      continue;
+    }
+
+    // Only every step-th frame is stored, frames dropped before storage
+    // leave larger gaps in the sequence numbers
+    int64_t interval = cap - frame_index_ns(&p_recs[i - 1].cap);
+    double jitter = fabs(interval - period);
+    uint32_t gap = p_recs[i].seq - p_recs[i - 1].seq;
+
+    skipped += (gap > step) ? gap / step - 1 : 0;
+    latency_add(&intervals, interval);
+    sum += interval;
+    sum_sq += (double)interval * interval;
+    jitter_max = (jitter > jitter_max) ? jitter : jitter_max;
+  }
+
+  printf("frames: %u seq %u-%u over %.3fs, %u skipped\n",
+         count,
+         p_recs[first].seq,
+         p_recs[last - 1].seq,
+         (frame_index_ns(&p_recs[last - 1].cap) - frame_index_ns(&p_recs[first].cap)) / NSEC_PER_SEC,
+         skipped);
+  if (intervals.count > 0)
+  {
+    double mean = sum / intervals.count;
+
+    printf("interval: min=%.3fms mean=%.3fms p50=%.1fms p99=%.1fms max=%.3fms stddev=%.3fms\n",
+           intervals.min / NSEC_PER_MSEC,
+           mean / NSEC_PER_MSEC,
+           latency_percentile(&intervals, 50) / NSEC_PER_MSEC,
+           latency_percentile(&intervals, 99) / NSEC_PER_MSEC,
+           intervals.max / NSEC_PER_MSEC,
+           sqrt(fmax(sum_sq / intervals.count - mean * mean, 0)) / NSEC_PER_MSEC);
+    printf("jitter: max=%.3fms from the %.3fms period\n",
+           jitter_max / NSEC_PER_MSEC,
+           period / NSEC_PER_MSEC);
+  }
+  printf("capture to write: mean=%.3fms max=%.3fms\n",
+         (double)write_sum / count / NSEC_PER_MSEC,
+         write_max / NSEC_PER_MSEC);
+} // report()
+
+int main(int argc, char ** argv)
+{
+  frame_index_map_t map;
+  const char * p_csv = NULL;
+  double begin = 0;
+  double end = INFINITY;
+  int32_t opt = 0;
+  uint32_t first = 0;
+  uint32_t last = 0;
+
+  while ((opt = getopt(argc, argv, "b:e:o:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b':
+        begin = atof(optarg);
+        break;
+      case 'e':
+        end = atof(optarg);
+        break;
+      case 'o':
+        p_csv = optarg;
+        break;
+      default:
+        optind = argc;
+        break;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    fprintf(stderr,
+            "Usage: %s [-b seconds] [-e seconds] [-o csv_file|-] index_file\n"
+            "  -b/-e select frames captured between seconds from the first frame\n",
+            argv[0]);
+    return FAILURE;
+  }
+  if (frame_index_map(argv[optind], &map) != SUCCESS)
+  {
+    return FAILURE;
+  }
+
+  // Find the range with binary searches instead of walking the records
+  if (map.count > 0)
+  {
+    int64_t start = frame_index_ns(&map.p_recs[0].cap);
+
+    first = frame_index_find(&map, start + (int64_t)(begin * NSEC_PER_SEC));
+    last = isinf(end) ? map.count : frame_index_find(&map, start + (int64_t)(end * NSEC_PER_SEC));
+  }
+  if (first >= last)
+  {
+    fprintf(stderr, "No frames in range\n");
+    frame_index_unmap(&map);
+    return FAILURE;
+  }
+
+  if (p_csv != NULL && export_csv(p_csv, &map, first, last) != SUCCESS)
+  {
+    frame_index_unmap(&map);
+    return FAILURE;
+  }
+  if (p_csv == NULL || strcmp(p_csv, "-") != 0)
+  {
+    report(&map, first, last);
+  }
+  frame_index_unmap(&map);
+  return SUCCESS;
+}
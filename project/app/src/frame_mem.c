@@ -0,0 +1,145 @@
+/** @file frame_mem.c
+*
+* @brief Locked and prefaulted memory arena for frame buffers.  All frame
+*        memory is carved out of one arena at startup so SCHED_FIFO threads
+*        never take page faults touching a buffer for the first time.
+*
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "frame_mem.h"
+#include "log.h"
+#include "project_defs.h"
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define ARENA_ALIGN (64)
+#define STAT_PATH_MAX (64)
+#define STAT_MAX (1024)
+
+// Frame memory arena
+static struct {
+  uint8_t * base;
+  size_t size;
+  size_t used;
+} arena;
+
+uint32_t frame_mem_init(size_t size)
+{
+  FUNC_ENTRY;
+  long page_size = sysconf(_SC_PAGESIZE);
+  int32_t res = 0;
+
+  // Round up to whole huge pages and try to get them
+  size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+  arena.base = mmap(NULL,
+                    size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                    -1,
+                    0);
+  if (arena.base == MAP_FAILED)
+  {
+    // Fall back to regular pages and ask for transparent huge pages
+    LOG_MED("No huge pages for frame memory: %s", strerror(errno));
+    EQ_RET_E(arena.base,
+             mmap(NULL,
+                  size,
+                  PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                  -1,
+                  0),
+             MAP_FAILED,
+             FAILURE);
+    madvise(arena.base, size, MADV_HUGEPAGE);
+  }
+  else
+  {
+    LOG_HIGH("Frame memory backed by %zu huge pages", size / HUGE_PAGE_SIZE);
+  }
+  arena.size = size;
+  arena.used = 0;
+
+  // Write every page so nothing is left to fault in later
+  for (size_t offset = 0; offset < size; offset += page_size)
+  {
+    arena.base[offset] = 0;
+  }
+
+  // Lock everything mapped now and later including thread stacks.  Without
+  // the privilege keep running but warn since later paging is possible.
+  res = mlockall(MCL_CURRENT | MCL_FUTURE);
+  if (res != 0)
+  {
+    LOG_ERROR("mlockall failed with error: %s", strerror(errno));
+  }
+
+  LOG_HIGH("Frame memory arena of %zu bytes ready", size);
+  return SUCCESS;
+} // frame_mem_init()
+
+void * frame_mem_alloc(size_t size)
+{
+  FUNC_ENTRY;
+  void * p_buf;
+
+  size = (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+  if (arena.base == NULL || arena.used + size > arena.size)
+  {
+    LOG_ERROR("Frame memory arena can't fit %zu bytes", size);
+    return NULL;
+  }
+
+  p_buf = arena.base + arena.used;
+  arena.used += size;
+  return p_buf;
+} // frame_mem_alloc()
+
+void frame_mem_prefault_stack()
+{
+  uint8_t stack[FRAME_MEM_STACK_PREFAULT];
+
+  // Write the whole array and keep the compiler from dropping the writes
+  memset(stack, 0, FRAME_MEM_STACK_PREFAULT);
+  __asm__ __volatile__("" : : "r"(stack) : "memory");
+} // frame_mem_prefault_stack()
+
+uint32_t frame_mem_faults(pid_t tid, uint64_t * minflt, uint64_t * majflt)
+{
+  CHECK_NULL(minflt);
+  CHECK_NULL(majflt);
+  char path[STAT_PATH_MAX];
+  char stat[STAT_MAX];
+  char * p_fields;
+  unsigned long long min = 0;
+  unsigned long long maj = 0;
+  FILE * fp;
+
+  snprintf(path, STAT_PATH_MAX, "/proc/self/task/%d/stat", tid);
+  if ((fp = fopen(path, "r")) == NULL)
+  {
+    return FAILURE;
+  }
+  p_fields = fgets(stat, STAT_MAX, fp);
+  fclose(fp);
+
+  // The name field can hold spaces so start after its closing parenthesis.
+  // minflt is field 10 and majflt is field 12.
+  if (p_fields == NULL || (p_fields = strrchr(stat, ')')) == NULL)
+  {
+    return FAILURE;
+  }
+  if (sscanf(p_fields + 2, "%*c %*d %*d %*d %*d %*d %*u %llu %*u %llu", &min, &maj) != 2)
+  {
+    return FAILURE;
+  }
+  *minflt = min;
+  *majflt = maj;
+  return SUCCESS;
+} // frame_mem_faults()
@@ -15,70 +15,138 @@
 #include <unistd.h>
 
 #include "capture.h"
+#include "enc_pool.h"
+#include "frame_bus.h"
+#include "frame_index.h"
+#include "frame_mem.h"
 #include "jpeg.h"
+#include "jpeg_raw.h"
+#include "load_test.h"
 #include "log.h"
+#include "metrics.h"
+#include "overload.h"
+#include "perf_counters.h"
 #include "project_defs.h"
 #include "profiler.h"
+#include "qoi.h"
+#include "retention.h"
+#include "sched_analysis.h"
+#include "sequencer.h"
 #include "server.h"
+#include "service.h"
+#include "task_graph.h"
+#include "trace.h"
 #include "utilities.h"
 
 // File storage info
-#define UNAME_MAX (255)
-#define IMAGE_EXT ".jpeg"
+#define FILE_PREFIX "capture_"
+#ifdef LOSSLESS
+#define FILE_NAME_FMT "%s/capture_%04d.qoi"
+#define FILE_SUFFIX ".qoi"
+#else
 #define FILE_NAME_FMT "%s/capture_%04d.jpeg"
-#define NUM_IMAGE_BUFS (4)
+#define FILE_SUFFIX ".jpeg"
+#endif /* LOSSLESS */
+#define JPEG_QUALITY (50)
+#define BYTES_PER_KB (1024)
 
 // Flag for setting abort status
 extern uint8_t abort_test;
 
-// Server accepting images to send
-
-// Location to store JPEG data and pass to TCP client service.  Using multiple buffering
-// for safety of data without using MUTEX.
-static uint8_t image_buf[NUM_IMAGE_BUFS][IMAGE_NUM_BYTES];
-
-// Struct of information for the thread
-typedef struct {
-  // Image buffer for current frame
-  uint8_t * cur_buf;
-
-  // Hold the uname str
-  char uname_str[UNAME_MAX];
-  uint16_t uname_len;
-  uint16_t comment_len;
-
-  // Filename
-  char file_name[FILE_NAME_MAX];
-
-  // Current image pointer
-  CvMat * image;
-
-  // Capture info object
-  cap_info_t cap;
-} jpeg_cap_t;
+// Encoder, QOI encodes into a buffer from frame memory.  Only one thread
+// may encode with it at a time.
+typedef struct jpeg_enc {
+#ifdef LOSSLESS
+  qoi_t qoi;
+  uint8_t * p_qoi;
+#else
+  jpeg_raw_t raw;
+#endif /* LOSSLESS */
+} jpeg_enc_t;
+
+#ifdef TASK_GRAPH
+struct jpeg_cam;
+
+// Frame moving through its camera's graph with its own copy of the capture
+// info, taken by capture and given back once the graph is done with it
+typedef struct jpeg_item {
+  task_item_t task;
+  struct jpeg_cam * p_cam;
+  jpeg_cap_t cap;
+  server_info_t server_msg;
+  uint32_t tick;
+  uint32_t len;
+  uint8_t built;
+  uint8_t busy;
+} jpeg_item_t;
+
+// Encoder of each graph worker, the last for a thread running a task itself
+static jpeg_enc_t encoders[SERVICE_WORKERS_MAX + 1];
+#endif /* TASK_GRAPH */
+
+// Store state of each camera
+typedef struct jpeg_cam {
+  uint32_t id;
+  char dir[DIR_NAME_MAX];
+
+  // Retention directory id and the number of the next file, which carries
+  // on from the files an earlier run left
+  uint32_t retain_id;
+  uint32_t count;
+
+  // Index of the stored frames and the queue frames are streamed on
+  frame_index_t index;
+  frame_index_rec_t rec;
+  mqd_t server_queue;
+  uint32_t stream_ticks;
+#ifdef FRAME_BUS
+  // Bus the camera's frames are published on for local readers
+  frame_bus_t bus;
+#endif /* FRAME_BUS */
+
+#ifdef TASK_GRAPH
+  // Stages run by the graph workers for each frame capture submits
+  char graph_name[SERVICE_NAME_MAX];
+  task_graph_t graph;
+  jpeg_item_t items[TASK_GRAPH_INFLIGHT];
+
+  // Items capture may have in flight, each holds its capture buffer until
+  // encoded
+  uint32_t max_items;
+#else
+  // Encoder of the camera's frames
+  jpeg_enc_t enc;
+
+  // Sequencer slot releasing the service at the storage rate
+  uint32_t slot;
+  pthread_t thread;
+#endif /* TASK_GRAPH */
+} jpeg_cam_t;
+
+static jpeg_cam_t cams[CAMERAS];
 
 // Add data macro
 #define ADD_DATA(dest, src, count, tally) memcpy(&dest[tally], src, count); tally += count
 
 /*!
-* @brief Builds the JPEG file buffer and writes to file
+* @brief Builds the file of an encoded frame in its buffer from the pool
 * @param cap current capture information
-* @return SUCCESS/FAILURE
+* @return number of bytes built or FAILURE
 */
-static inline
-uint32_t write_jpeg(jpeg_cap_t * cap)
+static
+uint32_t jpeg_build(jpeg_cap_t * cap)
 {
-  FUNC_ENTRY;
-  int32_t res = 0;
-  int32_t fd = 0;
   uint32_t cur_loc = 0;
+
+#ifdef LOSSLESS
+  // QOI has no comments, the frame index keeps the timestamp
+  ADD_DATA(cap->cur_buf, cap->enc_buf, cap->enc_len, cur_loc);
+#else
+  int32_t res = 0;
   char timestamp[TIMESTAMP_MAX];
   char image_start[] = {0xff, 0xd8};
   char com_start[] = {0xff, 0xfe};
 
-  // Open file to store contents
-  EQ_RET_E(fd, open(cap->file_name, O_CREAT | O_RDWR, FILE_PERM), -1, FAILURE);
-
   // Add the timestamp to the image comment
   EQ_RET_E(res,
            get_timestamp(&cap->cap.time, timestamp, TIMESTAMP_MAX),
@@ -91,61 +159,427 @@ uint32_t write_jpeg(jpeg_cap_t * cap)
   ADD_DATA(cap->cur_buf, &(cap->comment_len), 2, cur_loc);
   ADD_DATA(cap->cur_buf, timestamp, TIMESTAMP_MAX, cur_loc);
   ADD_DATA(cap->cur_buf, cap->uname_str, cap->uname_len, cur_loc);
-  ADD_DATA(cap->cur_buf, (cap->image->data.ptr + 2), cap->image->cols, cur_loc);
+  ADD_DATA(cap->cur_buf, (cap->enc_buf + 2), cap->enc_len - 2, cur_loc);
+#endif /* LOSSLESS */
+
+  return cur_loc;
+} // jpeg_build()
+
+/*!
+* @brief Writes a built file out
+* @param cap current capture information with the file name
+* @param len bytes built
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t jpeg_write_file(const jpeg_cap_t * cap, uint32_t len)
+{
+  int32_t res = 0;
+  int32_t fd = 0;
+
+  // Open file to store contents
+  EQ_RET_E(fd, open(cap->file_name, O_CREAT | O_RDWR, FILE_PERM), -1, FAILURE);
 
   // Write the file out
-  EQ_RET_E(res, write(fd, cap->cur_buf, cur_loc), -1, FAILURE);
+  EQ_RET_E(res, write(fd, cap->cur_buf, len), -1, FAILURE);
 
   // Close file properly
   EQ_RET_E(res, close(fd), -1, FAILURE);
+  return SUCCESS;
+} // jpeg_write_file()
 
-  return cur_loc;
+uint32_t write_jpeg(jpeg_cap_t * cap)
+{
+  FUNC_ENTRY;
+  uint32_t len = 0;
+  uint32_t res = 0;
+
+  EQ_RET_E(len, jpeg_build(cap), FAILURE, FAILURE);
+  NOT_EQ_RET_E(res, jpeg_write_file(cap, len), SUCCESS, FAILURE);
+  return len;
 }
 
 /*!
-* @brief Handles incoming messages from queue
-* @param param no information is passed
+* @brief Sets up an encoder for frames of the capture resolution
+* @param p_enc encoder
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t jpeg_enc_init(jpeg_enc_t * p_enc)
+{
+  int32_t res = 0;
+
+#ifdef LOSSLESS
+  // Buffer YUV frames are converted to RGB in and the encoder output
+  EQ_RET_E(res, qoi_init(&p_enc->qoi, HRES, VRES), FAILURE, FAILURE);
+  EQ_RET_E(p_enc->p_qoi, frame_mem_alloc(ENC_MAX_BYTES), NULL, FAILURE);
+#else
+  // libjpeg encoder for frames captured in YUV, and BGR in headless builds
+  EQ_RET_E(res, jpeg_raw_init(&p_enc->raw, HRES, VRES, JPEG_QUALITY), FAILURE, FAILURE);
+#endif /* LOSSLESS */
+  return SUCCESS;
+} // jpeg_enc_init()
+
+/*!
+* @brief Encodes the captured frame into the encoder's output.  YUV frames
+*        go straight to the encoder, BGR frames are converted back to YCbCr
+*        by libjpeg, so no frame allocates.  Lossless builds encode QOI
+*        instead.
+* @param p_enc encoder
+* @param cap capture info with the frame, gets the encoded image
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t encode_jpeg(jpeg_enc_t * p_enc, jpeg_cap_t * cap)
+{
+#ifdef LOSSLESS
+  cap->enc_buf = p_enc->p_qoi;
+  return qoi_encode_frame(&p_enc->qoi, &cap->cap.frame, p_enc->p_qoi, &cap->enc_len);
+#else
+  return jpeg_raw_encode(&p_enc->raw, &cap->cap.frame, &cap->enc_buf, &cap->enc_len);
+#endif /* LOSSLESS */
+} // encode_jpeg()
+
+/*!
+* @brief Gets the size of the file write_jpeg() builds from the encoded
+*        frame
+* @param cap capture info with the encoded image
+* @return bytes
+*/
+static
+uint32_t jpeg_file_len(const jpeg_cap_t * cap)
+{
+#ifdef LOSSLESS
+  return cap->enc_len;
+#else
+  // SOI, comment marker and length, the comment, then the encoded frame
+  // after its own SOI
+  return 2 + 2 + 2 + TIMESTAMP_MAX + cap->uname_len + cap->enc_len - 2;
+#endif /* LOSSLESS */
+} // jpeg_file_len()
+
+/*!
+* @brief Gets the uname string and comment length files are built with
+* @param cap capture info
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t jpeg_cap_init(jpeg_cap_t * cap)
+{
+  int32_t res = 0;
+
+  // Get the uname string and display
+  EQ_RET_E(res, get_uname(cap->uname_str, UNAME_MAX), FAILURE, FAILURE);
+  LOG_LOW("Using uname string: %s", cap->uname_str);
+
+  // Get the uname length for the comment
+  cap->uname_len = strlen(cap->uname_str);
+
+  // Calculate the total comment length for this image add 2 to include null
+  // term
+  cap->comment_len = TIMESTAMP_MAX + cap->uname_len + 2;
+  cap->comment_len = (cap->comment_len << 8 | cap->comment_len >> 8);
+  return SUCCESS;
+} // jpeg_cap_init()
+
+/*!
+* @brief Indexes a written frame, sends it to the server on the ticks the
+*        stream is due on, and hands the file to retention
+* @param p_cam camera the frame is from
+* @param cap capture info of the written frame
+* @param p_msg message for the server, with the encode time set
+* @param len bytes written
+* @param tick sequencer tick the frame was stored on
+*/
+static
+void jpeg_stored(jpeg_cam_t * p_cam, jpeg_cap_t * cap, server_info_t * p_msg, uint32_t len, uint32_t tick)
+{
+  p_msg->file_name_len = strlen(cap->file_name);
+  memcpy(p_msg->file_name, cap->file_name, p_msg->file_name_len);
+  p_msg->image_buf_len = len;
+  p_msg->image_buf = cap->cur_buf;
+  p_msg->seq = cap->cap.seq;
+  p_msg->cam = p_cam->id;
+  p_msg->times.cap = cap->cap.time;
+
+  // Add the stored frame to the index.  The file is written either way, so
+  // a frame left out is only counted and storage carries on.
+  p_cam->rec.seq = cap->cap.seq;
+  p_cam->rec.size = len;
+  p_cam->rec.format = cap->cap.frame.format;
+  frame_index_time(&p_cam->rec.cap, &cap->cap.time);
+  frame_index_time(&p_cam->rec.enc, &p_msg->times.enc);
+  if (frame_index_append(&p_cam->index, &p_cam->rec, cap->file_name) != SUCCESS)
+  {
+    LOG_ERROR("Frame %u of camera %u left out of the index", cap->cap.seq, p_cam->id);
+    METRICS_ADD(METRICS_INDEX_ERRORS, 1);
+  }
+
+  // Send the frames of the ticks the stream is due on to the server with
+  // their own reference, a full queue is handled by the server queue
+  // overload policy.  A message that can't be queued at all is dropped the
+  // same way, giving its reference back, and the stream carries on.
+  if (tick % p_cam->stream_ticks == 0)
+  {
+    enc_pool_ref(cap->cur_buf);
+    if (overload_send(OVERLOAD_Q_SERVER, p_cam->id, p_cam->server_queue, p_msg, sizeof(*p_msg)) != SUCCESS)
+    {
+      overload_drop(OVERLOAD_Q_SERVER, p_msg);
+    }
+  }
+  enc_pool_put(cap->cur_buf);
+
+  // Old files are deleted by the retention service
+  retention_stored(p_cam->retain_id, p_cam->count, len, &cap->cap.time);
+  p_cam->count++;
+} // jpeg_stored()
+
+#ifdef TASK_GRAPH
+#ifdef FRAME_BUS
+/*!
+* @brief Publishes a frame as captured for local readers, frames of a camera
+*        go on its bus in capture order
+* @param p_data jpeg_item_t
+*/
+static
+void jpeg_publish_task(void * p_data)
+{
+  jpeg_item_t * p_item = (jpeg_item_t *)p_data;
+  cap_info_t * p_info = &p_item->cap.cap;
+
+  // A frame that doesn't fit is only left off the bus
+  FRAME_BUS_PUBLISH(&p_item->p_cam->bus, &p_info->frame, p_info->seq, p_info->cam, &p_info->time);
+} // jpeg_publish_task()
+#endif /* FRAME_BUS */
+
+/*!
+* @brief Encodes a frame with the calling worker's encoder, gives the
+*        capture buffer back, and builds the file in a buffer from the pool.
+*        As many of a camera's frames are encoded at once as capture can
+*        spare buffers for.
+* @param p_data jpeg_item_t
+*/
+static
+void jpeg_encode_task(void * p_data)
+{
+  jpeg_item_t * p_item = (jpeg_item_t *)p_data;
+  jpeg_cap_t * cap = &p_item->cap;
+  uint32_t res = 0;
+  TRACE_ATTACH();
+
+  TRACE_BEGIN(TRACE_SPAN_ENCODE, cap->cap.seq);
+  PERF_BEGIN(PERF_STAGE_ENCODE);
+  res = encode_jpeg(&encoders[task_graph_worker()], cap);
+  TRACE_END(TRACE_SPAN_ENCODE, cap->cap.seq);
+  PERF_END(PERF_STAGE_ENCODE, cap->cap.frame.width * cap->cap.frame.height);
+
+  // The encoded copy is all that's needed, give the capture buffer back
+  capture_release(&cap->cap);
+  if (res != SUCCESS)
+  {
+    LOG_ERROR("Can't encode frame %u of camera %u", cap->cap.seq, cap->cap.cam);
+    abort_test = 1;
+    return;
+  }
+  clock_gettime(CLOCK_REALTIME, &p_item->server_msg.times.enc);
+  METRICS_ADD(METRICS_FRAMES_ENCODED, 1);
+  METRICS_LATENCY(METRICS_LAT_ENCODE, &cap->cap.time);
+
+  // The pool is only used up when the server holds too many frames, the
+  // frame is then dropped
+  cap->cur_buf = enc_pool_get(jpeg_file_len(cap));
+  if (cap->cur_buf == NULL)
+  {
+    LOAD_DROP(LOAD_STAGE_STORE);
+    METRICS_ADD(METRICS_FRAMES_DROPPED, 1);
+    return;
+  }
+  p_item->len = jpeg_build(cap);
+  if (p_item->len == FAILURE)
+  {
+    enc_pool_put(cap->cur_buf);
+    abort_test = 1;
+    return;
+  }
+  p_item->built = 1;
+} // jpeg_encode_task()
+
+/*!
+* @brief Writes a built frame out, then indexes, streams, and retains it.
+*        A camera's frames are stored one at a time in capture order, so
+*        files are numbered and indexed as in the thread per camera build.
+* @param p_data jpeg_item_t
+*/
+static
+void jpeg_store_task(void * p_data)
+{
+  jpeg_item_t * p_item = (jpeg_item_t *)p_data;
+  jpeg_cam_t * p_cam = p_item->p_cam;
+  jpeg_cap_t * cap = &p_item->cap;
+  TRACE_ATTACH();
+
+  // Dropped frames leave no file and keep their number for the next one
+  if (!p_item->built)
+  {
+    return;
+  }
+  snprintf(cap->file_name, FILE_NAME_MAX, FILE_NAME_FMT, p_cam->dir, p_cam->count);
+  LOG_LOW("Using %s file name", cap->file_name);
+
+  TRACE_BEGIN(TRACE_SPAN_FILE_WRITE, cap->cap.seq);
+  PERF_BEGIN(PERF_STAGE_FILE_WRITE);
+  if (jpeg_write_file(cap, p_item->len) != SUCCESS)
+  {
+    TRACE_END(TRACE_SPAN_FILE_WRITE, cap->cap.seq);
+    enc_pool_put(cap->cur_buf);
+    abort_test = 1;
+    return;
+  }
+  TRACE_END(TRACE_SPAN_FILE_WRITE, cap->cap.seq);
+  PERF_END(PERF_STAGE_FILE_WRITE, p_item->len);
+  LOAD_DONE(LOAD_STAGE_STORE, p_cam->id, &cap->cap.time);
+  METRICS_ADD(METRICS_FRAMES_WRITTEN, 1);
+  METRICS_ADD(METRICS_BYTES_WRITTEN, p_item->len);
+  METRICS_LATENCY(METRICS_LAT_STORE, &cap->cap.time);
+
+  // The file is written, a frame the index or the stream misses doesn't
+  // stop the graph
+  jpeg_stored(p_cam, cap, &p_item->server_msg, p_item->len, p_item->tick);
+} // jpeg_store_task()
+
+/*!
+* @brief Gives an item back to capture once its frame is stored or dropped
+* @param p_data jpeg_item_t
+*/
+static
+void jpeg_done_task(void * p_data)
+{
+  jpeg_item_t * p_item = (jpeg_item_t *)p_data;
+
+  __atomic_store_n(&p_item->busy, 0, __ATOMIC_RELEASE);
+} // jpeg_done_task()
+
+/*!
+* @brief Builds a camera's graph, publish then encode then store, and sets
+*        up its items
+* @param p_cam camera
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t jpeg_graph_init(jpeg_cam_t * p_cam)
+{
+  int32_t res = 0;
+  uint32_t encode = 0;
+  uint32_t store = 0;
+
+  capture_name(p_cam->id, "jpeg_graph", p_cam->graph_name, sizeof(p_cam->graph_name));
+  task_graph_create(&p_cam->graph, p_cam->graph_name, jpeg_done_task);
+#ifdef FRAME_BUS
+  uint32_t publish = 0;
+  EQ_RET_E(res, task_graph_node(&p_cam->graph, "publish", jpeg_publish_task, 1, &publish), FAILURE, FAILURE);
+#endif /* FRAME_BUS */
+  EQ_RET_E(res, task_graph_node(&p_cam->graph, "encode", jpeg_encode_task, 0, &encode), FAILURE, FAILURE);
+  EQ_RET_E(res, task_graph_node(&p_cam->graph, "store", jpeg_store_task, 1, &store), FAILURE, FAILURE);
+#ifdef FRAME_BUS
+  EQ_RET_E(res, task_graph_edge(&p_cam->graph, publish, encode), FAILURE, FAILURE);
+#endif /* FRAME_BUS */
+  EQ_RET_E(res, task_graph_edge(&p_cam->graph, encode, store), FAILURE, FAILURE);
+
+  for (uint32_t item = 0; item < TASK_GRAPH_INFLIGHT; item++)
+  {
+    p_cam->items[item].p_cam = p_cam;
+    EQ_RET_E(res, jpeg_cap_init(&p_cam->items[item].cap), FAILURE, FAILURE);
+  }
+
+  // Frames in flight can't hold more capture buffers than capture spares,
+  // or the driver runs dry and OpenCV frames are overwritten while encoded
+  p_cam->max_items = capture_frames_held(p_cam->id);
+  p_cam->max_items = (p_cam->max_items < TASK_GRAPH_INFLIGHT) ? p_cam->max_items : TASK_GRAPH_INFLIGHT;
+  LOG_HIGH("%s frames in flight: up to %u", p_cam->graph_name, p_cam->max_items);
+  return SUCCESS;
+} // jpeg_graph_init()
+
+uint32_t jpeg_submit(const cap_info_t * p_info, uint32_t tick)
+{
+  jpeg_cam_t * p_cam = &cams[p_info->cam];
+  jpeg_item_t * p_item = NULL;
+
+  // Only capture takes items, so one found free stays free until taken
+  for (uint32_t item = 0; item < p_cam->max_items && p_item == NULL; item++)
+  {
+    if (!__atomic_load_n(&p_cam->items[item].busy, __ATOMIC_ACQUIRE))
+    {
+      p_item = &p_cam->items[item];
+    }
+  }
+  if (p_item == NULL)
+  {
+    return FAILURE;
+  }
+  p_item->cap.cap = *p_info;
+  p_item->tick = tick;
+  p_item->built = 0;
+  p_item->busy = 1;
+  if (task_graph_submit(&p_cam->graph, &p_item->task, p_item) != SUCCESS)
+  {
+    p_item->busy = 0;
+    return FAILURE;
+  }
+  return SUCCESS;
+} // jpeg_submit()
+
+void jpeg_stop()
+{
+  FUNC_ENTRY;
+
+  // Frames already submitted are stored before the workers stop
+  task_graph_stop();
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    task_graph_report(&cams[cam].graph);
+    frame_index_close(&cams[cam].index);
+    FRAME_BUS_CLOSE(&cams[cam].bus);
+    mq_close(cams[cam].server_queue);
+  }
+} // jpeg_stop()
+#else
+/*!
+* @brief Handles incoming messages from a camera's queue
+* @param param jpeg_cam_t of the camera
 * @return NULL
 */
 void * jpeg_service(void * param)
 {
   FUNC_ENTRY;
+  jpeg_cam_t * p_cam = (jpeg_cam_t *)param;
   struct timespec diff;
   image_q_inf_t image_q_inf;
   jpeg_cap_t cap;
-  mqd_t server_queue;
   server_info_t server_msg;
-  const int32_t comp[2] = {CV_IMWRITE_JPEG_QUALITY, 50};
+  char name[SERVICE_NAME_MAX];
+  char queue_name[QUEUE_NAME_MAX];
   int32_t res = 0;
-  uint32_t count = 0;
   uint8_t timer = profiler_init();
-  char unlink_name[FILE_NAME_MAX];
 
-  // Get the uname string and display
-  EQ_RET_EA(res, get_uname(cap.uname_str, UNAME_MAX), FAILURE, NULL, abort_test);
-  LOG_LOW("Using uname string: %s", cap.uname_str);
+  capture_name(p_cam->id, "jpeg_service", name, sizeof(name));
+  TRACE_INIT(name);
+  METRICS_INIT(name);
+  PERF_INIT(name);
 
-  // Get the uname length for the comment
-  cap.uname_len = strlen(cap.uname_str);
+  // Register for schedulability analysis at the storage rate
+  sa_register(name, timer, seq_period_us("jpeg_service"));
 
-  // Calculate the total comment length for this image add 2 to include null
-  // term
-  cap.comment_len = TIMESTAMP_MAX + cap.uname_len + 2;
-  cap.comment_len = (cap.comment_len << 8 | cap.comment_len >> 8);
+  // Get the uname string and comment length for the files
+  EQ_RET_EA(res, jpeg_cap_init(&cap), FAILURE, NULL, abort_test);
 
-  // Try to create the queue
+  // Try to create the camera's queue
+  capture_name(p_cam->id, QUEUE_NAME, queue_name, sizeof(queue_name));
   EQ_RET_EA(image_q_inf.image_q,
-            mq_open(QUEUE_NAME, O_RDONLY | O_CREAT, S_IRWXU, NULL),
+            mq_open(queue_name, O_RDONLY | O_CREAT, S_IRWXU, NULL),
             -1,
             NULL,
             abort_test);
 
-  // Try to create the queue
-  EQ_RET_E(server_queue,
-           mq_open(SERVER_QUEUE_NAME, O_NONBLOCK | O_WRONLY | O_CREAT, S_IRWXU, NULL),
-           -1,
-           NULL);
-
   // Get the message queue attributes
   NOT_EQ_RET_EA(res,
                 mq_getattr(image_q_inf.image_q, &image_q_inf.attr),
@@ -155,112 +589,194 @@ void * jpeg_service(void * param)
 
   while(!abort_test)
   {
-    // Get the current buffer from the multi buffer for processing image
-    cap.cur_buf = image_buf[count % NUM_IMAGE_BUFS];
-
     // Get the time after the loop is done
     GET_TIME;
 
     // Display the timestamp
     DISPLAY_TIMESTAMP;
 
+#ifndef LOAD_TEST
+    // Wait to be released at the storage rate, capture only queues the frames
+    // of the ticks this service is released on.  Load tests store every frame.
+    if (!seq_wait(p_cam->slot))
+    {
+      break;
+    }
+#endif /* LOAD_TEST */
+
     // Create the file name to save data
-    snprintf(cap.file_name, FILE_NAME_MAX, FILE_NAME_FMT, DIR_NAME, count);
+    snprintf(cap.file_name, FILE_NAME_MAX, FILE_NAME_FMT, p_cam->dir, p_cam->count);
     LOG_LOW("Using %s file name", cap.file_name);
-    server_msg.file_name_len = strlen(cap.file_name);
-    memcpy(server_msg.file_name, cap.file_name, server_msg.file_name_len);
+    TRACE_BEGIN(TRACE_SPAN_QUEUE_WAIT, p_cam->count);
     EQ_RET_EA(res,
-              mq_receive(image_q_inf.image_q, (char *)&cap.cap, image_q_inf.attr.mq_msgsize, NULL),
+              overload_receive(image_q_inf.image_q, &cap.cap, image_q_inf.attr.mq_msgsize),
               -1,
               NULL,
               abort_test);
+    TRACE_END(TRACE_SPAN_QUEUE_WAIT, p_cam->count);
+    if (res == 0)
+    {
+      break;
+    }
+
+    // Skip encoding and storing this frame when too far behind
+    if (overload_degrade(OVERLOAD_Q_FRAME, image_q_inf.image_q, &cap.cap))
+    {
+      continue;
+    }
 
     // Start the timer for encoding/writing the image
     START_TIME;
 
     // Encode the frame into JPEG
-    EQ_RET_EA(cap.image,
-              cvEncodeImage(IMAGE_EXT, cap.cap.frame, comp),
-              NULL,
-              NULL,
-              abort_test);
-
-    // Add comment information
-    EQ_RET_EA(res, write_jpeg(&cap), 1, NULL, abort_test);
-
-    server_msg.image_buf_len = res;
-    server_msg.image_buf = cap.cur_buf;
-
-    // Try to send the cap info via messaqe queue
-    mq_send(server_queue, (char *)&server_msg, sizeof(server_msg), 0),
-
-    // Unlink old file if the number for frames is greater than the max frame setting
-    res = count - MAX_FRAMES;
-    if (res > -1)
+    TRACE_BEGIN(TRACE_SPAN_ENCODE, cap.cap.seq);
+    PERF_BEGIN(PERF_STAGE_ENCODE);
+    NOT_EQ_RET_EA(res, encode_jpeg(&p_cam->enc, &cap), SUCCESS, NULL, abort_test);
+    TRACE_END(TRACE_SPAN_ENCODE, cap.cap.seq);
+    PERF_END(PERF_STAGE_ENCODE, cap.cap.frame.width * cap.cap.frame.height);
+
+    // Local readers get the frame as captured, a frame that doesn't fit is
+    // only left off the bus
+    FRAME_BUS_PUBLISH(&p_cam->bus, &cap.cap.frame, cap.cap.seq, p_cam->id, &cap.cap.time);
+
+    // The encoded copy is all that's needed, give the capture buffer back
+    capture_release(&cap.cap);
+    clock_gettime(CLOCK_REALTIME, &server_msg.times.enc);
+    METRICS_ADD(METRICS_FRAMES_ENCODED, 1);
+    METRICS_LATENCY(METRICS_LAT_ENCODE, &cap.cap.time);
+
+    // The file is built in a buffer sized to it that the server shares.  The
+    // pool is only used up when the server holds too many frames, the frame
+    // is then dropped.
+    cap.cur_buf = enc_pool_get(jpeg_file_len(&cap));
+    if (cap.cur_buf == NULL)
     {
-      snprintf(unlink_name, FILE_NAME_MAX, FILE_NAME_FMT, DIR_NAME, res);
-      LOG_LOW("Unlinking %s", unlink_name);
-      EQ_RET_EA(res, unlink(unlink_name), -1, NULL, abort_test);
+      LOAD_DROP(LOAD_STAGE_STORE);
+      METRICS_ADD(METRICS_FRAMES_DROPPED, 1);
+      continue;
     }
 
-    // Increment counter
-    count++;
+    // Add comment information
+    TRACE_BEGIN(TRACE_SPAN_FILE_WRITE, cap.cap.seq);
+    PERF_BEGIN(PERF_STAGE_FILE_WRITE);
+    EQ_RET_EA(res, write_jpeg(&cap), 1, NULL, abort_test);
+    TRACE_END(TRACE_SPAN_FILE_WRITE, cap.cap.seq);
+    PERF_END(PERF_STAGE_FILE_WRITE, res);
+    LOAD_DONE(LOAD_STAGE_STORE, p_cam->id, &cap.cap.time);
+    METRICS_ADD(METRICS_FRAMES_WRITTEN, 1);
+    METRICS_ADD(METRICS_BYTES_WRITTEN, res);
+    METRICS_LATENCY(METRICS_LAT_STORE, &cap.cap.time);
+
+    // Index, stream, and retain the file
+    jpeg_stored(p_cam, &cap, &server_msg, res, seq_tick(p_cam->slot));
   }
-  LOG_HIGH("jpeg_service thread exiting");
+  LOG_HIGH("%s thread exiting", name);
+  frame_index_close(&p_cam->index);
+  FRAME_BUS_CLOSE(&p_cam->bus);
   mq_close(image_q_inf.image_q);
-  mq_close(server_queue);
+  mq_close(p_cam->server_queue);
   return NULL;
 } // jpeg_service()
 
-uint32_t jpeg_init()
+void jpeg_stop()
+{
+  FUNC_ENTRY;
+
+  // Each service closes its index and queues once it sees the abort flag
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    pthread_join(cams[cam].thread, NULL);
+  }
+} // jpeg_stop()
+#endif /* TASK_GRAPH */
+
+/*!
+* @brief Sets up a camera's storage directory, index, and encoder and starts
+*        its jpeg_service thread, or builds its graph in task graph builds
+* @param p_cam camera to start
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t jpeg_cam_init(jpeg_cam_t * p_cam)
 {
   FUNC_ENTRY;
-  struct sched_param sched;
-  struct sched_param  jpeg_sched;
-  pthread_attr_t sched_attr;
-  pthread_t jpeg_thread;
   int32_t res = 0;
-  int32_t rt_max_pri = 0;
-  int32_t jpeg_policy = 0;
 
   // Try to create directory for storing images
-  EQ_RET_E(res, create_dir(DIR_NAME), FAILURE, FAILURE);
+  capture_name(p_cam->id, DIR_NAME, p_cam->dir, DIR_NAME_MAX);
+  EQ_RET_E(res, create_dir(p_cam->dir), FAILURE, FAILURE);
 
-  // Initialize the schedule attributes
-  PT_NOT_EQ_EXIT(res, pthread_attr_init(&sched_attr), SUCCESS);
+  // Pick up the files already stored
+  EQ_RET_E(res,
+           retention_add(p_cam->dir, FILE_PREFIX, FILE_SUFFIX, &p_cam->retain_id, &p_cam->count),
+           FAILURE,
+           FAILURE);
 
-  // Set the attributes structure to PTHREAD_EXPLICIT_SCHED and SCHED_FIFO
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setinheritsched(&sched_attr, PTHREAD_EXPLICIT_SCHED),
-                SUCCESS,
-                FAILURE);
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setschedpolicy(&sched_attr, SCHED_FIFO),
-                SUCCESS,
-                FAILURE);
+  // Index every stored frame
+  EQ_RET_E(res,
+           frame_index_open(&p_cam->index, p_cam->dir, seq_period_us("jpeg_service"), seq_frame_step("jpeg_service", NULL)),
+           FAILURE,
+           FAILURE);
+  memset(&p_cam->rec, 0, sizeof(p_cam->rec));
+#ifndef LOSSLESS
+  p_cam->rec.quality = JPEG_QUALITY;
+#endif /* LOSSLESS */
+
+  // Try to create the queue as its overload policy needs it
+  EQ_RET_E(p_cam->server_queue, overload_open(OVERLOAD_Q_SERVER, p_cam->id), -1, FAILURE);
+  p_cam->stream_ticks = seq_divisor("server_service");
+
+#ifdef FRAME_BUS
+  // Shared memory the camera's frames are published to at the storage rate
+  char bus_name[FRAME_BUS_NAME_MAX];
+  capture_name(p_cam->id, FRAME_BUS_NAME, bus_name, sizeof(bus_name));
+  EQ_RET_E(res, frame_bus_create(&p_cam->bus, bus_name, IMAGE_NUM_BYTES, seq_period_us("jpeg_service")), FAILURE, FAILURE);
+#endif /* FRAME_BUS */
+
+#ifdef TASK_GRAPH
+  // Capture submits the frames, the graph workers store them
+  EQ_RET_E(res, jpeg_graph_init(p_cam), FAILURE, FAILURE);
+#else
+  EQ_RET_E(res, jpeg_enc_init(&p_cam->enc), FAILURE, FAILURE);
+
+  // Released by the sequencer at the storage rate
+  EQ_RET_E(res, seq_add("jpeg_service", p_cam->id, NULL, NULL, &p_cam->slot), FAILURE, FAILURE);
+
+  // Start the service thread with its configured priority and the cores of
+  // the camera
+  EQ_RET_E(res,
+           service_launch_camera("jpeg_service", p_cam->id, jpeg_service, p_cam, &p_cam->thread),
+           FAILURE,
+           FAILURE);
+#endif /* TASK_GRAPH */
+  return SUCCESS;
+} // jpeg_cam_init()
+
+uint32_t jpeg_init()
+{
+  FUNC_ENTRY;
+  int32_t res = 0;
 
-  // Get the max priority
-  EQ_RET_E(rt_max_pri, sched_get_priority_max(SCHED_FIFO), -1, FAILURE);
+#ifndef LOSSLESS
+  METRICS_SET(METRICS_ENCODE_QUALITY, JPEG_QUALITY);
+#endif /* LOSSLESS */
 
-  // Set the priority to max - 1 for the test thread
-  sched.sched_priority = rt_max_pri - 1;
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setschedparam(&sched_attr, &sched),
-                SUCCESS,
-                FAILURE);
-  // Create pthread
-  PT_NOT_EQ_RET(res,
-                pthread_create(&jpeg_thread, &sched_attr, jpeg_service, NULL),
-                SUCCESS,
-                FAILURE);
+  // Encoded frames of every camera share one pool from locked frame memory
+  EQ_RET_E(res, enc_pool_init((size_t)CAMERAS * ENC_POOL_KB * BYTES_PER_KB), FAILURE, FAILURE);
 
-  // Get the scheduler parameters to display
-  PT_NOT_EQ_RET(res,
-                pthread_getschedparam(jpeg_thread, &jpeg_policy, &jpeg_sched),
-                SUCCESS,
-                FAILURE);
-  LOG_HIGH("jpeg_service policy: %d, priority: %d",
-           jpeg_policy,
-           jpeg_sched.sched_priority);
+#ifdef TASK_GRAPH
+  // Every worker encodes any camera's frames with its own encoder
+  EQ_RET_E(res, task_graph_init(), FAILURE, FAILURE);
+  for (uint32_t enc = 0; enc <= task_graph_workers(); enc++)
+  {
+    EQ_RET_E(res, jpeg_enc_init(&encoders[enc]), FAILURE, FAILURE);
+  }
+#endif /* TASK_GRAPH */
+
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    cams[cam].id = cam;
+    EQ_RET_E(res, jpeg_cam_init(&cams[cam]), FAILURE, FAILURE);
+  }
   return SUCCESS;
 } // jpeg_init()
@@ -0,0 +1,413 @@
+/** @file jpeg_raw.c
+*
+* @brief Raw data JPEG encoder.  The camera's YCbCr samples are handed to
+*        libjpeg one MCU row at a time, so the only per pixel work before the
+*        DCT is spreading the limited range samples to the full range JPEG
+*        expects.  BGR24 frames go through libjpeg's own color conversion
+*        in place of cvEncodeImage, which allocates every frame.
+*
+*/
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif /* __SSE2__ */
+
+#include "frame.h"
+#include "frame_mem.h"
+#include "jpeg_raw.h"
+#include "log.h"
+#include "project_defs.h"
+
+// Most JPEG output, a frame of 3 byte pixels is far beyond any encoding
+#define RAW_OUT_BYTES(width, height) ((width) * (height) * 3)
+
+// BT.601 limited range, luma 16-235 and chroma 16-240, spread to full range
+// by 255/219 and 255/224 in 7 bit fixed point so it fits 16 bit lanes
+#define Y_MIN (16)
+#define C_MID (128)
+#define Y_SCALE (149)
+#define C_SCALE (146)
+#define RANGE_SHIFT (7)
+#define RANGE_ROUND (1 << (RANGE_SHIFT - 1))
+#define FULL_RANGE (255)
+
+/*!
+* @brief Logs a libjpeg error and returns to the encode call in place of
+*        libjpeg's exit
+* @param p_info libjpeg object that failed
+*/
+static
+void jpeg_raw_error(j_common_ptr p_info)
+{
+  char msg[JMSG_LENGTH_MAX];
+
+  (*p_info->err->format_message)(p_info, msg);
+  LOG_ERROR("libjpeg: %s", msg);
+
+  // The compressor is the first member of its encoder
+  longjmp(((jpeg_raw_t *)p_info)->fail, 1);
+} // jpeg_raw_error()
+
+/*!
+* @brief Scales a sample to full range the same way the vector code does
+* @param sample limited range sample
+* @param offset value of black or no color
+* @param scale fixed point scale
+* @param mid full range value of the offset
+* @return full range sample
+*/
+static
+uint8_t jpeg_raw_expand(int32_t sample, int32_t offset, int32_t scale, int32_t mid)
+{
+  int32_t value;
+
+  // Luma below black is black
+  if (mid == 0 && sample < offset)
+  {
+    sample = offset;
+  }
+  value = (((sample - offset) * scale + RANGE_ROUND) >> RANGE_SHIFT) + mid;
+  return value < 0 ? 0 : (value > FULL_RANGE ? FULL_RANGE : value);
+} // jpeg_raw_expand()
+
+uint32_t jpeg_raw_init(jpeg_raw_t * p_raw, uint32_t width, uint32_t height, int32_t quality)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_raw);
+
+  if (width % MCU_ROWS != 0 || height % MCU_ROWS != 0)
+  {
+    LOG_ERROR("Raw JPEG encode needs a multiple of %d, not %ux%u", MCU_ROWS, width, height);
+    return FAILURE;
+  }
+  p_raw->width = width;
+  p_raw->height = height;
+
+  EQ_RET_E(p_raw->p_out, frame_mem_alloc(RAW_OUT_BYTES(width, height)), NULL, FAILURE);
+  EQ_RET_E(p_raw->strips[0], frame_mem_alloc(MCU_ROWS * width), NULL, FAILURE);
+  EQ_RET_E(p_raw->strips[1], frame_mem_alloc(MCU_ROWS * width / 2), NULL, FAILURE);
+  EQ_RET_E(p_raw->strips[2], frame_mem_alloc(MCU_ROWS * width / 2), NULL, FAILURE);
+  for (uint32_t row = 0; row < MCU_ROWS; row++)
+  {
+    p_raw->rows[0][row] = p_raw->strips[0] + row * width;
+    p_raw->rows[1][row] = p_raw->strips[1] + row * width / 2;
+    p_raw->rows[2][row] = p_raw->strips[2] + row * width / 2;
+  }
+  for (uint32_t plane = 0; plane < FRAME_PLANES; plane++)
+  {
+    p_raw->planes[plane] = p_raw->rows[plane];
+  }
+  for (int32_t sample = 0; sample <= FULL_RANGE; sample++)
+  {
+    p_raw->y_lut[sample] = jpeg_raw_expand(sample, Y_MIN, Y_SCALE, 0);
+    p_raw->c_lut[sample] = jpeg_raw_expand(sample, C_MID, C_SCALE, C_MID);
+  }
+
+  // Parameters kept by the compressor for every frame.  The YCbCr defaults
+  // are 4:2:0 like OpenCV encodes BGR frames.
+  p_raw->cinfo.err = jpeg_std_error(&p_raw->jerr);
+  p_raw->jerr.error_exit = jpeg_raw_error;
+  if (setjmp(p_raw->fail))
+  {
+    return FAILURE;
+  }
+  jpeg_create_compress(&p_raw->cinfo);
+  p_raw->cinfo.image_width = width;
+  p_raw->cinfo.image_height = height;
+  p_raw->cinfo.input_components = FRAME_PLANES;
+  p_raw->cinfo.in_color_space = JCS_YCbCr;
+  jpeg_set_defaults(&p_raw->cinfo);
+  jpeg_set_quality(&p_raw->cinfo, quality, TRUE);
+  return SUCCESS;
+} // jpeg_raw_init()
+
+#if defined(__SSE2__)
+// Pixels split per SSE2 step
+#define SPLIT_STEP (16)
+
+/*!
+* @brief Spreads 8 luma samples in 16 bit lanes to full range
+* @param luma limited range samples
+* @return full range samples, packus clamps them
+*/
+static inline
+__m128i jpeg_raw_expand_y(__m128i luma)
+{
+  luma = _mm_sub_epi16(_mm_max_epi16(luma, _mm_set1_epi16(Y_MIN)), _mm_set1_epi16(Y_MIN));
+  luma = _mm_add_epi16(_mm_mullo_epi16(luma, _mm_set1_epi16(Y_SCALE)), _mm_set1_epi16(RANGE_ROUND));
+  return _mm_srli_epi16(luma, RANGE_SHIFT);
+} // jpeg_raw_expand_y()
+
+/*!
+* @brief Spreads 8 chroma samples in 16 bit lanes to full range
+* @param chroma limited range samples
+* @return full range samples, packus clamps them
+*/
+static inline
+__m128i jpeg_raw_expand_c(__m128i chroma)
+{
+  chroma = _mm_mullo_epi16(_mm_sub_epi16(chroma, _mm_set1_epi16(C_MID)), _mm_set1_epi16(C_SCALE));
+  chroma = _mm_srai_epi16(_mm_add_epi16(chroma, _mm_set1_epi16(RANGE_ROUND)), RANGE_SHIFT);
+  return _mm_add_epi16(chroma, _mm_set1_epi16(C_MID));
+} // jpeg_raw_expand_c()
+
+/*!
+* @brief Splits 16 pixels of a pair of YUYV rows with SSE2
+* @param p_top 32 bytes of the top row
+* @param p_bottom 32 bytes of the bottom row
+* @param p_y_top 16 top luma samples
+* @param p_y_bottom 16 bottom luma samples
+* @param p_u 8 Cb samples
+* @param p_v 8 Cr samples
+*/
+static inline
+void jpeg_raw_split_step(const uint8_t * p_top,
+                         const uint8_t * p_bottom,
+                         uint8_t * p_y_top,
+                         uint8_t * p_y_bottom,
+                         uint8_t * p_u,
+                         uint8_t * p_v)
+{
+  const __m128i mask = _mm_set1_epi16(0xff);
+  __m128i top[2];
+  __m128i bottom[2];
+  __m128i chroma[2];
+
+  top[0] = _mm_loadu_si128((const __m128i *)p_top);
+  top[1] = _mm_loadu_si128((const __m128i *)(p_top + 16));
+  bottom[0] = _mm_loadu_si128((const __m128i *)p_bottom);
+  bottom[1] = _mm_loadu_si128((const __m128i *)(p_bottom + 16));
+
+  // Luma is every even byte
+  _mm_storeu_si128((__m128i *)p_y_top,
+                   _mm_packus_epi16(jpeg_raw_expand_y(_mm_and_si128(top[0], mask)),
+                                    jpeg_raw_expand_y(_mm_and_si128(top[1], mask))));
+  _mm_storeu_si128((__m128i *)p_y_bottom,
+                   _mm_packus_epi16(jpeg_raw_expand_y(_mm_and_si128(bottom[0], mask)),
+                                    jpeg_raw_expand_y(_mm_and_si128(bottom[1], mask))));
+
+  // Cb and Cr alternate in the odd bytes, average the rows then split them
+  chroma[0] = _mm_avg_epu16(_mm_srli_epi16(top[0], 8), _mm_srli_epi16(bottom[0], 8));
+  chroma[1] = _mm_avg_epu16(_mm_srli_epi16(top[1], 8), _mm_srli_epi16(bottom[1], 8));
+  chroma[0] = _mm_packus_epi16(jpeg_raw_expand_c(chroma[0]), jpeg_raw_expand_c(chroma[1]));
+  _mm_storel_epi64((__m128i *)p_u, _mm_packus_epi16(_mm_and_si128(chroma[0], mask), mask));
+  _mm_storel_epi64((__m128i *)p_v, _mm_packus_epi16(_mm_srli_epi16(chroma[0], 8), mask));
+} // jpeg_raw_split_step()
+#elif defined(__ARM_NEON)
+// Pixels split per NEON step
+#define SPLIT_STEP (16)
+
+/*!
+* @brief Spreads 8 luma samples to full range
+* @param luma limited range samples
+* @return full range samples
+*/
+static inline
+uint8x8_t jpeg_raw_expand_y(uint8x8_t luma)
+{
+  return vqrshrn_n_u16(vmull_u8(vqsub_u8(luma, vdup_n_u8(Y_MIN)), vdup_n_u8(Y_SCALE)), RANGE_SHIFT);
+} // jpeg_raw_expand_y()
+
+/*!
+* @brief Spreads 8 chroma samples to full range
+* @param chroma limited range samples
+* @return full range samples
+*/
+static inline
+uint8x8_t jpeg_raw_expand_c(uint8x8_t chroma)
+{
+  int16x8_t value = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(chroma)), vdupq_n_s16(C_MID));
+
+  // Signed saturation around the middle then back to unsigned
+  value = vmulq_n_s16(value, C_SCALE);
+  return veor_u8(vreinterpret_u8_s8(vqrshrn_n_s16(value, RANGE_SHIFT)), vdup_n_u8(C_MID));
+} // jpeg_raw_expand_c()
+
+/*!
+* @brief Splits 16 pixels of a pair of YUYV rows with NEON
+* @param p_top 32 bytes of the top row
+* @param p_bottom 32 bytes of the bottom row
+* @param p_y_top 16 top luma samples
+* @param p_y_bottom 16 bottom luma samples
+* @param p_u 8 Cb samples
+* @param p_v 8 Cr samples
+*/
+static inline
+void jpeg_raw_split_step(const uint8_t * p_top,
+                         const uint8_t * p_bottom,
+                         uint8_t * p_y_top,
+                         uint8_t * p_y_bottom,
+                         uint8_t * p_u,
+                         uint8_t * p_v)
+{
+  // Even luma, Cb, odd luma, Cr
+  uint8x8x4_t top = vld4_u8(p_top);
+  uint8x8x4_t bottom = vld4_u8(p_bottom);
+  uint8x8x2_t luma;
+
+  luma.val[0] = jpeg_raw_expand_y(top.val[0]);
+  luma.val[1] = jpeg_raw_expand_y(top.val[2]);
+  vst2_u8(p_y_top, luma);
+  luma.val[0] = jpeg_raw_expand_y(bottom.val[0]);
+  luma.val[1] = jpeg_raw_expand_y(bottom.val[2]);
+  vst2_u8(p_y_bottom, luma);
+  vst1_u8(p_u, jpeg_raw_expand_c(vrhadd_u8(top.val[1], bottom.val[1])));
+  vst1_u8(p_v, jpeg_raw_expand_c(vrhadd_u8(top.val[3], bottom.val[3])));
+} // jpeg_raw_split_step()
+#endif /* __SSE2__ */
+
+/*!
+* @brief Splits an MCU row of YUYV into the component strips, averaging the
+*        chroma of each pair of rows down to 4:2:0
+* @param p_raw encoder
+* @param p_frame frame being encoded
+* @param first first row of the MCU row
+*/
+static
+void jpeg_raw_yuyv_rows(jpeg_raw_t * p_raw, const frame_t * p_frame, uint32_t first)
+{
+  for (uint32_t row = 0; row < MCU_ROWS; row += 2)
+  {
+    const uint8_t * p_top = p_frame->planes[0] + (first + row) * p_frame->strides[0];
+    const uint8_t * p_bottom = p_top + p_frame->strides[0];
+    uint8_t * p_y_top = p_raw->rows[0][row];
+    uint8_t * p_y_bottom = p_raw->rows[0][row + 1];
+    uint8_t * p_u = p_raw->rows[1][row / 2];
+    uint8_t * p_v = p_raw->rows[2][row / 2];
+    uint32_t pair = 0;
+
+#ifdef SPLIT_STEP
+    for (; pair + SPLIT_STEP / 2 <= p_raw->width / 2; pair += SPLIT_STEP / 2)
+    {
+      jpeg_raw_split_step(&p_top[4 * pair],
+                          &p_bottom[4 * pair],
+                          &p_y_top[2 * pair],
+                          &p_y_bottom[2 * pair],
+                          &p_u[pair],
+                          &p_v[pair]);
+    }
+#endif /* SPLIT_STEP */
+
+    // Pixels left over from the vector steps
+    for (; pair < p_raw->width / 2; pair++)
+    {
+      const uint8_t * p_t = &p_top[4 * pair];
+      const uint8_t * p_b = &p_bottom[4 * pair];
+
+      p_y_top[2 * pair]        = p_raw->y_lut[p_t[0]];
+      p_y_top[2 * pair + 1]    = p_raw->y_lut[p_t[2]];
+      p_y_bottom[2 * pair]     = p_raw->y_lut[p_b[0]];
+      p_y_bottom[2 * pair + 1] = p_raw->y_lut[p_b[2]];
+      p_u[pair] = p_raw->c_lut[(p_t[1] + p_b[1] + 1) >> 1];
+      p_v[pair] = p_raw->c_lut[(p_t[3] + p_b[3] + 1) >> 1];
+    }
+  }
+} // jpeg_raw_yuyv_rows()
+
+/*!
+* @brief Copies an MCU row of each YUV420 plane into the component strips
+* @param p_raw encoder
+* @param p_frame frame being encoded
+* @param first first luma row of the MCU row
+*/
+static
+void jpeg_raw_yuv420_rows(jpeg_raw_t * p_raw, const frame_t * p_frame, uint32_t first)
+{
+  for (uint32_t row = 0; row < MCU_ROWS; row++)
+  {
+    const uint8_t * p_src = p_frame->planes[0] + (first + row) * p_frame->strides[0];
+    for (uint32_t pixel = 0; pixel < p_raw->width; pixel++)
+    {
+      p_raw->rows[0][row][pixel] = p_raw->y_lut[p_src[pixel]];
+    }
+  }
+  for (uint32_t plane = 1; plane < FRAME_PLANES; plane++)
+  {
+    for (uint32_t row = 0; row < DCTSIZE; row++)
+    {
+      const uint8_t * p_src = p_frame->planes[plane] + (first / 2 + row) * p_frame->strides[plane];
+      for (uint32_t pixel = 0; pixel < p_raw->width / 2; pixel++)
+      {
+        p_raw->rows[plane][row][pixel] = p_raw->c_lut[p_src[pixel]];
+      }
+    }
+  }
+} // jpeg_raw_yuv420_rows()
+
+uint32_t jpeg_raw_encode(jpeg_raw_t * p_raw, const frame_t * p_frame, uint8_t ** pp_data, uint32_t * p_len)
+{
+  CHECK_NULL(p_raw);
+  CHECK_NULL(p_frame);
+  unsigned char * p_dest = p_raw->p_out;
+  uint8_t bgr = p_frame->format == PIX_FMT_BGR24;
+
+  if (p_frame->width != p_raw->width || p_frame->height != p_raw->height)
+  {
+    LOG_ERROR("Encoder is set up for %ux%u not %ux%u",
+              p_raw->width, p_raw->height, p_frame->width, p_frame->height);
+    return FAILURE;
+  }
+
+  if (!bgr && p_frame->format != PIX_FMT_YUYV && p_frame->format != PIX_FMT_YUV420)
+  {
+    LOG_ERROR("Can't encode %s frames", frame_format_name(p_frame->format));
+    return FAILURE;
+  }
+
+  // Errors come back here with the compressor ready for the next frame
+  if (setjmp(p_raw->fail))
+  {
+    jpeg_abort_compress(&p_raw->cinfo);
+    return FAILURE;
+  }
+
+  // Only BGR is color converted, setting the JPEG color space again puts
+  // back the 4:2:0 sampling
+  p_raw->cinfo.in_color_space = bgr ? JCS_EXT_BGR : JCS_YCbCr;
+  jpeg_set_colorspace(&p_raw->cinfo, JCS_YCbCr);
+  p_raw->cinfo.raw_data_in = !bgr;
+
+  // Encode into frame memory, libjpeg only allocates when that is too small
+  p_raw->out_size = RAW_OUT_BYTES(p_raw->width, p_raw->height);
+  jpeg_mem_dest(&p_raw->cinfo, &p_dest, &p_raw->out_size);
+  jpeg_start_compress(&p_raw->cinfo, TRUE);
+  while (bgr && p_raw->cinfo.next_scanline < p_raw->height)
+  {
+    JSAMPROW p_row = p_frame->planes[0] + p_raw->cinfo.next_scanline * p_frame->strides[0];
+    jpeg_write_scanlines(&p_raw->cinfo, &p_row, 1);
+  }
+  for (uint32_t row = 0; !bgr && row < p_raw->height; row += MCU_ROWS)
+  {
+    if (p_frame->format == PIX_FMT_YUYV)
+    {
+      jpeg_raw_yuyv_rows(p_raw, p_frame, row);
+    }
+    else
+    {
+      jpeg_raw_yuv420_rows(p_raw, p_frame, row);
+    }
+    jpeg_write_raw_data(&p_raw->cinfo, p_raw->planes, MCU_ROWS);
+  }
+  jpeg_finish_compress(&p_raw->cinfo);
+
+  if (p_dest != p_raw->p_out)
+  {
+    LOG_ERROR("Encoded frame of %lu bytes outgrew the output buffer", p_raw->out_size);
+    free(p_dest);
+    return FAILURE;
+  }
+  *pp_data = p_raw->p_out;
+  *p_len = p_raw->out_size;
+  return SUCCESS;
+} // jpeg_raw_encode()
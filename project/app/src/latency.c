@@ -0,0 +1,112 @@
+/** @file latency.c
+*
+* @brief Fixed bucket latency histograms used to report latency distributions
+*
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency.h"
+#include "log.h"
+#include "project_defs.h"
+
+#define NSEC_PER_SEC (1000000000ll)
+#define NSEC_PER_MSEC (1000000.0f)
+
+void latency_reset(latency_hist_t * hist)
+{
+  memset(hist, 0, sizeof(*hist));
+} // latency_reset()
+
+void latency_add(latency_hist_t * hist, int64_t ns)
+{
+  int64_t bucket = ns / LATENCY_BUCKET_NS;
+
+  // Negative values can show up across hosts with unsynchronized clocks
+  if (bucket < 0)
+  {
+    bucket = 0;
+  }
+  else if (bucket >= LATENCY_BUCKETS)
+  {
+    bucket = LATENCY_BUCKETS - 1;
+  }
+
+  if (hist->count == 0 || ns < hist->min)
+  {
+    hist->min = ns;
+  }
+  if (hist->count == 0 || ns > hist->max)
+  {
+    hist->max = ns;
+  }
+  hist->buckets[bucket]++;
+  hist->sum += ns;
+  hist->count++;
+} // latency_add()
+
+void latency_merge(latency_hist_t * dst, const latency_hist_t * src)
+{
+  if (src->count == 0)
+  {
+    return;
+  }
+  if (dst->count == 0 || src->min < dst->min)
+  {
+    dst->min = src->min;
+  }
+  if (dst->count == 0 || src->max > dst->max)
+  {
+    dst->max = src->max;
+  }
+  for (uint32_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+  {
+    dst->buckets[bucket] += src->buckets[bucket];
+  }
+  dst->sum += src->sum;
+  dst->count += src->count;
+} // latency_merge()
+
+int64_t latency_percentile(latency_hist_t * hist, double pct)
+{
+  uint64_t target = (uint64_t)((double)hist->count * pct / 100.0);
+  uint64_t seen = 0;
+
+  for (uint32_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+  {
+    seen += hist->buckets[bucket];
+    if (seen > target || (seen == hist->count && seen > 0))
+    {
+      return (int64_t)(bucket + 1) * LATENCY_BUCKET_NS;
+    }
+  }
+  return 0;
+} // latency_percentile()
+
+void latency_report(const char * p_name, latency_hist_t * hist)
+{
+  if (hist->count == 0)
+  {
+    LOG_HIGH("%-14s no samples", p_name);
+    return;
+  }
+
+  LOG_HIGH("%-14s n=%u min=%.2fms mean=%.2fms p50=%.1fms p90=%.1fms "
+           "p99=%.1fms max=%.2fms",
+           p_name,
+           hist->count,
+           (float)hist->min / NSEC_PER_MSEC,
+           (float)(hist->sum / hist->count) / NSEC_PER_MSEC,
+           (float)latency_percentile(hist, 50) / NSEC_PER_MSEC,
+           (float)latency_percentile(hist, 90) / NSEC_PER_MSEC,
+           (float)latency_percentile(hist, 99) / NSEC_PER_MSEC,
+           (float)hist->max / NSEC_PER_MSEC);
+} // latency_report()
+
+int64_t latency_diff_ns(const struct timespec * start, const struct timespec * end)
+{
+  return ((int64_t)end->tv_sec - start->tv_sec) * NSEC_PER_SEC +
+         ((int64_t)end->tv_nsec - start->tv_nsec);
+} // latency_diff_ns()
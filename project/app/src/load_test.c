@@ -0,0 +1,554 @@
+/** @file load_test.c
+*
+* @brief Load generator.  Replaces the camera with synthetic frames and
+*        releases the capture service at stepped rates.  Each stage reports
+*        frames it finished or dropped so every step can be checked for
+*        throughput, queue depth, drops, and latency against its deadline.
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "latency.h"
+#include "load_test.h"
+#include "log.h"
+#include "project_defs.h"
+#include "server.h"
+
+#define NSEC_PER_SEC (1000000000ll)
+#define NSEC_PER_MSEC (1000000ll)
+#define NSEC_PER_USEC (1000ll)
+#define MICROSECONDS_PER_MILLISECOND (1000)
+
+// Height of the band moved down the synthetic frame so every frame differs
+#define BAND_ROWS (16)
+
+// Flag for stopping application
+extern uint32_t abort_test;
+
+// Frames one camera finished at a stage, only written by the camera's
+// service for the stage
+typedef struct load_cam_stats {
+  uint32_t done;
+  struct timespec last;
+  latency_hist_t latency;
+} load_cam_stats_t;
+
+// Counters and latency of frames finishing one stage, totals over the
+// cameras
+typedef struct load_stage_stats {
+  uint32_t done;
+  uint32_t drops;
+  uint32_t depth_max;
+  uint64_t depth_sum;
+  struct timespec last;
+  latency_hist_t latency;
+} load_stage_stats_t;
+
+// Results of one step
+typedef struct load_step {
+  uint32_t rate;
+  uint32_t cams;
+  uint32_t frames;
+  uint32_t released;
+  uint32_t overruns;
+  uint32_t samples;
+  struct timespec start;
+  int64_t deadline;
+  double fps;
+  uint8_t drained;
+  uint8_t ok;
+} load_step_t;
+
+static const char * stage_names[LOAD_STAGES] = {
+  "capture",
+  "store",
+  "serve"
+};
+
+// Synthetic source of each camera and the queues feeding each stage, every
+// camera has its own frame queue and they share the server queue
+static struct {
+  IplImage * base;
+  IplImage * frames[CAMERAS][LOAD_FRAME_BUFS];
+  mqd_t queues[LOAD_STAGES][CAMERAS];
+  struct timespec release;
+} load;
+
+static load_stage_stats_t stages[LOAD_STAGES];
+static load_cam_stats_t cams[CAMERAS][LOAD_STAGES];
+
+/*!
+* @brief Clears the stage statistics between steps
+*/
+static
+void load_reset()
+{
+  for (uint32_t stage = 0; stage < LOAD_STAGES; stage++)
+  {
+    stages[stage].done = 0;
+    stages[stage].drops = 0;
+    stages[stage].depth_max = 0;
+    stages[stage].depth_sum = 0;
+    memset(&stages[stage].last, 0, sizeof(stages[stage].last));
+    latency_reset(&stages[stage].latency);
+    for (uint32_t cam = 0; cam < CAMERAS; cam++)
+    {
+      cams[cam][stage].done = 0;
+      memset(&cams[cam][stage].last, 0, sizeof(cams[cam][stage].last));
+      latency_reset(&cams[cam][stage].latency);
+    }
+  }
+} // load_reset()
+
+/*!
+* @brief Totals the cameras' frames and latency for every stage once a step
+*        has drained
+*/
+static
+void load_merge()
+{
+  for (uint32_t stage = 0; stage < LOAD_STAGES; stage++)
+  {
+    for (uint32_t cam = 0; cam < CAMERAS; cam++)
+    {
+      load_cam_stats_t * p_cam = &cams[cam][stage];
+
+      stages[stage].done += __atomic_load_n(&p_cam->done, __ATOMIC_ACQUIRE);
+      latency_merge(&stages[stage].latency, &p_cam->latency);
+      if (latency_diff_ns(&stages[stage].last, &p_cam->last) > 0)
+      {
+        stages[stage].last = p_cam->last;
+      }
+    }
+  }
+} // load_merge()
+
+/*!
+* @brief Samples the depth of the queues in front of every stage, a stage
+*        is as deep as its deepest camera queue
+*/
+static
+void load_sample_depths()
+{
+  struct mq_attr attr;
+  uint32_t depth;
+
+  for (uint32_t stage = 0; stage < LOAD_STAGES; stage++)
+  {
+    depth = 0;
+    for (uint32_t cam = 0; cam < CAMERAS; cam++)
+    {
+      if (load.queues[stage][cam] != -1 &&
+          mq_getattr(load.queues[stage][cam], &attr) == 0 &&
+          attr.mq_curmsgs > depth)
+      {
+        depth = attr.mq_curmsgs;
+      }
+    }
+    stages[stage].depth_sum += depth;
+    if (depth > stages[stage].depth_max)
+    {
+      stages[stage].depth_max = depth;
+    }
+  }
+} // load_sample_depths()
+
+/*!
+* @brief Gets the frames every camera finished at a stage
+* @param stage stage to count
+* @return frames finished
+*/
+static inline
+uint32_t load_finished(load_stage_t stage)
+{
+  uint32_t done = 0;
+
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    done += __atomic_load_n(&cams[cam][stage].done, __ATOMIC_ACQUIRE);
+  }
+  return done;
+} // load_finished()
+
+/*!
+* @brief Gets the frames that finished or were dropped at a stage
+* @param stage stage to count
+* @return frames accounted for
+*/
+static inline
+uint32_t load_accounted(load_stage_t stage)
+{
+  return load_finished(stage) +
+         __atomic_load_n(&stages[stage].drops, __ATOMIC_ACQUIRE);
+} // load_accounted()
+
+/*!
+* @brief Waits for every released frame to be stored and, when a client is
+*        connected, served
+* @param p_stop semaphore each capture service posts after each frame
+* @param p_busy capture services still holding a release
+* @param num_cams number of cameras
+* @return 1 if the pipeline emptied before LOAD_DRAIN_MS, 0 otherwise
+*/
+static
+uint8_t load_drain(sem_t * p_stop, const uint8_t * p_busy, uint32_t num_cams)
+{
+  struct timespec deadline;
+  struct timespec now;
+  uint32_t captured;
+  uint32_t stored;
+  uint32_t served;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += LOAD_DRAIN_MS / 1000;
+  deadline.tv_nsec += (LOAD_DRAIN_MS % 1000) * NSEC_PER_MSEC;
+  if (deadline.tv_nsec >= NSEC_PER_SEC)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= NSEC_PER_SEC;
+  }
+
+  // Wait for the capture services to finish the last release
+  for (uint32_t cam = 0; cam < num_cams; cam++)
+  {
+    if (p_busy[cam] && sem_timedwait(&p_stop[cam], &deadline) != 0)
+    {
+      return 0;
+    }
+  }
+
+  // Every captured frame has to be stored or dropped, and every stored frame
+  // served or dropped unless there is no client to serve to
+  do
+  {
+    captured = load_finished(LOAD_STAGE_CAPTURE);
+    stored = load_finished(LOAD_STAGE_STORE);
+    served = load_finished(LOAD_STAGE_SERVE);
+    if (load_accounted(LOAD_STAGE_STORE) >= captured &&
+        (served == 0 || load_accounted(LOAD_STAGE_SERVE) >= stored))
+    {
+      return 1;
+    }
+    usleep(MICROSECONDS_PER_MILLISECOND);
+    clock_gettime(CLOCK_REALTIME, &now);
+  } while (!abort_test && latency_diff_ns(&now, &deadline) > 0);
+  return 0;
+} // load_drain()
+
+/*!
+* @brief Checks a step against its deadline and rate and reports it
+* @param p_step step that was run
+* @param fp report file
+*/
+static
+void load_report(load_step_t * p_step, FILE * fp)
+{
+  load_stage_stats_t * cap = &stages[LOAD_STAGE_CAPTURE];
+  load_stage_stats_t * store = &stages[LOAD_STAGE_STORE];
+  load_stage_stats_t * serve = &stages[LOAD_STAGE_SERVE];
+  int64_t elapsed = 0;
+  int64_t store_p99 = 0;
+  int64_t serve_p99 = 0;
+
+  // Totals over the cameras
+  load_merge();
+  elapsed = latency_diff_ns(&p_step->start, &store->last);
+  store_p99 = latency_percentile(&store->latency, 99);
+  serve_p99 = latency_percentile(&serve->latency, 99);
+
+  // Stored frames of every camera over the time from the first release to
+  // the last store
+  p_step->fps = 0;
+  if (store->done > 0 && elapsed > 0)
+  {
+    p_step->fps = (double)store->done * NSEC_PER_SEC / elapsed;
+  }
+
+  // Sustainable when nothing was skipped or dropped, the rate was kept up,
+  // and frames made their deadline.  The serve stage only counts with a
+  // client connected.
+  p_step->ok = p_step->drained &&
+               p_step->overruns == 0 &&
+               cap->done == p_step->released &&
+               store->drops == 0 &&
+               store->done == cap->done &&
+               p_step->fps >= LOAD_RATE_MARGIN * p_step->rate * p_step->cams &&
+               store_p99 <= p_step->deadline;
+  if (serve->done > 0)
+  {
+    p_step->ok = p_step->ok &&
+                 serve->drops == 0 &&
+                 serve->done == store->done &&
+                 serve_p99 <= p_step->deadline;
+  }
+
+  LOG_HIGH("%3u fps x %u cameras: achieved %.1f fps, released %u, "
+           "overruns %u, drops %u/%u, deadline %.1fms, %s",
+           p_step->rate,
+           p_step->cams,
+           p_step->fps,
+           p_step->released,
+           p_step->overruns,
+           store->drops,
+           serve->drops,
+           (float)p_step->deadline / NSEC_PER_MSEC,
+           p_step->ok ? "sustainable" : "NOT sustainable");
+  for (uint32_t stage = 0; stage < LOAD_STAGES; stage++)
+  {
+    if (load.queues[stage][0] != -1)
+    {
+      LOG_HIGH("%-14s queue depth max %u mean %.2f",
+               stage_names[stage],
+               stages[stage].depth_max,
+               p_step->samples ? (double)stages[stage].depth_sum / p_step->samples : 0);
+    }
+    latency_report(stage_names[stage], &stages[stage].latency);
+  }
+  if (!p_step->drained)
+  {
+    LOG_ERROR("Pipeline did not drain within %dms", LOAD_DRAIN_MS);
+  }
+
+  if (fp == NULL)
+  {
+    return;
+  }
+  fprintf(fp,
+          "%u,%u,%u,%.1f,%u,%u,%u,%u,%u,%u,%.2f,%u,%.2f,%.1f,%.1f,%.1f,%.1f,"
+          "%.1f,%.1f,%s\n",
+          p_step->rate,
+          p_step->cams,
+          p_step->released,
+          p_step->fps,
+          p_step->overruns,
+          store->drops,
+          serve->drops,
+          store->done,
+          serve->done,
+          store->depth_max,
+          p_step->samples ? (double)store->depth_sum / p_step->samples : 0,
+          serve->depth_max,
+          p_step->samples ? (double)serve->depth_sum / p_step->samples : 0,
+          (double)latency_percentile(&store->latency, 50) / NSEC_PER_USEC,
+          (double)store_p99 / NSEC_PER_USEC,
+          (double)store->latency.max / NSEC_PER_USEC,
+          (double)latency_percentile(&serve->latency, 50) / NSEC_PER_USEC,
+          (double)serve_p99 / NSEC_PER_USEC,
+          (double)serve->latency.max / NSEC_PER_USEC,
+          p_step->ok ? "yes" : "no");
+  fflush(fp);
+} // load_report()
+
+/*!
+* @brief Releases the capture services at one rate for LOAD_STEP_SECONDS
+* @param p_step step to run with the rate and cameras set
+* @param p_start semaphore releasing each capture service
+* @param p_stop semaphore each capture service posts after each frame
+*/
+static
+void load_step(load_step_t * p_step, sem_t * p_start, sem_t * p_stop)
+{
+  struct timespec next;
+  int64_t period = NSEC_PER_SEC / p_step->rate;
+  uint8_t busy[CAMERAS];
+
+  p_step->frames = p_step->rate * LOAD_STEP_SECONDS;
+  p_step->deadline = LOAD_DEADLINE_PERIODS * period;
+  LOG_HIGH("Running %u frames at %u fps on %u cameras", p_step->frames, p_step->rate, p_step->cams);
+
+  load_reset();
+  memset(busy, 0, sizeof(busy));
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (uint32_t frame = 0; frame < p_step->frames && !abort_test; frame++)
+  {
+    // The first release time starts the throughput window
+    clock_gettime(CLOCK_REALTIME, &load.release);
+    if (p_step->released == 0)
+    {
+      p_step->start = load.release;
+    }
+    for (uint32_t cam = 0; cam < p_step->cams; cam++)
+    {
+      // Skip the release when the capture service is still on the last one
+      if (busy[cam] && sem_trywait(&p_stop[cam]) != 0)
+      {
+        p_step->overruns++;
+        continue;
+      }
+      sem_post(&p_start[cam]);
+      busy[cam] = 1;
+      p_step->released++;
+    }
+    load_sample_depths();
+    p_step->samples++;
+
+    // Sleep until the next absolute release time so lateness doesn't add up
+    next.tv_nsec += period;
+    while (next.tv_nsec >= NSEC_PER_SEC)
+    {
+      next.tv_sec++;
+      next.tv_nsec -= NSEC_PER_SEC;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+
+  p_step->drained = load_drain(p_stop, busy, p_step->cams);
+} // load_step()
+
+uint32_t load_init(uint32_t hres, uint32_t vres)
+{
+  FUNC_ENTRY;
+  char queue_name[QUEUE_NAME_MAX];
+  uint8_t * p_pixel;
+
+  // Base pattern each synthetic frame is copied from
+  EQ_RET_E(load.base,
+           cvCreateImage(cvSize(hres, vres), IPL_DEPTH_8U, 3),
+           NULL,
+           FAILURE);
+  for (uint32_t row = 0; row < vres; row++)
+  {
+    p_pixel = (uint8_t *)load.base->imageData + row * load.base->widthStep;
+    for (uint32_t col = 0; col < hres; col++)
+    {
+      *p_pixel++ = col * 255 / hres;
+      *p_pixel++ = row * 255 / vres;
+      *p_pixel++ = (col ^ row) & 0xff;
+    }
+  }
+
+  // Fill every camera's frames now so they are faulted in before the test
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    for (uint32_t buf = 0; buf < LOAD_FRAME_BUFS; buf++)
+    {
+      EQ_RET_E(load.frames[cam][buf],
+               cvCreateImage(cvSize(hres, vres), IPL_DEPTH_8U, 3),
+               NULL,
+               FAILURE);
+      memcpy(load.frames[cam][buf]->imageData, load.base->imageData, load.base->imageSize);
+    }
+  }
+
+  // Queues are only sampled for depth so open them without blocking
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    load.queues[LOAD_STAGE_CAPTURE][cam] = -1;
+    load.queues[LOAD_STAGE_SERVE][cam] = -1;
+    capture_name(cam, QUEUE_NAME, queue_name, sizeof(queue_name));
+    EQ_RET_E(load.queues[LOAD_STAGE_STORE][cam],
+             mq_open(queue_name, O_RDONLY | O_NONBLOCK | O_CREAT, S_IRWXU, NULL),
+             -1,
+             FAILURE);
+  }
+#ifdef JPEG_COMPRESSION
+  EQ_RET_E(load.queues[LOAD_STAGE_SERVE][0],
+           mq_open(SERVER_QUEUE_NAME, O_RDONLY | O_NONBLOCK | O_CREAT, S_IRWXU, NULL),
+           -1,
+           FAILURE);
+#endif /* JPEG_COMPRESSION */
+
+  LOG_HIGH("Load test source of %ux%u frames ready", hres, vres);
+  return SUCCESS;
+} // load_init()
+
+IplImage * load_frame(uint32_t cam, uint32_t seq)
+{
+  IplImage * frame = load.frames[cam][seq % LOAD_FRAME_BUFS];
+  uint32_t band = (seq * BAND_ROWS) % frame->height;
+  uint32_t rows = frame->height - band < BAND_ROWS ? frame->height - band : BAND_ROWS;
+
+  // Copy the pattern in as the camera would and mark a moving band
+  memcpy(frame->imageData, load.base->imageData, load.base->imageSize);
+  memset(frame->imageData + band * frame->widthStep, 0xff, rows * frame->widthStep);
+  return frame;
+} // load_frame()
+
+void load_done(load_stage_t stage, uint32_t cam, const struct timespec * cap_time)
+{
+  load_cam_stats_t * stats = &cams[cam][stage];
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  // Capture latency is from release, later stages from capture
+  if (stage == LOAD_STAGE_CAPTURE)
+  {
+    latency_add(&stats->latency, latency_diff_ns(&load.release, &now));
+  }
+  else
+  {
+    latency_add(&stats->latency, latency_diff_ns(cap_time, &now));
+  }
+  stats->last = now;
+  __atomic_fetch_add(&stats->done, 1, __ATOMIC_RELEASE);
+} // load_done()
+
+void load_drop(load_stage_t stage)
+{
+  __atomic_fetch_add(&stages[stage].drops, 1, __ATOMIC_RELEASE);
+} // load_drop()
+
+uint32_t load_run(sem_t * p_start, sem_t * p_stop, uint32_t num_cams)
+{
+  FUNC_ENTRY;
+  const uint32_t rates[] = LOAD_RATES;
+  load_step_t step;
+  uint32_t max_rate = 0;
+  uint32_t fails = 0;
+  FILE * fp;
+
+  // Results are still logged if the report can't be written
+  fp = fopen(LOAD_REPORT_FILE_NAME, "w");
+  if (fp == NULL)
+  {
+    LOG_ERROR("fopen(%s) failed with error: %s", LOAD_REPORT_FILE_NAME, strerror(errno));
+  }
+  else
+  {
+    fprintf(fp,
+            "rate,cameras,released,achieved_fps,overruns,store_drops,serve_drops,"
+            "stored,served,store_q_max,store_q_mean,serve_q_max,serve_q_mean,"
+            "store_p50_us,store_p99_us,store_max_us,serve_p50_us,"
+            "serve_p99_us,serve_max_us,sustainable\n");
+  }
+
+  for (uint32_t i = 0; i < sizeof(rates) / sizeof(rates[0]) && !abort_test; i++)
+  {
+    memset(&step, 0, sizeof(step));
+    step.rate = rates[i];
+    step.cams = num_cams;
+    load_step(&step, p_start, p_stop);
+    load_report(&step, fp);
+
+    // Rates are increasing so stop once it keeps failing
+    if (step.ok)
+    {
+      max_rate = step.rate;
+      fails = 0;
+    }
+    else if (++fails >= LOAD_FAIL_STEPS)
+    {
+      break;
+    }
+  }
+
+  if (fp != NULL)
+  {
+    fclose(fp);
+    LOG_HIGH("Wrote load test report to %s", LOAD_REPORT_FILE_NAME);
+  }
+  LOG_HIGH("Maximum sustainable rate is %u fps on each of %u cameras", max_rate, num_cams);
+  return max_rate;
+} // load_run()
@@ -0,0 +1,487 @@
+/** @file metrics.c
+*
+* @brief Keeps counters and latency histograms for every thread in its own
+*        cache line aligned slot, so the hot path only adds to memory no
+*        other thread writes.  A low priority service sums the slots when
+*        scraped and answers HTTP requests for /metrics in the Prometheus
+*        text format.
+*
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <mqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "enc_pool.h"
+#include "latency.h"
+#include "log.h"
+#include "metrics.h"
+#include "project_defs.h"
+#include "server.h"
+#include "service.h"
+
+#define USEC_PER_SEC (1000000.0)
+#define NSEC_PER_SEC (1000000000.0)
+
+// Cache line size slots are aligned to
+#define METRICS_CACHE_LINE (64)
+
+// Upper bounds of the latency buckets in microseconds, one more bucket holds
+// everything past the last
+#define METRICS_BUCKETS (12)
+#define METRICS_BUCKET_BOUNDS_US {500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000}
+
+// Request and response buffer sizes
+#define METRICS_REQUEST_MAX (1024)
+#define METRICS_RESPONSE_MAX (16384)
+#define METRICS_HEADER_MAX (256)
+
+// Time a scraper gets to send its request and take the response
+#define METRICS_IO_TIMEOUT_MS (1000)
+
+// Prefix of every metric name
+#define METRICS_PREFIX "capture_"
+
+// Path served, any other path gets a 404
+#define METRICS_PATH "GET /metrics"
+
+// One latency histogram
+typedef struct {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t buckets[METRICS_BUCKETS + 1];
+} metrics_hist_data_t;
+
+// Counters and histograms of one thread.  Only the owning thread writes them
+// and the alignment keeps each thread on its own cache lines.
+typedef struct {
+  uint64_t counters[METRICS_COUNTERS];
+  metrics_hist_data_t hists[METRICS_HISTS];
+} __attribute__((aligned(METRICS_CACHE_LINE))) metrics_slot_t;
+
+// Response being built
+typedef struct {
+  char * p_buf;
+  uint32_t len;
+} metrics_out_t;
+
+// Names and help text, must match metrics_counter_t
+static const char * counter_names[METRICS_COUNTERS] = {
+  "frames_captured_total",
+  "frames_encoded_total",
+  "frames_written_total",
+  "frames_sent_total",
+  "frames_dropped_total",
+  "bytes_written_total",
+  "bytes_sent_total",
+  "index_errors_total"
+};
+static const char * counter_help[METRICS_COUNTERS] = {
+  "Frames captured and queued for storage",
+  "Frames encoded or converted",
+  "Frames written to disk",
+  "Frames sent to the client",
+  "Frames dropped or degraded by a queue overload policy",
+  "Bytes of frames written to disk",
+  "Bytes sent to the client",
+  "Stored frames the frame index failed to record"
+};
+
+// Names and help text, must match metrics_gauge_t
+static const char * gauge_names[METRICS_GAUGES] = {
+  "encode_quality",
+  "clients_connected"
+};
+static const char * gauge_help[METRICS_GAUGES] = {
+  "JPEG quality frames are encoded at, 0 when there is none",
+  "Clients connected to the server"
+};
+
+// Stage labels, must match metrics_hist_t
+static const char * hist_stages[METRICS_HISTS] = {
+  "encode",
+  "store",
+  "send"
+};
+
+static const uint32_t bucket_bounds_us[METRICS_BUCKETS] = METRICS_BUCKET_BOUNDS_US;
+
+static struct metrics {
+  // Slots claimed by threads and the slot shared by threads without one
+  metrics_slot_t slots[METRICS_MAX_THREADS];
+  metrics_slot_t shared;
+  uint32_t num_slots;
+  int64_t gauges[METRICS_GAUGES];
+  int32_t sockfd;
+  pthread_t thread;
+  char response[METRICS_RESPONSE_MAX];
+} metrics;
+
+// Slot of the calling thread, NULL until it calls metrics_thread_init()
+static __thread metrics_slot_t * p_own = NULL;
+
+// Global abort flag
+extern uint32_t abort_test;
+
+/*!
+* @brief Adds to a value of a slot.  The owner is the only writer so a plain
+*        add is published with a relaxed store, the shared slot needs an
+*        atomic add.
+* @param p_value value to add to
+* @param value amount to add
+*/
+static inline
+void metrics_bump(uint64_t * p_value, uint64_t value)
+{
+  if (p_own != NULL)
+  {
+    __atomic_store_n(p_value, *p_value + value, __ATOMIC_RELAXED);
+  }
+  else
+  {
+    __atomic_fetch_add(p_value, value, __ATOMIC_RELAXED);
+  }
+} // metrics_bump()
+
+void metrics_thread_init(const char * p_name)
+{
+  FUNC_ENTRY;
+  uint32_t slot = __atomic_fetch_add(&metrics.num_slots, 1, __ATOMIC_RELAXED);
+
+  if (slot >= METRICS_MAX_THREADS)
+  {
+    LOG_MED("No metrics slot left for %s, sharing one", p_name);
+    return;
+  }
+  p_own = &metrics.slots[slot];
+} // metrics_thread_init()
+
+void metrics_add(metrics_counter_t counter, uint64_t value)
+{
+  metrics_slot_t * p_slot = p_own != NULL ? p_own : &metrics.shared;
+
+  metrics_bump(&p_slot->counters[counter], value);
+} // metrics_add()
+
+void metrics_set(metrics_gauge_t gauge, int64_t value)
+{
+  __atomic_store_n(&metrics.gauges[gauge], value, __ATOMIC_RELAXED);
+} // metrics_set()
+
+void metrics_latency(metrics_hist_t hist, const struct timespec * p_start)
+{
+  metrics_slot_t * p_slot = p_own != NULL ? p_own : &metrics.shared;
+  metrics_hist_data_t * p_hist = &p_slot->hists[hist];
+  struct timespec now;
+  int64_t ns;
+  uint32_t bucket = 0;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  ns = latency_diff_ns(p_start, &now);
+  if (ns < 0)
+  {
+    ns = 0;
+  }
+  while (bucket < METRICS_BUCKETS && ns > (int64_t)bucket_bounds_us[bucket] * 1000)
+  {
+    bucket++;
+  }
+  metrics_bump(&p_hist->buckets[bucket], 1);
+  metrics_bump(&p_hist->sum_ns, ns);
+  metrics_bump(&p_hist->count, 1);
+} // metrics_latency()
+
+/*!
+* @brief Appends formatted text to the response, text past the end of the
+*        buffer is cut off
+* @param p_out response being built
+* @param p_fmt printf format
+*/
+static
+void metrics_printf(metrics_out_t * p_out, const char * p_fmt, ...)
+{
+  va_list args;
+  int32_t len;
+
+  if (p_out->len >= METRICS_RESPONSE_MAX - 1)
+  {
+    return;
+  }
+  va_start(args, p_fmt);
+  len = vsnprintf(p_out->p_buf + p_out->len, METRICS_RESPONSE_MAX - p_out->len, p_fmt, args);
+  va_end(args);
+  if (len > 0)
+  {
+    p_out->len += len;
+    if (p_out->len >= METRICS_RESPONSE_MAX)
+    {
+      p_out->len = METRICS_RESPONSE_MAX - 1;
+    }
+  }
+} // metrics_printf()
+
+/*!
+* @brief Adds the depth of a queue, queues not open yet are left out
+* @param p_out response being built
+* @param p_name queue name
+*/
+static
+void metrics_queue_depth(metrics_out_t * p_out, const char * p_name)
+{
+  struct mq_attr attr;
+  mqd_t mq = mq_open(p_name, O_RDONLY | O_NONBLOCK);
+
+  if (mq == (mqd_t)-1)
+  {
+    return;
+  }
+  if (mq_getattr(mq, &attr) == 0)
+  {
+    metrics_printf(p_out,
+                   METRICS_PREFIX "queue_depth{queue=\"%s\"} %ld\n",
+                   p_name + 1,
+                   attr.mq_curmsgs);
+  }
+  mq_close(mq);
+} // metrics_queue_depth()
+
+/*!
+* @brief Sums every slot and writes the metrics in the Prometheus text format
+* @return length of the response
+*/
+static
+uint32_t metrics_render()
+{
+  metrics_out_t out = {metrics.response, 0};
+  metrics_hist_data_t hists[METRICS_HISTS];
+  uint64_t counters[METRICS_COUNTERS];
+  enc_pool_stats_t pool;
+  char queue_name[QUEUE_NAME_MAX];
+  uint32_t num = __atomic_load_n(&metrics.num_slots, __ATOMIC_RELAXED);
+
+  // Totals over the slots, the shared slot is last
+  memset(counters, 0, sizeof(counters));
+  memset(hists, 0, sizeof(hists));
+  num = num < METRICS_MAX_THREADS ? num : METRICS_MAX_THREADS;
+  for (uint32_t slot = 0; slot <= num; slot++)
+  {
+    metrics_slot_t * p_slot = slot < num ? &metrics.slots[slot] : &metrics.shared;
+
+    for (uint32_t counter = 0; counter < METRICS_COUNTERS; counter++)
+    {
+      counters[counter] += __atomic_load_n(&p_slot->counters[counter], __ATOMIC_RELAXED);
+    }
+    for (uint32_t hist = 0; hist < METRICS_HISTS; hist++)
+    {
+      metrics_hist_data_t * p_hist = &p_slot->hists[hist];
+
+      hists[hist].count += __atomic_load_n(&p_hist->count, __ATOMIC_RELAXED);
+      hists[hist].sum_ns += __atomic_load_n(&p_hist->sum_ns, __ATOMIC_RELAXED);
+      for (uint32_t bucket = 0; bucket <= METRICS_BUCKETS; bucket++)
+      {
+        hists[hist].buckets[bucket] += __atomic_load_n(&p_hist->buckets[bucket], __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  for (uint32_t counter = 0; counter < METRICS_COUNTERS; counter++)
+  {
+    metrics_printf(&out,
+                   "# HELP " METRICS_PREFIX "%s %s\n"
+                   "# TYPE " METRICS_PREFIX "%s counter\n"
+                   METRICS_PREFIX "%s %llu\n",
+                   counter_names[counter], counter_help[counter],
+                   counter_names[counter],
+                   counter_names[counter], (unsigned long long)counters[counter]);
+  }
+  for (uint32_t gauge = 0; gauge < METRICS_GAUGES; gauge++)
+  {
+    metrics_printf(&out,
+                   "# HELP " METRICS_PREFIX "%s %s\n"
+                   "# TYPE " METRICS_PREFIX "%s gauge\n"
+                   METRICS_PREFIX "%s %lld\n",
+                   gauge_names[gauge], gauge_help[gauge],
+                   gauge_names[gauge],
+                   gauge_names[gauge],
+                   (long long)__atomic_load_n(&metrics.gauges[gauge], __ATOMIC_RELAXED));
+  }
+
+  // Depth of each camera's frame queue and the server queue
+  metrics_printf(&out,
+                 "# HELP " METRICS_PREFIX "queue_depth Messages waiting in a queue\n"
+                 "# TYPE " METRICS_PREFIX "queue_depth gauge\n");
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    capture_name(cam, QUEUE_NAME, queue_name, sizeof(queue_name));
+    metrics_queue_depth(&out, queue_name);
+  }
+  metrics_queue_depth(&out, SERVER_QUEUE_NAME);
+
+  // Encoded frame pool usage, kept by the pool itself
+  enc_pool_stats(&pool);
+  metrics_printf(&out,
+                 "# HELP " METRICS_PREFIX "enc_pool_bytes Bytes of the encoded frame pool\n"
+                 "# TYPE " METRICS_PREFIX "enc_pool_bytes gauge\n"
+                 METRICS_PREFIX "enc_pool_bytes{state=\"size\"} %llu\n"
+                 METRICS_PREFIX "enc_pool_bytes{state=\"carved\"} %llu\n"
+                 METRICS_PREFIX "enc_pool_bytes{state=\"in_use\"} %llu\n"
+                 METRICS_PREFIX "enc_pool_bytes{state=\"peak\"} %llu\n",
+                 (unsigned long long)pool.size,
+                 (unsigned long long)pool.carved,
+                 (unsigned long long)pool.in_use,
+                 (unsigned long long)pool.peak);
+
+  // Histogram buckets are cumulative in the text format
+  metrics_printf(&out,
+                 "# HELP " METRICS_PREFIX "latency_seconds Time from capture to each stage\n"
+                 "# TYPE " METRICS_PREFIX "latency_seconds histogram\n");
+  for (uint32_t hist = 0; hist < METRICS_HISTS; hist++)
+  {
+    uint64_t total = 0;
+
+    for (uint32_t bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+    {
+      total += hists[hist].buckets[bucket];
+      metrics_printf(&out,
+                     METRICS_PREFIX "latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                     hist_stages[hist],
+                     bucket_bounds_us[bucket] / USEC_PER_SEC,
+                     (unsigned long long)total);
+    }
+    metrics_printf(&out,
+                   METRICS_PREFIX "latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+                   METRICS_PREFIX "latency_seconds_sum{stage=\"%s\"} %.6f\n"
+                   METRICS_PREFIX "latency_seconds_count{stage=\"%s\"} %llu\n",
+                   hist_stages[hist], (unsigned long long)hists[hist].count,
+                   hist_stages[hist], hists[hist].sum_ns / NSEC_PER_SEC,
+                   hist_stages[hist], (unsigned long long)hists[hist].count);
+  }
+  return out.len;
+} // metrics_render()
+
+/*!
+* @brief Answers one scrape and closes the connection
+* @param fd connected socket
+*/
+static
+void metrics_answer(int32_t fd)
+{
+  char request[METRICS_REQUEST_MAX];
+  char header[METRICS_HEADER_MAX];
+  struct pollfd readable = {fd, POLLIN, 0};
+  uint32_t body_len = 0;
+  int32_t header_len = 0;
+  ssize_t len = 0;
+
+  // Only the request line matters, the rest of the request is ignored
+  if (poll(&readable, 1, METRICS_IO_TIMEOUT_MS) != 1 ||
+      (len = recv(fd, request, sizeof(request) - 1, 0)) <= 0)
+  {
+    return;
+  }
+  request[len] = '\0';
+
+  if (strncmp(request, METRICS_PATH, strlen(METRICS_PATH)) == 0 &&
+      (request[strlen(METRICS_PATH)] == ' ' || request[strlen(METRICS_PATH)] == '?'))
+  {
+    body_len = metrics_render();
+    header_len = snprintf(header,
+                          sizeof(header),
+                          "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %u\r\n"
+                          "Connection: close\r\n\r\n",
+                          body_len);
+  }
+  else
+  {
+    header_len = snprintf(header,
+                          sizeof(header),
+                          "HTTP/1.0 404 Not Found\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n\r\n");
+  }
+
+  // A scraper that goes away or stalls just misses this scrape
+  if (send(fd, header, header_len, MSG_NOSIGNAL) == header_len && body_len > 0)
+  {
+    send(fd, metrics.response, body_len, MSG_NOSIGNAL);
+  }
+} // metrics_answer()
+
+/*!
+* @brief Serves scrapes until the abort flag is set
+* @param param unused
+* @return NULL
+*/
+static
+void * metrics_service(void * param)
+{
+  FUNC_ENTRY;
+  struct pollfd incoming = {metrics.sockfd, POLLIN, 0};
+  struct timeval timeout;
+  int32_t fd = -1;
+
+  timeout.tv_sec = METRICS_IO_TIMEOUT_MS / 1000;
+  timeout.tv_usec = (METRICS_IO_TIMEOUT_MS % 1000) * 1000;
+
+  // Wake up every period to check the abort flag
+  while (!abort_test)
+  {
+    if (poll(&incoming, 1, METRICS_PERIOD_US / 1000) != 1)
+    {
+      continue;
+    }
+    fd = accept(metrics.sockfd, NULL, NULL);
+    if (fd == -1)
+    {
+      continue;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    metrics_answer(fd);
+    close(fd);
+  }
+  close(metrics.sockfd);
+  LOG_HIGH("metrics_service thread exiting");
+  return NULL;
+} // metrics_service()
+
+uint32_t metrics_init()
+{
+  FUNC_ENTRY;
+  struct sockaddr_in addr;
+  int32_t reuse = 1;
+  int32_t res = 0;
+
+  // Only reachable from the host, a collector on the host scrapes it
+  EQ_RET_E(metrics.sockfd, socket(AF_INET, SOCK_STREAM, 0), -1, FAILURE);
+  EQ_RET_E(res,
+           setsockopt(metrics.sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)),
+           -1,
+           FAILURE);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(METRICS_PORT);
+  EQ_RET_E(res, bind(metrics.sockfd, (struct sockaddr *)&addr, sizeof(addr)), -1, FAILURE);
+  EQ_RET_E(res, listen(metrics.sockfd, SOMAXCONN), -1, FAILURE);
+  LOG_MED("Serving metrics on http://localhost:%d/metrics", METRICS_PORT);
+
+  // Start the service thread with its configured priority and affinity
+  EQ_RET_E(res,
+           service_launch("metrics_service", metrics_service, NULL, &metrics.thread),
+           FAILURE,
+           FAILURE);
+  return SUCCESS;
+} // metrics_init()
@@ -0,0 +1,261 @@
+/** @file overload.c
+*
+* @brief Per queue overload policy.  Senders go through overload_send() so a
+*        full queue is handled by the configured policy instead of stalling or
+*        aborting, and every dropped or degraded frame is counted against the
+*        stage it was headed for.
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "capture.h"
+#include "frame_mem.h"
+#include "load_test.h"
+#include "log.h"
+#include "metrics.h"
+#include "overload.h"
+#include "project_defs.h"
+#include "server.h"
+
+#define NSEC_PER_SEC (1000000000l)
+#define NSEC_PER_MSEC (1000000l)
+
+// Global abort flag
+extern uint32_t abort_test;
+
+// Configuration and counters of one queue
+typedef struct overload_q {
+  const char * name;
+  const char * mq_name;
+  uint8_t per_camera;
+  load_stage_t stage;
+  overload_policy_t policy;
+  char * p_old[CAMERAS];
+  long old_size;
+  void (*release)(void * msg);
+  uint32_t sent;
+  uint32_t dropped;
+  uint32_t degraded;
+
+  // Most messages the queue is created with, 0 for the system default
+  long depth;
+  long msg_size;
+} overload_q_t;
+
+static const char * policy_names[OVERLOAD_POLICIES] = {
+  "block",
+  "drop-newest",
+  "drop-oldest",
+  "degrade"
+};
+
+// Capture keeps real-time by having the store service skip frames, while the
+// server always sends the latest frames.  Every camera has its own frame
+// queue and they all share the server queue.
+static overload_q_t queues[OVERLOAD_QUEUES] = {
+  {"frame_queue",  QUEUE_NAME,        1, LOAD_STAGE_STORE, OVERLOAD_DEGRADE,     {NULL}, 0, NULL, 0, 0, 0, 0, 0},
+  {"server_queue", SERVER_QUEUE_NAME, 0, LOAD_STAGE_SERVE, OVERLOAD_DROP_OLDEST, {NULL}, 0, NULL, 0, 0, 0, 0, 0},
+};
+
+uint32_t overload_config(const char * p_queue, const char * p_policy)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_queue);
+  CHECK_NULL(p_policy);
+
+  for (uint32_t queue = 0; queue < OVERLOAD_QUEUES; queue++)
+  {
+    if (strcmp(queues[queue].name, p_queue) != 0)
+    {
+      continue;
+    }
+    for (uint32_t policy = 0; policy < OVERLOAD_POLICIES; policy++)
+    {
+      if (strcmp(policy_names[policy], p_policy) == 0)
+      {
+        queues[queue].policy = policy;
+        return SUCCESS;
+      }
+    }
+    LOG_ERROR("Unknown policy for %s: %s", p_queue, p_policy);
+    return FAILURE;
+  }
+  LOG_ERROR("Unknown queue: %s", p_queue);
+  return FAILURE;
+} // overload_config()
+
+void overload_set_release(overload_queue_t queue, void (*release)(void * msg))
+{
+  queues[queue].release = release;
+} // overload_set_release()
+
+void overload_set_depth(overload_queue_t queue, long depth, long msg_size)
+{
+  queues[queue].depth = depth;
+  queues[queue].msg_size = msg_size;
+} // overload_set_depth()
+
+mqd_t overload_open(overload_queue_t queue, uint32_t cam)
+{
+  FUNC_ENTRY;
+  overload_q_t * p_q = &queues[queue];
+  char mq_name[QUEUE_NAME_MAX];
+  struct mq_attr attr;
+  int32_t flags = O_WRONLY | O_CREAT;
+  mqd_t mq;
+
+  // Only block waits for room.  Drop oldest also reads to make room.
+  if (p_q->policy == OVERLOAD_DROP_OLDEST)
+  {
+    flags = O_RDWR | O_NONBLOCK | O_CREAT;
+  }
+  else if (p_q->policy != OVERLOAD_BLOCK)
+  {
+    flags |= O_NONBLOCK;
+  }
+
+  capture_name(p_q->per_camera ? cam : 0, p_q->mq_name, mq_name, sizeof(mq_name));
+  LOG_HIGH("Opening %s with %s policy", mq_name, policy_names[p_q->policy]);
+  if (p_q->depth > 0)
+  {
+    memset(&attr, 0, sizeof(attr));
+    attr.mq_maxmsg = p_q->depth;
+    attr.mq_msgsize = p_q->msg_size;
+    LOG_HIGH("%s holds at most %ld messages", mq_name, p_q->depth);
+    EQ_RET_E(mq, mq_open(mq_name, flags, S_IRWXU, &attr), -1, -1);
+  }
+  else
+  {
+    EQ_RET_E(mq, mq_open(mq_name, flags, S_IRWXU, NULL), -1, -1);
+  }
+
+  // Room for each camera's sender to receive the dropped message, which has
+  // to fit the queue's message size
+  if (p_q->policy == OVERLOAD_DROP_OLDEST)
+  {
+    if (mq_getattr(mq, &attr) != 0 ||
+        (p_q->p_old[cam] = frame_mem_alloc(attr.mq_msgsize)) == NULL)
+    {
+      LOG_ERROR("No room to drop messages from %s", p_q->name);
+      mq_close(mq);
+      return -1;
+    }
+    p_q->old_size = attr.mq_msgsize;
+  }
+  return mq;
+} // overload_open()
+
+void overload_drop(overload_queue_t queue, void * msg)
+{
+  __atomic_fetch_add(&queues[queue].dropped, 1, __ATOMIC_RELAXED);
+  LOAD_DROP(queues[queue].stage);
+  METRICS_ADD(METRICS_FRAMES_DROPPED, 1);
+  if (queues[queue].release != NULL)
+  {
+    queues[queue].release(msg);
+  }
+} // overload_drop()
+
+uint32_t overload_send(overload_queue_t queue, uint32_t cam, mqd_t mq, const void * msg, size_t size)
+{
+  overload_q_t * p_q = &queues[queue];
+
+  while (mq_send(mq, msg, size, 0) != 0)
+  {
+    if (errno != EAGAIN)
+    {
+      LOG_ERROR("mq_send to %s failed with error: %s", p_q->name, strerror(errno));
+      return FAILURE;
+    }
+
+    // Full queue, drop this frame or drop the oldest and try again.  The
+    // consumer may empty the queue first leaving nothing to drop.
+    if (p_q->policy != OVERLOAD_DROP_OLDEST)
+    {
+      overload_drop(queue, (void *)msg);
+      return SUCCESS;
+    }
+    if (mq_receive(mq, p_q->p_old[cam], p_q->old_size, NULL) != -1)
+    {
+      overload_drop(queue, p_q->p_old[cam]);
+    }
+    else if (errno != EAGAIN)
+    {
+      LOG_ERROR("mq_receive from %s failed with error: %s", p_q->name, strerror(errno));
+      return FAILURE;
+    }
+  }
+  __atomic_fetch_add(&p_q->sent, 1, __ATOMIC_RELAXED);
+  return SUCCESS;
+} // overload_send()
+
+ssize_t overload_receive(mqd_t mq, void * msg, size_t size)
+{
+  struct timespec timeout;
+  ssize_t res;
+
+  // Wait in slices so an abort is seen while the queue is empty
+  while (!abort_test)
+  {
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_nsec += OVERLOAD_RECEIVE_MS * NSEC_PER_MSEC;
+    if (timeout.tv_nsec >= NSEC_PER_SEC)
+    {
+      timeout.tv_sec++;
+      timeout.tv_nsec -= NSEC_PER_SEC;
+    }
+    res = mq_timedreceive(mq, (char *)msg, size, NULL, &timeout);
+    if (res != -1 || (errno != ETIMEDOUT && errno != EINTR))
+    {
+      return res;
+    }
+  }
+  return 0;
+} // overload_receive()
+
+uint8_t overload_degrade(overload_queue_t queue, mqd_t mq, void * msg)
+{
+  overload_q_t * p_q = &queues[queue];
+  struct mq_attr attr;
+
+  if (p_q->policy != OVERLOAD_DEGRADE || mq_getattr(mq, &attr) != 0)
+  {
+    return 0;
+  }
+
+  // Behind by more than the threshold, skip this frame's work
+  if (attr.mq_curmsgs * 100 >= attr.mq_maxmsg * OVERLOAD_DEGRADE_PCT)
+  {
+    __atomic_fetch_add(&p_q->degraded, 1, __ATOMIC_RELAXED);
+    LOAD_DROP(p_q->stage);
+    METRICS_ADD(METRICS_FRAMES_DROPPED, 1);
+    if (p_q->release != NULL)
+    {
+      p_q->release(msg);
+    }
+    return 1;
+  }
+  return 0;
+} // overload_degrade()
+
+void overload_report()
+{
+  FUNC_ENTRY;
+
+  for (uint32_t queue = 0; queue < OVERLOAD_QUEUES; queue++)
+  {
+    LOG_HIGH("%-14s %-12s sent: %u dropped: %u degraded: %u",
+             queues[queue].name,
+             policy_names[queues[queue].policy],
+             __atomic_load_n(&queues[queue].sent, __ATOMIC_RELAXED),
+             __atomic_load_n(&queues[queue].dropped, __ATOMIC_RELAXED),
+             __atomic_load_n(&queues[queue].degraded, __ATOMIC_RELAXED));
+  }
+} // overload_report()
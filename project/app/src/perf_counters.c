@@ -0,0 +1,406 @@
+/** @file perf_counters.c
+*
+* @brief Counts cycles, instructions, LLC misses, branch misses, CPU time,
+*        context switches, and page faults for each pipeline stage.  Each
+*        thread opens one group led by its task clock so a single read()
+*        returns every event, taken at the same instant.  Events the kernel
+*        refuses are left out of the group, and the software events fall
+*        back to getrusage() and the thread CPU clock when there is no group
+*        or it may only count user space.
+*
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "perf_counters.h"
+#include "project_defs.h"
+
+#define PERF_NAME_MAX (32)
+#define PERF_LINE_MAX (256)
+#define PERF_NOT_OPEN (-1)
+#define NSEC_PER_SEC (1000000000ull)
+
+// Misses are reported per thousand pixels or bytes
+#define PERF_UNITS_PER_K (1000.0)
+
+// Event definitions, must match perf_event_t
+typedef struct {
+  const char * p_name;
+  uint32_t type;
+  uint64_t config;
+} perf_def_t;
+
+static const perf_def_t defs[PERF_EVENTS] = {
+  {"cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"llc_misses",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {"branch_misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {"task_clock_ns",    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+  {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+  {"page_faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}
+};
+
+// Stage names and what their units are, must match perf_stage_t
+static const char * p_stage_str[PERF_STAGES] = {
+  "capture",
+  "convert",
+  "encode",
+  "file_write",
+  "socket_send"
+};
+static const char * p_unit_str[PERF_STAGES] = {
+  "pixel",
+  "pixel",
+  "pixel",
+  "byte",
+  "byte"
+};
+
+// Counts added up for a stage
+typedef struct {
+  uint64_t frames;
+  uint64_t units;
+  uint64_t totals[PERF_EVENTS];
+
+  // Frames not counted because a read failed, e.g. the group was pushed off
+  // the PMU by another user of the counters
+  uint64_t lost;
+} perf_stage_data_t;
+
+// Counter group of one thread.  Only the owning thread writes to it.
+typedef struct {
+  char name[PERF_NAME_MAX];
+  int32_t fds[PERF_EVENTS];
+
+  // Position of each event in a group read and how many the group has
+  int32_t order[PERF_EVENTS];
+  uint32_t opened;
+
+  // Events taken from getrusage() and the thread CPU clock instead
+  uint32_t rusage;
+
+  uint8_t begun[PERF_STAGES];
+  uint64_t begin[PERF_STAGES][PERF_EVENTS];
+  perf_stage_data_t stages[PERF_STAGES];
+} perf_slot_t;
+
+static perf_slot_t slots[PERF_MAX_THREADS];
+static uint32_t num_slots = 0;
+
+// Slot of the calling thread, NULL until it calls perf_thread_init()
+static __thread perf_slot_t * p_own = NULL;
+
+/*!
+* @brief Opens one event counting the calling thread on any cpu
+* @param event event to open
+* @param group leader of the group to join or -1 to lead a new group
+* @param user_only 1 to leave out time spent in the kernel
+* @return file descriptor or -1 with errno set
+*/
+static
+int32_t perf_open(perf_event_t event, int32_t group, uint8_t user_only)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = defs[event].type;
+  attr.config = defs[event].config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = user_only;
+  attr.exclude_hv = 1;
+
+  // The group always stays on the PMU or reads fail, it is never scaled
+  attr.pinned = (group == -1);
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+} // perf_open()
+
+/*!
+* @brief Reads every event of the calling thread
+* @param p_slot slot of the thread
+* @param p_values counts of each event, events not counted are left alone
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t perf_read(perf_slot_t * p_slot, uint64_t * p_values)
+{
+  uint64_t group[1 + PERF_EVENTS];
+  struct rusage usage;
+  struct timespec cpu;
+
+  // A pinned group that lost its counters reads end of file
+  if (p_slot->fds[PERF_TASK_CLOCK] != -1)
+  {
+    if (read(p_slot->fds[PERF_TASK_CLOCK], group, sizeof(group)) <= 0 || group[0] != p_slot->opened)
+    {
+      return FAILURE;
+    }
+    for (uint32_t event = 0; event < PERF_EVENTS; event++)
+    {
+      if (p_slot->order[event] != PERF_NOT_OPEN)
+      {
+        p_values[event] = group[1 + p_slot->order[event]];
+      }
+    }
+  }
+  if (p_slot->rusage & (1 << PERF_CONTEXT_SWITCHES))
+  {
+    getrusage(RUSAGE_THREAD, &usage);
+    p_values[PERF_CONTEXT_SWITCHES] = usage.ru_nvcsw + usage.ru_nivcsw;
+    p_values[PERF_PAGE_FAULTS] = usage.ru_minflt + usage.ru_majflt;
+  }
+  if (p_slot->rusage & (1 << PERF_TASK_CLOCK))
+  {
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    p_values[PERF_TASK_CLOCK] = (uint64_t)cpu.tv_sec * NSEC_PER_SEC + cpu.tv_nsec;
+  }
+  return SUCCESS;
+} // perf_read()
+
+/*!
+* @brief Checks if an event is counted one way or the other
+* @param p_slot slot of the thread
+* @param event event
+* @return 1 if counted, 0 otherwise
+*/
+static inline
+uint8_t perf_counted(const perf_slot_t * p_slot, perf_event_t event)
+{
+  return p_slot->order[event] != PERF_NOT_OPEN || (p_slot->rusage & (1 << event));
+} // perf_counted()
+
+void perf_thread_init(const char * p_name)
+{
+  FUNC_ENTRY;
+  uint32_t slot = __atomic_fetch_add(&num_slots, 1, __ATOMIC_RELAXED);
+  perf_slot_t * p_slot = NULL;
+  char line[PERF_LINE_MAX];
+  uint32_t used = 0;
+  uint8_t user_only = 0;
+
+  if (slot >= PERF_MAX_THREADS)
+  {
+    LOG_ERROR("No perf counters left for %s", p_name);
+    return;
+  }
+  p_slot = &slots[slot];
+  strncpy(p_slot->name, p_name, PERF_NAME_MAX - 1);
+  for (uint32_t event = 0; event < PERF_EVENTS; event++)
+  {
+    p_slot->fds[event] = -1;
+    p_slot->order[event] = PERF_NOT_OPEN;
+  }
+
+  // Kernel time is left out when perf_event_paranoid only allows user space
+  p_slot->fds[PERF_TASK_CLOCK] = perf_open(PERF_TASK_CLOCK, -1, 0);
+  if (p_slot->fds[PERF_TASK_CLOCK] == -1 && (errno == EACCES || errno == EPERM))
+  {
+    user_only = 1;
+    p_slot->fds[PERF_TASK_CLOCK] = perf_open(PERF_TASK_CLOCK, -1, 1);
+  }
+  if (p_slot->fds[PERF_TASK_CLOCK] != -1)
+  {
+    p_slot->order[PERF_TASK_CLOCK] = p_slot->opened++;
+    for (uint32_t event = 0; event < PERF_EVENTS; event++)
+    {
+      // Context switches and page faults happen in the kernel
+      if (event == PERF_TASK_CLOCK ||
+          (user_only && defs[event].type == PERF_TYPE_SOFTWARE))
+      {
+        continue;
+      }
+      p_slot->fds[event] = perf_open(event, p_slot->fds[PERF_TASK_CLOCK], user_only);
+      if (p_slot->fds[event] != -1)
+      {
+        p_slot->order[event] = p_slot->opened++;
+      }
+    }
+  }
+  else
+  {
+    LOG_MED("No perf counters for %s: %s", p_name, strerror(errno));
+    p_slot->rusage |= (1 << PERF_TASK_CLOCK);
+  }
+  if (p_slot->order[PERF_CONTEXT_SWITCHES] == PERF_NOT_OPEN ||
+      p_slot->order[PERF_PAGE_FAULTS] == PERF_NOT_OPEN)
+  {
+    p_slot->rusage |= (1 << PERF_CONTEXT_SWITCHES) | (1 << PERF_PAGE_FAULTS);
+  }
+
+  // Log what is counted and how
+  for (uint32_t event = 0; event < PERF_EVENTS && used < sizeof(line); event++)
+  {
+    if (perf_counted(p_slot, event))
+    {
+      used += snprintf(line + used,
+                       sizeof(line) - used,
+                       " %s%s",
+                       defs[event].p_name,
+                       (p_slot->rusage & (1 << event)) ? "(rusage)" : "");
+    }
+  }
+  LOG_MED("%s counting%s%s", p_name, line, user_only ? " in user space" : "");
+  p_own = p_slot;
+} // perf_thread_init()
+
+void perf_begin(perf_stage_t stage)
+{
+  if (p_own == NULL)
+  {
+    return;
+  }
+  p_own->begun[stage] = (perf_read(p_own, p_own->begin[stage]) == SUCCESS);
+  p_own->stages[stage].lost += !p_own->begun[stage];
+} // perf_begin()
+
+void perf_end(perf_stage_t stage, uint64_t units)
+{
+  perf_stage_data_t * p_data;
+  uint64_t now[PERF_EVENTS] = {0};
+
+  if (p_own == NULL || !p_own->begun[stage])
+  {
+    return;
+  }
+  p_own->begun[stage] = 0;
+  p_data = &p_own->stages[stage];
+  if (perf_read(p_own, now) != SUCCESS)
+  {
+    p_data->lost++;
+    return;
+  }
+  for (uint32_t event = 0; event < PERF_EVENTS; event++)
+  {
+    p_data->totals[event] += now[event] - p_own->begin[stage][event];
+  }
+  p_data->units += units;
+  p_data->frames++;
+} // perf_end()
+
+/*!
+* @brief Writes one stage of a thread to the report and the log
+* @param fp report file
+* @param p_slot slot of the thread
+* @param stage stage
+*/
+static
+void perf_report_stage(FILE * fp, const perf_slot_t * p_slot, perf_stage_t stage)
+{
+  const perf_stage_data_t * p_data = &p_slot->stages[stage];
+  double frames = p_data->frames;
+  double k_units = p_data->units / PERF_UNITS_PER_K;
+  double totals[PERF_EVENTS];
+  char line[PERF_LINE_MAX];
+  uint32_t used = 0;
+  uint8_t ipc = perf_counted(p_slot, PERF_CYCLES) && perf_counted(p_slot, PERF_INSTRUCTIONS) &&
+                p_data->totals[PERF_CYCLES] != 0;
+
+  fprintf(fp,
+          "%s,%s,%s,%llu,%llu,%.0f",
+          p_slot->name,
+          p_stage_str[stage],
+          p_unit_str[stage],
+          (unsigned long long)p_data->frames,
+          (unsigned long long)p_data->lost,
+          p_data->units / frames);
+
+  // Events per frame, empty when not counted
+  for (uint32_t event = 0; event < PERF_EVENTS; event++)
+  {
+    totals[event] = p_data->totals[event];
+    if (perf_counted(p_slot, event))
+    {
+      fprintf(fp, ",%.1f", totals[event] / frames);
+    }
+    else
+    {
+      fprintf(fp, ",");
+    }
+  }
+  fprintf(fp, ",");
+  if (ipc)
+  {
+    fprintf(fp, "%.3f", totals[PERF_INSTRUCTIONS] / totals[PERF_CYCLES]);
+  }
+  for (uint32_t event = PERF_LLC_MISSES; event <= PERF_BRANCH_MISSES; event++)
+  {
+    fprintf(fp, ",");
+    if (perf_counted(p_slot, event) && k_units > 0)
+    {
+      fprintf(fp, "%.3f", totals[event] / k_units);
+    }
+  }
+  fprintf(fp, "\n");
+
+  // The same with only what was counted in the log
+  used = snprintf(line, sizeof(line), "%.0fus/frame", totals[PERF_TASK_CLOCK] / frames / 1000);
+  if (ipc)
+  {
+    used += snprintf(line + used, sizeof(line) - used, ", IPC %.2f", totals[PERF_INSTRUCTIONS] / totals[PERF_CYCLES]);
+  }
+  for (uint32_t event = PERF_LLC_MISSES; event <= PERF_BRANCH_MISSES && used < sizeof(line); event++)
+  {
+    if (perf_counted(p_slot, event) && k_units > 0)
+    {
+      used += snprintf(line + used,
+                       sizeof(line) - used,
+                       ", %s/k%s %.2f",
+                       defs[event].p_name,
+                       p_unit_str[stage],
+                       totals[event] / k_units);
+    }
+  }
+  if (used < sizeof(line))
+  {
+    snprintf(line + used,
+             sizeof(line) - used,
+             ", %.2f switches and %.2f faults/frame",
+             totals[PERF_CONTEXT_SWITCHES] / frames,
+             totals[PERF_PAGE_FAULTS] / frames);
+  }
+  LOG_HIGH("%-16s %-11s %llu frames: %s", p_slot->name, p_stage_str[stage], (unsigned long long)p_data->frames, line);
+} // perf_report_stage()
+
+uint32_t perf_report(const char * p_file_name)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_file_name);
+  int32_t res = 0;
+  uint32_t num = num_slots < PERF_MAX_THREADS ? num_slots : PERF_MAX_THREADS;
+  FILE * fp;
+
+  EQ_RET_E(fp, fopen(p_file_name, "w"), NULL, FAILURE);
+  fprintf(fp, "thread,stage,unit,frames,lost,units_per_frame");
+  for (uint32_t event = 0; event < PERF_EVENTS; event++)
+  {
+    fprintf(fp, ",%s_per_frame", defs[event].p_name);
+  }
+  fprintf(fp, ",ipc,llc_misses_per_k_unit,branch_misses_per_k_unit\n");
+
+  // Stages still running on other threads may be one frame behind
+  for (uint32_t slot = 0; slot < num; slot++)
+  {
+    for (uint32_t stage = 0; stage < PERF_STAGES; stage++)
+    {
+      if (slots[slot].stages[stage].frames != 0)
+      {
+        perf_report_stage(fp, &slots[slot], stage);
+      }
+    }
+  }
+
+  EQ_RET_E(res, fclose(fp), EOF, FAILURE);
+  LOG_HIGH("Wrote per stage counters to %s", p_file_name);
+  return SUCCESS;
+} // perf_report()
@@ -0,0 +1,253 @@
+/** @file pixel_pass.c
+*
+* @brief Fused pixel pass and its ops.  The conversion writes a strip
+*        straight into the destination, then each op works on the strip in
+*        place while it is still in cache.  Parallel passes hand the strips
+*        to the worker pool.  The downscale averages rows with
+*        SSE2 or NEON, the table lookups and histogram stay scalar as
+*        neither instruction set gathers bytes.
+*
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif /* __SSE2__ */
+
+#include "frame.h"
+#include "log.h"
+#include "pixel_pass.h"
+#include "project_defs.h"
+#include "worker_pool.h"
+
+#define PIXEL_BYTES (3)
+#define STRIP_BYTES (PIXEL_STRIP_KB * 1024)
+
+// BT.601 luma in 8 bit fixed point
+#define LUMA_SHIFT (8)
+#define LUMA_ROUND (1 << (LUMA_SHIFT - 1))
+#define LUMA_R (77)
+#define LUMA_G (150)
+#define LUMA_B (29)
+
+// Frame a pass is run over, shared by the threads converting its strips
+typedef struct pixel_job {
+  const pixel_pass_t * p_pass;
+  const frame_t * p_frame;
+  uint8_t * p_dst;
+  uint32_t dst_stride;
+  uint32_t strip_rows;
+  uint32_t failed;
+} pixel_job_t;
+
+void pixel_pass_init(pixel_pass_t * p_pass, uint8_t bgr, uint8_t parallel)
+{
+  memset(p_pass, 0, sizeof(*p_pass));
+  p_pass->bgr = bgr;
+  p_pass->parallel = parallel;
+} // pixel_pass_init()
+
+uint32_t pixel_pass_add(pixel_pass_t * p_pass, const char * p_name, pixel_kernel_t kernel, void * p_ctx)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_pass);
+  CHECK_NULL(kernel);
+
+  if (p_pass->count == PIXEL_PASS_OPS_MAX)
+  {
+    LOG_ERROR("No room for %s, a pass takes %d ops", p_name, PIXEL_PASS_OPS_MAX);
+    return FAILURE;
+  }
+  p_pass->ops[p_pass->count].p_name = p_name;
+  p_pass->ops[p_pass->count].kernel = kernel;
+  p_pass->ops[p_pass->count].p_ctx = p_ctx;
+  p_pass->count++;
+  return SUCCESS;
+} // pixel_pass_add()
+
+/*!
+* @brief Converts one strip and runs every op on it
+* @param p_ctx pixel_job_t
+* @param item strip number
+*/
+static
+void pixel_pass_strip(void * p_ctx, uint32_t item)
+{
+  pixel_job_t * p_job = (pixel_job_t *)p_ctx;
+  const pixel_pass_t * p_pass = p_job->p_pass;
+  pixel_strip_t strip;
+
+  strip.first = item * p_job->strip_rows;
+  strip.rows = p_job->p_frame->height - strip.first;
+  strip.rows = (strip.rows < p_job->strip_rows) ? strip.rows : p_job->strip_rows;
+  strip.p_rows = p_job->p_dst + strip.first * p_job->dst_stride;
+  strip.stride = p_job->dst_stride;
+  strip.width = p_job->p_frame->width;
+  strip.bgr = p_pass->bgr;
+  if (frame_convert_rows(p_job->p_frame, strip.first, strip.rows, strip.p_rows, strip.stride, strip.bgr) != SUCCESS)
+  {
+    __atomic_store_n(&p_job->failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  for (uint32_t op = 0; op < p_pass->count; op++)
+  {
+    p_pass->ops[op].kernel(&strip, p_pass->ops[op].p_ctx);
+  }
+} // pixel_pass_strip()
+
+uint32_t pixel_pass_run(const pixel_pass_t * p_pass, const frame_t * p_frame, uint8_t * p_dst, uint32_t dst_stride)
+{
+  CHECK_NULL(p_pass);
+  CHECK_NULL(p_frame);
+  CHECK_NULL(p_dst);
+
+  pixel_job_t job = {p_pass, p_frame, p_dst, dst_stride, 0, 0};
+  uint32_t strips = 0;
+
+  if (p_frame->width == 0 || p_frame->width > PIXEL_WIDTH_MAX)
+  {
+    LOG_ERROR("Can't run a pass over a frame %u pixels wide", p_frame->width);
+    return FAILURE;
+  }
+
+  // As many rows as fit the strip, at least one 2x2 block high
+  job.strip_rows = (STRIP_BYTES / (p_frame->width * PIXEL_BYTES)) & ~1u;
+  job.strip_rows = job.strip_rows ? job.strip_rows : 2;
+  strips = (p_frame->height + job.strip_rows - 1) / job.strip_rows;
+
+  if (p_pass->parallel)
+  {
+    worker_pool_for(strips, pixel_pass_strip, &job);
+  }
+  else
+  {
+    for (uint32_t strip = 0; strip < strips; strip++)
+    {
+      pixel_pass_strip(&job, strip);
+    }
+  }
+  return job.failed ? FAILURE : SUCCESS;
+} // pixel_pass_run()
+
+void pixel_tone_map(const pixel_strip_t * p_strip, void * p_ctx)
+{
+  const uint8_t * p_lut = (const uint8_t *)p_ctx;
+  uint32_t bytes = p_strip->width * PIXEL_BYTES;
+
+  // Bounds are kept in locals, the byte stores could alias the strip
+  for (uint32_t row = 0; row < p_strip->rows; row++)
+  {
+    uint8_t * p_row = p_strip->p_rows + row * p_strip->stride;
+
+    for (uint32_t byte = 0; byte < bytes; byte++)
+    {
+      p_row[byte] = p_lut[p_row[byte]];
+    }
+  }
+} // pixel_tone_map()
+
+void pixel_stats(const pixel_strip_t * p_strip, void * p_ctx)
+{
+  pixel_stats_t * p_stats = (pixel_stats_t *)p_ctx;
+  uint32_t red = p_strip->bgr ? 2 : 0;
+  uint32_t blue = p_strip->bgr ? 0 : 2;
+  uint32_t width = p_strip->width;
+  uint32_t hist[PIXEL_HIST_BINS];
+  uint64_t sums[3] = {0, 0, 0};
+
+  memset(hist, 0, sizeof(hist));
+  for (uint32_t row = 0; row < p_strip->rows; row++)
+  {
+    const uint8_t * p_pixel = p_strip->p_rows + row * p_strip->stride;
+    uint32_t row_sums[3] = {0, 0, 0};
+
+    // Row sums fit 32 bits, the frame's don't
+    for (uint32_t col = 0; col < width; col++, p_pixel += PIXEL_BYTES)
+    {
+      uint32_t luma = LUMA_R * p_pixel[red] + LUMA_G * p_pixel[1] + LUMA_B * p_pixel[blue];
+
+      hist[(luma + LUMA_ROUND) >> LUMA_SHIFT]++;
+      row_sums[0] += p_pixel[red];
+      row_sums[1] += p_pixel[1];
+      row_sums[2] += p_pixel[blue];
+    }
+    for (uint32_t channel = 0; channel < 3; channel++)
+    {
+      sums[channel] += row_sums[channel];
+    }
+  }
+
+  // Other strips may be adding theirs at the same time
+  for (uint32_t bin = 0; bin < PIXEL_HIST_BINS; bin++)
+  {
+    if (hist[bin] != 0)
+    {
+      __atomic_fetch_add(&p_stats->hist[bin], hist[bin], __ATOMIC_RELAXED);
+    }
+  }
+  for (uint32_t channel = 0; channel < 3; channel++)
+  {
+    __atomic_fetch_add(&p_stats->sums[channel], sums[channel], __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&p_stats->pixels, p_strip->rows * width, __ATOMIC_RELAXED);
+} // pixel_stats()
+
+/*!
+* @brief Rounded average of two rows
+* @param p_top first row
+* @param p_bottom second row
+* @param p_avg average
+* @param bytes bytes in a row
+*/
+static
+void average_rows(const uint8_t * p_top, const uint8_t * p_bottom, uint8_t * p_avg, uint32_t bytes)
+{
+  uint32_t byte = 0;
+
+#if defined(__SSE2__)
+  for (; byte + 16 <= bytes; byte += 16)
+  {
+    __m128i top = _mm_loadu_si128((const __m128i *)&p_top[byte]);
+    __m128i bottom = _mm_loadu_si128((const __m128i *)&p_bottom[byte]);
+    _mm_storeu_si128((__m128i *)&p_avg[byte], _mm_avg_epu8(top, bottom));
+  }
+#elif defined(__ARM_NEON)
+  for (; byte + 16 <= bytes; byte += 16)
+  {
+    vst1q_u8(&p_avg[byte], vrhaddq_u8(vld1q_u8(&p_top[byte]), vld1q_u8(&p_bottom[byte])));
+  }
+#endif /* __SSE2__ */
+
+  // Bytes left over from the vector steps, rounded the same way
+  for (; byte < bytes; byte++)
+  {
+    p_avg[byte] = (p_top[byte] + p_bottom[byte] + 1) >> 1;
+  }
+} // average_rows()
+
+void pixel_downscale(const pixel_strip_t * p_strip, void * p_ctx)
+{
+  pixel_thumb_t * p_thumb = (pixel_thumb_t *)p_ctx;
+  uint8_t avg[PIXEL_WIDTH_MAX * PIXEL_BYTES];
+
+  // An odd last row of the frame has no pair and is left out
+  for (uint32_t row = 0; row + 1 < p_strip->rows; row += 2)
+  {
+    const uint8_t * p_top = p_strip->p_rows + row * p_strip->stride;
+    uint8_t * p_out = p_thumb->p_buf + ((p_strip->first + row) / 2) * p_thumb->stride;
+
+    average_rows(p_top, p_top + p_strip->stride, avg, p_strip->width * PIXEL_BYTES);
+    for (uint32_t col = 0; col + 1 < p_strip->width; col += 2, p_out += PIXEL_BYTES)
+    {
+      const uint8_t * p_pair = &avg[col * PIXEL_BYTES];
+
+      p_out[0] = (p_pair[0] + p_pair[3] + 1) >> 1;
+      p_out[1] = (p_pair[1] + p_pair[4] + 1) >> 1;
+      p_out[2] = (p_pair[2] + p_pair[5] + 1) >> 1;
+    }
+  }
+} // pixel_downscale()
@@ -15,17 +15,31 @@
 #include <unistd.h>
 
 #include "capture.h"
+#include "frame_bus.h"
+#include "frame_index.h"
+#include "frame_mem.h"
+#include "load_test.h"
 #include "log.h"
+#include "metrics.h"
+#include "overload.h"
+#include "perf_counters.h"
+#include "pixel_pass.h"
 #include "project_defs.h"
 #include "profiler.h"
+#include "retention.h"
+#include "sched_analysis.h"
+#include "sequencer.h"
+#include "service.h"
 #include "ppm.h"
+#include "trace.h"
 #include "utilities.h"
+#include "worker_pool.h"
 
 // File storage info
-#define FILE_NAME_MAX (255)
-#define UNAME_MAX (255)
 #define DIR_NAME "capture_ppm"
 #define FILE_NAME_FMT "%s/capture_%04d.ppm"
+#define FILE_PREFIX "capture_"
+#define FILE_SUFFIX ".ppm"
 
 // Image info
 #define MAX_INTENSITY_STR "255\n"
@@ -35,42 +49,44 @@
 #define MAX_INTENSITY (255)
 #define MAX_INTENSITY_FLOAT (255.0f)
 
-// Image buffer for current frame used to hold converted PPM file
-static char image_buf[IMAGE_NUM_BYTES];
+// Store state of each camera
+typedef struct ppm_cam {
+  uint32_t id;
+  char dir[DIR_NAME_MAX];
 
-// Abort flag
-extern uint8_t abort_test;
+  // Image buffer for current frame used to hold converted PPM file,
+  // allocated from frame memory
+  char * image_buf;
 
-// PPM capture info
-typedef struct {
-  // Hold the uname str
-  char uname_str[UNAME_MAX];
+  // Retention directory id and the number of the first file, which carries
+  // on from the files an earlier run left
+  uint32_t retain_id;
+  uint32_t first_frame;
+#ifdef FRAME_BUS
+  // Bus the camera's frames are published on for local readers
+  frame_bus_t bus;
+#endif /* FRAME_BUS */
 
-  // Length of uname string
-  uint8_t uname_len;
+  // Sequencer slot releasing the service at the storage rate
+  uint32_t slot;
+  pthread_t thread;
+} ppm_cam_t;
 
-  // Resolution info
-  resolution_t resolution;
+static ppm_cam_t cams[CAMERAS];
 
-  // Timestamp to place in image
-  char timestamp[TIMESTAMP_MAX];
+// Gamma transfer function for every intensity, built once by ppm_buf_init()
+static uint8_t gamma_lut[MAX_INTENSITY + 1];
 
-  // Captupre info object
-  cap_info_t cap;
+// Conversion to R, G, B and the gamma function in one pass over the frame,
+// shared by every camera as its op only reads the table.  The strips are
+// spread over the worker pool once ppm_init() has started it.
+static pixel_pass_t ppm_pass;
 
-  // Filename
-  char file_name[FILE_NAME_MAX];
-} ppm_cap_t;
+// Abort flag
+extern uint8_t abort_test;
 
-/*!
-* @brief Applies gamma transfer function to color intensity
-* @param color color intensity
-* @return transformed result
-*/
-static inline
 uint8_t gamma_tf(uint8_t color)
 {
-  FUNC_ENTRY;
   float conversion = (float)color / MAX_INTENSITY_FLOAT;
   if (conversion >= 0 && conversion < 0.0013f)
   {
@@ -82,13 +98,11 @@ uint8_t gamma_tf(uint8_t color)
   }
 } // gamma_tf()
 
-/*!
-* @brief Writes ppm to file and socket
-* @param fd file descriptor to write ppm to
-* @param ppm struct holding ppm data to write to fd
-* @return SUCCESS/FAILURE
-*/
-static inline
+uint8_t gamma_tf_lut(uint8_t color)
+{
+  return gamma_lut[color];
+} // gamma_tf_lut()
+
 uint32_t write_ppm(uint32_t fd, ppm_cap_t * ppm)
 {
   FUNC_ENTRY;
@@ -122,76 +136,86 @@ uint32_t write_ppm(uint32_t fd, ppm_cap_t * ppm)
            FAILURE);
 
   // Write the color data
-  EQ_RET_E(res, write(fd, (void *)image_buf, IMAGE_NUM_BYTES), -1, FAILURE);
+  EQ_RET_E(res, write(fd, (void *)ppm->image_buf, IMAGE_NUM_BYTES), -1, FAILURE);
 
   // Success
   return SUCCESS;
 } // write_ppm()
 
-/*!
-* @brief Puts image buffer rgb in correct format
-* @param ppm ppm structure to set data pointer
-* @param data imageData casted as a colors_t data structure
-* @return SUCCESS/FAILURE
-*/
-static inline
 uint32_t create_image_buf(ppm_cap_t * ppm, colors_t * data)
 {
   FUNC_ENTRY;
   CHECK_NULL(data);
   CHECK_NULL(ppm);
 
-  uint32_t count = 0;
+  frame_t frame;
 
-  // Write the image buffer with proper info
-  for (uint32_t vres = 0; vres < ppm->resolution.vres; vres++)
-  {
-    for (uint32_t hres = 0; hres < ppm->resolution.hres; hres++)
-    {
-#ifdef GAMMA_FUNCTION
-      // Do gamma function conversion which is specified by the NetPbm spec
-      image_buf[count]     = gamma_tf(data->green);
-      image_buf[count + 1] = gamma_tf(data->blue);
-      image_buf[count + 2] = gamma_tf(data->red);
-#else // GAMMA_FUNCTION
-      // Write the raw intensity
-      image_buf[count]     = (data->red);
-      image_buf[count + 1] = (data->green);
-      image_buf[count + 2] = (data->blue);
-#endif // GAMMA_FUNCTION
-      count += 3;
-      data++;
-    }
-  }
+  // Packed B, G, R rows of the capture buffer
+  memset(&frame, 0, sizeof(frame));
+  frame.format = PIX_FMT_BGR24;
+  frame.width = ppm->resolution.hres;
+  frame.height = ppm->resolution.vres;
+  frame.planes[0] = (uint8_t *)data;
+  frame.strides[0] = ppm->resolution.hres * BYTES_PER_PIXEL;
+  return create_image_buf_yuv(ppm, &frame);
+} // create_image_buf()
 
-  // Set the color data pointer to image buf
+uint32_t create_image_buf_yuv(ppm_cap_t * ppm, const frame_t * frame)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(frame);
+  CHECK_NULL(ppm);
+
+  uint32_t res = 0;
+
+  // Convert to RGB where the PPM wants it, with the gamma function applied
+  // to each strip while it is in cache
+  NOT_EQ_RET_E(res,
+               pixel_pass_run(&ppm_pass, frame, (uint8_t *)ppm->image_buf, ppm->resolution.hres * BYTES_PER_PIXEL),
+               SUCCESS,
+               FAILURE);
   return SUCCESS;
-} // create_image_buf()
+} // create_image_buf_yuv()
 
 /*!
-* @brief Handles inccming messages from queue
-* @param no information passed
+* @brief Handles inccming messages from a camera's queue
+* @param param ppm_cam_t of the camera
 * @return NULL
 */
 void * ppm_service(void * param)
 {
   FUNC_ENTRY;
+  ppm_cam_t * p_cam = (ppm_cam_t *)param;
   struct timespec diff;
   ppm_cap_t cap;
+  frame_index_t index;
+  frame_index_rec_t rec;
+  struct timespec enc_time;
   int32_t res = 0;
   uint32_t fd = 0;
-  uint32_t count = 0;
+  uint32_t count = p_cam->first_frame;
   uint8_t timer = profiler_init();
-  char unlink_name[FILE_NAME_MAX];
   image_q_inf_t image_q_inf;
+  char name[SERVICE_NAME_MAX];
+  char queue_name[QUEUE_NAME_MAX];
+
+  capture_name(p_cam->id, "ppm_service", name, sizeof(name));
+  TRACE_INIT(name);
+  METRICS_INIT(name);
+  PERF_INIT(name);
 
-  // Set the resolution
+  // Register for schedulability analysis at the storage rate
+  sa_register(name, timer, seq_period_us("ppm_service"));
+
+  // Set the resolution and the camera's buffer
   cap.resolution.hres = HRES;
   cap.resolution.vres = VRES;
+  cap.image_buf = p_cam->image_buf;
 
-  // Try to create the queue
+  // Try to create the camera's queue
+  capture_name(p_cam->id, QUEUE_NAME, queue_name, sizeof(queue_name));
   EQ_RET_EA(image_q_inf.image_q,
-            mq_open(QUEUE_NAME, O_RDONLY | O_CREAT, S_IRWXU, NULL),
+            mq_open(queue_name, O_RDONLY | O_CREAT, S_IRWXU, NULL),
             -1,
             NULL,
             abort_test);
@@ -208,6 +232,14 @@ void * ppm_service(void * param)
   LOG_LOW("Using uname string: %s", cap.uname_str);
   cap.uname_len = strlen(cap.uname_str);
 
+  // Index every stored frame, PPM frames have no quality
+  EQ_RET_EA(res,
+            frame_index_open(&index, p_cam->dir, seq_period_us("ppm_service"), seq_frame_step("ppm_service", NULL)),
+            FAILURE,
+            NULL,
+            abort_test);
+  memset(&rec, 0, sizeof(rec));
+
   while(!abort_test)
   {
     // Get the time after the loop is done
@@ -216,25 +248,73 @@ void * ppm_service(void * param)
     // Display the timestamp
     DISPLAY_TIMESTAMP;
 
+#ifndef LOAD_TEST
+    // Wait to be released at the storage rate, capture only queues the frames
+    // of the ticks this service is released on.  Load tests store every frame.
+    if (!seq_wait(p_cam->slot))
+    {
+      break;
+    }
+#endif /* LOAD_TEST */
+
     // Create the file name to save data
-    snprintf(cap.file_name, FILE_NAME_MAX, FILE_NAME_FMT, DIR_NAME, count);
+    snprintf(cap.file_name, FILE_NAME_MAX, FILE_NAME_FMT, p_cam->dir, count);
     LOG_LOW("Using %s file name", cap.file_name);
+    TRACE_BEGIN(TRACE_SPAN_QUEUE_WAIT, count);
     EQ_RET_EA(res,
-              mq_receive(image_q_inf.image_q, (char *)&cap.cap, image_q_inf.attr.mq_msgsize, NULL),
+              overload_receive(image_q_inf.image_q, &cap.cap, image_q_inf.attr.mq_msgsize),
               -1,
               NULL,
               abort_test);
+    TRACE_END(TRACE_SPAN_QUEUE_WAIT, count);
+    if (res == 0)
+    {
+      break;
+    }
+
+    // Skip converting and storing this frame when too far behind
+    if (overload_degrade(OVERLOAD_Q_FRAME, image_q_inf.image_q, &cap.cap))
+    {
+      continue;
+    }
 
     // Start the timer after the message has been capture to write to disk
     START_TIME;
 
     // Translate the data from the capture buffer into properly formatted ppm
     // data
-    NOT_EQ_RET_EA(res,
-                  create_image_buf(&cap, (colors_t *)cap.cap.frame->imageData),
-                  SUCCESS,
-                  NULL,
-                  abort_test);
+    TRACE_BEGIN(TRACE_SPAN_CONVERT, cap.cap.seq);
+    PERF_BEGIN(PERF_STAGE_CONVERT);
+    if (cap.cap.frame.format == PIX_FMT_BGR24)
+    {
+      NOT_EQ_RET_EA(res,
+                    create_image_buf(&cap, (colors_t *)cap.cap.frame.planes[0]),
+                    SUCCESS,
+                    NULL,
+                    abort_test);
+    }
+    else
+    {
+      NOT_EQ_RET_EA(res,
+                    create_image_buf_yuv(&cap, &cap.cap.frame),
+                    SUCCESS,
+                    NULL,
+                    abort_test);
+    }
+    TRACE_END(TRACE_SPAN_CONVERT, cap.cap.seq);
+    PERF_END(PERF_STAGE_CONVERT, cap.cap.frame.width * cap.cap.frame.height);
+    clock_gettime(CLOCK_REALTIME, &enc_time);
+    METRICS_ADD(METRICS_FRAMES_ENCODED, 1);
+    METRICS_LATENCY(METRICS_LAT_ENCODE, &cap.cap.time);
+
+    // Local readers get the frame as captured, a frame that doesn't fit is
+    // only left off the bus
+    FRAME_BUS_PUBLISH(&p_cam->bus, &cap.cap.frame, cap.cap.seq, p_cam->id, &cap.cap.time);
+
+    // The converted copy is all that's needed, give the capture buffer back
+    capture_release(&cap.cap);
+    TRACE_BEGIN(TRACE_SPAN_FILE_WRITE, cap.cap.seq);
+    PERF_BEGIN(PERF_STAGE_FILE_WRITE);
 
     // Open file to store contents
     EQ_RET_EA(fd,
@@ -252,76 +332,128 @@ void * ppm_service(void * param)
 
     // Write data to file
     NOT_EQ_RET_EA(res, write_ppm(fd, &cap), SUCCESS, NULL, abort_test);
+    EQ_RET_EA(res, lseek(fd, 0, SEEK_CUR), -1, NULL, abort_test);
+    rec.size = res;
 
     // Close file properly
     EQ_RET_EA(res, close(fd), -1, NULL, abort_test);
-
-    // Unlink old file if the number for frames is greater than the max frame setting
-    res = count - MAX_FRAMES;
-    if (res > -1)
-    {
-      snprintf(unlink_name, FILE_NAME_MAX, FILE_NAME_FMT, DIR_NAME, res);
-      LOG_LOW("Unlinking %s", unlink_name);
-      EQ_RET_EA(res, unlink(unlink_name), -1, NULL, abort_test);
-    }
+    TRACE_END(TRACE_SPAN_FILE_WRITE, cap.cap.seq);
+    PERF_END(PERF_STAGE_FILE_WRITE, rec.size);
+
+    // Add the stored frame to the index
+    rec.seq = cap.cap.seq;
+    rec.format = cap.cap.frame.format;
+    frame_index_time(&rec.cap, &cap.cap.time);
+    frame_index_time(&rec.enc, &enc_time);
+    NOT_EQ_RET_EA(res, frame_index_append(&index, &rec, cap.file_name), SUCCESS, NULL, abort_test);
+    LOAD_DONE(LOAD_STAGE_STORE, p_cam->id, &cap.cap.time);
+    METRICS_ADD(METRICS_FRAMES_WRITTEN, 1);
+    METRICS_ADD(METRICS_BYTES_WRITTEN, rec.size);
+    METRICS_LATENCY(METRICS_LAT_STORE, &cap.cap.time);
+
+    // Old files are deleted by the retention service
+    retention_stored(p_cam->retain_id, count, rec.size, &cap.cap.time);
 
     // Increment counter
     count++;
   }
-  LOG_HIGH("ppm_service thread exiting");
+  LOG_HIGH("%s thread exiting", name);
+  frame_index_close(&index);
+  FRAME_BUS_CLOSE(&p_cam->bus);
   mq_close(image_q_inf.image_q);
   return NULL;
 } // ppm_service()
 
-uint32_t ppm_init()
+uint32_t ppm_buf_init(char ** pp_buf)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(pp_buf);
+
+  // Get the image buffer from locked frame memory
+  EQ_RET_E(*pp_buf, frame_mem_alloc(IMAGE_NUM_BYTES), NULL, FAILURE);
+
+  // Precompute the gamma transfer function so it isn't run for every pixel
+  for (uint32_t color = 0; color <= MAX_INTENSITY; color++)
+  {
+    gamma_lut[color] = gamma_tf(color);
+  }
+
+  // Do gamma function conversion which is specified by the NetPbm spec
+  pixel_pass_init(&ppm_pass, 0, 1);
+#ifdef GAMMA_FUNCTION
+  uint32_t res = 0;
+  EQ_RET_E(res, pixel_pass_add(&ppm_pass, "gamma", pixel_tone_map, gamma_lut), FAILURE, FAILURE);
+#endif // GAMMA_FUNCTION
+  return SUCCESS;
+} // ppm_buf_init()
+
+/*!
+* @brief Sets up a camera's storage directory and buffer and starts its
+*        ppm_service thread
+* @param p_cam camera to start
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t ppm_cam_init(ppm_cam_t * p_cam)
 {
   FUNC_ENTRY;
-  struct sched_param sched;
-  struct sched_param  ppm_sched;
-  pthread_attr_t sched_attr;
-  pthread_t ppm_thread;
   int32_t res = 0;
-  int32_t rt_max_pri = 0;
-  int32_t ppm_policy = 0;
 
   // Try to create directory for storing images
-  EQ_RET_E(res, create_dir(DIR_NAME), FAILURE, FAILURE);
+  capture_name(p_cam->id, DIR_NAME, p_cam->dir, DIR_NAME_MAX);
+  EQ_RET_E(res, create_dir(p_cam->dir), FAILURE, FAILURE);
 
-  // Initialize the schedule attributes
-  PT_NOT_EQ_EXIT(res, pthread_attr_init(&sched_attr), SUCCESS);
+  // Pick up the files already stored
+  EQ_RET_E(res,
+           retention_add(p_cam->dir, FILE_PREFIX, FILE_SUFFIX, &p_cam->retain_id, &p_cam->first_frame),
+           FAILURE,
+           FAILURE);
 
-  // Set the attributes structure to PTHREAD_EXPLICIT_SCHED and SCHED_FIFO
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setinheritsched(&sched_attr, PTHREAD_EXPLICIT_SCHED),
-                SUCCESS,
-                FAILURE);
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setschedpolicy(&sched_attr, SCHED_FIFO),
-                SUCCESS,
-                FAILURE);
+  // Get the image buffer and gamma table ready
+  EQ_RET_E(res, ppm_buf_init(&p_cam->image_buf), FAILURE, FAILURE);
 
-  // Get the max priority
-  EQ_RET_E(rt_max_pri, sched_get_priority_max(SCHED_FIFO), -1, FAILURE);
+#ifdef FRAME_BUS
+  // Shared memory the camera's frames are published to at the storage rate
+  char bus_name[FRAME_BUS_NAME_MAX];
+  capture_name(p_cam->id, FRAME_BUS_NAME, bus_name, sizeof(bus_name));
+  EQ_RET_E(res, frame_bus_create(&p_cam->bus, bus_name, IMAGE_NUM_BYTES, seq_period_us("ppm_service")), FAILURE, FAILURE);
+#endif /* FRAME_BUS */
 
-  // Set the priority to max - 1 for the test thread
-  sched.sched_priority = rt_max_pri - 1;
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setschedparam(&sched_attr, &sched),
-                SUCCESS,
-                FAILURE);
-  // Create pthread
-  PT_NOT_EQ_RET(res,
-                pthread_create(&ppm_thread, &sched_attr, ppm_service, NULL),
-                SUCCESS,
-                FAILURE);
+  // Released by the sequencer at the storage rate
+  EQ_RET_E(res, seq_add("ppm_service", p_cam->id, NULL, NULL, &p_cam->slot), FAILURE, FAILURE);
 
-  // Get the scheduler parameters to display
-  PT_NOT_EQ_RET(res,
-                pthread_getschedparam(ppm_thread, &ppm_policy, &ppm_sched),
-                SUCCESS,
-                FAILURE);
-  LOG_HIGH("ppm_service policy: %d, priority: %d",
-           ppm_policy,
-           ppm_sched.sched_priority);
+  // Start the service thread with its configured priority and the cores of
+  // the camera
+  EQ_RET_E(res,
+           service_launch_camera("ppm_service", p_cam->id, ppm_service, p_cam, &p_cam->thread),
+           FAILURE,
+           FAILURE);
+  return SUCCESS;
+} // ppm_cam_init()
+
+uint32_t ppm_init()
+{
+  FUNC_ENTRY;
+  int32_t res = 0;
+
+  // Workers the conversion of every camera's frames is split over
+  EQ_RET_E(res, worker_pool_init(), FAILURE, FAILURE);
+
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    cams[cam].id = cam;
+    EQ_RET_E(res, ppm_cam_init(&cams[cam]), FAILURE, FAILURE);
+  }
   return SUCCESS;
 } // ppm_init()
+
+void ppm_stop()
+{
+  FUNC_ENTRY;
+
+  // Each service closes its index and queue once it sees the abort flag
+  for (uint32_t cam = 0; cam < CAMERAS; cam++)
+  {
+    pthread_join(cams[cam].thread, NULL);
+  }
+} // ppm_stop()
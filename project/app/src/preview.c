@@ -0,0 +1,198 @@
+/** @file preview.c
+*
+* @brief Preview window.  The preview service runs at a low priority, wakes
+*        every PREVIEW_MS, and asks for a frame once it has shown the last
+*        one.  Capture copies the next frame it posts into the preview's own
+*        memory and hands it over, so the capture buffer can be released
+*        right away and posting never waits on the preview.  Frames posted
+*        while the preview isn't asking are only counted.
+*
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+#include "frame.h"
+#include "log.h"
+#include "preview.h"
+#include "project_defs.h"
+#include "service.h"
+
+#ifdef PREVIEW
+
+// Open CV window info
+#define WINDOWNAME "capture"
+
+// Flag for stopping application
+extern uint32_t abort_test;
+
+// Frame handoff and the preview state
+static struct preview {
+  // Set by the preview when it wants a frame, cleared by capture once the
+  // frame is copied.  Each side only touches the frame while it owns it.
+  uint32_t wanted;
+  frame_t frame;
+  uint32_t seq;
+  uint32_t posted;
+
+  // Planes of frames not in BGR are copied into
+  uint8_t * p_copy;
+  size_t copy_size;
+
+  // Image the window shows, BGR frames are copied and the others converted
+  // into it
+  IplImage * image;
+  pthread_t thread;
+  uint32_t shown;
+} preview;
+
+/*!
+* @brief Copies a BGR frame into the window's image
+* @param p_frame frame
+* @return SUCCESS, FAILURE when the frame is another size
+*/
+static
+uint32_t preview_copy_bgr(const frame_t * p_frame)
+{
+  if (p_frame->width != (uint32_t)preview.image->width || p_frame->height != (uint32_t)preview.image->height)
+  {
+    return FAILURE;
+  }
+  for (uint32_t row = 0; row < p_frame->height; row++)
+  {
+    memcpy(preview.image->imageData + row * preview.image->widthStep,
+           p_frame->planes[0] + row * p_frame->strides[0],
+           p_frame->width * 3);
+  }
+  frame_from_image(&preview.frame, preview.image);
+  return SUCCESS;
+} // preview_copy_bgr()
+
+/*!
+* @brief Copies the planes of a frame not in BGR, keeping their strides
+* @param p_frame frame
+* @return SUCCESS, FAILURE when the frame doesn't fit
+*/
+static
+uint32_t preview_copy_planes(const frame_t * p_frame)
+{
+  size_t plane_bytes;
+  size_t size = 0;
+
+  preview.frame = *p_frame;
+  for (uint32_t plane = 0; plane < FRAME_PLANES; plane++)
+  {
+    plane_bytes = (size_t)frame_plane_rows(p_frame->format, p_frame->height, plane) * p_frame->strides[plane];
+    if (plane_bytes == 0)
+    {
+      continue;
+    }
+    if (size + plane_bytes > preview.copy_size)
+    {
+      return FAILURE;
+    }
+    memcpy(preview.p_copy + size, p_frame->planes[plane], plane_bytes);
+    preview.frame.planes[plane] = preview.p_copy + size;
+    size += plane_bytes;
+  }
+  return SUCCESS;
+} // preview_copy_planes()
+
+void preview_post(const frame_t * p_frame, uint32_t seq)
+{
+  uint32_t res = 0;
+
+  preview.posted++;
+  if (!__atomic_load_n(&preview.wanted, __ATOMIC_ACQUIRE))
+  {
+    return;
+  }
+
+  // A frame that can't be copied is skipped, the preview keeps asking
+  if (p_frame->format == PIX_FMT_BGR24)
+  {
+    res = preview_copy_bgr(p_frame);
+  }
+  else
+  {
+    res = preview_copy_planes(p_frame);
+  }
+  if (res == SUCCESS)
+  {
+    preview.seq = seq;
+    __atomic_store_n(&preview.wanted, 0, __ATOMIC_RELEASE);
+  }
+} // preview_post()
+
+/*!
+* @brief Shows the latest frame every PREVIEW_MS.  The window belongs to this
+*        thread, waiting for GUI events is the sleep between updates.
+* @param param unused
+* @return NULL
+*/
+static
+void * preview_service(void * param)
+{
+  FUNC_ENTRY;
+
+  cvNamedWindow(WINDOWNAME, CV_WINDOW_AUTOSIZE);
+  __atomic_store_n(&preview.wanted, 1, __ATOMIC_RELEASE);
+  while (!abort_test)
+  {
+    // Capture has handed a frame over, only frames in another format are
+    // converted
+    if (!__atomic_load_n(&preview.wanted, __ATOMIC_ACQUIRE))
+    {
+      LOG_LOW("Showing frame %u", preview.seq);
+      if (preview.frame.image != NULL ||
+          frame_to_bgr(&preview.frame, (uint8_t *)preview.image->imageData, preview.image->widthStep) == SUCCESS)
+      {
+        cvShowImage(WINDOWNAME, preview.image);
+        preview.shown++;
+      }
+      __atomic_store_n(&preview.wanted, 1, __ATOMIC_RELEASE);
+    }
+    cvWaitKey(PREVIEW_MS);
+  }
+  cvDestroyWindow(WINDOWNAME);
+  LOG_HIGH("preview_service thread exiting");
+  return NULL;
+} // preview_service()
+
+uint32_t preview_init(uint32_t hres, uint32_t vres)
+{
+  FUNC_ENTRY;
+  uint32_t res = 0;
+
+  // Frames in YUV are converted here for the window
+  EQ_RET_E(preview.image, cvCreateImage(cvSize(hres, vres), IPL_DEPTH_8U, 3), NULL, FAILURE);
+
+  // Room for the planes of a YUV frame with padded rows, touched now so
+  // capture doesn't fault copying into it
+  preview.copy_size = (size_t)hres * vres * 3;
+  EQ_RET_E(preview.p_copy, malloc(preview.copy_size), NULL, FAILURE);
+  memset(preview.p_copy, 0, preview.copy_size);
+
+  // Start the service thread with its configured priority and affinity
+  EQ_RET_E(res,
+           service_launch("preview_service", preview_service, NULL, &preview.thread),
+           FAILURE,
+           FAILURE);
+  return SUCCESS;
+} // preview_init()
+
+void preview_stop()
+{
+  FUNC_ENTRY;
+
+  pthread_join(preview.thread, NULL);
+  cvReleaseImage(&preview.image);
+  free(preview.p_copy);
+  LOG_HIGH("Preview showed %u of %u frames", preview.shown, preview.posted);
+} // preview_stop()
+
+#endif /* PREVIEW */
@@ -7,6 +7,7 @@
 #include <time.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "profiler.h"
 #include "log.h"
@@ -15,28 +16,80 @@ struct timespec start[256];
 struct timespec end[256];
 uint8_t num_timers = 0;
 
+// Statistics and state used to only sample timers that were started
+static profiler_stats_t stats[256];
+static struct timespec last_start[256];
+static uint8_t running[256];
+
 #define NSEC_PER_SEC (1000000000)
 
+/*!
+* @brief Gets the nanoseconds between two timespecs
+* @param from earlier time
+* @param to later time
+* @return nanoseconds between the times
+*/
+static inline
+uint64_t diff_ns(struct timespec * from, struct timespec * to)
+{
+  return (uint64_t)(to->tv_sec - from->tv_sec) * NSEC_PER_SEC +
+         to->tv_nsec - from->tv_nsec;
+} // diff_ns()
+
 uint8_t profiler_init()
 {
-  num_timers++;
-  reset_timer(num_timers);
-  return num_timers;
+  uint8_t timer = __sync_add_and_fetch(&num_timers, 1);
+  reset_timer(timer);
+  return timer;
 } // profiler_init()
 
 int8_t start_timer(uint8_t timer)
 {
-  return clock_gettime(CLOCK_MONOTONIC, &start[timer]);
+  int8_t res = clock_gettime(CLOCK_MONOTONIC, &start[timer]);
+  uint64_t period;
+
+  // Time between starts is the observed period of the service
+  if (last_start[timer].tv_sec != 0)
+  {
+    period = diff_ns(&last_start[timer], &start[timer]);
+    if (stats[timer].period_count == 0 || period < stats[timer].period_min)
+    {
+      stats[timer].period_min = period;
+    }
+    stats[timer].period_total += period;
+    stats[timer].period_count++;
+  }
+  last_start[timer] = start[timer];
+  running[timer] = 1;
+  return res;
 } // start_timer()
 
 int8_t stop_timer(uint8_t timer)
 {
-  return clock_gettime(CLOCK_MONOTONIC, &end[timer]);
+  int8_t res = clock_gettime(CLOCK_MONOTONIC, &end[timer]);
+  uint64_t exec;
+
+  // Only sample the execution time when the timer was started
+  if (running[timer])
+  {
+    exec = diff_ns(&start[timer], &end[timer]);
+    if (exec > stats[timer].wcet)
+    {
+      stats[timer].wcet = exec;
+    }
+    stats[timer].total += exec;
+    stats[timer].count++;
+    running[timer] = 0;
+  }
+  return res;
 } // stop_timer()
 
 void reset_timer(uint8_t timer)
 {
   start[timer].tv_nsec = end[timer].tv_nsec = 0;
+  last_start[timer].tv_sec = last_start[timer].tv_nsec = 0;
+  running[timer] = 0;
+  memset(&stats[timer], 0, sizeof(stats[timer]));
 } // reset_timer()
 
 void get_time(uint8_t timer, struct timespec * diff)
@@ -50,3 +103,8 @@ void get_time(uint8_t timer, struct timespec * diff)
     diff->tv_nsec += NSEC_PER_SEC;
   }
 } // get_time()
+
+void get_stats(uint8_t timer, profiler_stats_t * p_stats)
+{
+  *p_stats = stats[timer];
+} // get_stats()
@@ -0,0 +1,188 @@
+/** @file qoi.c
+*
+* @brief QOI encoder following the QOI specification 1.0.  Frames have no
+*        alpha, so alpha is always 255 and QOI_OP_RGBA is never written.
+*
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "frame.h"
+#include "frame_mem.h"
+#include "log.h"
+#include "project_defs.h"
+#include "qoi.h"
+
+// Chunk tags
+#define QOI_OP_INDEX (0x00)
+#define QOI_OP_DIFF (0x40)
+#define QOI_OP_LUMA (0x80)
+#define QOI_OP_RUN (0xc0)
+#define QOI_OP_RGB (0xfe)
+
+// Longest run one chunk holds
+#define QOI_RUN_MAX (62)
+
+// Pixel packed R, G, B, A from the low byte up
+#define QOI_PIXEL(r, g, b) ((uint32_t)(r) | (uint32_t)(g) << 8 | (uint32_t)(b) << 16 | 0xff000000u)
+
+// Slot of a pixel in the index, alpha is always 255
+#define QOI_HASH(r, g, b) (((r) * 3 + (g) * 5 + (b) * 7 + 255 * 11) & 63)
+
+/*!
+* @brief Writes a big endian 32 bit value
+* @param p_dst destination
+* @param value value to write
+*/
+static inline
+void qoi_put32(uint8_t * p_dst, uint32_t value)
+{
+  p_dst[0] = value >> 24;
+  p_dst[1] = value >> 16;
+  p_dst[2] = value >> 8;
+  p_dst[3] = value;
+} // qoi_put32()
+
+uint32_t qoi_init(qoi_t * p_qoi, uint32_t width, uint32_t height)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_qoi);
+
+  EQ_RET_E(p_qoi->p_rgb, frame_mem_alloc(width * height * 3), NULL, FAILURE);
+  p_qoi->width = width;
+  p_qoi->height = height;
+  return SUCCESS;
+} // qoi_init()
+
+uint32_t qoi_encode(const uint8_t * p_src,
+                    uint32_t width,
+                    uint32_t height,
+                    uint32_t stride,
+                    uint8_t bgr,
+                    uint8_t * p_dst)
+{
+  static const uint8_t end[QOI_END_BYTES] = {0, 0, 0, 0, 0, 0, 0, 1};
+  uint32_t index[64];
+  uint8_t * p_out = p_dst;
+  uint32_t prev = QOI_PIXEL(0, 0, 0);
+  int32_t pr = 0;
+  int32_t pg = 0;
+  int32_t pb = 0;
+  uint32_t run = 0;
+  uint32_t r_off = bgr ? 2 : 0;
+  uint32_t b_off = bgr ? 0 : 2;
+
+  // Header, 3 channels of sRGB
+  memcpy(p_out, "qoif", 4);
+  qoi_put32(p_out + 4, width);
+  qoi_put32(p_out + 8, height);
+  p_out[12] = 3;
+  p_out[13] = 0;
+  p_out += QOI_HEADER_BYTES;
+  memset(index, 0, sizeof(index));
+
+  for (uint32_t row = 0; row < height; row++)
+  {
+    const uint8_t * p_px = p_src + row * stride;
+
+    for (uint32_t col = 0; col < width; col++, p_px += 3)
+    {
+      int32_t r = p_px[r_off];
+      int32_t g = p_px[1];
+      int32_t b = p_px[b_off];
+      uint32_t px = QOI_PIXEL(r, g, b);
+
+      // Runs carry on across rows
+      if (px == prev)
+      {
+        if (++run == QOI_RUN_MAX)
+        {
+          *p_out++ = QOI_OP_RUN | (run - 1);
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0)
+      {
+        *p_out++ = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+
+      uint32_t hash = QOI_HASH(r, g, b);
+      if (index[hash] == px)
+      {
+        *p_out++ = QOI_OP_INDEX | hash;
+      }
+      else
+      {
+        // Differences wrap around like the decoder's 8 bit arithmetic
+        int32_t dr = (int8_t)(r - pr);
+        int32_t dg = (int8_t)(g - pg);
+        int32_t db = (int8_t)(b - pb);
+        int32_t dr_dg = dr - dg;
+        int32_t db_dg = db - dg;
+
+        index[hash] = px;
+        // Biased differences out of range are negative or too big, either
+        // way they set a bit above the range
+        if ((uint32_t)((dr + 2) | (dg + 2) | (db + 2)) < 4)
+        {
+          *p_out++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+        }
+        else if ((uint32_t)(dg + 32) < 64 && (uint32_t)((dr_dg + 8) | (db_dg + 8)) < 16)
+        {
+          *p_out++ = QOI_OP_LUMA | (dg + 32);
+          *p_out++ = (dr_dg + 8) << 4 | (db_dg + 8);
+        }
+        else
+        {
+          p_out[0] = QOI_OP_RGB;
+          p_out[1] = r;
+          p_out[2] = g;
+          p_out[3] = b;
+          p_out += 4;
+        }
+      }
+      prev = px;
+      pr = r;
+      pg = g;
+      pb = b;
+    }
+  }
+  if (run > 0)
+  {
+    *p_out++ = QOI_OP_RUN | (run - 1);
+  }
+  memcpy(p_out, end, QOI_END_BYTES);
+  return p_out + QOI_END_BYTES - p_dst;
+} // qoi_encode()
+
+uint32_t qoi_encode_frame(qoi_t * p_qoi, const frame_t * p_frame, uint8_t * p_dst, uint32_t * p_len)
+{
+  CHECK_NULL(p_qoi);
+  CHECK_NULL(p_frame);
+  CHECK_NULL(p_dst);
+  CHECK_NULL(p_len);
+
+  uint32_t res = 0;
+
+  // The conversion buffer and the output are sized for the frame size the
+  // encoder was set up for, a camera that ignores it would overflow both
+  if (p_frame->width != p_qoi->width || p_frame->height != p_qoi->height)
+  {
+    LOG_ERROR("Encoder is set up for %ux%u not %ux%u",
+              p_qoi->width, p_qoi->height, p_frame->width, p_frame->height);
+    return FAILURE;
+  }
+
+  if (p_frame->format == PIX_FMT_BGR24)
+  {
+    *p_len = qoi_encode(p_frame->planes[0], p_frame->width, p_frame->height, p_frame->strides[0], 1, p_dst);
+    return SUCCESS;
+  }
+  NOT_EQ_RET_E(res, frame_to_rgb(p_frame, p_qoi->p_rgb, p_frame->width * 3), SUCCESS, FAILURE);
+  *p_len = qoi_encode(p_qoi->p_rgb, p_frame->width, p_frame->height, p_frame->width * 3, 0, p_dst);
+  return SUCCESS;
+} // qoi_encode_frame()
@@ -0,0 +1,377 @@
+/** @file retention.c
+*
+* @brief Retention service.  Each directory keeps a ring of the files stored
+*        in it, oldest first.  The storage service is the only producer and
+*        the retention service the only consumer, so reporting a file is a
+*        store and a release.  Deletions are done with unlinkat() on the
+*        directory fd, a batch per pass.
+*
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame_mem.h"
+#include "log.h"
+#include "project_defs.h"
+#include "retention.h"
+#include "sequencer.h"
+#include "service.h"
+
+// Byte quota
+#define RETAIN_BYTES ((uint64_t)RETAIN_MB * 1024 * 1024)
+
+// Slot in a directory's ring
+#define RETAIN_SLOT(idx) ((idx) & (RETENTION_FILES_MAX - 1))
+
+// Flag for stopping application
+extern uint32_t abort_test;
+
+// Stored file
+typedef struct retain_file {
+  uint32_t num;
+  uint32_t size;
+  int64_t sec;
+} retain_file_t;
+
+// Storage directory
+typedef struct retain_dir {
+  const char * p_name;
+  const char * p_prefix;
+  const char * p_suffix;
+  int32_t fd;
+
+  // Ring of stored files, head is written by the retention service and tail
+  // by the storage service
+  retain_file_t * p_files;
+  uint32_t head;
+  uint32_t tail;
+
+  // Files up to seen are counted in bytes
+  uint32_t seen;
+  uint64_t bytes;
+
+  // Files deleted, already gone, and deleted as stored because the ring was
+  // full
+  uint32_t deleted;
+  uint32_t missing;
+  uint32_t lost;
+} retain_dir_t;
+
+// Directories and the service thread
+static struct retention {
+  retain_dir_t dirs[RETENTION_DIRS];
+  uint32_t count;
+  uint32_t slot;
+  pthread_t thread;
+} retention;
+
+/*!
+* @brief Gets the number of a file named <prefix><number><suffix>
+* @param p_dir directory the file is in
+* @param p_name file name
+* @param p_num file number
+* @return 1 when the name matches, 0 otherwise
+*/
+static
+uint8_t retention_parse(const retain_dir_t * p_dir, const char * p_name, uint32_t * p_num)
+{
+  size_t len = strlen(p_dir->p_prefix);
+  char * p_end = NULL;
+
+  if (strncmp(p_name, p_dir->p_prefix, len) != 0 ||
+      p_name[len] < '0' || p_name[len] > '9')
+  {
+    return 0;
+  }
+  *p_num = strtoul(p_name + len, &p_end, 10);
+  return strcmp(p_end, p_dir->p_suffix) == 0;
+} // retention_parse()
+
+/*!
+* @brief Builds the name of a file from its number
+* @param p_dir directory the file is in
+* @param num file number
+* @param p_name name, FILE_NAME_MAX bytes
+*/
+static
+void retention_name(const retain_dir_t * p_dir, uint32_t num, char * p_name)
+{
+  snprintf(p_name, FILE_NAME_MAX, "%s%04u%s", p_dir->p_prefix, num, p_dir->p_suffix);
+} // retention_name()
+
+/*!
+* @brief Deletes a file
+* @param p_dir directory the file is in
+* @param num file number
+*/
+static
+void retention_unlink(retain_dir_t * p_dir, uint32_t num)
+{
+  char name[FILE_NAME_MAX];
+
+  retention_name(p_dir, num, name);
+  if (unlinkat(p_dir->fd, name, 0) == 0)
+  {
+    p_dir->deleted++;
+  }
+  else if (errno == ENOENT)
+  {
+    p_dir->missing++;
+  }
+  else
+  {
+    LOG_ERROR("Unlinking %s/%s failed with error: %s", p_dir->p_name, name, strerror(errno));
+  }
+} // retention_unlink()
+
+/*!
+* @brief Orders files by number
+* @param p_a file
+* @param p_b file
+* @return negative, 0, or positive like strcmp()
+*/
+static
+int retention_cmp(const void * p_a, const void * p_b)
+{
+  uint32_t a = ((const retain_file_t *)p_a)->num;
+  uint32_t b = ((const retain_file_t *)p_b)->num;
+
+  return (a > b) - (a < b);
+} // retention_cmp()
+
+/*!
+* @brief Fills the ring with the files already in a directory, deleting the
+*        oldest when there are more than the ring holds
+* @param p_dir directory to scan
+* @param p_next number to give the next file
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t retention_scan(retain_dir_t * p_dir, uint32_t * p_next)
+{
+  FUNC_ENTRY;
+  retain_file_t * p_found = NULL;
+  retain_file_t * p_grown = NULL;
+  struct dirent * p_ent = NULL;
+  struct stat info;
+  uint32_t found = 0;
+  uint32_t size = 0;
+  uint32_t first = 0;
+  int32_t fd = 0;
+  DIR * p_listing = NULL;
+
+  // The listing closes its own copy of the fd
+  EQ_RET_E(fd, dup(p_dir->fd), -1, FAILURE);
+  EQ_RET_E(p_listing, fdopendir(fd), NULL, FAILURE);
+  while ((p_ent = readdir(p_listing)) != NULL)
+  {
+    uint32_t num = 0;
+
+    if (!retention_parse(p_dir, p_ent->d_name, &num) ||
+        fstatat(p_dir->fd, p_ent->d_name, &info, 0) != 0 ||
+        !S_ISREG(info.st_mode))
+    {
+      continue;
+    }
+    if (found == size)
+    {
+      size = size ? size * 2 : RETENTION_BATCH;
+      if ((p_grown = realloc(p_found, size * sizeof(retain_file_t))) == NULL)
+      {
+        LOG_ERROR("Out of memory listing %s", p_dir->p_name);
+        free(p_found);
+        closedir(p_listing);
+        return FAILURE;
+      }
+      p_found = p_grown;
+    }
+    p_found[found].num = num;
+    p_found[found].size = info.st_size;
+    p_found[found].sec = info.st_mtim.tv_sec;
+    found++;
+  }
+  closedir(p_listing);
+
+  // Oldest first, only as many as the ring holds
+  qsort(p_found, found, sizeof(retain_file_t), retention_cmp);
+  if (found > RETENTION_FILES_MAX)
+  {
+    first = found - RETENTION_FILES_MAX;
+  }
+  for (uint32_t i = 0; i < first; i++)
+  {
+    retention_unlink(p_dir, p_found[i].num);
+  }
+  for (uint32_t i = first; i < found; i++)
+  {
+    p_dir->p_files[i - first] = p_found[i];
+  }
+  p_dir->tail = found - first;
+  *p_next = found ? p_found[found - 1].num + 1 : 0;
+  free(p_found);
+
+  LOG_HIGH("Resuming %s with %u files, next file %u", p_dir->p_name, p_dir->tail, *p_next);
+  return SUCCESS;
+} // retention_scan()
+
+/*!
+* @brief Deletes the oldest files of a directory while it is over a quota
+* @param p_dir directory to check
+* @param now current time in seconds
+*/
+static
+void retention_pass(retain_dir_t * p_dir, int64_t now)
+{
+  uint32_t tail = __atomic_load_n(&p_dir->tail, __ATOMIC_ACQUIRE);
+  uint32_t head = p_dir->head;
+  uint32_t batch = 0;
+
+  // Count the files stored since the last pass
+  for (; p_dir->seen != tail; p_dir->seen++)
+  {
+    p_dir->bytes += p_dir->p_files[RETAIN_SLOT(p_dir->seen)].size;
+  }
+
+  while (head != tail && batch < RETENTION_BATCH)
+  {
+    const retain_file_t * p_file = &p_dir->p_files[RETAIN_SLOT(head)];
+
+    if (!(RETAIN_FRAMES && tail - head > RETAIN_FRAMES) &&
+        !(RETAIN_BYTES && p_dir->bytes > RETAIN_BYTES) &&
+        !(RETAIN_AGE_S && now - p_file->sec > RETAIN_AGE_S))
+    {
+      break;
+    }
+    retention_unlink(p_dir, p_file->num);
+    p_dir->bytes -= p_file->size;
+    head++;
+    batch++;
+  }
+
+  // Hand the slots back to the storage service
+  __atomic_store_n(&p_dir->head, head, __ATOMIC_RELEASE);
+} // retention_pass()
+
+/*!
+* @brief Enforces the quotas each time the sequencer releases it
+* @param param unused
+* @return NULL
+*/
+static
+void * retention_service(void * param)
+{
+  FUNC_ENTRY;
+  struct timespec now;
+
+  while (seq_wait(retention.slot))
+  {
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (uint32_t dir = 0; dir < retention.count; dir++)
+    {
+      retention_pass(&retention.dirs[dir], now.tv_sec);
+    }
+  }
+
+  for (uint32_t dir = 0; dir < retention.count; dir++)
+  {
+    retain_dir_t * p_dir = &retention.dirs[dir];
+
+    LOG_HIGH("%s: %u files deleted, %u already gone, %u deleted untracked",
+             p_dir->p_name,
+             p_dir->deleted,
+             p_dir->missing,
+             __atomic_load_n(&p_dir->lost, __ATOMIC_RELAXED));
+  }
+  LOG_HIGH("retention_service thread exiting");
+  return NULL;
+} // retention_service()
+
+uint32_t retention_add(const char * p_dir, const char * p_prefix, const char * p_suffix, uint32_t * p_id, uint32_t * p_next)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_dir);
+  CHECK_NULL(p_prefix);
+  CHECK_NULL(p_suffix);
+  CHECK_NULL(p_id);
+  CHECK_NULL(p_next);
+
+  retain_dir_t * p_new = NULL;
+
+  if (retention.count == RETENTION_DIRS)
+  {
+    LOG_ERROR("No room to add %s", p_dir);
+    return FAILURE;
+  }
+  p_new = &retention.dirs[retention.count];
+  p_new->p_name = p_dir;
+  p_new->p_prefix = p_prefix;
+  p_new->p_suffix = p_suffix;
+
+  // The ring is written by the storage service, so it comes from locked
+  // frame memory
+  EQ_RET_E(p_new->fd, open(p_dir, O_RDONLY | O_DIRECTORY), -1, FAILURE);
+  EQ_RET_E(p_new->p_files,
+           frame_mem_alloc(RETENTION_FILES_MAX * sizeof(retain_file_t)),
+           NULL,
+           FAILURE);
+  if (retention_scan(p_new, p_next) != SUCCESS)
+  {
+    return FAILURE;
+  }
+  *p_id = retention.count++;
+  return SUCCESS;
+} // retention_add()
+
+void retention_stored(uint32_t id, uint32_t num, uint32_t size, const struct timespec * p_time)
+{
+  retain_dir_t * p_dir = &retention.dirs[id];
+  uint32_t tail = p_dir->tail;
+  retain_file_t * p_file = &p_dir->p_files[RETAIN_SLOT(tail)];
+  char name[FILE_NAME_MAX];
+
+  // A full ring means the retention service is starved.  A file left on disk
+  // untracked would never be deleted, so the new file goes now and disk use
+  // stays bounded.  The retention service owns the older files.
+  if (tail - __atomic_load_n(&p_dir->head, __ATOMIC_ACQUIRE) == RETENTION_FILES_MAX)
+  {
+    retention_name(p_dir, num, name);
+    if (unlinkat(p_dir->fd, name, 0) != 0 && errno != ENOENT)
+    {
+      LOG_ERROR("Unlinking %s/%s failed with error: %s", p_dir->p_name, name, strerror(errno));
+    }
+    __atomic_store_n(&p_dir->lost, p_dir->lost + 1, __ATOMIC_RELAXED);
+    return;
+  }
+  p_file->num = num;
+  p_file->size = size;
+  p_file->sec = p_time->tv_sec;
+  __atomic_store_n(&p_dir->tail, tail + 1, __ATOMIC_RELEASE);
+} // retention_stored()
+
+uint32_t retention_init()
+{
+  FUNC_ENTRY;
+  uint32_t res = 0;
+
+  // Start the service thread with its configured priority and affinity,
+  // released at its period by the sequencer
+  EQ_RET_E(res,
+           seq_add("retention_service", 0, NULL, NULL, &retention.slot),
+           FAILURE,
+           FAILURE);
+  EQ_RET_E(res,
+           service_launch("retention_service", retention_service, NULL, &retention.thread),
+           FAILURE,
+           FAILURE);
+  return SUCCESS;
+} // retention_init()
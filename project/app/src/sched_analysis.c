@@ -0,0 +1,313 @@
+/** @file sched_analysis.c
+*
+* @brief Rate monotonic schedulability analysis of the service set.  Services
+*        are given rate monotonic priorities (shorter period is higher
+*        priority, ties broken by registration order) and checked against the
+*        Liu & Layland utilization bound and by exact response time analysis
+*        with deadline equal to period.  The analysis assumes every service
+*        shares one core which is pessimistic on multi-core targets.
+*
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "profiler.h"
+#include "project_defs.h"
+#include "sched_analysis.h"
+#include "sequencer.h"
+
+#define NSEC_PER_USEC (1000)
+#define LINE_MAX_LEN (256)
+
+// Timer value used for services loaded from a budget file
+#define NO_TIMER (0)
+
+// Analysis information for a single service, times are in nanoseconds
+typedef struct {
+  char name[SA_NAME_MAX];
+  uint8_t timer;
+  uint64_t period;
+  uint64_t wcet;
+  uint64_t mean;
+  uint64_t obs_period;
+  uint64_t response;
+  uint32_t count;
+} sa_service_t;
+
+// Registered services
+static sa_service_t services[SA_MAX_SERVICES];
+static uint32_t num_services = 0;
+static pthread_mutex_t services_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+* @brief Runs utilization and response time analysis on a set of services
+* @param set services to analyze, response times are filled out
+* @param num number of services in the set
+* @return SUCCESS if schedulable, FAILURE otherwise
+*/
+static
+uint32_t sa_analyze(sa_service_t * set, uint32_t num)
+{
+  FUNC_ENTRY;
+  uint32_t order[SA_MAX_SERVICES];
+  uint32_t status = SUCCESS;
+  double util = 0;
+  double bound = 0;
+
+  if (num == 0)
+  {
+    return SUCCESS;
+  }
+
+  // Order the services by period for rate monotonic priorities
+  for (uint32_t i = 0; i < num; i++)
+  {
+    uint32_t j = i;
+    while (j > 0 && set[order[j - 1]].period > set[i].period)
+    {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = i;
+  }
+
+  // Total utilization against the Liu & Layland bound
+  for (uint32_t i = 0; i < num; i++)
+  {
+    util += (double)set[i].wcet / (double)set[i].period;
+  }
+  bound = num * (pow(2.0, 1.0 / num) - 1.0);
+  LOG_HIGH("Utilization %.3f, Liu & Layland bound for %d services %.3f",
+           util,
+           num,
+           bound);
+  if (util > 1.0)
+  {
+    LOG_ERROR("Utilization %.3f is over 1.0", util);
+    return FAILURE;
+  }
+
+  // Response time analysis, iterate R = C + sum(ceil(R / T_j) * C_j) over
+  // the higher priority services until it settles or misses the deadline
+  for (uint32_t i = 0; i < num; i++)
+  {
+    sa_service_t * svc = &set[order[i]];
+    uint64_t response = svc->wcet;
+    uint64_t next = 0;
+
+    for (uint32_t j = 0; j < i; j++)
+    {
+      response += set[order[j]].wcet;
+    }
+
+    while (response <= svc->period)
+    {
+      next = svc->wcet;
+      for (uint32_t j = 0; j < i; j++)
+      {
+        sa_service_t * hp = &set[order[j]];
+        next += ((response + hp->period - 1) / hp->period) * hp->wcet;
+      }
+      if (next == response)
+      {
+        break;
+      }
+      response = next;
+    }
+    svc->response = response;
+
+    if (response > svc->period)
+    {
+      LOG_ERROR("%s misses deadline, response %lluus > period %lluus",
+                svc->name,
+                (unsigned long long)(response / NSEC_PER_USEC),
+                (unsigned long long)(svc->period / NSEC_PER_USEC));
+      status = FAILURE;
+    }
+    else
+    {
+      LOG_MED("%s response %lluus within period %lluus",
+              svc->name,
+              (unsigned long long)(response / NSEC_PER_USEC),
+              (unsigned long long)(svc->period / NSEC_PER_USEC));
+    }
+  }
+  return status;
+} // sa_analyze()
+
+uint32_t sa_register(const char * p_name, uint8_t timer, uint32_t period_us)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_name);
+  uint32_t status = FAILURE;
+
+  pthread_mutex_lock(&services_lock);
+  if (num_services < SA_MAX_SERVICES)
+  {
+    memset(&services[num_services], 0, sizeof(services[num_services]));
+    strncpy(services[num_services].name, p_name, SA_NAME_MAX - 1);
+    services[num_services].timer = timer;
+    services[num_services].period = (uint64_t)period_us * NSEC_PER_USEC;
+    num_services++;
+    status = SUCCESS;
+  }
+  else
+  {
+    LOG_ERROR("No room to register %s for analysis", p_name);
+  }
+  pthread_mutex_unlock(&services_lock);
+  return status;
+} // sa_register()
+
+/*!
+* @brief Gets the period a service from a report is configured to run at,
+*        the services of other cameras take the period of the service they
+*        are named after
+* @param p_name service name from the report, e.g. jpeg_service_1
+* @return period in us
+*/
+static
+uint32_t sa_period_us(const char * p_name)
+{
+  char base[SA_NAME_MAX];
+  char * p_cam;
+
+  strncpy(base, p_name, SA_NAME_MAX - 1);
+  base[SA_NAME_MAX - 1] = '\0';
+  p_cam = strrchr(base, '_');
+  if (p_cam != NULL && p_cam[1] != '\0' && strspn(p_cam + 1, "0123456789") == strlen(p_cam + 1))
+  {
+    *p_cam = '\0';
+  }
+  return seq_period_us(base);
+} // sa_period_us()
+
+uint32_t sa_admit(const char * p_file_name)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_file_name);
+  sa_service_t budget[SA_MAX_SERVICES];
+  char line[LINE_MAX_LEN];
+  double wcet_us = 0;
+  uint32_t report_us = 0;
+  uint32_t num = 0;
+  FILE * fp;
+
+  // Without a previous report there is nothing to check against
+  fp = fopen(p_file_name, "r");
+  if (fp == NULL)
+  {
+    LOG_MED("No budget file %s, skipping admission check", p_file_name);
+    return SUCCESS;
+  }
+
+  // Skip the header then read name, period, and wcet from each line.  Each
+  // service is checked at the period it is configured for now, which may
+  // not be the one it was measured at.
+  fgets(line, LINE_MAX_LEN, fp);
+  while (num < SA_MAX_SERVICES && fgets(line, LINE_MAX_LEN, fp) != NULL)
+  {
+    memset(&budget[num], 0, sizeof(budget[num]));
+    if (sscanf(line, "%31[^,],%u,%lf", budget[num].name, &report_us, &wcet_us) == 3)
+    {
+      budget[num].timer = NO_TIMER;
+      budget[num].wcet = (uint64_t)(wcet_us * NSEC_PER_USEC);
+      budget[num].period = (uint64_t)sa_period_us(budget[num].name) * NSEC_PER_USEC;
+      if (budget[num].period != (uint64_t)report_us * NSEC_PER_USEC)
+      {
+        LOG_MED("%s was measured at %uus and now runs at %lluus",
+                budget[num].name,
+                report_us,
+                (unsigned long long)(budget[num].period / NSEC_PER_USEC));
+      }
+      num++;
+    }
+  }
+  fclose(fp);
+
+  LOG_HIGH("Checking %d service budgets from %s at tick %uus",
+           num,
+           p_file_name,
+           seq_tick_us());
+  return sa_analyze(budget, num);
+} // sa_admit()
+
+uint32_t sa_check()
+{
+  FUNC_ENTRY;
+  profiler_stats_t stats;
+  sa_service_t set[SA_MAX_SERVICES];
+  uint32_t num = 0;
+  uint32_t res = 0;
+
+  // Pull the latest observed execution times out of the profiler
+  pthread_mutex_lock(&services_lock);
+  for (uint32_t i = 0; i < num_services; i++)
+  {
+    get_stats(services[i].timer, &stats);
+    services[i].count = stats.count;
+    services[i].wcet = stats.wcet;
+    services[i].mean = stats.count ? stats.total / stats.count : 0;
+    services[i].obs_period = stats.period_count ?
+                             stats.period_total / stats.period_count : 0;
+  }
+  num = num_services;
+  memcpy(set, services, sizeof(set[0]) * num);
+  pthread_mutex_unlock(&services_lock);
+
+  // Analyze a copy and keep the response times for the report
+  res = sa_analyze(set, num);
+  pthread_mutex_lock(&services_lock);
+  for (uint32_t i = 0; i < num; i++)
+  {
+    services[i].response = set[i].response;
+  }
+  pthread_mutex_unlock(&services_lock);
+
+  if (res != SUCCESS)
+  {
+    LOG_ERROR("Service set is not schedulable at the observed WCETs");
+  }
+  return res;
+} // sa_check()
+
+uint32_t sa_report(const char * p_file_name)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_file_name);
+  int32_t res = 0;
+  FILE * fp;
+
+  EQ_RET_E(fp, fopen(p_file_name, "w"), NULL, FAILURE);
+  fprintf(fp,
+          "name,period_us,wcet_us,mean_us,observed_period_us,samples,"
+          "utilization,response_us,schedulable\n");
+
+  pthread_mutex_lock(&services_lock);
+  for (uint32_t i = 0; i < num_services; i++)
+  {
+    sa_service_t * svc = &services[i];
+    fprintf(fp,
+            "%s,%llu,%.1f,%.1f,%.1f,%u,%.4f,%.1f,%s\n",
+            svc->name,
+            (unsigned long long)(svc->period / NSEC_PER_USEC),
+            (double)svc->wcet / NSEC_PER_USEC,
+            (double)svc->mean / NSEC_PER_USEC,
+            (double)svc->obs_period / NSEC_PER_USEC,
+            svc->count,
+            (double)svc->wcet / (double)svc->period,
+            (double)svc->response / NSEC_PER_USEC,
+            svc->response <= svc->period ? "yes" : "no");
+  }
+  pthread_mutex_unlock(&services_lock);
+
+  EQ_RET_E(res, fclose(fp), EOF, FAILURE);
+  LOG_HIGH("Wrote service budget report to %s", p_file_name);
+  return SUCCESS;
+} // sa_report()
@@ -0,0 +1,310 @@
+/** @file sequencer.c
+*
+* @brief Multi-rate cyclic executive.  The sequencer sleeps to absolute tick
+*        times so releases don't drift, and on each tick first decides which
+*        services are released, recording the tick, then posts them all so
+*        a service released on a tick can tell which others were too.
+*
+*/
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "log.h"
+#include "project_defs.h"
+#include "sequencer.h"
+#include "service.h"
+#include "trace.h"
+
+// Time conversion
+#define NSEC_PER_SEC (1000000000l)
+#define NSEC_PER_USEC (1000l)
+#define USEC_PER_SEC (1000000.0)
+
+// Flag for stopping application
+extern uint32_t abort_test;
+
+// Service released by the sequencer
+typedef struct seq_slot {
+  char name[SERVICE_NAME_MAX];
+  uint32_t period_us;
+  uint32_t divisor;
+
+  // Semaphores in use and the sequencer's own
+  sem_t * p_release;
+  sem_t * p_done;
+  sem_t release;
+  sem_t done;
+
+  // Released and not yet seen done, only used by the sequencer
+  uint8_t outstanding;
+
+  // Has waited before so the last release is done, only used by the service
+  uint8_t waited;
+
+  // Tick of the last release, read by other services
+  uint32_t tick;
+  uint32_t releases;
+  uint32_t overruns;
+} seq_slot_t;
+
+static struct {
+  seq_slot_t slots[SEQ_MAX_SLOTS];
+  uint32_t count;
+  uint32_t tick_us;
+
+  // Next tick and when it is due, CLOCK_MONOTONIC
+  uint32_t tick;
+  struct timespec next;
+  uint32_t late;
+  uint8_t running;
+#ifdef TRACE
+  uint8_t trace_buf;
+#endif /* TRACE */
+} seq;
+
+uint32_t seq_tick_us()
+{
+  if (seq.tick_us == 0)
+  {
+    seq.tick_us = service_period_us("sched_service");
+    seq.tick_us = seq.tick_us ? seq.tick_us : PERIOD_US;
+  }
+  return seq.tick_us;
+} // seq_tick_us()
+
+uint32_t seq_divisor(const char * p_name)
+{
+  uint32_t period_us = service_period_us(p_name);
+  uint32_t divisor = (period_us + seq_tick_us() / 2) / seq_tick_us();
+
+  return divisor ? divisor : 1;
+} // seq_divisor()
+
+uint32_t seq_period_us(const char * p_name)
+{
+  return seq_divisor(p_name) * seq_tick_us();
+} // seq_period_us()
+
+/*!
+* @brief Least common multiple of two tick counts
+* @param a ticks, not 0
+* @param b ticks, not 0
+* @return lcm
+*/
+static
+uint32_t seq_lcm(uint32_t a, uint32_t b)
+{
+  uint32_t x = a;
+  uint32_t y = b;
+
+  while (y != 0)
+  {
+    uint32_t r = x % y;
+    x = y;
+    y = r;
+  }
+  return a / x * b;
+} // seq_lcm()
+
+uint32_t seq_frame_step(const char * p_name, const char * p_also)
+{
+  uint32_t cap_ticks = seq_divisor("cap_service");
+  uint32_t ticks = seq_lcm(cap_ticks, seq_divisor(p_name));
+
+  if (p_also != NULL)
+  {
+    ticks = seq_lcm(ticks, seq_divisor(p_also));
+  }
+#ifdef LOAD_TEST
+  // Load tests store and stream every frame
+  ticks = cap_ticks;
+#endif /* LOAD_TEST */
+  return ticks / cap_ticks;
+} // seq_frame_step()
+
+uint32_t seq_add(const char * p_name, uint32_t cam, sem_t * p_release, sem_t * p_done, uint32_t * p_slot)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_name);
+  CHECK_NULL(p_slot);
+
+  seq_slot_t * p_new;
+  int32_t res = 0;
+
+  if (seq.count == SEQ_MAX_SLOTS || (p_release == NULL) != (p_done == NULL))
+  {
+    LOG_ERROR("Can't add %s camera %u to the sequencer", p_name, cam);
+    return FAILURE;
+  }
+  p_new = &seq.slots[seq.count];
+  memset(p_new, 0, sizeof(*p_new));
+  capture_name(cam, p_name, p_new->name, SERVICE_NAME_MAX);
+  p_new->divisor = seq_divisor(p_name);
+  p_new->period_us = p_new->divisor * seq_tick_us();
+  if (p_release == NULL)
+  {
+    PT_NOT_EQ_RET(res, sem_init(&p_new->release, 0, 0), SUCCESS, FAILURE);
+    PT_NOT_EQ_RET(res, sem_init(&p_new->done, 0, 0), SUCCESS, FAILURE);
+    p_release = &p_new->release;
+    p_done = &p_new->done;
+  }
+  p_new->p_release = p_release;
+  p_new->p_done = p_done;
+  *p_slot = seq.count++;
+  return SUCCESS;
+} // seq_add()
+
+uint32_t seq_find(const char * p_name, uint32_t cam)
+{
+  char name[SERVICE_NAME_MAX];
+
+  capture_name(cam, p_name, name, sizeof(name));
+  for (uint32_t slot = 0; slot < seq.count; slot++)
+  {
+    if (strcmp(seq.slots[slot].name, name) == 0)
+    {
+      return slot;
+    }
+  }
+  return SEQ_NO_SLOT;
+} // seq_find()
+
+uint8_t seq_wait(uint32_t slot)
+{
+  seq_slot_t * p_slot = &seq.slots[slot];
+
+#ifdef LOAD_TEST
+  // Load tests release capture themselves, keep to the service's period
+  usleep(p_slot->period_us);
+  return !abort_test;
+#endif /* LOAD_TEST */
+
+  if (p_slot->waited)
+  {
+    sem_post(p_slot->p_done);
+  }
+  p_slot->waited = 1;
+  sem_wait(p_slot->p_release);
+  return !abort_test;
+} // seq_wait()
+
+uint32_t seq_tick(uint32_t slot)
+{
+  return __atomic_load_n(&seq.slots[slot].tick, __ATOMIC_ACQUIRE);
+} // seq_tick()
+
+void seq_run(uint32_t ticks)
+{
+  FUNC_ENTRY;
+  seq_slot_t * released[SEQ_MAX_SLOTS];
+  struct timespec now;
+  uint32_t count = 0;
+
+  if (!seq.running)
+  {
+    for (uint32_t slot = 0; slot < seq.count; slot++)
+    {
+      LOG_HIGH("%-16s released every %u ticks of %dus (%.2fHz)",
+               seq.slots[slot].name,
+               seq.slots[slot].divisor,
+               seq_tick_us(),
+               USEC_PER_SEC / seq.slots[slot].period_us);
+    }
+#ifdef TRACE
+    // Spans of the releases, recorded by the thread running the sequencer
+    seq.trace_buf = trace_thread_init("sched_service");
+#endif /* TRACE */
+    clock_gettime(CLOCK_MONOTONIC, &seq.next);
+    seq.running = 1;
+  }
+#ifdef TRACE
+  uint8_t trace_buf = seq.trace_buf;
+#endif /* TRACE */
+
+  for (uint32_t i = 0; i < ticks && !abort_test; i++)
+  {
+    TRACE_BEGIN(TRACE_SPAN_RELEASE, seq.tick);
+
+    // A service still busy with its last release skips this one
+    count = 0;
+    for (uint32_t slot = 0; slot < seq.count; slot++)
+    {
+      seq_slot_t * p_slot = &seq.slots[slot];
+
+      if (seq.tick % p_slot->divisor != 0)
+      {
+        continue;
+      }
+      if (p_slot->outstanding && sem_trywait(p_slot->p_done) != 0)
+      {
+        p_slot->overruns++;
+        continue;
+      }
+      p_slot->outstanding = 1;
+      p_slot->releases++;
+      __atomic_store_n(&p_slot->tick, seq.tick, __ATOMIC_RELEASE);
+      released[count++] = p_slot;
+    }
+
+    // Every tick is recorded before any service runs
+    for (uint32_t slot = 0; slot < count; slot++)
+    {
+      sem_post(released[slot]->p_release);
+    }
+    TRACE_END(TRACE_SPAN_RELEASE, seq.tick);
+    seq.tick++;
+
+    // Sleep to the next tick, starting over from now after falling a whole
+    // tick behind instead of releasing a burst to catch up
+    seq.next.tv_nsec += (int64_t)seq_tick_us() * NSEC_PER_USEC;
+    while (seq.next.tv_nsec >= NSEC_PER_SEC)
+    {
+      seq.next.tv_nsec -= NSEC_PER_SEC;
+      seq.next.tv_sec++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - seq.next.tv_sec) * NSEC_PER_SEC + (now.tv_nsec - seq.next.tv_nsec) >
+        (int64_t)seq_tick_us() * NSEC_PER_USEC)
+    {
+      seq.late++;
+      seq.next = now;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &seq.next, NULL);
+  }
+} // seq_run()
+
+void seq_stop()
+{
+  FUNC_ENTRY;
+
+  // Services on their own semaphores wait in seq_wait(), the others are
+  // woken by their owners
+  for (uint32_t slot = 0; slot < seq.count; slot++)
+  {
+    if (seq.slots[slot].p_release == &seq.slots[slot].release)
+    {
+      sem_post(&seq.slots[slot].release);
+    }
+  }
+} // seq_stop()
+
+void seq_report()
+{
+  FUNC_ENTRY;
+
+  LOG_HIGH("Sequencer ran %u ticks, %u late", seq.tick, seq.late);
+  for (uint32_t slot = 0; slot < seq.count; slot++)
+  {
+    LOG_HIGH("%-16s %u releases, %u overruns",
+             seq.slots[slot].name,
+             seq.slots[slot].releases,
+             seq.slots[slot].overruns);
+  }
+} // seq_report()
@@ -4,9 +4,11 @@
 *
 */
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <mqueue.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -15,16 +17,66 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "capture.h"
+#include "enc_pool.h"
+#include "load_test.h"
 #include "log.h"
+#include "metrics.h"
+#include "overload.h"
+#include "perf_counters.h"
+#include "profiler.h"
 #include "project_defs.h"
+#include "sched_analysis.h"
+#include "sequencer.h"
 #include "server.h"
+#include "service.h"
+#include "trace.h"
 
-#define SERVER_PORT (12345)
 #define SOCKET_BACKLOG_LEN (5)
 
+// A frame is dropped when the socket can't take data within this time, and
+// the client is dropped when a frame stalls part way for SERVER_STALL_MS
+#define SERVER_WRITABLE_MS (PERIOD)
+#define SERVER_STALL_MS (10 * PERIOD)
+
 // Global abort flag
 extern uint32_t abort_test;
 
+// Joined by server_stop()
+static pthread_t server_thread;
+
+/*!
+* @brief Sends all of a buffer over the socket
+* @param sockfd socket to send on
+* @param p_buf data to send
+* @param len number of bytes
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t server_send(int32_t sockfd, const void * p_buf, size_t len)
+{
+  const uint8_t * p_data = (const uint8_t *)p_buf;
+  ssize_t sent;
+
+  // Sends time out after SERVER_STALL_MS and a closed socket is an error
+  // instead of SIGPIPE
+  while (len > 0)
+  {
+    sent = send(sockfd, p_data, len, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (sent <= 0)
+    {
+      return FAILURE;
+    }
+    p_data += sent;
+    len -= sent;
+  }
+  return SUCCESS;
+} // server_send()
+
 /*!
 * @brief Sends JPEG file over socket to client
 * @param param no data
@@ -36,16 +88,30 @@ void * server_service(void * param)
 
   mqd_t server_queue;
   server_info_t server_msg;
+  frame_hdr_t hdr;
   struct mq_attr attr;
   struct sockaddr_in serv_addr;
   struct sockaddr_in cli_addr;
+  struct timeval stall;
+  struct pollfd writable;
+  struct pollfd incoming;
 
   int32_t sockfd;
-  int32_t newsockfd = 0;
+  int32_t newsockfd = -1;
   int32_t res = 0;
   uint32_t clilen;
   uint32_t name_len;
   uint32_t buf_len;
+  uint32_t waits = 0;
+  uint32_t seq_step = seq_frame_step("jpeg_service", "server_service");
+  struct timespec diff;
+  uint8_t timer = profiler_init();
+  TRACE_INIT("server_service");
+  METRICS_INIT("server_service");
+  PERF_INIT("server_service");
+
+  // Register for schedulability analysis
+  sa_register("server_service", timer, seq_period_us("server_service"));
 
   // Try to create the queue
   EQ_RET_E(server_queue,
@@ -89,10 +155,16 @@ void * server_service(void * param)
   // Set the socket as a passive socket
   EQ_RET_E(res, listen(sockfd, SOCKET_BACKLOG_LEN), -1, NULL);
   clilen = sizeof(cli_addr);
+  incoming.fd = sockfd;
+  incoming.events = POLLIN;
 
   while(!abort_test)
   {
-    // Wait for incoming connections
+    // Wait for incoming connections, looking at the abort flag while none come
+    if (poll(&incoming, 1, OVERLOAD_RECEIVE_MS) != 1)
+    {
+      continue;
+    }
     EQ_RET_E(newsockfd,
              accept(sockfd, (struct sockaddr *)&cli_addr, &clilen),
              -1,
@@ -103,91 +175,136 @@ void * server_service(void * param)
             cli_addr.sin_addr.s_addr,
             cli_addr.sin_port);
 
-    // Loop until read returns 0 bytes
-    while(1)
+    // Don't let a stalled client block the server forever
+    stall.tv_sec = SERVER_STALL_MS / 1000;
+    stall.tv_usec = (SERVER_STALL_MS % 1000) * 1000;
+    EQ_RET_E(res,
+             setsockopt(newsockfd, SOL_SOCKET, SO_SNDTIMEO, &stall, sizeof(stall)),
+             -1,
+             NULL);
+    writable.fd = newsockfd;
+    writable.events = POLLOUT;
+    METRICS_SET(METRICS_CLIENTS, 1);
+
+    // Loop until the client goes away or stalls
+    while(!abort_test)
     {
 
       // Wait for a message with file to send
+      TRACE_BEGIN(TRACE_SPAN_QUEUE_WAIT, waits);
       EQ_RET_E(res,
-               mq_receive(server_queue, (char *)&server_msg, attr.mq_msgsize, NULL),
+               overload_receive(server_queue, &server_msg, attr.mq_msgsize),
                -1,
                NULL);
+      TRACE_END(TRACE_SPAN_QUEUE_WAIT, waits);
+      waits++;
+      if (res == 0)
+      {
+        break;
+      }
+
+      // Skip sending when too far behind or when the client isn't keeping up
+      if (overload_degrade(OVERLOAD_Q_SERVER, server_queue, &server_msg))
+      {
+        continue;
+      }
+      if (poll(&writable, 1, SERVER_WRITABLE_MS) != 1)
+      {
+        overload_drop(OVERLOAD_Q_SERVER, &server_msg);
+        continue;
+      }
+      START_TIME;
+
+      // Stamp the send time so the client can measure each hop
+      clock_gettime(CLOCK_REALTIME, &server_msg.times.send);
 
       // Transform to network format
-      name_len = htons(server_msg.file_name_len);
-      buf_len = htons(server_msg.image_buf_len);
+      hdr.seq = htonl(server_msg.seq);
+      hdr.cam = htonl(server_msg.cam);
+      hdr.cap_sec = htonl(server_msg.times.cap.tv_sec);
+      hdr.cap_nsec = htonl(server_msg.times.cap.tv_nsec);
+      hdr.enc_sec = htonl(server_msg.times.enc.tv_sec);
+      hdr.enc_nsec = htonl(server_msg.times.enc.tv_nsec);
+      hdr.send_sec = htonl(server_msg.times.send.tv_sec);
+      hdr.send_nsec = htonl(server_msg.times.send.tv_nsec);
+      hdr.seq_step = htonl(seq_step);
+      name_len = htonl(server_msg.file_name_len);
+      buf_len = htonl(server_msg.image_buf_len);
 
-      // Send name length, file name, buffer length, and buffer over socket
-      LOG_FATAL("Sending file %s over socket", server_msg.file_name);
-      EQ_RET_E(res, write(newsockfd, &name_len, sizeof(name_len)), -1, NULL);
-      EQ_RET_E(res,
-               write(newsockfd, server_msg.file_name, server_msg.file_name_len),
-               -1,
-               NULL);
-      EQ_RET_E(res, write(newsockfd, &buf_len, sizeof(buf_len)), -1, NULL);
-      EQ_RET_E(res,
-               write(newsockfd, server_msg.image_buf, server_msg.image_buf_len),
-               -1,
-               NULL);
+      // Send header, name length, file name, buffer length, and buffer over
+      // socket
+      LOG_FATAL("Sending file %s of camera %u over socket", server_msg.file_name, server_msg.cam);
+      TRACE_BEGIN(TRACE_SPAN_SOCKET_SEND, server_msg.seq);
+      PERF_BEGIN(PERF_STAGE_SOCKET_SEND);
+      if (server_send(newsockfd, &hdr, sizeof(hdr)) != SUCCESS ||
+          server_send(newsockfd, &name_len, sizeof(name_len)) != SUCCESS ||
+          server_send(newsockfd, server_msg.file_name, server_msg.file_name_len) != SUCCESS ||
+          server_send(newsockfd, &buf_len, sizeof(buf_len)) != SUCCESS ||
+          server_send(newsockfd, server_msg.image_buf, server_msg.image_buf_len) != SUCCESS)
+      {
+        // The stream is out of sync after a partial frame so drop the client
+        // and wait for a new one
+        LOG_ERROR("Dropping client, send failed with error: %s", strerror(errno));
+        TRACE_END(TRACE_SPAN_SOCKET_SEND, server_msg.seq);
+        overload_drop(OVERLOAD_Q_SERVER, &server_msg);
+        GET_TIME;
+        break;
+      }
+      TRACE_END(TRACE_SPAN_SOCKET_SEND, server_msg.seq);
+      PERF_END(PERF_STAGE_SOCKET_SEND, server_msg.image_buf_len);
+      LOAD_DONE(LOAD_STAGE_SERVE, server_msg.cam, &server_msg.times.cap);
+      METRICS_ADD(METRICS_FRAMES_SENT, 1);
+      METRICS_ADD(METRICS_BYTES_SENT,
+                  sizeof(hdr) + sizeof(name_len) + server_msg.file_name_len + sizeof(buf_len) + server_msg.image_buf_len);
+      METRICS_LATENCY(METRICS_LAT_SEND, &server_msg.times.cap);
+      enc_pool_put(server_msg.image_buf);
+      GET_TIME;
     }
+    close(newsockfd);
+    newsockfd = -1;
+    METRICS_SET(METRICS_CLIENTS, 0);
   }
 
   LOG_HIGH("server_service thread exiting");
   mq_close(server_queue);
   close(sockfd);
-  if (newsockfd)
+  if (newsockfd != -1)
   {
     close(newsockfd);
   }
   return NULL;
 } // server_service()
 
+/*!
+* @brief Drops the server's reference to the buffer of a dropped frame
+* @param msg server_info_t of the dropped frame
+*/
+static
+void server_release_msg(void * msg)
+{
+  enc_pool_put(((server_info_t *)msg)->image_buf);
+} // server_release_msg()
+
 uint32_t server_init()
 {
   FUNC_ENTRY;
-  struct sched_param sched;
-  struct sched_param  server_sched;
-  pthread_attr_t sched_attr;
-  pthread_t server_thread;
   int32_t res = 0;
-  int32_t rt_max_pri = 0;
-  int32_t server_policy = 0;
 
-  // Initialize the schedule attributes
-  PT_NOT_EQ_EXIT(res, pthread_attr_init(&sched_attr), SUCCESS);
+  // Dropped frames give their encoded buffer back
+  overload_set_release(OVERLOAD_Q_SERVER, server_release_msg);
 
-  // Set the attributes structure to PTHREAD_EXPLICIT_SCHED and SCHED_FIFO
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setinheritsched(&sched_attr, PTHREAD_EXPLICIT_SCHED),
-                SUCCESS,
-                FAILURE);
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setschedpolicy(&sched_attr, SCHED_FIFO),
-                SUCCESS,
-                FAILURE);
-
-  // Get the max priority
-  EQ_RET_E(rt_max_pri, sched_get_priority_max(SCHED_FIFO), -1, FAILURE);
-
-  // Set the priority to max - 1 for the test thread
-  sched.sched_priority = rt_max_pri - 1;
-  PT_NOT_EQ_RET(res,
-                pthread_attr_setschedparam(&sched_attr, &sched),
-                SUCCESS,
-                FAILURE);
-  // Create pthread
-  PT_NOT_EQ_RET(res,
-                pthread_create(&server_thread, &sched_attr, server_service, NULL),
-                SUCCESS,
-                FAILURE);
-
-  // Get the scheduler parameters to display
-  PT_NOT_EQ_RET(res,
-                pthread_getschedparam(server_thread, &server_policy, &server_sched),
-                SUCCESS,
-                FAILURE);
-  LOG_HIGH("server_service policy: %d, priority: %d",
-           server_policy,
-           server_sched.sched_priority);
+  // Start the service thread with its configured priority and affinity
+  EQ_RET_E(res,
+           service_launch("server_service", server_service, NULL, &server_thread),
+           FAILURE,
+           FAILURE);
   return SUCCESS;
 } // server_init()
+
+void server_stop()
+{
+  FUNC_ENTRY;
+
+  // The service sees the abort flag within a receive or accept timeout
+  pthread_join(server_thread, NULL);
+} // server_stop()
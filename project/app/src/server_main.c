@@ -6,8 +6,16 @@
 
 #include <stdint.h>
 #include <capture.h>
+#include <project_defs.h>
+#include <service.h>
 
-int main()
+int main(int argc, char ** argv)
 {
+  // Load the service configuration from the command line
+  if (service_args(argc, argv) != SUCCESS)
+  {
+    return FAILURE;
+  }
+
   return sched_service();
 }
@@ -0,0 +1,786 @@
+/** @file service.c
+*
+* @brief Service configuration table and common thread launcher.  Every
+*        service thread is created through service_launch() so priority,
+*        scheduling policy, and CPU affinity come from one table.  Services
+*        left at SERVICE_PRI_RM get rate monotonic priorities counting down
+*        from the max SCHED_FIFO priority, shortest period first and ties
+*        broken by table order.
+*
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "capture.h"
+#include "frame_mem.h"
+#include "log.h"
+#include "metrics.h"
+#include "overload.h"
+#include "preview.h"
+#include "project_defs.h"
+#include "retention.h"
+#include "service.h"
+
+#define LINE_MAX_LEN (256)
+#define TOKEN_MAX (64)
+#define MAX_CPUS (32)
+
+// Keyword used to set the housekeeping cores in the configuration
+#define HOUSEKEEPING "housekeeping"
+
+// Keyword used to set the overload policy of a queue in the configuration
+#define QUEUE "queue"
+
+// Keyword used to set the cores and device of a camera in the configuration
+#define CAMERA "camera"
+
+// Keyword used to set the period of a service in the configuration
+#define PERIOD_KEY "period"
+
+// Instance of services that aren't run for each camera
+#define SERVICE_NO_CAMERA (-1)
+
+// Thread of a service that isn't one of a pool of workers
+#define SERVICE_NO_WORKER (-1)
+
+// Service table, ordered from most to least important within a period
+static service_cfg_t services[SERVICE_MAX] = {
+  {"sched_service",    PERIOD_US,          SERVICE_PRI_RM, 0},
+  {"cap_service",      PERIOD_US,          SERVICE_PRI_RM, 0},
+  {"jpeg_service",     PERIOD_US,          SERVICE_PRI_RM, 0},
+  {"ppm_service",      PERIOD_US,          SERVICE_PRI_RM, 0},
+  {"pool_worker",      PERIOD_US,          SERVICE_PRI_RM, 0},
+  {"graph_worker",     PERIOD_US,          SERVICE_PRI_RM, 0},
+  {"server_service",   PERIOD_US,          SERVICE_PRI_RM, 0},
+  {"client_service",   PERIOD_US,          SERVICE_PRI_RM, 0},
+  {"preview_service",  PREVIEW_PERIOD_US,  SERVICE_PRI_OTHER, 0},
+  {"retention_service", RETENTION_PERIOD_US, SERVICE_PRI_OTHER, 0},
+  {"metrics_service",  METRICS_PERIOD_US,  SERVICE_PRI_OTHER, 0},
+  {"archive_service",  ARCHIVE_PERIOD_US,  SERVICE_PRI_OTHER, 0},
+};
+static uint32_t num_services = 12;
+
+// Cores reserved for housekeeping (non real-time) work, 0 when not isolating
+static uint32_t housekeeping_mask = 0;
+
+// Cores each camera's services run on, 0 to spread them from the table
+static uint32_t camera_masks[CAMERAS];
+
+// Thread information for each launched service, same index as the table
+// and one for each camera
+typedef struct {
+  void * (*func)(void *);
+  void * arg;
+  pid_t tid;
+  uint64_t minflt;
+  uint64_t majflt;
+} service_thread_t;
+
+static service_thread_t threads[SERVICE_MAX][CAMERAS];
+
+// Thread information for each worker of a pool, same index as the table
+static service_thread_t workers[SERVICE_MAX][SERVICE_WORKERS_MAX];
+
+/*!
+* @brief Finds a service in the table
+* @param p_name name of the service
+* @return pointer to the service or NULL when not found
+*/
+static
+service_cfg_t * service_find(const char * p_name)
+{
+  for (uint32_t i = 0; i < num_services; i++)
+  {
+    if (strncmp(services[i].name, p_name, SERVICE_NAME_MAX) == 0)
+    {
+      return &services[i];
+    }
+  }
+  return NULL;
+} // service_find()
+
+/*!
+* @brief Parses a cpu list such as 0-1,3 or all into a mask
+* @param p_cpus cpu list string
+* @param mask mask to fill out, 0 means any cpu
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t service_parse_cpus(const char * p_cpus, uint32_t * mask)
+{
+  char * p_end;
+  long first;
+  long last;
+
+  *mask = 0;
+  if (strcmp(p_cpus, "all") == 0)
+  {
+    return SUCCESS;
+  }
+
+  while (*p_cpus != '\0')
+  {
+    first = last = strtol(p_cpus, &p_end, 10);
+    if (p_end == p_cpus)
+    {
+      return FAILURE;
+    }
+    if (*p_end == '-')
+    {
+      p_cpus = p_end + 1;
+      last = strtol(p_cpus, &p_end, 10);
+      if (p_end == p_cpus)
+      {
+        return FAILURE;
+      }
+    }
+    if (first < 0 || last >= MAX_CPUS || first > last)
+    {
+      return FAILURE;
+    }
+    for (long cpu = first; cpu <= last; cpu++)
+    {
+      *mask |= 1u << cpu;
+    }
+
+    // Move to the next entry in the list
+    if (*p_end == ',')
+    {
+      p_cpus = p_end + 1;
+    }
+    else if (*p_end == '\0')
+    {
+      p_cpus = p_end;
+    }
+    else
+    {
+      return FAILURE;
+    }
+  }
+  return SUCCESS;
+} // service_parse_cpus()
+
+/*!
+* @brief Parses a camera line, camera <id> <cpus> [device]
+* @param p_line line to parse
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t service_parse_camera(const char * p_line)
+{
+  char device[TOKEN_MAX];
+  char cpus[TOKEN_MAX];
+  uint32_t cam = 0;
+  int32_t num = 0;
+
+  // Configurations can be shared with builds for fewer cameras
+  num = sscanf(p_line, CAMERA " %u %63s %63s", &cam, cpus, device);
+  if (num >= 2 && cam >= CAMERAS && cam < CAMERAS_MAX)
+  {
+    LOG_MED("Ignoring camera %u, built for %d cameras", cam, CAMERAS);
+    return SUCCESS;
+  }
+  if (num < 2 || cam >= CAMERAS ||
+      service_parse_cpus(cpus, &camera_masks[cam]) != SUCCESS ||
+      (num == 3 && capture_config(cam, device) != SUCCESS))
+  {
+    LOG_ERROR("Bad camera line: %s", p_line);
+    return FAILURE;
+  }
+  return SUCCESS;
+} // service_parse_camera()
+
+/*!
+* @brief Parses a single configuration line
+* @param p_line line to parse
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t service_parse_line(const char * p_line)
+{
+  FUNC_ENTRY;
+  char name[TOKEN_MAX];
+  char priority[TOKEN_MAX];
+  char cpus[TOKEN_MAX];
+  service_cfg_t * cfg;
+  uint32_t mask = 0;
+  int32_t num = 0;
+  long pri = 0;
+
+  // Skip comments and blank lines
+  num = sscanf(p_line, "%63s %63s %63s", name, priority, cpus);
+  if (num < 1 || name[0] == '#')
+  {
+    return SUCCESS;
+  }
+
+  // The housekeeping line only has a cpu list
+  if (strcmp(name, HOUSEKEEPING) == 0)
+  {
+    if (num < 2 || service_parse_cpus(priority, &housekeeping_mask) != SUCCESS)
+    {
+      LOG_ERROR("Bad housekeeping cpu list: %s", p_line);
+      return FAILURE;
+    }
+    return SUCCESS;
+  }
+
+  // The queue line has a queue name and overload policy
+  if (strcmp(name, QUEUE) == 0)
+  {
+    if (num < 3 || overload_config(priority, cpus) != SUCCESS)
+    {
+      LOG_ERROR("Bad queue policy: %s", p_line);
+      return FAILURE;
+    }
+    return SUCCESS;
+  }
+
+  // The camera line has a camera id, cpu list, and optional device
+  if (strcmp(name, CAMERA) == 0)
+  {
+    return service_parse_camera(p_line);
+  }
+
+  // The period line has a service name and its period in milliseconds
+  if (strcmp(name, PERIOD_KEY) == 0)
+  {
+    if (num < 3 || (cfg = service_find(priority)) == NULL || (pri = strtol(cpus, NULL, 10)) <= 0)
+    {
+      LOG_ERROR("Bad period line: %s", p_line);
+      return FAILURE;
+    }
+    cfg->period_us = pri * 1000;
+    return SUCCESS;
+  }
+
+  if (num < 2 || (cfg = service_find(name)) == NULL)
+  {
+    LOG_ERROR("Unknown service or missing priority: %s", p_line);
+    return FAILURE;
+  }
+
+  // Priority is rm, other, or a SCHED_FIFO priority
+  if (strcmp(priority, "rm") == 0)
+  {
+    cfg->priority = SERVICE_PRI_RM;
+  }
+  else if (strcmp(priority, "other") == 0)
+  {
+    cfg->priority = SERVICE_PRI_OTHER;
+  }
+  else
+  {
+    pri = strtol(priority, NULL, 10);
+    if (pri < sched_get_priority_min(SCHED_FIFO) ||
+        pri > sched_get_priority_max(SCHED_FIFO))
+    {
+      LOG_ERROR("Bad priority for %s: %s", name, priority);
+      return FAILURE;
+    }
+    cfg->priority = pri;
+  }
+
+  if (num == 3)
+  {
+    if (service_parse_cpus(cpus, &mask) != SUCCESS)
+    {
+      LOG_ERROR("Bad cpu list for %s: %s", name, cpus);
+      return FAILURE;
+    }
+    cfg->cpu_mask = mask;
+  }
+  return SUCCESS;
+} // service_parse_line()
+
+/*!
+* @brief Gets the priority for a service resolving rate monotonic priorities
+* @param cfg service configuration
+* @return SCHED_FIFO priority or SERVICE_PRI_OTHER
+*/
+static
+int32_t service_priority(service_cfg_t * cfg)
+{
+  int32_t rank = 0;
+
+  if (cfg->priority != SERVICE_PRI_RM)
+  {
+    return cfg->priority;
+  }
+
+  // Count the services with a shorter period or earlier in the table
+  for (uint32_t i = 0; i < num_services && &services[i] != cfg; i++)
+  {
+    if (services[i].period_us <= cfg->period_us)
+    {
+      rank++;
+    }
+  }
+  for (uint32_t i = cfg - services + 1; i < num_services; i++)
+  {
+    if (services[i].period_us < cfg->period_us)
+    {
+      rank++;
+    }
+  }
+  return sched_get_priority_max(SCHED_FIFO) - rank;
+} // service_priority()
+
+/*!
+* @brief Moves each cpu of a mask n cpus further through a pool of cpus
+* @param mask cpus to move
+* @param pool cpus to move through, wrapping around
+* @param shift number of cpus to move by
+* @return moved mask, or the mask when none of it is in the pool
+*/
+static
+uint32_t service_spread(uint32_t mask, uint32_t pool, uint32_t shift)
+{
+  uint32_t cpus[MAX_CPUS];
+  uint32_t num = 0;
+  uint32_t spread = 0;
+
+  for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+  {
+    if (pool & (1u << cpu))
+    {
+      cpus[num++] = cpu;
+    }
+  }
+  for (uint32_t i = 0; i < num; i++)
+  {
+    if (mask & (1u << cpus[i]))
+    {
+      spread |= 1u << cpus[(i + shift) % num];
+    }
+  }
+  return spread ? spread : mask;
+} // service_spread()
+
+/*!
+* @brief Gets the cpus a service is allowed to run on
+* @param cfg service configuration
+* @param cam camera the service runs for or SERVICE_NO_CAMERA
+* @param cpus cpu set to fill out
+* @return SUCCESS when the service should be pinned, FAILURE otherwise
+*/
+static
+uint32_t service_cpus(service_cfg_t * cfg, int32_t cam, cpu_set_t * cpus)
+{
+  uint32_t mask = cfg->cpu_mask;
+  uint32_t online = 0;
+  uint32_t pool = 0;
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (long cpu = 0; cpu < num_cpus && cpu < MAX_CPUS; cpu++)
+  {
+    online |= 1u << cpu;
+  }
+
+  // When isolating, real-time services stay off the housekeeping cores and
+  // non real-time services stay on them
+  pool = online;
+  if (housekeeping_mask != 0)
+  {
+    if (service_priority(cfg) == SERVICE_PRI_OTHER)
+    {
+      pool = housekeeping_mask;
+    }
+    else
+    {
+      pool = online & ~housekeeping_mask;
+    }
+  }
+  if (mask == 0 && housekeeping_mask != 0)
+  {
+    mask = pool;
+  }
+
+  // A camera's services go on its configured cores, otherwise each camera
+  // after the first moves the table's cores along so the pipelines don't
+  // share them
+  if (cam != SERVICE_NO_CAMERA && camera_masks[cam] != 0)
+  {
+    mask = camera_masks[cam];
+  }
+  else if (cam > 0 && mask != 0)
+  {
+    mask = service_spread(mask, pool & online, cam);
+  }
+  mask &= online;
+
+  if (mask == 0)
+  {
+    return FAILURE;
+  }
+
+  CPU_ZERO(cpus);
+  for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+  {
+    if (mask & (1u << cpu))
+    {
+      CPU_SET(cpu, cpus);
+    }
+  }
+  return SUCCESS;
+} // service_cpus()
+
+/*!
+* @brief Gets the one cpu a worker of a pool is pinned to, the worker'th cpu
+*        the service may run on, wrapping around
+* @param cfg service configuration
+* @param worker index of the worker in its pool
+* @param cpus cpu set to fill out
+*/
+static
+void service_worker_cpu(service_cfg_t * cfg, uint32_t worker, cpu_set_t * cpus)
+{
+  cpu_set_t allowed;
+  uint32_t count = 0;
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  // Workers of a service without cpus spread over every online cpu
+  if (service_cpus(cfg, SERVICE_NO_CAMERA, &allowed) != SUCCESS)
+  {
+    CPU_ZERO(&allowed);
+    for (long cpu = 0; cpu < num_cpus && cpu < MAX_CPUS; cpu++)
+    {
+      CPU_SET(cpu, &allowed);
+    }
+  }
+  worker %= CPU_COUNT(&allowed);
+  CPU_ZERO(cpus);
+  for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+  {
+    if (CPU_ISSET(cpu, &allowed) && count++ == worker)
+    {
+      CPU_SET(cpu, cpus);
+      return;
+    }
+  }
+} // service_worker_cpu()
+
+/*!
+* @brief Entry point of every service thread, prefaults the stack before
+*        running the service
+* @param param service_thread_t for the service
+* @return value returned by the service
+*/
+static
+void * service_entry(void * param)
+{
+  service_thread_t * thread = (service_thread_t *)param;
+
+  thread->tid = syscall(SYS_gettid);
+  frame_mem_prefault_stack();
+  return thread->func(thread->arg);
+} // service_entry()
+
+uint32_t service_args(int32_t argc, char ** argv)
+{
+  FUNC_ENTRY;
+  int32_t opt = 0;
+
+  while ((opt = getopt(argc, argv, "c:s:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'c':
+        if (service_config(optarg) != SUCCESS)
+        {
+          return FAILURE;
+        }
+        break;
+      case 's':
+        if (service_parse_line(optarg) != SUCCESS)
+        {
+          return FAILURE;
+        }
+        break;
+      default:
+        LOG_ERROR("Usage: %s [-c config_file] [-s \"name priority cpus\"]",
+                  argv[0]);
+        return FAILURE;
+    }
+  }
+  return SUCCESS;
+} // service_args()
+
+uint32_t service_period_us(const char * p_name)
+{
+  service_cfg_t * cfg = service_find(p_name);
+
+  return cfg ? cfg->period_us : 0;
+} // service_period_us()
+
+uint32_t service_config(const char * p_file_name)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_file_name);
+  char line[LINE_MAX_LEN];
+  uint32_t status = SUCCESS;
+  FILE * fp;
+
+  EQ_RET_E(fp, fopen(p_file_name, "r"), NULL, FAILURE);
+  while (status == SUCCESS && fgets(line, LINE_MAX_LEN, fp) != NULL)
+  {
+    status = service_parse_line(line);
+  }
+  fclose(fp);
+
+  // Log the resulting table
+  for (uint32_t i = 0; i < num_services; i++)
+  {
+    LOG_MED("%-16s period: %dus priority: %d cpus: 0x%x",
+            services[i].name,
+            services[i].period_us,
+            service_priority(&services[i]),
+            services[i].cpu_mask);
+  }
+  return status;
+} // service_config()
+
+/*!
+* @brief Creates a service thread with the priority and affinity from the
+*        service table
+* @param p_name name of the service in the table
+* @param cam camera the service runs for or SERVICE_NO_CAMERA
+* @param worker worker of a pool pinned to one cpu or SERVICE_NO_WORKER
+* @param func thread function
+* @param arg argument passed to the thread function
+* @param thread created thread
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t service_start(const char * p_name,
+                       int32_t cam,
+                       int32_t worker,
+                       void * (*func)(void *),
+                       void * arg,
+                       pthread_t * thread)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_name);
+  CHECK_NULL(thread);
+  char name[SERVICE_NAME_MAX];
+  struct sched_param sched;
+  struct sched_param thread_sched;
+  pthread_attr_t sched_attr;
+  service_cfg_t * cfg;
+  service_thread_t * service_thread;
+  cpu_set_t cpus;
+  int32_t res = 0;
+  int32_t policy = 0;
+  int32_t thread_policy = 0;
+
+  // Find the service configuration
+  EQ_RET_E(cfg, service_find(p_name), NULL, FAILURE);
+  sched.sched_priority = service_priority(cfg);
+  policy = (sched.sched_priority == SERVICE_PRI_OTHER) ? SCHED_OTHER : SCHED_FIFO;
+  if (worker == SERVICE_NO_WORKER)
+  {
+    service_thread = &threads[cfg - services][cam == SERVICE_NO_CAMERA ? 0 : cam];
+    capture_name(cam == SERVICE_NO_CAMERA ? 0 : cam, p_name, name, sizeof(name));
+  }
+  else
+  {
+    service_thread = &workers[cfg - services][worker];
+    capture_name(worker, p_name, name, sizeof(name));
+  }
+  service_thread->func = func;
+  service_thread->arg = arg;
+
+  // Initialize the schedule attributes
+  PT_NOT_EQ_RET(res, pthread_attr_init(&sched_attr), SUCCESS, FAILURE);
+
+  // Use a fixed stack size so locking memory doesn't pin default sized stacks
+  PT_NOT_EQ_RET(res,
+                pthread_attr_setstacksize(&sched_attr, SERVICE_STACK_SIZE),
+                SUCCESS,
+                FAILURE);
+
+  // Set the attributes structure to PTHREAD_EXPLICIT_SCHED and the policy
+  PT_NOT_EQ_RET(res,
+                pthread_attr_setinheritsched(&sched_attr, PTHREAD_EXPLICIT_SCHED),
+                SUCCESS,
+                FAILURE);
+  PT_NOT_EQ_RET(res,
+                pthread_attr_setschedpolicy(&sched_attr, policy),
+                SUCCESS,
+                FAILURE);
+  PT_NOT_EQ_RET(res,
+                pthread_attr_setschedparam(&sched_attr, &sched),
+                SUCCESS,
+                FAILURE);
+
+  // Pin the thread if it has cpus configured, workers always get a cpu
+  if (worker != SERVICE_NO_WORKER)
+  {
+    service_worker_cpu(cfg, worker, &cpus);
+    PT_NOT_EQ_RET(res,
+                  pthread_attr_setaffinity_np(&sched_attr, sizeof(cpus), &cpus),
+                  SUCCESS,
+                  FAILURE);
+  }
+  else if (service_cpus(cfg, cam, &cpus) == SUCCESS)
+  {
+    PT_NOT_EQ_RET(res,
+                  pthread_attr_setaffinity_np(&sched_attr, sizeof(cpus), &cpus),
+                  SUCCESS,
+                  FAILURE);
+  }
+
+  // Create pthread
+  PT_NOT_EQ_RET(res,
+                pthread_create(thread, &sched_attr, service_entry, service_thread),
+                SUCCESS,
+                FAILURE);
+  pthread_attr_destroy(&sched_attr);
+
+  // Get the scheduler parameters to display
+  PT_NOT_EQ_RET(res,
+                pthread_getschedparam(*thread, &thread_policy, &thread_sched),
+                SUCCESS,
+                FAILURE);
+  LOG_HIGH("%s policy: %d, priority: %d",
+           name,
+           thread_policy,
+           thread_sched.sched_priority);
+  return SUCCESS;
+} // service_start()
+
+uint32_t service_launch(const char * p_name,
+                        void * (*func)(void *),
+                        void * arg,
+                        pthread_t * thread)
+{
+  return service_start(p_name, SERVICE_NO_CAMERA, SERVICE_NO_WORKER, func, arg, thread);
+} // service_launch()
+
+uint32_t service_launch_camera(const char * p_name,
+                               uint32_t cam,
+                               void * (*func)(void *),
+                               void * arg,
+                               pthread_t * thread)
+{
+  if (cam >= CAMERAS)
+  {
+    LOG_ERROR("No camera %u for %s", cam, p_name);
+    return FAILURE;
+  }
+  return service_start(p_name, cam, SERVICE_NO_WORKER, func, arg, thread);
+} // service_launch_camera()
+
+uint32_t service_launch_worker(const char * p_name,
+                               uint32_t worker,
+                               void * (*func)(void *),
+                               void * arg,
+                               pthread_t * thread)
+{
+  if (worker >= SERVICE_WORKERS_MAX)
+  {
+    LOG_ERROR("No worker %u for %s, pools have up to %d", worker, p_name, SERVICE_WORKERS_MAX);
+    return FAILURE;
+  }
+  return service_start(p_name, SERVICE_NO_CAMERA, worker, func, arg, thread);
+} // service_launch_worker()
+
+uint32_t service_workers(const char * p_name)
+{
+  service_cfg_t * cfg = service_find(p_name);
+  cpu_set_t cpus;
+
+  if (cfg == NULL || service_cpus(cfg, SERVICE_NO_CAMERA, &cpus) != SUCCESS)
+  {
+    return 0;
+  }
+  return CPU_COUNT(&cpus);
+} // service_workers()
+
+uint32_t service_apply_self(const char * p_name)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_name);
+  struct sched_param sched;
+  service_cfg_t * cfg;
+  cpu_set_t cpus;
+  int32_t res = 0;
+  int32_t policy = 0;
+
+  // Find the service configuration
+  EQ_RET_E(cfg, service_find(p_name), NULL, FAILURE);
+  sched.sched_priority = service_priority(cfg);
+  policy = (sched.sched_priority == SERVICE_PRI_OTHER) ? SCHED_OTHER : SCHED_FIFO;
+
+  // Set the scheduler for the calling thread
+  PT_NOT_EQ_RET(res,
+                pthread_setschedparam(pthread_self(), policy, &sched),
+                SUCCESS,
+                FAILURE);
+
+  // Pin the calling thread if it has cpus configured
+  if (service_cpus(cfg, SERVICE_NO_CAMERA, &cpus) == SUCCESS)
+  {
+    NOT_EQ_RET_E(res, sched_setaffinity(0, sizeof(cpus), &cpus), SUCCESS, FAILURE);
+  }
+  LOG_HIGH("%s policy: %d, priority: %d", p_name, policy, sched.sched_priority);
+  return SUCCESS;
+} // service_apply_self()
+
+/*!
+* @brief Logs the page faults of one launched thread
+* @param thread thread information
+* @param id camera or worker the thread runs as
+* @param p_name name of the service in the table
+*/
+static
+void service_report_thread(service_thread_t * thread, uint32_t id, const char * p_name)
+{
+  char name[SERVICE_NAME_MAX];
+  uint64_t minflt = 0;
+  uint64_t majflt = 0;
+
+  if (thread->tid == 0 ||
+      frame_mem_faults(thread->tid, &minflt, &majflt) != SUCCESS)
+  {
+    return;
+  }
+  capture_name(id, p_name, name, sizeof(name));
+  LOG_HIGH("%-16s minor faults: %llu (+%llu) major faults: %llu (+%llu)",
+           name,
+           (unsigned long long)minflt,
+           (unsigned long long)(minflt - thread->minflt),
+           (unsigned long long)majflt,
+           (unsigned long long)(majflt - thread->majflt));
+  thread->minflt = minflt;
+  thread->majflt = majflt;
+} // service_report_thread()
+
+void service_report_faults()
+{
+  FUNC_ENTRY;
+
+  for (uint32_t i = 0; i < num_services; i++)
+  {
+    for (uint32_t cam = 0; cam < CAMERAS; cam++)
+    {
+      service_report_thread(&threads[i][cam], cam, services[i].name);
+    }
+    for (uint32_t worker = 0; worker < SERVICE_WORKERS_MAX; worker++)
+    {
+      service_report_thread(&workers[i][worker], worker, services[i].name);
+    }
+  }
+} // service_report_faults()
@@ -0,0 +1,583 @@
+/** @file task_graph.c
+*
+* @brief Task graph executor.  Each worker owns a Chase-Lev deque: it pushes
+*        and pops tasks at the bottom, so an item's next stage runs on the
+*        worker that just finished the last one with its data still in
+*        cache, while idle workers steal the oldest task from the top.
+*        Tasks submitted by other threads go through a shared queue.  Idle
+*        workers sleep on a futex counting pushed tasks.
+*
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "project_defs.h"
+#include "service.h"
+#include "task_graph.h"
+#include "trace.h"
+
+// Tasks each deque and the shared queue hold, powers of 2
+#define TASK_DEQUE_SIZE (256)
+#define TASK_SHARED_SIZE (256)
+
+// Time conversion
+#define NSEC_PER_SEC (1000000000ull)
+#define NSEC_PER_USEC (1000.0)
+
+// Cache line the deque ends are kept apart by
+#define TASK_CACHE_LINE (64)
+
+// Deque of one worker, top is taken by thieves and bottom by the owner
+typedef struct task_deque {
+  int64_t top __attribute__((aligned(TASK_CACHE_LINE)));
+  int64_t bottom __attribute__((aligned(TASK_CACHE_LINE)));
+  task_t * p_tasks[TASK_DEQUE_SIZE];
+} task_deque_t;
+
+// Time spent running tasks and tasks taken from other workers
+typedef struct task_worker_stats {
+  uint64_t busy_ns;
+  uint64_t runs;
+  uint64_t steals;
+} __attribute__((aligned(TASK_CACHE_LINE))) task_worker_stats_t;
+
+static struct {
+  pthread_t threads[SERVICE_WORKERS_MAX];
+  task_deque_t deques[SERVICE_WORKERS_MAX];
+  task_worker_stats_t stats[SERVICE_WORKERS_MAX];
+  uint32_t workers;
+  uint8_t running;
+  uint8_t stop;
+  uint64_t start_ns;
+
+  // Tasks made ready by threads that aren't workers
+  pthread_mutex_t lock;
+  task_t * p_shared[TASK_SHARED_SIZE];
+  uint32_t shared_head;
+  uint32_t shared_tail;
+
+  // Bumped on every push, idle workers sleep on it
+  uint32_t pushes;
+  uint32_t sleepers;
+} exec = {
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+// Worker the calling thread is, -1 for other threads
+static __thread int32_t own = -1;
+
+/*!
+* @brief Gets the monotonic time
+* @return nanoseconds
+*/
+static inline
+uint64_t task_now_ns()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+} // task_now_ns()
+
+/*!
+* @brief Pushes a task on the bottom of the calling worker's deque
+* @param p_deque deque of the calling worker
+* @param p_task task
+* @return SUCCESS, FAILURE when the deque is full
+*/
+static
+uint32_t deque_push(task_deque_t * p_deque, task_t * p_task)
+{
+  int64_t bottom = __atomic_load_n(&p_deque->bottom, __ATOMIC_RELAXED);
+  int64_t top = __atomic_load_n(&p_deque->top, __ATOMIC_ACQUIRE);
+
+  if (bottom - top >= TASK_DEQUE_SIZE)
+  {
+    return FAILURE;
+  }
+  __atomic_store_n(&p_deque->p_tasks[bottom & (TASK_DEQUE_SIZE - 1)], p_task, __ATOMIC_RELAXED);
+  __atomic_store_n(&p_deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+  return SUCCESS;
+} // deque_push()
+
+/*!
+* @brief Pops the newest task off the bottom of the calling worker's deque
+* @param p_deque deque of the calling worker
+* @return task or NULL when empty
+*/
+static
+task_t * deque_pop(task_deque_t * p_deque)
+{
+  int64_t bottom = __atomic_load_n(&p_deque->bottom, __ATOMIC_RELAXED) - 1;
+  int64_t top = 0;
+  task_t * p_task = NULL;
+
+  // Claim the bottom before looking at the top thieves move
+  __atomic_store_n(&p_deque->bottom, bottom, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  top = __atomic_load_n(&p_deque->top, __ATOMIC_RELAXED);
+  if (top > bottom)
+  {
+    __atomic_store_n(&p_deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  p_task = __atomic_load_n(&p_deque->p_tasks[bottom & (TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+
+  // The last task may be stolen at the same time, whoever moves the top wins
+  if (top == bottom)
+  {
+    if (!__atomic_compare_exchange_n(&p_deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+      p_task = NULL;
+    }
+    __atomic_store_n(&p_deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+  }
+  return p_task;
+} // deque_pop()
+
+/*!
+* @brief Steals the oldest task off the top of another worker's deque
+* @param p_deque deque stolen from
+* @return task or NULL when empty or another thread took it first
+*/
+static
+task_t * deque_steal(task_deque_t * p_deque)
+{
+  int64_t top = __atomic_load_n(&p_deque->top, __ATOMIC_ACQUIRE);
+  int64_t bottom = 0;
+  task_t * p_task = NULL;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  bottom = __atomic_load_n(&p_deque->bottom, __ATOMIC_ACQUIRE);
+  if (top >= bottom)
+  {
+    return NULL;
+  }
+  p_task = __atomic_load_n(&p_deque->p_tasks[top & (TASK_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&p_deque->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+  {
+    return NULL;
+  }
+  return p_task;
+} // deque_steal()
+
+static inline
+void task_run(task_t * p_task);
+
+/*!
+* @brief Makes a task ready, on the calling worker's own deque or the shared
+*        queue, and wakes a sleeping worker
+* @param p_task task
+*/
+static
+void task_push(task_t * p_task)
+{
+  uint32_t res = FAILURE;
+
+  if (own >= 0)
+  {
+    res = deque_push(&exec.deques[own], p_task);
+  }
+
+  if (res != SUCCESS)
+  {
+    pthread_mutex_lock(&exec.lock);
+    if (exec.shared_tail - exec.shared_head < TASK_SHARED_SIZE)
+    {
+      exec.p_shared[exec.shared_tail++ & (TASK_SHARED_SIZE - 1)] = p_task;
+      res = SUCCESS;
+    }
+    pthread_mutex_unlock(&exec.lock);
+  }
+
+  // Only with more items in flight than the queues hold, the caller runs it
+  if (res != SUCCESS)
+  {
+    task_run(p_task);
+    return;
+  }
+
+  // Pairs with the sleeper counting itself before looking for work again
+  __atomic_add_fetch(&exec.pushes, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&exec.sleepers, __ATOMIC_SEQ_CST) != 0)
+  {
+    syscall(SYS_futex, &exec.pushes, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+} // task_push()
+
+/*!
+* @brief Finds a task for a worker, its own newest first, then the shared
+*        queue, then the oldest of another worker
+* @param worker worker looking
+* @return task or NULL when there is none
+*/
+static
+task_t * task_find(uint32_t worker)
+{
+  task_t * p_task = deque_pop(&exec.deques[worker]);
+
+  if (p_task != NULL)
+  {
+    return p_task;
+  }
+  pthread_mutex_lock(&exec.lock);
+  if (exec.shared_head != exec.shared_tail)
+  {
+    p_task = exec.p_shared[exec.shared_head++ & (TASK_SHARED_SIZE - 1)];
+  }
+  pthread_mutex_unlock(&exec.lock);
+  if (p_task != NULL)
+  {
+    return p_task;
+  }
+
+  // Victims are tried in turn from the next worker so thieves spread out
+  for (uint32_t i = 1; i < exec.workers && p_task == NULL; i++)
+  {
+    p_task = deque_steal(&exec.deques[(worker + i) % exec.workers]);
+  }
+  exec.stats[worker].steals += (p_task != NULL);
+  return p_task;
+} // task_find()
+
+/*!
+* @brief Runs one node for an item, then readies the nodes after it and
+*        finishes the item after its last node
+* @param p_task task
+*/
+static
+void task_exec(task_t * p_task)
+{
+  task_item_t * p_item = p_task->p_item;
+  task_graph_t * p_graph = p_item->p_graph;
+  task_node_t * p_node = &p_graph->nodes[p_task->node];
+  uint64_t start = task_now_ns();
+  uint64_t busy = 0;
+
+  p_node->func(p_item->p_data);
+  busy = task_now_ns() - start;
+  __atomic_fetch_add(&p_node->busy_ns, busy, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&p_node->runs, 1, __ATOMIC_RELAXED);
+  if (own >= 0)
+  {
+    exec.stats[own].busy_ns += busy;
+    exec.stats[own].runs++;
+  }
+
+  for (uint32_t i = 0; i < p_node->num_next; i++)
+  {
+    uint32_t next = p_node->next[i];
+
+    if (__atomic_sub_fetch(&p_item->waiting[next], 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      task_push(&p_item->tasks[next]);
+    }
+  }
+  // The graph has room again before the caller is told its item is free
+  if (__atomic_sub_fetch(&p_item->left, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    __atomic_sub_fetch(&p_graph->inflight, 1, __ATOMIC_RELEASE);
+    p_graph->done(p_item->p_data);
+  }
+} // task_exec()
+
+/*!
+* @brief Runs a task of a serial node once every earlier item has run it.
+*        The worker finding the node idle runs every item that is next in
+*        turn, the others only leave theirs.
+* @param p_task task
+*/
+static
+void task_serial(task_t * p_task)
+{
+  task_node_t * p_node = &p_task->p_item->p_graph->nodes[p_task->node];
+  task_t * p_next = NULL;
+
+  pthread_mutex_lock(&p_node->lock);
+  p_node->p_ready[p_task->p_item->ticket & (TASK_GRAPH_INFLIGHT - 1)] = p_task;
+  if (p_node->draining)
+  {
+    pthread_mutex_unlock(&p_node->lock);
+    return;
+  }
+  p_node->draining = 1;
+  while ((p_next = p_node->p_ready[p_node->next_ticket & (TASK_GRAPH_INFLIGHT - 1)]) != NULL &&
+         p_next->p_item->ticket == p_node->next_ticket)
+  {
+    p_node->p_ready[p_node->next_ticket & (TASK_GRAPH_INFLIGHT - 1)] = NULL;
+    p_node->next_ticket++;
+    pthread_mutex_unlock(&p_node->lock);
+    task_exec(p_next);
+    pthread_mutex_lock(&p_node->lock);
+  }
+  p_node->draining = 0;
+  pthread_mutex_unlock(&p_node->lock);
+} // task_serial()
+
+/*!
+* @brief Runs a task on the calling thread
+* @param p_task task
+*/
+static inline
+void task_run(task_t * p_task)
+{
+  if (p_task->p_item->p_graph->nodes[p_task->node].serial)
+  {
+    task_serial(p_task);
+  }
+  else
+  {
+    task_exec(p_task);
+  }
+} // task_run()
+
+/*!
+* @brief Runs tasks until the executor is stopped and no task is left
+* @param param worker index, cast to a pointer
+* @return NULL
+*/
+static
+void * task_worker(void * param)
+{
+  uint32_t worker = (uint32_t)(uintptr_t)param;
+  task_t * p_task = NULL;
+  uint32_t pushes = 0;
+  uint8_t stop = 0;
+  char name[SERVICE_NAME_MAX];
+
+  own = worker;
+  snprintf(name, sizeof(name), "%s_%u", TASK_GRAPH_SERVICE, worker);
+  METRICS_INIT(name);
+  PERF_INIT(name);
+#ifdef TRACE
+  // Tasks record their spans in the worker's buffer
+  trace_thread_init(name);
+#endif /* TRACE */
+  while (1)
+  {
+    p_task = task_find(worker);
+    if (p_task != NULL)
+    {
+      task_run(p_task);
+      continue;
+    }
+
+    // Count as sleeping before the last look, so a push after it either
+    // sees the sleeper or changes the count the futex checks.  Stop is read
+    // first, so only a look made after it finding nothing ends the worker.
+    pushes = __atomic_load_n(&exec.pushes, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&exec.sleepers, 1, __ATOMIC_SEQ_CST);
+    stop = __atomic_load_n(&exec.stop, __ATOMIC_ACQUIRE);
+    p_task = task_find(worker);
+    if (p_task == NULL && !stop)
+    {
+      syscall(SYS_futex, &exec.pushes, FUTEX_WAIT_PRIVATE, pushes, NULL, NULL, 0);
+    }
+    __atomic_sub_fetch(&exec.sleepers, 1, __ATOMIC_SEQ_CST);
+    if (p_task != NULL)
+    {
+      task_run(p_task);
+    }
+    else if (stop)
+    {
+      break;
+    }
+  }
+  return NULL;
+} // task_worker()
+
+uint32_t task_graph_init()
+{
+  FUNC_ENTRY;
+  int32_t workers = GRAPH_WORKERS;
+  uint32_t res = 0;
+
+  if (exec.running)
+  {
+    return SUCCESS;
+  }
+
+  // A worker for each configured cpu, otherwise each cpu besides capture's,
+  // and always one so items are run
+  if (workers < 0)
+  {
+    workers = service_workers(TASK_GRAPH_SERVICE);
+    workers = workers ? workers : sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  }
+  workers = (workers > 1) ? workers : 1;
+  workers = (workers < SERVICE_WORKERS_MAX) ? workers : SERVICE_WORKERS_MAX;
+
+  exec.start_ns = task_now_ns();
+  for (exec.workers = 0; exec.workers < (uint32_t)workers; exec.workers++)
+  {
+    EQ_RET_E(res,
+             service_launch_worker(TASK_GRAPH_SERVICE,
+                                   exec.workers,
+                                   task_worker,
+                                   (void *)(uintptr_t)exec.workers,
+                                   &exec.threads[exec.workers]),
+             FAILURE,
+             FAILURE);
+  }
+  exec.running = 1;
+  LOG_MED("Task graph running %u workers", exec.workers);
+  return SUCCESS;
+} // task_graph_init()
+
+void task_graph_create(task_graph_t * p_graph, const char * p_name, task_func_t done)
+{
+  memset(p_graph, 0, sizeof(*p_graph));
+  p_graph->p_name = p_name;
+  p_graph->done = done;
+} // task_graph_create()
+
+uint32_t task_graph_node(task_graph_t * p_graph, const char * p_name, task_func_t func, uint8_t serial, uint32_t * p_node)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_graph);
+  CHECK_NULL(func);
+  CHECK_NULL(p_node);
+
+  task_node_t * p_new = NULL;
+  int32_t res = 0;
+
+  if (p_graph->num_nodes == TASK_GRAPH_NODES_MAX)
+  {
+    LOG_ERROR("No room for %s in %s, a graph takes %d nodes", p_name, p_graph->p_name, TASK_GRAPH_NODES_MAX);
+    return FAILURE;
+  }
+  p_new = &p_graph->nodes[p_graph->num_nodes];
+  p_new->p_name = p_name;
+  p_new->func = func;
+  p_new->serial = serial;
+  PT_NOT_EQ_RET(res, pthread_mutex_init(&p_new->lock, NULL), SUCCESS, FAILURE);
+  *p_node = p_graph->num_nodes++;
+  return SUCCESS;
+} // task_graph_node()
+
+uint32_t task_graph_edge(task_graph_t * p_graph, uint32_t before, uint32_t after)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_graph);
+
+  task_node_t * p_before = &p_graph->nodes[before];
+
+  // Nodes only follow nodes added before them, so the graph has no cycles
+  if (before >= after || after >= p_graph->num_nodes || p_before->num_next == TASK_GRAPH_NEXT_MAX)
+  {
+    LOG_ERROR("Can't run node %u after %u in %s", after, before, p_graph->p_name);
+    return FAILURE;
+  }
+  p_before->next[p_before->num_next++] = after;
+  p_graph->nodes[after].num_prev++;
+  return SUCCESS;
+} // task_graph_edge()
+
+uint32_t task_graph_submit(task_graph_t * p_graph, task_item_t * p_item, void * p_data)
+{
+  CHECK_NULL(p_graph);
+  CHECK_NULL(p_item);
+
+  uint32_t inflight = __atomic_load_n(&p_graph->inflight, __ATOMIC_ACQUIRE);
+
+  // Serial nodes keep one slot for each item in flight, the count is only
+  // raised below the limit so submitters racing each other can't pass it
+  do
+  {
+    if (inflight == TASK_GRAPH_INFLIGHT)
+    {
+      return FAILURE;
+    }
+  } while (!__atomic_compare_exchange_n(&p_graph->inflight, &inflight, inflight + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+  p_item->p_graph = p_graph;
+  p_item->p_data = p_data;
+  p_item->ticket = __atomic_fetch_add(&p_graph->tickets, 1, __ATOMIC_RELAXED);
+  p_item->left = p_graph->num_nodes;
+  for (uint32_t node = 0; node < p_graph->num_nodes; node++)
+  {
+    p_item->waiting[node] = p_graph->nodes[node].num_prev;
+    p_item->tasks[node].p_item = p_item;
+    p_item->tasks[node].node = node;
+  }
+  for (uint32_t node = 0; node < p_graph->num_nodes; node++)
+  {
+    if (p_graph->nodes[node].num_prev == 0)
+    {
+      task_push(&p_item->tasks[node]);
+    }
+  }
+  return SUCCESS;
+} // task_graph_submit()
+
+uint32_t task_graph_worker()
+{
+  return (own >= 0) ? (uint32_t)own : exec.workers;
+} // task_graph_worker()
+
+uint32_t task_graph_workers()
+{
+  return exec.workers;
+} // task_graph_workers()
+
+void task_graph_report(const task_graph_t * p_graph)
+{
+  FUNC_ENTRY;
+  double elapsed = task_now_ns() - exec.start_ns;
+  const task_node_t * p_node = NULL;
+
+  // Occupancy of a node is the workers it kept busy on average, so a
+  // bottleneck stage shows as the one near the worker count
+  LOG_HIGH("%s ran %u items on %u workers", p_graph->p_name, p_graph->tickets, exec.workers);
+  for (uint32_t node = 0; node < p_graph->num_nodes; node++)
+  {
+    p_node = &p_graph->nodes[node];
+    LOG_HIGH("%-16s %-6s %llu runs, %.1fus mean, occupancy %.3f",
+             p_node->p_name,
+             p_node->serial ? "serial" : "",
+             (unsigned long long)p_node->runs,
+             p_node->runs ? p_node->busy_ns / NSEC_PER_USEC / p_node->runs : 0.0,
+             p_node->busy_ns / elapsed);
+  }
+} // task_graph_report()
+
+void task_graph_stop()
+{
+  FUNC_ENTRY;
+
+  if (!exec.running)
+  {
+    return;
+  }
+
+  // Workers go on until they find nothing left
+  __atomic_store_n(&exec.stop, 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&exec.pushes, 1, __ATOMIC_SEQ_CST);
+  syscall(SYS_futex, &exec.pushes, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  for (uint32_t worker = 0; worker < exec.workers; worker++)
+  {
+    pthread_join(exec.threads[worker], NULL);
+  }
+  for (uint32_t worker = 0; worker < exec.workers; worker++)
+  {
+    LOG_HIGH("%s_%u busy %.1f%%, %llu tasks, %llu stolen",
+             TASK_GRAPH_SERVICE,
+             worker,
+             100.0 * exec.stats[worker].busy_ns / (task_now_ns() - exec.start_ns),
+             (unsigned long long)exec.stats[worker].runs,
+             (unsigned long long)exec.stats[worker].steals);
+  }
+  exec.running = 0;
+} // task_graph_stop()
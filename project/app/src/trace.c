@@ -0,0 +1,184 @@
+/** @file trace.c
+*
+* @brief Records pipeline spans into per-thread buffers and dumps them as
+*        Chrome Trace Event JSON which can be opened in chrome://tracing or
+*        the Perfetto UI
+*
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "project_defs.h"
+#include "trace.h"
+
+#define TRACE_NAME_MAX (32)
+#define NSEC_PER_USEC (1000.0)
+#define NSEC_PER_SEC (1000000000ull)
+
+// Phases used by the trace event format
+#define PHASE_BEGIN 'B'
+#define PHASE_END 'E'
+
+// A single begin or end event
+typedef struct {
+  uint64_t ts;
+  uint32_t seq;
+  uint8_t span;
+  char phase;
+} trace_event_t;
+
+// Per-thread event buffer.  Only the owning thread writes to it so no locking
+// is needed on the hot path, the buffer wraps when full keeping newest events.
+typedef struct {
+  char name[TRACE_NAME_MAX];
+  pid_t tid;
+  uint32_t count;
+  trace_event_t events[TRACE_MAX_EVENTS];
+} trace_buf_t;
+
+// Span names shown in the trace viewer, must match trace_span_t
+static const char * p_span_str[] = {
+  "release",
+  "capture",
+  "queue_wait",
+  "encode",
+  "convert",
+  "file_write",
+  "socket_send"
+};
+
+// Preallocated buffers for every thread
+static trace_buf_t buffers[TRACE_MAX_THREADS];
+static uint32_t num_buffers = 0;
+
+// Buffer claimed by the calling thread, for code run on threads it doesn't own
+static __thread uint8_t own = TRACE_MAX_THREADS;
+
+/*!
+* @brief Adds an event to a thread buffer
+* @param buf buffer id
+* @param span span of the event
+* @param seq frame sequence number
+* @param phase begin or end phase
+*/
+static inline
+void trace_event(uint8_t buf, trace_span_t span, uint32_t seq, char phase)
+{
+  struct timespec now;
+  trace_event_t * event;
+
+  // Buffer ids past the max are threads that could not get a buffer
+  if (buf >= TRACE_MAX_THREADS)
+  {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  event = &buffers[buf].events[buffers[buf].count % TRACE_MAX_EVENTS];
+  event->ts = (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+  event->seq = seq;
+  event->span = span;
+  event->phase = phase;
+  buffers[buf].count++;
+} // trace_event()
+
+uint8_t trace_thread_init(const char * p_name)
+{
+  FUNC_ENTRY;
+  uint32_t buf = __sync_fetch_and_add(&num_buffers, 1);
+
+  if (buf >= TRACE_MAX_THREADS)
+  {
+    LOG_ERROR("No trace buffer left for %s", p_name);
+    return TRACE_MAX_THREADS;
+  }
+
+  // Fill out the thread information shown in the viewer
+  strncpy(buffers[buf].name, p_name, TRACE_NAME_MAX - 1);
+  buffers[buf].tid = syscall(SYS_gettid);
+  buffers[buf].count = 0;
+  own = buf;
+  return buf;
+} // trace_thread_init()
+
+uint8_t trace_thread_buf()
+{
+  return own;
+} // trace_thread_buf()
+
+void trace_begin(uint8_t buf, trace_span_t span, uint32_t seq)
+{
+  trace_event(buf, span, seq, PHASE_BEGIN);
+} // trace_begin()
+
+void trace_end(uint8_t buf, trace_span_t span, uint32_t seq)
+{
+  trace_event(buf, span, seq, PHASE_END);
+} // trace_end()
+
+uint32_t trace_dump(const char * p_file_name)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_file_name);
+
+  FILE * fp;
+  trace_event_t * event;
+  pid_t pid = getpid();
+  int32_t res = 0;
+  uint32_t num = num_buffers < TRACE_MAX_THREADS ? num_buffers : TRACE_MAX_THREADS;
+  uint32_t first = 1;
+
+  EQ_RET_E(fp, fopen(p_file_name, "w"), NULL, FAILURE);
+  fprintf(fp, "{\"traceEvents\":[\n");
+
+  for (uint32_t buf = 0; buf < num; buf++)
+  {
+    uint32_t count = buffers[buf].count;
+    uint32_t start = count > TRACE_MAX_EVENTS ? count - TRACE_MAX_EVENTS : 0;
+
+    // Metadata event naming the thread
+    fprintf(fp,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n",
+            pid,
+            buffers[buf].tid,
+            buffers[buf].name);
+    first = 0;
+
+    // Write out every event still held by the buffer
+    for (uint32_t i = start; i < count; i++)
+    {
+      event = &buffers[buf].events[i % TRACE_MAX_EVENTS];
+      fprintf(fp,
+              ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"%c\",\"ts\":%.3f,"
+              "\"pid\":%d,\"tid\":%d,\"args\":{\"seq\":%u}}",
+              p_span_str[event->span],
+              event->phase,
+              (double)event->ts / NSEC_PER_USEC,
+              pid,
+              buffers[buf].tid,
+              event->seq);
+    }
+
+    if (count > TRACE_MAX_EVENTS)
+    {
+      LOG_MED("Trace buffer %s wrapped, dropped %d events",
+              buffers[buf].name,
+              count - TRACE_MAX_EVENTS);
+    }
+  }
+
+  fprintf(fp, "\n]}\n");
+  EQ_RET_E(res, fclose(fp), EOF, FAILURE);
+  LOG_HIGH("Wrote trace for %d threads to %s", num, p_file_name);
+  return SUCCESS;
+} // trace_dump()
@@ -0,0 +1,392 @@
+/** @file v4l2_cap.c
+*
+* @brief V4L2 mmap streaming capture.  The driver fills a ring of mapped
+*        buffers, each dequeued buffer is described by a frame in the format
+*        the camera delivers so the encoder reads the driver memory directly,
+*        and the buffer is queued back to the driver when the encoder releases
+*        it.
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "log.h"
+#include "project_defs.h"
+#include "v4l2_cap.h"
+
+#define NSEC_PER_SEC (1000000000l)
+#define NSEC_PER_USEC (1000l)
+#define BGR_BYTES_PER_PIXEL (3)
+
+// Formats asked for in order.  The YUV formats are what cameras produce and
+// encode to JPEG without any color conversion.
+static const struct {
+  uint32_t fourcc;
+  pix_fmt_t format;
+} formats[] = {
+  {V4L2_PIX_FMT_YUYV,   PIX_FMT_YUYV},
+  {V4L2_PIX_FMT_YUV420, PIX_FMT_YUV420},
+  {V4L2_PIX_FMT_BGR24,  PIX_FMT_BGR24},
+};
+#define NUM_FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+/*!
+* @brief ioctl retried when interrupted by a signal
+* @param fd device
+* @param request ioctl request
+* @param arg ioctl argument
+* @return ioctl result
+*/
+static
+int32_t v4l2_ioctl(int32_t fd, unsigned long request, void * arg)
+{
+  int32_t res;
+
+  do
+  {
+    res = ioctl(fd, request, arg);
+  } while (res == -1 && errno == EINTR);
+  return res;
+} // v4l2_ioctl()
+
+/*!
+* @brief Sets the first format the device supports at the resolution
+* @param fd device
+* @param hres horizontal resolution
+* @param vres vertical resolution
+* @param p_fmt format set
+* @param p_format pixel format of the frames
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t v4l2_set_format(int32_t fd,
+                         uint32_t hres,
+                         uint32_t vres,
+                         struct v4l2_format * p_fmt,
+                         pix_fmt_t * p_format)
+{
+  for (uint32_t index = 0; index < NUM_FORMATS; index++)
+  {
+    memset(p_fmt, 0, sizeof(*p_fmt));
+    p_fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    p_fmt->fmt.pix.width = hres;
+    p_fmt->fmt.pix.height = vres;
+    p_fmt->fmt.pix.pixelformat = formats[index].fourcc;
+    p_fmt->fmt.pix.field = V4L2_FIELD_NONE;
+    if (v4l2_ioctl(fd, VIDIOC_S_FMT, p_fmt) == -1)
+    {
+      LOG_ERROR("VIDIOC_S_FMT failed with error: %s", strerror(errno));
+      return FAILURE;
+    }
+
+    // The driver answers with what it can do instead.  BGR24 also has to be
+    // packed to match the IplImage layout.
+    if (p_fmt->fmt.pix.pixelformat == formats[index].fourcc &&
+        p_fmt->fmt.pix.width == hres &&
+        p_fmt->fmt.pix.height == vres &&
+        (formats[index].format != PIX_FMT_BGR24 ||
+         p_fmt->fmt.pix.bytesperline == hres * BGR_BYTES_PER_PIXEL))
+    {
+      *p_format = formats[index].format;
+      return SUCCESS;
+    }
+  }
+  return FAILURE;
+} // v4l2_set_format()
+
+/*!
+* @brief Describes the data of a mapped buffer as a frame
+* @param p_buf mapped buffer
+* @param p_fmt format set on the device
+* @param format pixel format of the frames
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t v4l2_buf_frame(v4l2_cap_buf_t * p_buf, struct v4l2_format * p_fmt, pix_fmt_t format)
+{
+  frame_t * p_frame = &p_buf->frame;
+  uint32_t stride = p_fmt->fmt.pix.bytesperline;
+  uint32_t height = p_fmt->fmt.pix.height;
+
+  memset(p_frame, 0, sizeof(*p_frame));
+  p_frame->format = format;
+  p_frame->width = p_fmt->fmt.pix.width;
+  p_frame->height = height;
+  p_frame->planes[0] = p_buf->start;
+  p_frame->strides[0] = stride;
+
+  switch (format)
+  {
+    case PIX_FMT_YUV420:
+      // Cb then Cr follow the luma plane at half the stride and height
+      p_frame->planes[1] = p_frame->planes[0] + stride * height;
+      p_frame->planes[2] = p_frame->planes[1] + (stride / 2) * (height / 2);
+      p_frame->strides[1] = stride / 2;
+      p_frame->strides[2] = stride / 2;
+      break;
+    case PIX_FMT_BGR24:
+      // Image header for OpenCV over the driver buffer
+      EQ_RET_E(p_frame->image,
+               cvCreateImageHeader(cvSize(p_frame->width, height), IPL_DEPTH_8U, BGR_BYTES_PER_PIXEL),
+               NULL,
+               FAILURE);
+      cvSetData(p_frame->image, p_buf->start, stride);
+      break;
+    default:
+      break;
+  }
+  return SUCCESS;
+} // v4l2_buf_frame()
+
+/*!
+* @brief Converts a driver timestamp to CLOCK_REALTIME
+* @param p_buf dequeued buffer
+* @param p_time converted time
+*/
+static
+void v4l2_timestamp(struct v4l2_buffer * p_buf, struct timespec * p_time)
+{
+  struct timespec mono;
+  int64_t age;
+
+  clock_gettime(CLOCK_REALTIME, p_time);
+  if ((p_buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+  {
+    return;
+  }
+
+  // Move the monotonic driver timestamp onto the realtime clock by how long
+  // ago it was taken
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  age = (int64_t)(mono.tv_sec - p_buf->timestamp.tv_sec) * NSEC_PER_SEC +
+        (mono.tv_nsec - (int64_t)p_buf->timestamp.tv_usec * NSEC_PER_USEC);
+  p_time->tv_sec -= age / NSEC_PER_SEC;
+  p_time->tv_nsec -= age % NSEC_PER_SEC;
+  if (p_time->tv_nsec < 0)
+  {
+    p_time->tv_sec--;
+    p_time->tv_nsec += NSEC_PER_SEC;
+  }
+} // v4l2_timestamp()
+
+/*!
+* @brief Sets up an open device, maps and queues its buffers, and starts
+*        streaming.  Stops at the first error leaving what was set up for
+*        v4l2_close().
+* @param p_cap capture with the device open
+* @param p_dev device path, for logs
+* @param hres horizontal resolution
+* @param vres vertical resolution
+* @param num_bufs buffers to ask for
+* @return SUCCESS/FAILURE
+*/
+static
+uint32_t v4l2_start(v4l2_cap_t * p_cap,
+                    const char * p_dev,
+                    uint32_t hres,
+                    uint32_t vres,
+                    uint32_t num_bufs)
+{
+  struct v4l2_capability caps;
+  struct v4l2_format fmt;
+  struct v4l2_requestbuffers req;
+  struct v4l2_streamparm parm;
+  struct v4l2_buffer buf;
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  pix_fmt_t format = PIX_FMT_BGR24;
+  int32_t res = 0;
+
+  // Has to be a streaming capture device
+  EQ_RET_E(res, v4l2_ioctl(p_cap->fd, VIDIOC_QUERYCAP, &caps), -1, FAILURE);
+  if (!(caps.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+      !(caps.capabilities & V4L2_CAP_STREAMING))
+  {
+    LOG_ERROR("%s (%s) can't stream video capture", p_dev, caps.card);
+    return FAILURE;
+  }
+  LOG_HIGH("Opened %s: %s on %s", p_dev, caps.card, caps.driver);
+
+  // Keep frames in the camera's own format when it is one we can encode
+  if (v4l2_set_format(p_cap->fd, hres, vres, &fmt, &format) != SUCCESS)
+  {
+    LOG_ERROR("%s doesn't support YUYV, YUV420, or BGR24 at %ux%u", p_dev, hres, vres);
+    return FAILURE;
+  }
+
+  // Run the camera at the frame rate, not every driver supports it
+  memset(&parm, 0, sizeof(parm));
+  parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  parm.parm.capture.timeperframe.numerator = PERIOD;
+  parm.parm.capture.timeperframe.denominator = 1000;
+  if (v4l2_ioctl(p_cap->fd, VIDIOC_S_PARM, &parm) == -1)
+  {
+    LOG_MED("%s frame rate not set: %s", p_dev, strerror(errno));
+  }
+
+  // Ask for the buffers, the driver may give more or fewer
+  memset(&req, 0, sizeof(req));
+  req.count = num_bufs;
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  req.memory = V4L2_MEMORY_MMAP;
+  EQ_RET_E(res, v4l2_ioctl(p_cap->fd, VIDIOC_REQBUFS, &req), -1, FAILURE);
+  if (req.count < 2 || req.count > V4L2_MAX_BUFS)
+  {
+    LOG_ERROR("%s gave %u buffers", p_dev, req.count);
+    return FAILURE;
+  }
+  p_cap->num_bufs = req.count;
+
+  // Map each buffer, describe it as a frame, and queue it
+  for (uint32_t index = 0; index < p_cap->num_bufs; index++)
+  {
+    v4l2_cap_buf_t * p_buf = &p_cap->bufs[index];
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    EQ_RET_E(res, v4l2_ioctl(p_cap->fd, VIDIOC_QUERYBUF, &buf), -1, FAILURE);
+
+    p_buf->length = buf.length;
+    EQ_RET_E(p_buf->start,
+             mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, p_cap->fd, buf.m.offset),
+             MAP_FAILED,
+             FAILURE);
+    EQ_RET_E(res, v4l2_buf_frame(p_buf, &fmt, format), FAILURE, FAILURE);
+
+    EQ_RET_E(res, v4l2_ioctl(p_cap->fd, VIDIOC_QBUF, &buf), -1, FAILURE);
+  }
+  p_cap->queued = p_cap->num_bufs;
+
+  EQ_RET_E(res, v4l2_ioctl(p_cap->fd, VIDIOC_STREAMON, &type), -1, FAILURE);
+  LOG_HIGH("Streaming %ux%u %s with %u buffers",
+           hres,
+           vres,
+           frame_format_name(format),
+           p_cap->num_bufs);
+  return SUCCESS;
+} // v4l2_start()
+
+uint32_t v4l2_open(v4l2_cap_t * p_cap,
+                   const char * p_dev,
+                   uint32_t hres,
+                   uint32_t vres,
+                   uint32_t num_bufs)
+{
+  FUNC_ENTRY;
+  CHECK_NULL(p_cap);
+  CHECK_NULL(p_dev);
+
+  memset(p_cap, 0, sizeof(*p_cap));
+  EQ_RET_E(p_cap->fd, open(p_dev, O_RDWR | O_NONBLOCK), -1, FAILURE);
+
+  // Unmap whatever buffers were mapped and close the device on any error
+  if (v4l2_start(p_cap, p_dev, hres, vres, num_bufs) != SUCCESS)
+  {
+    v4l2_close(p_cap);
+    return FAILURE;
+  }
+  return SUCCESS;
+} // v4l2_open()
+
+uint32_t v4l2_release(v4l2_cap_t * p_cap, int32_t index)
+{
+  struct v4l2_buffer buf;
+  int32_t res = 0;
+
+  if (index < 0 || (uint32_t)index >= p_cap->num_bufs)
+  {
+    return FAILURE;
+  }
+
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.index = index;
+  EQ_RET_E(res, v4l2_ioctl(p_cap->fd, VIDIOC_QBUF, &buf), -1, FAILURE);
+  __atomic_fetch_add(&p_cap->queued, 1, __ATOMIC_RELAXED);
+  return SUCCESS;
+} // v4l2_release()
+
+uint32_t v4l2_grab(v4l2_cap_t * p_cap, cap_info_t * p_info)
+{
+  struct pollfd ready;
+  struct v4l2_buffer buf;
+  struct v4l2_buffer newer;
+  int32_t res = 0;
+
+  // Wait for the driver to fill a buffer
+  ready.fd = p_cap->fd;
+  ready.events = POLLIN;
+  do
+  {
+    res = poll(&ready, 1, V4L2_POLL_MS);
+  } while (res == -1 && errno == EINTR);
+  if (res == 0)
+  {
+    LOG_ERROR("No frame within %dms, %u of %u buffers with the driver",
+              V4L2_POLL_MS,
+              __atomic_load_n(&p_cap->queued, __ATOMIC_RELAXED),
+              p_cap->num_bufs);
+    return FAILURE;
+  }
+  if (res == -1)
+  {
+    LOG_ERROR("poll failed with error: %s", strerror(errno));
+    return FAILURE;
+  }
+
+  // Take every filled buffer keeping only the newest so a frame released
+  // late isn't one that has been sitting in the driver
+  memset(&buf, 0, sizeof(buf));
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  EQ_RET_E(res, v4l2_ioctl(p_cap->fd, VIDIOC_DQBUF, &buf), -1, FAILURE);
+  __atomic_fetch_sub(&p_cap->queued, 1, __ATOMIC_RELAXED);
+  newer = buf;
+  while (v4l2_ioctl(p_cap->fd, VIDIOC_DQBUF, &newer) == 0)
+  {
+    __atomic_fetch_sub(&p_cap->queued, 1, __ATOMIC_RELAXED);
+    v4l2_release(p_cap, buf.index);
+    buf = newer;
+  }
+
+  p_info->frame = p_cap->bufs[buf.index].frame;
+  p_info->buf_index = buf.index;
+  v4l2_timestamp(&buf, &p_info->time);
+  return SUCCESS;
+} // v4l2_grab()
+
+void v4l2_close(v4l2_cap_t * p_cap)
+{
+  FUNC_ENTRY;
+  enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+  v4l2_ioctl(p_cap->fd, VIDIOC_STREAMOFF, &type);
+  for (uint32_t index = 0; index < p_cap->num_bufs; index++)
+  {
+    if (p_cap->bufs[index].frame.image != NULL)
+    {
+      cvReleaseImageHeader(&p_cap->bufs[index].frame.image);
+    }
+
+    // A failed open may have stopped before mapping every buffer
+    if (p_cap->bufs[index].start != NULL && p_cap->bufs[index].start != MAP_FAILED)
+    {
+      munmap(p_cap->bufs[index].start, p_cap->bufs[index].length);
+    }
+  }
+  close(p_cap->fd);
+  p_cap->num_bufs = 0;
+} // v4l2_close()
@@ -0,0 +1,232 @@
+/** @file worker_pool.c
+*
+* @brief Worker pool.  A job is published by bumping a generation count
+*        the workers sleep on with a futex.  Everyone taking part claims
+*        items from a shared count until none are left, and the caller
+*        waits on a latch counting down the workers, so no worker is still
+*        in a job when the next one is set up.
+*
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "project_defs.h"
+#include "service.h"
+#include "worker_pool.h"
+
+static struct {
+  pthread_t threads[SERVICE_WORKERS_MAX];
+  uint32_t workers;
+  uint8_t running;
+
+  // One job at a time
+  pthread_mutex_t lock;
+
+  // Job being run, only written while no worker is in a job
+  worker_pool_func_t func;
+  void * p_ctx;
+  uint32_t items;
+  uint8_t stop;
+
+  // Next item to claim, workers yet to finish the job, and the job count
+  // the workers sleep on
+  uint32_t next;
+  uint32_t pending;
+  uint32_t generation;
+} pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/*!
+* @brief Sleeps while a count has a value
+* @param p_count count
+* @param value value to sleep on
+*/
+static inline
+void pool_wait(uint32_t * p_count, uint32_t value)
+{
+  syscall(SYS_futex, p_count, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+} // pool_wait()
+
+/*!
+* @brief Wakes the threads sleeping on a count
+* @param p_count count
+* @param threads most threads woken
+*/
+static inline
+void pool_wake(uint32_t * p_count, int32_t threads)
+{
+  syscall(SYS_futex, p_count, FUTEX_WAKE_PRIVATE, threads, NULL, NULL, 0);
+} // pool_wake()
+
+/*!
+* @brief Runs items of the current job until none are left
+*/
+static
+void pool_work()
+{
+  uint32_t item = 0;
+
+  while ((item = __atomic_fetch_add(&pool.next, 1, __ATOMIC_RELAXED)) < pool.items)
+  {
+    pool.func(pool.p_ctx, item);
+  }
+} // pool_work()
+
+/*!
+* @brief Runs jobs until the pool is stopped
+* @param param generation when the worker was started, cast to a pointer
+* @return NULL
+*/
+static
+void * pool_worker(void * param)
+{
+  uint32_t seen = (uint32_t)(uintptr_t)param;
+  uint32_t generation = 0;
+
+  while (1)
+  {
+    // Job fields are read after the generation that published them
+    generation = __atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE);
+    if (generation == seen)
+    {
+      pool_wait(&pool.generation, seen);
+      continue;
+    }
+    seen = generation;
+    if (!pool.stop)
+    {
+      pool_work();
+    }
+
+    // The last worker out lets the caller go on
+    if (__atomic_sub_fetch(&pool.pending, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      pool_wake(&pool.pending, 1);
+    }
+    if (pool.stop)
+    {
+      break;
+    }
+  }
+  return NULL;
+} // pool_worker()
+
+/*!
+* @brief Publishes a job to the workers and waits until they all finish it,
+*        the caller runs items too
+* @param func item function
+* @param p_ctx context passed to func
+* @param items number of items
+* @param stop 1 to stop the workers instead
+*/
+static
+void pool_run(worker_pool_func_t func, void * p_ctx, uint32_t items, uint8_t stop)
+{
+  uint32_t pending = 0;
+
+  pool.func = func;
+  pool.p_ctx = p_ctx;
+  pool.items = items;
+  pool.stop = stop;
+  pool.next = 0;
+  pool.pending = pool.workers;
+  __atomic_add_fetch(&pool.generation, 1, __ATOMIC_RELEASE);
+  pool_wake(&pool.generation, INT_MAX);
+
+  if (!stop)
+  {
+    pool_work();
+  }
+  while ((pending = __atomic_load_n(&pool.pending, __ATOMIC_ACQUIRE)) != 0)
+  {
+    pool_wait(&pool.pending, pending);
+  }
+} // pool_run()
+
+uint32_t worker_pool_init()
+{
+  FUNC_ENTRY;
+  int32_t workers = POOL_WORKERS;
+  uint32_t res = 0;
+
+  if (pool.running)
+  {
+    return SUCCESS;
+  }
+
+  // A worker for each configured cpu, otherwise each cpu besides the caller's
+  if (workers < 0)
+  {
+    workers = service_workers(WORKER_POOL_SERVICE);
+    workers = workers ? workers : sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  }
+  workers = (workers < SERVICE_WORKERS_MAX) ? workers : SERVICE_WORKERS_MAX;
+
+  // Workers only wait for jobs published after they were started
+  for (pool.workers = 0; pool.workers < (uint32_t)workers; pool.workers++)
+  {
+    EQ_RET_E(res,
+             service_launch_worker(WORKER_POOL_SERVICE,
+                                   pool.workers,
+                                   pool_worker,
+                                   (void *)(uintptr_t)pool.generation,
+                                   &pool.threads[pool.workers]),
+             FAILURE,
+             FAILURE);
+  }
+  pool.running = 1;
+  LOG_MED("Worker pool running %u workers", pool.workers);
+  return SUCCESS;
+} // worker_pool_init()
+
+void worker_pool_for(uint32_t items, worker_pool_func_t func, void * p_ctx)
+{
+  // Nothing to share the job with
+  if (pool.workers == 0 || items < 2)
+  {
+    for (uint32_t item = 0; item < items; item++)
+    {
+      func(p_ctx, item);
+    }
+    return;
+  }
+  pthread_mutex_lock(&pool.lock);
+  pool_run(func, p_ctx, items, 0);
+  pthread_mutex_unlock(&pool.lock);
+} // worker_pool_for()
+
+uint32_t worker_pool_workers()
+{
+  return pool.workers;
+} // worker_pool_workers()
+
+void worker_pool_stop()
+{
+  FUNC_ENTRY;
+
+  if (!pool.running)
+  {
+    return;
+  }
+  pthread_mutex_lock(&pool.lock);
+  if (pool.workers > 0)
+  {
+    pool_run(NULL, NULL, 0, 1);
+  }
+  for (uint32_t worker = 0; worker < pool.workers; worker++)
+  {
+    pthread_join(pool.threads[worker], NULL);
+  }
+  pool.workers = 0;
+  pool.running = 0;
+  pthread_mutex_unlock(&pool.lock);
+} // worker_pool_stop()
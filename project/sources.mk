@@ -10,12 +10,35 @@ ARM_APP_OUT=$(APP_OUT)/$(ARM)
 
 APP_SRC_C += \
 	$(APP_SRC_DIR)/log.c \
+	$(APP_SRC_DIR)/perf_counters.c \
 	$(APP_SRC_DIR)/profiler.c \
 	$(APP_SRC_DIR)/client.c \
 	$(APP_SRC_DIR)/capture.c \
 	$(APP_SRC_DIR)/ppm.c \
 	$(APP_SRC_DIR)/jpeg.c \
 	$(APP_SRC_DIR)/utilities.c \
+	$(APP_SRC_DIR)/trace.c \
+	$(APP_SRC_DIR)/latency.c \
+	$(APP_SRC_DIR)/sched_analysis.c \
+	$(APP_SRC_DIR)/service.c \
+	$(APP_SRC_DIR)/frame_mem.c \
+	$(APP_SRC_DIR)/load_test.c \
+	$(APP_SRC_DIR)/overload.c \
+	$(APP_SRC_DIR)/v4l2_cap.c \
+	$(APP_SRC_DIR)/frame.c \
+	$(APP_SRC_DIR)/jpeg_raw.c \
+	$(APP_SRC_DIR)/preview.c \
+	$(APP_SRC_DIR)/frame_index.c \
+	$(APP_SRC_DIR)/retention.c \
+	$(APP_SRC_DIR)/qoi.c \
+	$(APP_SRC_DIR)/metrics.c \
+	$(APP_SRC_DIR)/frame_bus.c \
+	$(APP_SRC_DIR)/sequencer.c \
+	$(APP_SRC_DIR)/enc_pool.c \
+	$(APP_SRC_DIR)/archive.c \
+	$(APP_SRC_DIR)/pixel_pass.c \
+	$(APP_SRC_DIR)/worker_pool.c \
+	$(APP_SRC_DIR)/task_graph.c \
 	$(APP_SRC_DIR)/server.c
 
 SERVER_MAIN+= \
@@ -24,6 +47,21 @@ SERVER_MAIN+= \
 CLIENT_MAIN+= \
 	$(APP_SRC_DIR)/client_main.c \
 
+BENCH_MAIN+= \
+	$(APP_SRC_DIR)/bench.c \
+	$(APP_SRC_DIR)/bench_ppm.c \
+	$(APP_SRC_DIR)/bench_jpeg.c \
+	$(APP_SRC_DIR)/bench_main.c \
+
+INDEX_MAIN+= \
+	$(APP_SRC_DIR)/frame_index_main.c \
+
+BUS_MAIN+= \
+	$(APP_SRC_DIR)/frame_bus_main.c \
+
+ARCHIVE_MAIN+= \
+	$(APP_SRC_DIR)/archive_main.c \
+
 # Make a src list without any directories to feed into the allasm/alli targets
 SRC_LIST = $(subst $(APP_SRC_DIR)/,,$(APP_SRC_C))
 SRC_LIST = $(subst $(APP_SRC_DIR)/,,$(APP_SRC_CPP))
@@ -38,6 +76,18 @@ CLIENT_ARM_OBJS = $(subst src,out/$(ARM),$(patsubst %.c,%.o,$(CLIENT_MAIN)))
 SERVER_X86_OBJS = $(subst src,out/$(X86),$(patsubst %.c,%.o,$(SERVER_MAIN)))
 SERVER_ARM_OBJS = $(subst src,out/$(ARM),$(patsubst %.c,%.o,$(SERVER_MAIN)))
 
+BENCH_X86_OBJS = $(subst src,out/$(X86),$(patsubst %.c,%.o,$(BENCH_MAIN)))
+BENCH_ARM_OBJS = $(subst src,out/$(ARM),$(patsubst %.c,%.o,$(BENCH_MAIN)))
+
+INDEX_X86_OBJS = $(subst src,out/$(X86),$(patsubst %.c,%.o,$(INDEX_MAIN)))
+INDEX_ARM_OBJS = $(subst src,out/$(ARM),$(patsubst %.c,%.o,$(INDEX_MAIN)))
+
+BUS_X86_OBJS = $(subst src,out/$(X86),$(patsubst %.c,%.o,$(BUS_MAIN)))
+BUS_ARM_OBJS = $(subst src,out/$(ARM),$(patsubst %.c,%.o,$(BUS_MAIN)))
+
+ARCHIVE_X86_OBJS = $(subst src,out/$(X86),$(patsubst %.c,%.o,$(ARCHIVE_MAIN)))
+ARCHIVE_ARM_OBJS = $(subst src,out/$(ARM),$(patsubst %.c,%.o,$(ARCHIVE_MAIN)))
+
 # Build a list of .d files to clean
 APP_DEPS += $(patsubst %.o,%.d, $(OBJS) $(25Z_OBJS) $(ARM_OBJS))
 
@@ -48,6 +98,14 @@ CLEAN+=$(ARM_OBJS) \
        $(CLIENT_ARM_OBJS) \
        $(SERVER_X86_OBJS) \
        $(SERVER_ARM_OBJS) \
+       $(BENCH_X86_OBJS) \
+       $(BENCH_ARM_OBJS) \
+       $(INDEX_X86_OBJS) \
+       $(INDEX_ARM_OBJS) \
+       $(BUS_X86_OBJS) \
+       $(BUS_ARM_OBJS) \
+       $(ARCHIVE_X86_OBJS) \
+       $(ARCHIVE_ARM_OBJS) \
        $(APP_DEPS) \
        $(TEST_OBJS) \
        $(APP_OUT)